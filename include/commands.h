@@ -6,5 +6,7 @@
 
 void help();
 void execute_job(Job job);
+int login(); // Asks for a user on the terminal; index into fs_state.users, -1 if none
+void handle_signal(int sig);
 
 #endif // COMMANDS_H
\ No newline at end of file
@@ -0,0 +1,60 @@
+#ifndef DCACHE_H
+#define DCACHE_H
+
+#include "filesystem.h"
+
+// Dentry cache: remembers what a path resolved to, so repeated lookups of
+// the same path skip the walk. Entries are keyed by the path bytes (a path
+// need not be terminated, so a prefix can be looked up in place) and the
+// directory a relative walk starts from, and cache misses too (negative
+// entries). Each entry depends on one name in one directory: the entry a
+// file lookup found or missed, or the component a failed walk stopped at.
+// Adding or removing that name drops the entry. Moving or deleting a
+// directory can redirect any path below it, so it drops the whole cache.
+//
+// Lookups take no lock (entries are published atomically and reclaimed by
+// epoch, see epoch.h); inserts and invalidations serialize on a lock of
+// their own, a leaf. A lookup that misses and walks the tree itself takes
+// dcache_version() first and passes it to dcache_insert(), which drops the
+// result if any name changed meanwhile: writers change a directory first
+// and invalidate after, so a walk that raced them is never cached.
+//
+// The generation doubles as a sequence count for readers that walk the
+// tree without the filesystem lock. A writer moving or deleting directories
+// (or replacing the whole tree) brackets the change with
+// dcache_reshape_begin() and dcache_reshape_end(): the generation is odd in
+// between and advances at both ends, so every cached entry is dropped. A
+// reader takes dcache_generation() before its walk and trusts the result
+// only if dcache_reshaped() says nothing was reshaped since.
+
+#define DCACHE_SIZE 1024    // Entries (a power of two)
+#define DCACHE_PATH_MAX 200 // Longer paths are not cached
+
+typedef enum
+{
+    DCACHE_DIRECTORY = 1, // Path names a directory
+    DCACHE_FILE           // Path names a directory entry (symlinks not followed)
+} DcacheKind;
+
+typedef struct
+{
+    int dir_idx;        // Directory found (-1 if the walk failed)
+    ino_t inode;        // DCACHE_FILE: entry's inode (0 if there is none)
+    int key_dir;        // Name the entry depends on (-1 for none)
+    char key_name[MAX_FILENAME];
+} DcacheResult;
+
+int dcache_lookup(int start, const char *path, size_t length, DcacheKind kind,
+                  DcacheResult *result); // 1 on a hit
+unsigned int dcache_version(); // Advances with every invalidation
+void dcache_insert(int start, const char *path, size_t length, DcacheKind kind,
+                   const DcacheResult *result, unsigned int version);
+void dcache_invalidate_name(int dir_idx, const char *name);
+void dcache_invalidate_all();
+unsigned int dcache_generation();        // Odd while the tree is being reshaped
+int dcache_reshaped(unsigned int seen);  // Nonzero if seen was odd or has advanced
+void dcache_reshape_begin();             // With the filesystem lock held exclusively
+void dcache_reshape_end();
+void dcache_print_stats();
+
+#endif // DCACHE_H
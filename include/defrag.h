@@ -0,0 +1,50 @@
+#ifndef DEFRAG_H
+#define DEFRAG_H
+
+#include "filesystem.h"
+
+// Snapshot of how scattered the volume is
+typedef struct
+{
+    int files;            // Regular file entries with pages
+    int extents;          // Extents across those files
+    int fragmented_files; // Files mapped by more than one extent
+    int max_extents;      // Extents of the most fragmented file
+    int free_pages;
+    int largest_free_run; // Pages in the largest free run
+} FragmentationReport;
+
+// What defrag_start() did
+typedef enum
+{
+    DEFRAG_ALREADY_RUNNING,
+    DEFRAG_BACKGROUND, // Handed to the worker, see defrag_status()
+    DEFRAG_DONE        // No worker: the whole pass ran at once
+} DefragStart;
+
+typedef struct
+{
+    int active;    // A pass is in progress
+    int completed; // At least one pass has finished
+    int files_moved, pages_moved, files_skipped; // By the current or last pass
+    ino_t inode;      // File being moved, 0 when none
+    int copied;       // ... pages of it copied so far
+    int target_pages; // ... out of
+    FragmentationReport before, after; // Of the current or last pass
+    FragmentationReport now;
+} DefragStatus;
+
+// Called with the filesystem lock held (exclusively, except the reports).
+// before is filled in unless a pass was already running, after only with
+// DEFRAG_DONE.
+DefragStart defrag_start(FragmentationReport *before, FragmentationReport *after);
+void defrag_cancel();
+void defrag_note_write(ino_t inode);
+void defrag_report(FragmentationReport *report);
+void defrag_status(DefragStatus *status);
+
+// Background worker
+void *defrag_worker(void *arg);
+void defrag_shutdown();
+
+#endif // DEFRAG_H
@@ -0,0 +1,55 @@
+#ifndef DIRECTORY_H
+#define DIRECTORY_H
+
+#include "filesystem.h"
+
+// Directories. The directory table (fs_state.directories) grows as needed;
+// a directory is addressed by its slot, and freed slots are reused. Each
+// directory keeps its file entries and its child directories in growable
+// arrays, each with a hash index on the name, so lookup, insert and remove
+// take constant time on average however large it gets. Removing an item
+// moves the last one into its place, so entry indexes are only good until
+// the directory next changes, and Directory pointers only until the table
+// next grows. A DirEntry itself never moves or changes: it stays readable
+// until it is removed, or under a reader's epoch section (see epoch.h)
+// until that section ends.
+//
+// Names are looked up without locks: dir_get(), dir_child() and dir_find()
+// are safe inside an epoch section with no other lock held. A table that
+// grows, and a directory that is deleted, go to the epoch reclaimer, so a
+// reader never touches freed memory; it may still see a directory that is
+// moving or being deleted, which the dcache generation tells it (see
+// dcache.h).
+
+// Directory table
+void dir_table_reset();         // Free every directory (see epoch_synchronize())
+int dir_table_alloc();          // Slot for a new directory (unnamed, no parent), or -1
+Directory *dir_table_claim(int index); // Make slot index exist, for loaders and replay
+void dir_table_release(int index);     // Detach an empty directory and free its slot; takes its lock
+void dir_table_attach_all();    // Index every named directory under its parent_directory
+Directory *dir_get(int index);  // NULL unless index is a live directory
+
+// Directory locks guard a directory's file entries and its list of child
+// directories; the table only changes under the exclusive filesystem lock.
+// Writers take them with the filesystem lock held (shared is enough for
+// file entries), before any inode lock; a pair goes in slot order (see
+// lockorder.h). Listers take one shared with no filesystem lock, and read
+// the directory through dir_get() once they hold it. dir_lookup() needs
+// the directory's lock held; dir_find() needs none.
+void dir_lock(int index, int exclusive);
+void dir_unlock(int index);
+void dir_lock_pair(int a, int b); // Both exclusively; a may equal b
+void dir_unlock_pair(int a, int b);
+
+// Child directories. Attach and detach take the parent's lock themselves.
+int dir_child(int parent, const char *name); // Child slot, or -1; lock-free
+int dir_attach(int parent, int child);       // Index child (named already) under parent; -1 if taken
+void dir_detach(int child);                  // Take child out of its parent's index
+
+// File entries
+DirEntry *dir_find(const Directory *dir, const char *name);          // Entry, or NULL; lock-free
+int dir_lookup(const Directory *dir, const char *name);              // Entry index, or -1
+DirEntry *dir_insert(Directory *dir, const char *name, ino_t inode); // NULL if taken or out of memory
+void dir_remove(Directory *dir, int index);
+
+#endif // DIRECTORY_H
@@ -0,0 +1,25 @@
+#ifndef EPOCH_H
+#define EPOCH_H
+
+// Epoch-based reclamation, for structures read without locks. A reader
+// brackets each lookup with epoch_enter()/epoch_exit() and may keep what it
+// found only until the exit. A writer (still under its own lock) unpublishes
+// memory with an atomic store and hands it to epoch_retire(), which frees it
+// once every reader that could still see it has left its section.
+//
+// Sections nest and are cheap: entering writes only the thread's own slot.
+// Retiring never waits for readers, so a section may wait for a lock held
+// by a writer that retires memory meanwhile. The retire list lock is itself
+// a leaf.
+//
+// epoch_synchronize() is for writers that replace everything at once
+// (format, restore): it waits until every section open when it was called
+// has ended. Its caller must not be in a section, nor hold a lock a
+// section may wait for.
+
+void epoch_enter();
+void epoch_exit();
+void epoch_retire(void *ptr); // free(ptr) once no reader can hold it (NULL is ignored)
+void epoch_synchronize();
+
+#endif // EPOCH_H
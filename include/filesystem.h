@@ -15,14 +15,29 @@
 #include <ctype.h>
 #include <time.h>
 
-#define MAX_JOBS 10
+#define MAX_JOBS 10          // Commands in flight per worker
+#define SCHED_MAX_WORKERS 16 // Worker threads, at most one per core
+#define SCHED_KEY_STRIPES 64 // Path keys commands are ordered by
+#define SCHED_RING_SIZE 256  // Ready commands per ring (a power of two, >= MAX_JOBS * SCHED_MAX_WORKERS)
+#define SCHED_QUANTUM 32      // Cost each user may run per fair-share round, at least the costliest command
+#define SCHED_WAIT_BUCKETS 24 // Queue-wait histogram, one bucket per power of two microseconds
+#define PIPE_BUFFER_SIZE 16384 // Bytes buffered between two pipeline stages
+#define PIPE_MAX_STAGES 8
 #define BLOCK_SIZE 4
+#ifndef TOTAL_BLOCKS
 #define TOTAL_BLOCKS 262144 // 1MB / 4B
+#endif
 #define MAX_USERS 3
-#define MAX_FILES 100
 #define MAX_FILENAME 50
-#define MAX_DIRECTORIES 10
+#define MAX_SYMLINK_HOPS 8 // Symlinks followed in one path lookup
 #define STORAGE_FILE "filesystem.dat"
+#define JOURNAL_FILE "filesystem.journal"
+#define JOURNAL_CHECKPOINT_SIZE (256 * 1024) // Fold the journal into the image past this size
+#define JOURNAL_BATCH_OPS 64                 // Group commit: records per durable write
+#define JOURNAL_FLUSH_INTERVAL_MS 100        // Group commit: max delay before a flush
+#define JOURNAL_DEFAULT_DURABILITY 2         // DURABILITY_PER_BATCH
+#define DEFRAG_PAGES_PER_TICK 256            // Defragmenter: max pages moved per tick
+#define DEFRAG_TICK_MS 10                    // Defragmenter: pause between ticks
 
 // ANSI color codes
 #define COLOR_YELLOW "\033[1;33m"
@@ -41,7 +56,8 @@ typedef struct
 } Job;
 
 #define PAGE_SIZE 4096 // 4KB pages
-#define TOTAL_PAGES (TOTAL_BLOCKS * BLOCK_SIZE / PAGE_SIZE)
+#define TOTAL_PAGES (TOTAL_BLOCKS * BLOCK_SIZE / PAGE_SIZE) // Default volume size
+#define MAX_TOTAL_PAGES (1 << 28)                           // 1TB of pages
 
 typedef struct
 {
@@ -49,32 +65,56 @@ typedef struct
     int is_allocated;  // Allocation status
 } PageTableEntry;
 
+// A run of contiguous physical pages mapped in file order
+typedef struct
+{
+    int start_page; // First physical page of the run
+    int length;     // Number of pages in the run
+} Extent;
+
+// An inode: everything about a file except its names. Each file has exactly
+// one, in the inode table, however many hard links name it.
 typedef struct
 {
-    char filename[MAX_FILENAME];
     int size; // Will be calculated automatically
-    PageTableEntry *page_table;
-    int page_table_size;
+    Extent *extents;
+    int extent_count;
+    int page_count; // Pages mapped by all extents
     char owner[20];
     int permissions;
     time_t creation_time;
     time_t modification_time;
     int content_size;
-    char *content;
+    off_t data_offset; // Image offset of bytes not yet loaded into the pages (0 when loaded)
     int file_position;
     int is_open;
     int open_count;
     int is_symlink;    // 1 if this is a symbolic link
     char *link_target; // Target path for symlinks
-    int ref_count;     // For hard link reference counting
+    int ref_count;     // Directory entries naming this inode (link count)
     ino_t inode;       // Unique inode number
 } File;
 
+// A directory entry binds a name to an inode
+typedef struct
+{
+    char filename[MAX_FILENAME];
+    ino_t inode;
+} DirEntry;
+
+typedef struct EntryIndex EntryIndex; // Published name index of a directory, see directory.c
+
 typedef struct
 {
     char dirname[MAX_FILENAME];
-    File files[MAX_FILES];
+    DirEntry **files;       // Entries in [0, file_count); see directory.h
     int file_count;
+    int file_capacity;
+    EntryIndex *file_names; // Entries by filename, read without locks
+    int *subdirs;           // Child directory slots in [0, subdir_count)
+    int subdir_count;
+    int subdir_capacity;
+    EntryIndex *subdir_names; // Children by dirname, read without locks
     int parent_directory;
     time_t creation_time;
     ino_t inode; // Add this for directories
@@ -89,53 +129,169 @@ typedef struct
 typedef struct
 {
     User users[MAX_USERS];
-    Directory directories[MAX_DIRECTORIES];
+    Directory *directories; // Directory table, see directory.h
+    int directory_count;    // Slots ever used (high-water mark)
+    int directory_capacity;
     int current_directory;
 } FileSystemState;
 
-// Path resolution helpers
-void split_path(const char *path, char **dir, char **file);
+// Path resolution helpers. Paths are walked in place and nothing is
+// allocated; name buffers hold MAX_FILENAME bytes, and longer last
+// components are truncated the way directory entries store them.
 int find_directory_from_path(const char *path);
+int resolve_parent(const char *path, char *name);
+DirEntry* find_entry_in_dir(int dir_idx, const char *filename);
 File* find_file_in_dir(int dir_idx, const char *filename);
-File* resolve_file_path(const char *path, int *dir_idx, char **filename);
-int resolve_path(const char *path);
+File* resolve_file_path(const char *path, int *dir_idx, char *filename);
+
+// Lock-free reads. A read section is an epoch section (see epoch.h) begun
+// while no directory is being moved or deleted; read_begin() returns the
+// dcache generation it began in, and dcache_reshaped() says whether what
+// was found since can be trusted. Readers hold no filesystem lock.
+unsigned int read_begin();
+void read_end();
+File *lock_file_in_dir(int dir_idx, const char *filename, int exclusive); // Opens a read section; NULL if none
+
+// Status of a core operation. Operations print nothing: callers report
+// what happened from the status and the result structs they pass in (the
+// shell does in commands.c), so no terminal I/O happens under their locks.
+// Only diagnostics print for themselves: the *_print_stats() and
+// *_print_status() reports, and load_state()'s loading and recovery
+// messages (restore_filesystem() reloads through it).
+typedef enum
+{
+    FS_OK = 0,
+    FS_ERR_NOT_FOUND,      // No such file or directory
+    FS_ERR_DIR_NOT_FOUND,  // A directory on the path is missing
+    FS_ERR_DEST_NOT_FOUND, // The destination or link directory is missing
+    FS_ERR_EXISTS,         // The name is taken
+    FS_ERR_PERMISSION,     // The file's mode forbids it
+    FS_ERR_NO_SPACE,       // Out of pages
+    FS_ERR_NO_MEMORY,
+    FS_ERR_IO,             // File bytes or an image could not be read or written
+    FS_ERR_INVALID,        // Bad name or argument
+    FS_ERR_NAME_TOO_LONG,
+    FS_ERR_NOT_OPEN,
+    FS_ERR_IS_SYMLINK,     // Symbolic links cannot be hard linked
+    FS_ERR_NOT_EMPTY,      // The directory has contents and recursive was not asked for
+    FS_ERR_BUSY,           // The current directory, or one above it
+    FS_ERR_ROOT,           // The root directory cannot be deleted
+    FS_ERR_CYCLE,          // A directory cannot move below itself
+    FS_STATUS_COUNT
+} FsStatus;
+
+const char *fs_strerror(FsStatus status); // One line, no newline or colors
+
+#define FS_LINK_TARGET_MAX 256 // Longest symlink target reported
+#define FS_REPORTED_LINKS 8    // Dangling symlinks named by a delete
+
+// A file or directory as it was under the locks, still valid after them
+typedef struct
+{
+    char name[MAX_FILENAME];
+    char dirname[MAX_FILENAME]; // Directory holding it
+    int is_directory;
+    int depth; // Levels below the listed directory, in listings
+    ino_t inode;
+    int size;
+    char owner[20];
+    int permissions;
+    int is_symlink;
+    int has_target; // Symlinks: 0 once the target was deleted
+    char link_target[FS_LINK_TARGET_MAX];
+    int link_count;
+    time_t creation_time;
+    time_t modification_time;
+    int open_count;
+    int page_count;
+    int extent_count;
+    int shared_pages;
+} FsFileInfo;
+
+typedef struct
+{
+    char name[MAX_FILENAME];
+    char path[1024]; // From the root's own name, as in "~/home"
+    int index;       // Into fs_state.directories
+    ino_t inode;
+    int file_count;
+    int subdir_count;
+    time_t creation_time;
+} FsDirInfo;
+
+// A directory's subdirectories and then its files, or a whole tree depth
+// first with each directory followed by its files and then its subtrees
+typedef struct
+{
+    FsDirInfo dir;          // The directory listed
+    int directory_count;    // Directories in the filesystem
+    FsFileInfo *entries;    // Allocated; see free_listing()
+    int count;
+    int capacity;
+} FsListing;
+
+typedef struct
+{
+    FsFileInfo file; // As it was just before
+    int invalidated; // Symbolic links to it, now dangling
+    struct
+    {
+        char path[2 * MAX_FILENAME]; // Directory and name
+        char target[FS_LINK_TARGET_MAX];
+    } invalidated_links[FS_REPORTED_LINKS]; // The first of them
+} FsDeleteInfo;
+
+typedef struct
+{
+    int pages;      // Volume size
+    int size_kept;  // The size asked for was refused, so it stayed
+    int mapped;     // Pages live in a mapped volume file
+    int map_failed; // A mapped volume was asked for but memory is used
+} FsFormatInfo;
 
-// File operations
-int open_file(const char *filename);
-int close_file(const char *filename);
+// File operations. Result structs may be NULL when not wanted.
+FsStatus open_file(const char *path, int *open_count);
+FsStatus close_file(const char *path, int *open_count);
 int file_seek(File *file, int offset, int whence);
-int create_file(char *path, int permissions);
-int create_directory(char *path);
+FsStatus seek_file(const char *filename, int offset, int whence, int *position); // In the current directory
+FsStatus create_file(const char *path, int permissions, FsFileInfo *info);
+FsStatus create_directory(const char *path, FsDirInfo *info);
 char* get_current_working_directory();
-void delete_file(char *path);
-void delete_directory(const char *dirname);
-void list_files();
-int write_to_file(const char *path, const char *data, int append);
-char* read_from_file(const char *path, int bytes_to_read, int offset);
-void change_permissions(char *path, int mode);
-void print_file_info(const char *path);
-void copy_file_to_dir(const char *src_path, const char *dest_dir_path);
-void change_directory(char *dirname);
-void move_file_to_dir(const char *path, const char *dest_dir_path, const char *new_name);
-void move_directory(const char *src_path, const char *dest_path, const char *new_name);
+FsStatus delete_file(const char *path, FsDeleteInfo *info);
+FsStatus delete_directory(const char *dirname, int recursive, FsDirInfo *info);
+FsStatus list_directory(FsListing *listing); // The current directory
+FsStatus list_tree(FsListing *listing);      // From the current directory
+void free_listing(FsListing *listing);
+FsStatus read_from_file(const char *path, int bytes_to_read, int offset, char **content); // Allocated, NUL-terminated
+// Byte ranges, for streaming and the asynchronous ring
+FsStatus write_file_range(const char *path, const char *data, int length, int append, int *new_size);
+FsStatus read_file_range(const char *path, int offset, char *buffer, int length, int *copied, int *content_size);
+FsStatus change_permissions(const char *path, int mode);
+FsStatus stat_file(const char *path, FsFileInfo *info);
+FsStatus copy_file_to_dir(const char *src_path, const char *dest_dir_path, FsFileInfo *info);
+FsStatus clone_file(const char *src_path, const char *dest_path, FsFileInfo *info);
+FsStatus change_directory(const char *path, FsDirInfo *info);
+FsStatus move_file_to_dir(const char *path, const char *dest_dir_path, const char *new_name, FsFileInfo *info);
+// info->name is the name it has, or would have, in the destination, and
+// info->path the destination's path from the root
+FsStatus move_directory(const char *src_path, const char *dest_path, const char *new_name, FsDirInfo *info);
+FsStatus directory_info(const char *dirname, FsDirInfo *info); // NULL or "." for the current one
 
 // Link operations
-void create_hard_link(const char *source, const char *link);
-void create_symbolic_link(const char *source, const char *link);
+FsStatus create_hard_link(const char *source, const char *link, FsFileInfo *info);
+FsStatus create_symbolic_link(const char *source, const char *link, FsFileInfo *info);
 
-// System operations
-void defragment_filesystem();
-void format_filesystem();
-void backup_filesystem(const char *backup_name);
-void restore_filesystem(const char *backup_name);
-void show_directory_info(const char *dirname);
-void tree_command(int show_inodes);
+// System operations; asking before wiping anything is the caller's job
+FsStatus format_filesystem(int mmap_volume, int pages, FsFormatInfo *info);
+int backup_exists(const char *backup_name);
+FsStatus backup_filesystem(const char *backup_name);
+FsStatus restore_filesystem(const char *backup_name); // FS_ERR_IO: restored, but not the volume file
 
 // Initialization and state management
 void initialize_directories();
 void save_state();
 void load_state();
-int login();
+int find_user(const char *username, const char *password); // Index into fs_state.users, -1 if none
 
 // Helper functions
 int check_file_permissions(File *file, int required_perms);
@@ -0,0 +1,95 @@
+#ifndef FSRING_H
+#define FSRING_H
+
+#include "filesystem.h"
+#include "jobqueue.h"
+
+// Asynchronous filesystem operations for code embedding the filesystem, in
+// the style of io_uring but within the process. The caller fills in
+// submissions (an operation, a path, a buffer and a tag of its own) and
+// hands them to a ring. They run on the scheduler's workers, ordered
+// against each other and against queued commands by the path they name,
+// and each leaves a completion with the caller's tag and a status.
+//
+// A ring holds at most its number of entries between submission and
+// reaping, so completions never overflow. Submissions the worker pool has
+// no room for yet wait in the ring and go out as others finish; neither
+// submitting nor polling blocks. One thread drives a ring; any number of
+// rings may be in use at once, each on its own thread. FS_OP_NOP and paths
+// starting with ".." run as barriers, which the scheduler lets join one at
+// a time, so barriers from several rings cannot wait on each other.
+
+typedef enum
+{
+    FS_OP_NOP,    // Runs after everything submitted before it, on any path
+    FS_OP_CREATE, // mode: permissions
+    FS_OP_MKDIR,
+    FS_OP_READ,   // length bytes from offset into buffer; result: bytes read
+    FS_OP_WRITE,  // length bytes from buffer (FS_RING_APPEND: after the contents); result: new size
+    FS_OP_STAT,   // result: size of a readable file
+    FS_OP_DELETE,
+    FS_OP_COUNT
+} FsOpcode;
+
+#define FS_RING_APPEND 1 // Submission flag
+
+// Completion statuses
+#define FS_RING_OK 0
+#define FS_RING_FAILED -1   // The operation reported an error, see error
+#define FS_RING_INVALID -2  // Unknown opcode, a path missing or too long, or no buffer
+#define FS_RING_SHUTDOWN -3 // The scheduler stopped before it ran
+
+typedef struct
+{
+    int opcode;
+    const char *path;        // Copied on submission
+    void *buffer;            // Must stay valid until the completion is reaped
+    int length;
+    int offset;
+    int mode;
+    int flags;
+    unsigned long user_data; // Handed back untouched
+} FsSubmission;
+
+typedef struct
+{
+    unsigned long user_data;
+    int status;
+    int result;
+    FsStatus error; // Why it failed, with FS_RING_FAILED
+} FsCompletion;
+
+typedef struct FsRingEntry FsRingEntry;
+
+typedef struct
+{
+    FsRingEntry *entries;
+    int capacity;
+    int user; // Operations run on this user's fair share
+
+    // Touched by the driving thread only
+    FsRingEntry **free; // Entries not in flight, a stack
+    int free_count;
+    FsRingEntry **waiting; // Submitted but not yet on the workers, a FIFO
+    int waiting_head, waiting_count;
+
+    int scheduled;      // On the workers, not yet complete
+    JobQueue completed; // Filled by the workers, emptied by fs_ring_reap()
+
+    // Only to sleep until a completion arrives
+    pthread_mutex_t lock;
+    pthread_cond_t completion;
+    int sleeping;
+} FsRing;
+
+int fs_ring_init(FsRing *ring, int entries, int user); // entries: a power of two; -1 without memory
+void fs_ring_destroy(FsRing *ring);                     // Waits for the operations in flight
+
+// How many of ops were taken, fewer once the ring is full
+int fs_ring_submit(FsRing *ring, const FsSubmission *ops, int count);
+
+// Up to max completions into out, waiting until there are min_complete
+// (or until nothing is left in flight). 0 polls.
+int fs_ring_reap(FsRing *ring, FsCompletion *out, int max, int min_complete);
+
+#endif // FSRING_H
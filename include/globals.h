@@ -3,17 +3,17 @@
 #define GLOBALS_H
 
 #include <pthread.h>
+#include <stdint.h>
 #include "filesystem.h"  // For FileSystemState and Job definitions
 
 // EXTERN DECLARATIONS (no initialization here)
 extern FileSystemState fs_state;
-extern pthread_mutex_t mutex;
-extern Job job_queue[MAX_JOBS];
-extern int front, rear, job_count;
-extern pthread_mutex_t queue_lock;
+extern pthread_rwlock_t fs_lock; // Exclusive to reshape the tree, shared for other changes; lookups skip it
+extern pthread_mutex_t queue_lock;    // Scheduler sleep and wake-up, see scheduler.c
 extern pthread_cond_t job_available;
 extern int running;
-extern unsigned char page_bitmap[];  // No size or initialization here
+extern uint64_t *page_bitmap;  // One bit per page, 64 pages per word
+extern int total_pages;        // Volume size in pages, chosen at format time
 
 #endif
 
@@ -0,0 +1,34 @@
+#ifndef INODE_H
+#define INODE_H
+
+#include "filesystem.h"
+
+// Inode table: one File record per file however many directory entries name
+// it. Records live in fixed-size chunks, so a File pointer stays valid while
+// the table grows, and a hash index maps inode numbers to records. The
+// table has a lock of its own; inode_get() takes none. A record any
+// directory named is only freed under the exclusive filesystem lock, so a
+// pointer looked up under the shared one stays good.
+//
+// Each record also has a lock guarding its fields and its pages' bytes.
+// Writers take it with the filesystem lock held, after any directory locks;
+// several go in inode number order (see lockorder.h). A record is only
+// freed with its lock held exclusively, so readers without the filesystem
+// lock use inode_get_locked(), which checks under the lock that the number
+// still names the record. Only a table reset, after epoch_synchronize(),
+// frees the chunks.
+
+#define INODE_CHUNK 256 // Records per chunk
+
+void inode_table_reset();
+File *inode_alloc(ino_t number); // 0 picks the next unused number
+File *inode_get(ino_t number);
+void inode_free(File *file); // Locked exclusively by the caller; releases the lock
+File *inode_next(int *cursor); // Live records in table order; start with *cursor = 0
+int inode_count();
+
+void inode_lock(const File *file, int exclusive);
+void inode_unlock(const File *file);
+File *inode_get_locked(ino_t number, int exclusive); // Live record, locked; NULL if none
+
+#endif // INODE_H
@@ -0,0 +1,33 @@
+#ifndef JOBQUEUE_H
+#define JOBQUEUE_H
+
+// Bounded multi-producer, multi-consumer queue of pointers, without locks.
+// Each cell carries a sequence number that says whose turn it is: a
+// producer claims a cell by advancing the enqueue position when the cell is
+// free for that lap, fills it and bumps the sequence; a consumer does the
+// same from the dequeue position. Neither ever waits for the other, and a
+// full or empty queue is reported rather than waited on (callers block on
+// their own conditions). Positions never wrap back onto a stale cell, so
+// there is no ABA problem.
+
+typedef struct
+{
+    unsigned long sequence;
+    void *value;
+} JobQueueCell;
+
+typedef struct
+{
+    JobQueueCell *cells;
+    unsigned long mask; // Capacity - 1
+    unsigned long enqueue_pos __attribute__((aligned(64))); // Own cache lines:
+    unsigned long dequeue_pos __attribute__((aligned(64))); // producers and consumers
+} JobQueue;
+
+int jobqueue_init(JobQueue *queue, unsigned long capacity); // Capacity: a power of two; -1 without memory
+void jobqueue_destroy(JobQueue *queue);
+int jobqueue_push(JobQueue *queue, void *value); // 0 when full
+void *jobqueue_pop(JobQueue *queue);             // NULL when empty
+unsigned long jobqueue_size(const JobQueue *queue); // Approximate while others run
+
+#endif // JOBQUEUE_H
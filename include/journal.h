@@ -0,0 +1,71 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include "filesystem.h"
+
+// Journal record types
+typedef enum
+{
+    JOURNAL_PUT_INODE = 1,   // Insert or replace an inode (metadata + extents)
+    JOURNAL_WRITE,           // New bytes written at an offset of an inode
+    JOURNAL_DELETE_FILE,     // Remove a directory entry; the last one frees its inode
+    JOURNAL_PUT_DIRECTORY,   // Insert or replace a directory header
+    JOURNAL_DELETE_DIRECTORY, // Remove a directory and its entries
+    JOURNAL_WRITE_PAGES,      // Bytes already in the mapped volume: size and extents only
+    JOURNAL_FORMAT,           // First record of every journal: JOURNAL_VERSION
+    JOURNAL_MOVE_PAGES,       // Defragmenter relocated an inode's pages to new extents
+    JOURNAL_LINK,             // Add a directory entry naming an existing inode
+    JOURNAL_UNSHARE           // Copy on write: shared pages copied to an inode's own
+} JournalOp;
+
+// Bumped whenever a record payload layout changes (records embed File)
+#define JOURNAL_VERSION 4
+
+// Durability modes for group commit
+typedef enum
+{
+    DURABILITY_PER_OP = 1, // Every mutation is written and synced before it returns
+    DURABILITY_PER_BATCH,  // Synced every JOURNAL_BATCH_OPS mutations (or interval)
+    DURABILITY_INTERVAL    // Synced every JOURNAL_FLUSH_INTERVAL_MS
+} DurabilityMode;
+
+typedef struct
+{
+    unsigned int op;       // JournalOp
+    unsigned int length;   // Payload length in bytes
+    unsigned int checksum; // FNV-1a of the payload
+} JournalRecordHeader;
+
+// Logging. Callers hold the filesystem lock at least shared plus the lock of
+// whatever they log (directory for entries, inode for contents), so records
+// of one object are appended in the order its changes were made. Records are
+// replayed in append order, which journal_lock serializes.
+void journal_log_put_inode(const File *file, ino_t content_source);
+void journal_log_link(int dir_idx, const char *filename, ino_t inode);
+void journal_log_write(const File *file, int offset, const char *data, int len);
+void journal_log_delete_file(int dir_idx, const char *filename);
+void journal_log_put_directory(int dir_idx);
+void journal_log_delete_directory(int dir_idx);
+void journal_log_move_pages(const File *file);
+void journal_log_unshare(const File *file, int index, int source, const Extent *fresh,
+                         int fresh_count);
+
+// Recovery and checkpointing
+int journal_replay();
+void journal_reset();
+void checkpoint_filesystem();
+
+// Group commit
+void *journal_flusher(void *arg);
+int journal_flush();
+void journal_shutdown();
+void journal_set_durability(int mode, int value);
+
+// Batches: changes logged in between are made durable together by the
+// outermost commit. Returns the batches still open (-1 if none was), and
+// the records logged since the outermost began.
+void journal_begin();
+int journal_commit(int *records); // Takes the filesystem lock exclusively
+void journal_print_status();
+
+#endif // JOURNAL_H
@@ -0,0 +1,31 @@
+#ifndef LOCKORDER_H
+#define LOCKORDER_H
+
+// Lock hierarchy. The filesystem lock (fs_lock) comes first: exclusive for
+// anything that reshapes the tree or walks every file, shared for other
+// changes and for faulting file bytes in from the image. Lookups, stat and
+// listings skip it and run in a read section (read_begin()) instead. Under
+// it, directory locks are taken in slot order, then inode locks in inode
+// number order. Leaf locks (inode table, page allocator, dentry
+// cache, journal, volume) come last and are never held across another.
+//
+// Debug builds (make debug, or -DLOCK_DEBUG) check every directory and
+// inode lock taken against the ones the thread already holds, and abort on
+// an acquisition out of order, so a bug shows up at once rather than as a
+// rare deadlock.
+
+typedef enum
+{
+    LOCK_DIRECTORY = 1, // Key: directory slot
+    LOCK_INODE          // Key: inode number
+} LockClass;
+
+#ifdef LOCK_DEBUG
+void lock_order_acquire(LockClass lock_class, unsigned long key); // Before blocking on the lock
+void lock_order_release(LockClass lock_class, unsigned long key);
+#else
+#define lock_order_acquire(lock_class, key) ((void)0)
+#define lock_order_release(lock_class, key) ((void)0)
+#endif
+
+#endif // LOCKORDER_H
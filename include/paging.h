@@ -1,13 +1,58 @@
 #ifndef PAGING_H
 #define PAGING_H
 
+#include <stdint.h>
 #include "filesystem.h"
 
+#define BITMAP_WORDS ((total_pages + 63) / 64)
+#define INDEX_LEAF_WORDS 8 // Bitmap words summarized by one free-space index leaf
+#define PAGE_MAP_CELLS (64 * 64) // Cells in the allocation map, 64 rows of 64
+
+// A file's mapping, copied out for showpages
+typedef struct
+{
+    int size;
+    int page_count;
+    int extent_count;
+    Extent *extents; // Allocated, extent_count of them
+} FileExtents;
+
+// The allocation bitmap, summarized for showpages
+typedef struct
+{
+    int pages;            // Volume size
+    int free_pages;
+    int shared_pages;
+    int largest_free_run;
+    int pages_per_cell;   // 1, or a whole number of bitmap words on larger volumes
+    int cell_count;
+    char cells[PAGE_MAP_CELLS]; // X full, + over half used, - under half used, . free
+} PageMap;
 
 void initialize_paging();
-void print_page_table(const char *filename);
-void print_page_bitmap();
+int paging_set_total(int pages);
+FsStatus file_extents(const char *filename, FileExtents *out); // In the current directory
+void page_map(PageMap *map);
 void free_pages(File *file);
-int allocate_pages(int pages_needed, PageTableEntry **page_table);
+void rebuild_page_bitmap();
+int allocate_pages(int pages_needed, Extent **extents, int *extent_count);
+int allocate_extents(Extent **extents, int *extent_count, int pages);
+int extents_from_pages(const int *pages, int page_count, Extent **extents, int *extent_count);
+int extent_page_count(const Extent *extents, int extent_count);
+int file_page(const File *file, int index);
+int page_is_used(int page);
+void mark_page_used(int page);
+void mark_page_free(int page);
+int free_page_total();
+int largest_free_run();
+void release_pages(int start, int length);
+int share_pages(const Extent *extents, int extent_count);
+int page_refs(int page);
+int shared_pages_in(const Extent *extents, int extent_count);
+int shared_page_total();
+int splice_extents(Extent **extents, int *extent_count, int index, int pages,
+                   const Extent *with, int with_count);
+void page_bitmap_to_bytes(unsigned char *bytes);
+void page_bitmap_from_bytes(const unsigned char *bytes);
 
-#endif // PAGING_H
\ No newline at end of file
+#endif // PAGING_H
@@ -0,0 +1,16 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include "filesystem.h"
+
+// Data-flow pipelines: "read <file> [off] [len] | grep [-v] <text> | ...
+// | write [-a] <file>". Every stage runs on its own thread and passes bytes
+// to the next through a bounded stream of PIPE_BUFFER_SIZE, so memory stays
+// fixed whatever the file size. Without a final write the output goes to
+// the terminal. Other "a | b" lines are queued as separate commands.
+
+// Runs line if it is a data-flow pipeline and returns 1 once it finished;
+// returns 0 without side effects otherwise
+int pipeline_run(const char *line);
+
+#endif // PIPELINE_H
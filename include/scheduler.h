@@ -3,11 +3,24 @@
 
 #include "filesystem.h"
 
+// Scheduling classes, see scheduler.c
+enum
+{
+    JOB_FAST,   // Cheap metadata, ahead of everything
+    JOB_NORMAL,
+    JOB_BULK,   // Copies and whole-volume work
+    JOB_CLASSES
+};
 
-void execute_job(Job job);
-void* scheduler(void *arg);
-void add_job(const char *command);
+void* scheduler(void *arg);      // Worker loop, arg is the worker number
+// One worker per core, up to SCHED_MAX_WORKERS; execute runs queued commands
+void scheduler_start(void (*execute)(Job job));
+void add_job(const char *command, int user); // Blocks while every worker's queue is full
+// Queue run(arg), ordered with the commands naming path's first component
+// (NULL: with everything). 0 if the pool is full and !wait, or shutting down.
+int add_call(const char *path, int job_class, void (*run)(void *), void *arg, int user, int wait);
+void scheduler_drain(int user); // Waits for every command queued so far; not from a worker
+void scheduler_print_stats();
 void cleanup();
-void handle_signal(int sig);
 
 #endif // SCHEDULER_H
\ No newline at end of file
@@ -0,0 +1,115 @@
+#ifndef STORAGE_H
+#define STORAGE_H
+
+#include <stdint.h>
+#include "filesystem.h"
+
+// On-disk image layout (version 5):
+//
+//   Superblock | users | directories | entries | inodes | extents | bitmap | data
+//
+// Every section is located through the superblock, and every record carries
+// its size there, so readers never depend on in-memory struct layouts.
+// Directory entries name inodes; each inode (with its extents and bytes) is
+// stored once however many hard links it has.
+// Version 1 images (a raw FileSystemState dump), versions 2-3 (one page
+// table entry per page instead of extents) and version 4 (one inode record
+// per directory entry) are upgraded on load.
+// With STORAGE_FLAG_MMAP_VOLUME set, file bytes live in VOLUME_FILE and the
+// data region only holds symlink targets.
+
+#define STORAGE_MAGIC "MINIFS\0"
+#define STORAGE_VERSION 5
+#define STORAGE_FIRST_EXTENT_VERSION 4
+#define STORAGE_FIRST_ENTRY_VERSION 5
+
+#define STORAGE_FLAG_MMAP_VOLUME 0x1
+
+typedef struct
+{
+    uint64_t offset;      // Absolute file offset of the section
+    uint64_t length;      // Section length in bytes
+    uint32_t count;       // Number of records
+    uint32_t record_size; // Size of one record (0 for raw byte sections)
+} DiskSection;
+
+typedef struct
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t superblock_size;
+    uint32_t page_size;
+    uint32_t total_pages; // Volume size, chosen at format time
+    int32_t current_directory;
+    uint32_t flags; // STORAGE_FLAG_*
+    DiskSection users;
+    DiskSection directories;
+    DiskSection inodes;
+    DiskSection extents; // DiskPageEntry records before version 4
+    DiskSection bitmap;
+    DiskSection data;
+    DiskSection entries; // Since version 5
+} Superblock;
+
+typedef struct
+{
+    char username[20];
+    char password[20];
+} DiskUser;
+
+typedef struct
+{
+    int32_t index; // Slot in fs_state.directories
+    int32_t parent_directory;
+    int32_t file_count;
+    int32_t reserved;
+    int64_t creation_time;
+    uint64_t inode;
+    char dirname[MAX_FILENAME];
+} DiskDirectory;
+
+// One record per inode (metadata only; bytes live in the data region).
+// Before version 5, one record per directory entry, named by dir_idx and filename.
+typedef struct
+{
+    int32_t dir_idx;
+    int32_t size;
+    int32_t permissions;
+    int32_t content_size;
+    int32_t is_symlink;
+    int32_t ref_count;
+    int32_t extent_count; // Page table entries before version 4
+    int32_t link_target_len;
+    int64_t creation_time;
+    int64_t modification_time;
+    uint64_t inode;
+    uint64_t extent_index;     // First record in the extent section
+    uint64_t data_offset;      // Relative to the data section: content, then link target
+    char filename[MAX_FILENAME];
+    char owner[20];
+} DiskInode;
+
+typedef struct
+{
+    int32_t start_page;
+    int32_t length;
+} DiskExtent;
+
+typedef struct
+{
+    int32_t dir_idx;
+    int32_t reserved;
+    uint64_t inode;
+    char filename[MAX_FILENAME];
+} DiskEntry;
+
+// Per-page mapping used by versions 2 and 3
+typedef struct
+{
+    int32_t physical_page;
+    int32_t is_allocated;
+} DiskPageEntry;
+
+int load_file_content(File *file);
+
+#endif // STORAGE_H
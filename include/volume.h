@@ -0,0 +1,26 @@
+#ifndef VOLUME_H
+#define VOLUME_H
+
+#include "filesystem.h"
+
+// Block store: file data lives in PAGE_SIZE pages addressed through each
+// file's extents. The pages are anonymous memory, or VOLUME_FILE mapped
+// shared when the filesystem was formatted with a volume (recorded in the
+// image superblock).
+
+#define VOLUME_FILE "filesystem.vol"
+#define VOLUME_SIZE ((size_t)total_pages * PAGE_SIZE)
+
+extern int volume_mode; // 1 when the pages are backed by VOLUME_FILE
+
+int volume_open(int create);
+void volume_close();
+char *volume_page(int page);
+int volume_read(const File *file, int offset, char *buffer, int len);
+int volume_write(const File *file, int offset, const char *data, int len);
+int volume_copy_pages(const File *src, File *dst);
+int volume_copy_range(const File *src, File *dst, int first, int pages);
+int volume_unshare(File *file, int first, int pages);
+int volume_sync();
+
+#endif // VOLUME_H
@@ -1,6 +1,663 @@
 #include "../include/commands.h"
 #include "../include/filesystem.h"
 #include "../include/globals.h"
+#include "../include/journal.h"
+#include "../include/defrag.h"
+#include "../include/dcache.h"
+#include "../include/volume.h"
+#include "../include/paging.h"
+
+// Volume size in pages from a byte count with an optional K/M/G/T suffix
+// (rounded up to whole pages; -1 if malformed or out of range)
+static int parse_volume_size(const char *text)
+{
+    char *end;
+    double bytes = strtod(text, &end);
+    switch (toupper((unsigned char)*end))
+    {
+    case 'T':
+        bytes *= 1024;
+        /* fall through */
+    case 'G':
+        bytes *= 1024;
+        /* fall through */
+    case 'M':
+        bytes *= 1024;
+        /* fall through */
+    case 'K':
+        bytes *= 1024;
+        end++;
+        break;
+    }
+    if (end == text || (*end && toupper((unsigned char)*end) != 'B'))
+        return -1;
+
+    double pages = (bytes + PAGE_SIZE - 1) / PAGE_SIZE;
+    return pages >= 1 && pages <= MAX_TOTAL_PAGES ? (int)pages : -1;
+}
+
+int login()
+{
+    char username[20], password[20];
+    printf("Username: ");
+    fgets(username, sizeof(username), stdin);
+    username[strcspn(username, "\n")] = 0;
+
+    printf("Password: ");
+    fgets(password, sizeof(password), stdin);
+    password[strcspn(password, "\n")] = 0;
+
+    return find_user(username, password);
+}
+
+void handle_signal(int sig)
+{
+    (void)sig;
+    printf("\nShutting down...\n");
+    cleanup();
+    exit(0);
+}
+
+// The core says what went wrong; the messages below add what it was about
+
+static void print_error(FsStatus status)
+{
+    printf(COLOR_RED "Error: %s\n" COLOR_RESET, fs_strerror(status));
+}
+
+static void print_path_error(FsStatus status, const char *path)
+{
+    printf(COLOR_RED "Error: %s: %s\n" COLOR_RESET, fs_strerror(status), path);
+}
+
+// Asks on the terminal; an empty answer is default_yes
+static int confirm(int default_yes)
+{
+    fflush(stdout);
+    char response[10];
+    if (fgets(response, sizeof(response), stdin) == NULL)
+        return -1;
+    if (response[0] == '\n')
+        return default_yes;
+    return tolower((unsigned char)response[0]) == 'y';
+}
+
+static const char *link_target(const FsFileInfo *info)
+{
+    return info->has_target ? info->link_target : "(null)";
+}
+
+static void show_create_file(const char *path, int permissions)
+{
+    FsFileInfo info;
+    FsStatus status = create_file(path, permissions, &info);
+    if (status == FS_OK)
+        printf(COLOR_GREEN "Created file %s (size: %d bytes, inode: %lu)\n" COLOR_RESET, path, info.size,
+               info.inode);
+    else if (status == FS_ERR_DIR_NOT_FOUND || status == FS_ERR_EXISTS)
+        print_path_error(status, path);
+    else
+        print_error(status);
+}
+
+static void show_create_directory(const char *path)
+{
+    FsDirInfo info;
+    FsStatus status = create_directory(path, &info);
+    if (status == FS_OK)
+        printf(COLOR_GREEN "Created directory %s (inode: %lu)\n" COLOR_RESET, path, info.inode);
+    else if (status == FS_ERR_INVALID)
+        printf(COLOR_RED "Error: Invalid directory name\n" COLOR_RESET);
+    else if (status == FS_ERR_DIR_NOT_FOUND)
+        printf(COLOR_RED "Error: Parent directory not found: %s\n" COLOR_RESET, path);
+    else if (status == FS_ERR_EXISTS)
+        printf(COLOR_RED "Error: Directory already exists: %s\n" COLOR_RESET, path);
+    else
+        print_error(status);
+}
+
+static void show_delete_file(const char *path)
+{
+    FsDeleteInfo info;
+    FsStatus status = delete_file(path, &info);
+    if (status != FS_OK)
+    {
+        if (status == FS_ERR_DIR_NOT_FOUND || status == FS_ERR_NOT_FOUND)
+            print_path_error(status, path);
+        else
+            print_error(status);
+        return;
+    }
+
+    if (info.file.is_symlink)
+        printf(COLOR_BLUE "Deleting symbolic link (inode: %lu): %s -> %s\n" COLOR_RESET, info.file.inode, path,
+               link_target(&info.file));
+    else
+        printf(COLOR_BLUE "Deleting %s (inode: %lu): %s\n" COLOR_RESET,
+               info.file.link_count > 1 ? "hard link" : "file", info.file.inode, path);
+
+    int named = info.invalidated < FS_REPORTED_LINKS ? info.invalidated : FS_REPORTED_LINKS;
+    for (int i = 0; i < named; i++)
+        printf(COLOR_YELLOW "  Invalidating symlink: %s -> %s\n" COLOR_RESET, info.invalidated_links[i].path,
+               info.invalidated_links[i].target);
+    if (info.invalidated > named)
+        printf(COLOR_YELLOW "  ... and %d more symlinks\n" COLOR_RESET, info.invalidated - named);
+    printf(COLOR_GREEN "Successfully deleted: %s\n" COLOR_RESET, path);
+}
+
+static void show_delete_directory(const char *dirname)
+{
+    FsDirInfo info;
+    FsStatus status = delete_directory(dirname, 0, &info);
+    if (status == FS_ERR_NOT_EMPTY)
+    {
+        if (info.file_count > 0)
+            printf(COLOR_RED "Warning: Directory '%s' is not empty (%d files)\n" COLOR_RESET, dirname,
+                   info.file_count);
+        if (info.subdir_count > 0)
+            printf(COLOR_RED "Warning: Directory '%s' contains subdirectories\n" COLOR_RESET, dirname);
+        printf(COLOR_RED "Are you sure you want to delete '%s' and all its contents? [Y/n] " COLOR_RESET, dirname);
+
+        int answer = confirm(1);
+        if (answer < 0)
+            return;
+        if (!answer)
+        {
+            printf("Deletion cancelled\n");
+            return;
+        }
+        status = delete_directory(dirname, 1, &info);
+    }
+
+    if (status == FS_OK)
+        printf(COLOR_GREEN "Directory '%s' deleted successfully\n" COLOR_RESET, dirname);
+    else if (status == FS_ERR_NOT_FOUND)
+        printf(COLOR_RED "Error: Directory '%s' not found\n" COLOR_RESET, dirname);
+    else
+        print_error(status);
+}
+
+static void show_list()
+{
+    FsListing listing;
+    FsStatus status = list_directory(&listing);
+    if (status != FS_OK)
+    {
+        print_error(status);
+        return;
+    }
+
+    printf("\nCurrent directory: %d (%s)\n", listing.dir.index, listing.dir.name);
+    printf("Existing directories: %d\n", listing.directory_count);
+    printf("File count: %d\n", listing.dir.file_count);
+
+    printf("\nContents of directory '%s':\n", listing.dir.name);
+    printf("--------------------------------\n");
+
+    printf("[Directories]\n");
+    for (int i = 0; i < listing.count && listing.entries[i].is_directory; i++)
+        printf("  %s/\n", listing.entries[i].name);
+
+    printf("\n[Files]\n");
+    for (int i = 0; i < listing.count; i++)
+    {
+        FsFileInfo *f = &listing.entries[i];
+        if (f->is_directory)
+            continue;
+        printf("  %-15s %6d bytes  %04o  %s", f->name, f->size, f->permissions, f->owner);
+        if (f->is_symlink)
+            printf(" -> %s", link_target(f));
+        printf("\n");
+    }
+    printf("--------------------------------\n");
+    free_listing(&listing);
+}
+
+static void show_tree(int show_inodes)
+{
+    FsListing listing;
+    FsStatus status = list_tree(&listing);
+    if (status != FS_OK)
+    {
+        print_error(status);
+        return;
+    }
+
+    printf(".\n");
+    for (int i = 0; i < listing.count; i++)
+    {
+        FsFileInfo *entry = &listing.entries[i];
+        for (int j = 0; j < entry->depth; j++)
+            printf("│   ");
+        printf("├── ");
+        if (show_inodes)
+            printf("[%lu] ", entry->inode);
+
+        if (entry->is_directory)
+            printf(COLOR_BLUE "%s" COLOR_RESET "\n", entry->name);
+        else if (entry->is_symlink)
+            printf(COLOR_YELLOW "%s" COLOR_RESET " -> %s\n", entry->name, link_target(entry));
+        else if (entry->link_count > 1)
+            printf(COLOR_GREEN "%s" COLOR_RESET "\n", entry->name);
+        else
+            printf("%s\n", entry->name);
+    }
+    free_listing(&listing);
+}
+
+static void show_write(const char *path, const char *data, int append)
+{
+    int length = strlen(data), new_size;
+    FsStatus status = write_file_range(path, data, length, append, &new_size);
+    if (status == FS_OK)
+        printf(COLOR_GREEN "Successfully wrote %d bytes to %s (new size: %d bytes)\n" COLOR_RESET, length, path,
+               new_size);
+    else
+        print_error(status);
+}
+
+static void show_read(const char *path, int bytes_to_read, int offset)
+{
+    char *content;
+    FsStatus status = read_from_file(path, bytes_to_read, offset, &content);
+    if (status != FS_OK)
+    {
+        print_error(status);
+        return;
+    }
+    printf("File content [%d bytes]: %s\n", (int)strlen(content), content);
+    free(content);
+}
+
+static void show_stat(const char *path)
+{
+    FsFileInfo info;
+    FsStatus status = stat_file(path, &info);
+    if (status != FS_OK)
+    {
+        print_path_error(status, path);
+        return;
+    }
+
+    char created[26], modified[26];
+    int p = info.permissions;
+    printf("\nFile: %s\n", info.name);
+    printf("Path: %s/%s\n", info.dirname, info.name);
+    printf("Size: %d bytes\n", info.size);
+    printf("Owner: %s\n", info.owner);
+    printf("Permissions: %04o ", p);
+
+    // Show permission interpretation
+    printf("(%c%c%c%c%c%c%c%c%c)\n", (p & 0400) ? 'r' : '-', (p & 0200) ? 'w' : '-', (p & 0100) ? 'x' : '-',
+           (p & 0040) ? 'r' : '-', (p & 0020) ? 'w' : '-', (p & 0010) ? 'x' : '-', (p & 0004) ? 'r' : '-',
+           (p & 0002) ? 'w' : '-', (p & 0001) ? 'x' : '-');
+
+    printf("Type: %s\n", info.is_symlink ? "Symbolic link" : (info.link_count > 1) ? "Hard link" : "Regular file");
+    if (info.is_symlink)
+        printf("Link target: %s\n", link_target(&info));
+    else if (info.link_count > 1)
+        printf("Link count: %d\n", info.link_count);
+
+    printf("Inode: %lu\n", info.inode);
+    printf("Created: %s", ctime_r(&info.creation_time, created));
+    printf("Modified: %s", ctime_r(&info.modification_time, modified));
+    printf("Open count: %d\n", info.open_count);
+    printf("Pages allocated: %d (%d extents, %d shared)\n", info.page_count, info.extent_count,
+           info.shared_pages);
+}
+
+static void show_page_table(const char *filename)
+{
+    FileExtents map;
+    FsStatus status = file_extents(filename, &map);
+    if (status == FS_ERR_NOT_FOUND)
+    {
+        printf(COLOR_RED "File not found: %s\n" COLOR_RESET, filename);
+        return;
+    }
+    if (status != FS_OK)
+    {
+        printf(COLOR_RED "Error: %s\n" COLOR_RESET, fs_strerror(status));
+        return;
+    }
+
+    printf("\nExtents for %s (Size: %d bytes, Pages: %d, Extents: %d):\n",
+           filename, map.size, map.page_count, map.extent_count);
+    printf("----------------------------------------\n");
+    printf("Logical Page | Physical Pages | Length\n");
+    printf("-------------|----------------|-------\n");
+
+    int logical = 0;
+    for (int e = 0; e < map.extent_count; e++)
+    {
+        printf("%12d | %6d - %-6d | %6d\n",
+               logical,
+               map.extents[e].start_page,
+               map.extents[e].start_page + map.extents[e].length - 1,
+               map.extents[e].length);
+        logical += map.extents[e].length;
+    }
+    free(map.extents);
+}
+
+static void show_page_bitmap()
+{
+    PageMap map;
+    page_map(&map);
+
+    printf("\nPage Allocation Bitmap:\n");
+    printf("----------------------\n");
+    printf("%d pages (%ld MB), %d free, %d shared, largest free run %d pages\n",
+           map.pages, (long)map.pages * PAGE_SIZE >> 20, map.free_pages, map.shared_pages,
+           map.largest_free_run);
+
+    for (int i = 0; i < map.cell_count; i++)
+    {
+        if (i % 64 == 0 && map.pages_per_cell == 1)
+            printf("\n%04d: ", i);
+        else if (i % 64 == 0)
+            printf("\n%10d: ", i * map.pages_per_cell);
+        printf("%c", map.cells[i]);
+    }
+    if (map.pages_per_cell == 1)
+        printf("\n\nX = Allocated, . = Free\n");
+    else
+        printf("\n\nOne character per %d pages: X = Full, + = Over half used, - = Under half used, . = Free\n",
+               map.pages_per_cell);
+}
+
+static void print_fragmentation(const char *label, const FragmentationReport *report)
+{
+    printf("  %-8s %d files, %d extents (%.2f per file), %d fragmented (max %d extents)\n",
+           label, report->files, report->extents,
+           report->files ? (double)report->extents / report->files : 0.0,
+           report->fragmented_files, report->max_extents);
+    printf("  %-8s %d free pages, largest free run %d pages\n", "", report->free_pages,
+           report->largest_free_run);
+}
+
+static void show_defrag()
+{
+    FragmentationReport before, after;
+    pthread_rwlock_wrlock(&fs_lock);
+    DefragStart started = defrag_start(&before, &after);
+    pthread_rwlock_unlock(&fs_lock);
+
+    if (started == DEFRAG_ALREADY_RUNNING)
+    {
+        printf(COLOR_YELLOW "Defragmentation already running (see defrag --status)\n" COLOR_RESET);
+        return;
+    }
+    printf("Fragmentation before defragmenting:\n");
+    print_fragmentation("Before", &before);
+    if (started == DEFRAG_BACKGROUND)
+        printf(COLOR_GREEN "Defragmenting in the background, %d pages per %d ms tick\n" COLOR_RESET,
+               DEFRAG_PAGES_PER_TICK, DEFRAG_TICK_MS);
+    else
+        print_fragmentation("After", &after);
+}
+
+static void show_defrag_status()
+{
+    DefragStatus status;
+    pthread_rwlock_wrlock(&fs_lock); // The report reads every file's extents
+    defrag_status(&status);
+    pthread_rwlock_unlock(&fs_lock);
+
+    printf("Defragmenter: %s (%d pages per %d ms tick)\n",
+           status.active ? "running" : "idle", DEFRAG_PAGES_PER_TICK, DEFRAG_TICK_MS);
+    if (status.active || status.completed)
+    {
+        printf("  %s pass: %d files moved (%d pages), %d skipped\n",
+               status.active ? "Current" : "Last", status.files_moved, status.pages_moved,
+               status.files_skipped);
+        if (status.inode)
+            printf("  Moving inode %lu: %d of %d pages copied\n",
+                   (unsigned long)status.inode, status.copied, status.target_pages);
+        print_fragmentation("Before", &status.before);
+        if (!status.active)
+            print_fragmentation("After", &status.after);
+    }
+    print_fragmentation("Now", &status.now);
+}
+
+static void show_directory_info(const char *dirname)
+{
+    FsDirInfo info;
+    if (directory_info(dirname, &info) != FS_OK)
+    {
+        printf(COLOR_RED "Directory not found\n" COLOR_RESET);
+        return;
+    }
+
+    char created[26];
+    printf("\nDirectory: %s\n", dirname && strcmp(dirname, ".") != 0 ? dirname : info.name);
+    printf("Path: %s\n", info.path);
+    printf("Files: %d\n", info.file_count);
+    printf("Created: %s", ctime_r(&info.creation_time, created));
+}
+
+static void show_change_directory(const char *path)
+{
+    FsDirInfo info;
+    if (change_directory(path, &info) == FS_OK)
+        printf("Changed to directory: %s\n", info.name);
+    else
+        printf(COLOR_RED "Directory not found: %s\n" COLOR_RESET, path);
+}
+
+// Errors shared by the commands that make a new entry from a source file
+static void print_copy_error(FsStatus status, const char *src, const char *dest)
+{
+    if (status == FS_ERR_NOT_FOUND)
+        printf(COLOR_RED "Error: Source file not found: %s\n" COLOR_RESET, src);
+    else if (status == FS_ERR_DEST_NOT_FOUND)
+        print_path_error(status, dest);
+    else if (status == FS_ERR_EXISTS)
+        printf(COLOR_RED "Error: File already exists in destination directory\n" COLOR_RESET);
+    else if (status == FS_ERR_INVALID)
+        printf(COLOR_RED "Error: Invalid destination: %s\n" COLOR_RESET, dest);
+    else
+        print_error(status);
+}
+
+static void show_copy(const char *src, const char *dest_dir)
+{
+    FsFileInfo info;
+    FsStatus status = copy_file_to_dir(src, dest_dir, &info);
+    if (status == FS_OK)
+        printf(COLOR_GREEN "Copied '%s' to '%s/%s' (new inode: %lu)\n" COLOR_RESET, src, info.dirname, info.name,
+               info.inode);
+    else
+        print_copy_error(status, src, dest_dir);
+}
+
+static void show_clone(const char *src, const char *dest)
+{
+    FsFileInfo info;
+    FsStatus status = clone_file(src, dest, &info);
+    if (status == FS_OK)
+        printf(COLOR_GREEN "Cloned '%s' to '%s' (%d pages shared, new inode: %lu)\n" COLOR_RESET, src, dest,
+               info.page_count, info.inode);
+    else
+        print_copy_error(status, src, dest);
+}
+
+static void show_move_file(const char *path, const char *dest_dir, const char *new_name)
+{
+    FsFileInfo info;
+    FsStatus status = move_file_to_dir(path, dest_dir, new_name, &info);
+    if (status == FS_OK)
+        printf(COLOR_GREEN "Moved '%s' to '%s/%s'\n" COLOR_RESET, path, info.dirname, info.name);
+    else
+        print_copy_error(status, path, dest_dir);
+}
+
+static void show_move_directory(const char *src, const char *dest, const char *new_name)
+{
+    FsDirInfo info;
+    FsStatus status = move_directory(src, dest, new_name, &info);
+    const char *slash = strrchr(src, '/');
+    switch (status)
+    {
+    case FS_OK:
+        printf(COLOR_GREEN "Moved directory '%s' to '%s/%s'\n" COLOR_RESET, slash ? slash + 1 : src, info.path,
+               info.name);
+        break;
+    case FS_ERR_DIR_NOT_FOUND:
+        printf(COLOR_RED "Error: Source parent directory not found\n" COLOR_RESET);
+        break;
+    case FS_ERR_NOT_FOUND:
+        printf(COLOR_RED "Error: Source directory not found\n" COLOR_RESET);
+        break;
+    case FS_ERR_INVALID:
+        printf(COLOR_RED "Error: Cannot move directory into itself\n" COLOR_RESET);
+        break;
+    case FS_ERR_EXISTS:
+        printf(COLOR_RED "Error: Directory '%s' already exists in destination\n" COLOR_RESET, info.name);
+        break;
+    default:
+        print_error(status);
+    }
+}
+
+static void show_chmod(const char *path, int mode)
+{
+    FsStatus status = change_permissions(path, mode);
+    if (status == FS_OK)
+        printf(COLOR_GREEN "Permissions of '%s' changed to %04o\n" COLOR_RESET, path, mode);
+    else
+        print_path_error(status, path);
+}
+
+static void show_open(const char *path)
+{
+    int count;
+    FsStatus status = open_file(path, &count);
+    if (status == FS_OK)
+        printf("File '%s' opened (count: %d)\n", path, count);
+    else
+        print_error(status);
+}
+
+static void show_close(const char *path)
+{
+    int count;
+    FsStatus status = close_file(path, &count);
+    if (status == FS_OK)
+        printf("File '%s' closed (count: %d)\n", path, count);
+    else
+        printf("Error: %s\n", fs_strerror(status));
+}
+
+// Errors shared by both kinds of link
+static void print_link_error(FsStatus status, const char *source, const char *link)
+{
+    if (status == FS_ERR_DIR_NOT_FOUND)
+        printf(COLOR_RED "Error: Source directory not found: %s\n" COLOR_RESET, source);
+    else if (status == FS_ERR_NOT_FOUND)
+        printf(COLOR_RED "Error: Source file not found: %s\n" COLOR_RESET, source);
+    else if (status == FS_ERR_DEST_NOT_FOUND)
+        printf(COLOR_RED "Error: Link directory not found: %s\n" COLOR_RESET, link);
+    else if (status == FS_ERR_EXISTS)
+        printf(COLOR_RED "Error: Link already exists: %s\n" COLOR_RESET, link);
+    else
+        print_error(status);
+}
+
+static void show_hard_link(const char *source, const char *link)
+{
+    FsFileInfo info;
+    FsStatus status = create_hard_link(source, link, &info);
+    if (status == FS_OK)
+        printf(COLOR_GREEN "Created hard link: %s -> %s (inode: %lu, refcount: %d)\n" COLOR_RESET, link, source,
+               info.inode, info.link_count);
+    else
+        print_link_error(status, source, link);
+}
+
+static void show_symbolic_link(const char *source, const char *link)
+{
+    FsFileInfo info;
+    FsStatus status = create_symbolic_link(source, link, &info);
+    if (status == FS_OK)
+        printf(COLOR_GREEN "Created symbolic link: %s -> %s (inode: %lu)\n" COLOR_RESET, link, source, info.inode);
+    else
+        print_link_error(status, source, link);
+}
+
+static void show_format(int mmap_volume, int pages)
+{
+    printf(COLOR_RED "WARNING: This will erase ALL data! Continue? [y/N] " COLOR_RESET);
+    if (confirm(0) != 1)
+    {
+        printf("Format cancelled\n");
+        return;
+    }
+
+    FsFormatInfo info;
+    format_filesystem(mmap_volume, pages, &info);
+    if (info.size_kept)
+    {
+        printf(COLOR_RED "Error: Could not allocate page bitmap for %d pages\n" COLOR_RESET, pages);
+        printf(COLOR_YELLOW "Keeping the current size of %d pages\n" COLOR_RESET, info.pages);
+    }
+    if (info.map_failed)
+        printf(COLOR_RED "Error: Could not create mapped volume, using memory buffers\n" COLOR_RESET);
+    printf(COLOR_GREEN "File system formatted successfully, %ld MB volume%s\n" COLOR_RESET,
+           (long)info.pages * PAGE_SIZE >> 20, info.mapped ? " (mapped " VOLUME_FILE ")" : "");
+}
+
+static void show_backup(const char *name)
+{
+    if (backup_exists(name))
+    {
+        printf(COLOR_YELLOW "Warning: Backup file '%s.bak' already exists!\n" COLOR_RESET, name);
+        printf(COLOR_RED "This operation will overwrite it. Continue? [y/N] " COLOR_RESET);
+        if (confirm(0) != 1)
+        {
+            printf(COLOR_BLUE "Backup cancelled\n" COLOR_RESET);
+            return;
+        }
+    }
+
+    if (backup_filesystem(name) == FS_OK)
+        printf(COLOR_GREEN "Backup successfully created: %s.bak\n" COLOR_RESET, name);
+    else
+        printf(COLOR_RED "Backup failed - no files were changed\n" COLOR_RESET);
+}
+
+static void show_restore(const char *name)
+{
+    printf(COLOR_RED "WARNING: This will overwrite current filesystem! Continue? [y/N] " COLOR_RESET);
+    if (confirm(0) != 1)
+    {
+        printf("Restore cancelled\n");
+        return;
+    }
+
+    FsStatus status = restore_filesystem(name);
+    if (status == FS_ERR_NOT_FOUND)
+    {
+        printf("Error restoring backup\n");
+        return;
+    }
+    if (status == FS_ERR_IO)
+        printf(COLOR_RED "Error: Could not restore %s\n" COLOR_RESET, VOLUME_FILE);
+    printf("Filesystem restored from: %s.bak\n", name);
+}
+
+static void show_seek(const char *path, int offset, int whence)
+{
+    int position;
+    FsStatus status = seek_file(path, offset, whence, &position);
+    if (status == FS_OK)
+        printf("Position set to %d in file '%s'\n", position, path);
+    else if (status == FS_ERR_INVALID)
+        printf("Invalid seek position\n");
+    else
+        printf(COLOR_RED "File not found\n" COLOR_RESET);
+}
 
 void help()
 {
@@ -17,11 +674,14 @@ void help()
     printf("  read <file> [off] [len]  - Read file (optional offset and length)\n");
     printf("  seek <file> <off> <whence> - Move file pointer (SET/CUR/END)\n");
     printf("  stat <file>              - Show file metadata\n");
-    printf("  write [-a] <file> <data> - Write to file (-a to append)\n\n");
+    printf("  write [-a] <file> <data> - Write to file (-a to append)\n");
+    printf("  read <file> | grep [-v] <text> | write [-a] <file>\n");
+    printf("                           - Stream a file through filters into another\n\n");
 
     printf(COLOR_YELLOW "Directory Operations:" COLOR_RESET "\n");
     printf("  cd <dir>                 - Change directory\n");
     printf("  copy <src> <dest>        - Copy file\n");
+    printf("  clone <src> <dest>       - Copy a file sharing its pages until written\n");
     printf("  create -d <dir>          - Create directory\n");
     printf("  delete -d <dir>          - Delete empty directory\n");
     printf("  dirinfo [dir]            - Show directory info\n");
@@ -36,19 +696,27 @@ void help()
 
     printf(COLOR_YELLOW "System Operations:" COLOR_RESET "\n");
     printf("  backup [name]            - Create backup\n");
-    printf("  format                   - Wipe filesystem (DANGER!)\n");
+    printf("  begin / commit           - Make the changes in between durable together\n");
+    printf("  dcache                   - Show path lookup cache statistics\n");
+    printf("  defrag [--status]        - Defragment files in the background / show progress\n");
+    printf("  durability [op|batch|interval] [n] - Show/set commit mode (n = ops or ms)\n");
+    printf("  format [-m] [-s size]    - Wipe filesystem (DANGER!), -m uses a mapped volume,\n");
+    printf("                             -s sets the volume size (e.g. 64M, 100G; default 1M)\n");
     printf("  help                     - This help message\n");
     printf("  quit                     - Exit the system\n");
     printf("  restore [name]           - Restore backup\n");
     printf("  showpages [file]         - Show page table info\n");
+    printf("  sync                     - Flush pending changes to disk\n");
+    printf("  workers                  - Show queued command worker statistics\n");
 
     printf("\n");
 }
 
+// The caller owns job.command
 void execute_job(Job job)
 {
     char command[256];
-    strcpy(command, job.command);
+    snprintf(command, sizeof(command), "%s", job.command);
 
     if (strncmp(command, "create", 6) == 0)
     {
@@ -57,7 +725,7 @@ void execute_job(Job job)
             char dirname[MAX_FILENAME];
             if (sscanf(command, "create -d %s", dirname) == 1)
             {
-                create_directory(dirname);
+                show_create_directory(dirname);
             }
             else
             {
@@ -70,7 +738,7 @@ void execute_job(Job job)
             int permissions;
             if (sscanf(command, "create %s %o", filename, &permissions) == 2)
             {
-                create_file(filename, permissions);
+                show_create_file(filename, permissions);
             }
             else
             {
@@ -81,7 +749,7 @@ void execute_job(Job job)
     }
     else if (strcmp(command, "list") == 0)
     {
-        list_files();
+        show_list();
     }
     else if (strcmp(command, "pwd") == 0)
     {
@@ -91,17 +759,114 @@ void execute_job(Job job)
     {
         char name[256] = "default";
         sscanf(command, "backup %255s", name);
-        backup_filesystem(name);
+        show_backup(name);
     }
     else if (strncmp(command, "restore", 7) == 0)
     {
         char name[256] = "default";
         sscanf(command, "restore %255s", name);
-        restore_filesystem(name);
+        show_restore(name);
     }
-    else if (strcmp(command, "format") == 0)
+    else if (strcmp(command, "format") == 0 || strncmp(command, "format ", 7) == 0)
     {
-        format_filesystem();
+        int mmap_volume = 0;
+        int pages = TOTAL_PAGES;
+        int ok = 1;
+        char args[256], *save = NULL;
+        snprintf(args, sizeof(args), "%s", command + 6);
+        for (char *arg = strtok_r(args, " ", &save); arg && ok; arg = strtok_r(NULL, " ", &save))
+        {
+            if (strcmp(arg, "-m") == 0 || strcmp(arg, "--mmap") == 0)
+            {
+                mmap_volume = 1;
+            }
+            else if (strcmp(arg, "-s") == 0)
+            {
+                char *size = strtok_r(NULL, " ", &save);
+                pages = size ? parse_volume_size(size) : -1;
+                ok = pages > 0;
+            }
+            else
+            {
+                ok = 0;
+            }
+        }
+
+        if (ok)
+        {
+            show_format(mmap_volume, pages);
+        }
+        else
+        {
+            printf(COLOR_RED "Usage: format [-m] [-s <size>[K|M|G|T]]\n" COLOR_RESET);
+        }
+    }
+    else if (strcmp(command, "defrag") == 0)
+    {
+        show_defrag();
+    }
+    else if (strcmp(command, "defrag --status") == 0 || strcmp(command, "defrag -s") == 0)
+    {
+        show_defrag_status();
+    }
+    else if (strcmp(command, "dcache") == 0)
+    {
+        dcache_print_stats();
+    }
+    else if (strcmp(command, "workers") == 0)
+    {
+        scheduler_print_stats();
+    }
+    else if (strcmp(command, "begin") == 0)
+    {
+        journal_begin();
+        printf(COLOR_GREEN "Batch started, changes are made durable together at 'commit'\n" COLOR_RESET);
+    }
+    else if (strcmp(command, "commit") == 0)
+    {
+        int records;
+        int open = journal_commit(&records);
+        if (open < 0)
+            printf(COLOR_RED "Error: No batch in progress\n" COLOR_RESET);
+        else if (open > 0)
+            printf("Inner batch closed, %d still open\n", open);
+        else
+            printf(COLOR_GREEN "Committed %d operations\n" COLOR_RESET, records);
+    }
+    else if (strcmp(command, "sync") == 0)
+    {
+        int flushed = journal_flush();
+        printf(COLOR_GREEN "Flushed %d pending operations\n" COLOR_RESET, flushed);
+    }
+    else if (strncmp(command, "durability", 10) == 0)
+    {
+        char mode[16] = {0};
+        int value = 0;
+        int parsed = sscanf(command, "durability %15s %d", mode, &value);
+
+        if (parsed < 1)
+        {
+            journal_print_status();
+        }
+        else if (strcmp(mode, "op") == 0)
+        {
+            journal_set_durability(DURABILITY_PER_OP, 0);
+            journal_print_status();
+        }
+        else if (strcmp(mode, "batch") == 0)
+        {
+            journal_set_durability(DURABILITY_PER_BATCH, value);
+            journal_print_status();
+        }
+        else if (strcmp(mode, "interval") == 0)
+        {
+            journal_set_durability(DURABILITY_INTERVAL, value);
+            journal_print_status();
+        }
+        else
+        {
+            printf(COLOR_RED "Usage: durability [op|batch|interval] [n]\n" COLOR_RESET);
+        }
     }
     else if (strncmp(command, "dirinfo", 7) == 0)
     {
@@ -130,33 +895,7 @@ void execute_job(Job job)
                 return;
             }
 
-            // Find the file
-            File *file = NULL;
-            for (int i = 0; i < fs_state.directories[fs_state.current_directory].file_count; i++)
-            {
-                if (strcmp(fs_state.directories[fs_state.current_directory].files[i].filename, filename) == 0)
-                {
-                    file = &fs_state.directories[fs_state.current_directory].files[i];
-                    break;
-                }
-            }
-
-            if (file)
-            {
-                int new_pos = file_seek(file, offset, whence);
-                if (new_pos != -1)
-                {
-                    printf("Position set to %d in file '%s'\n", new_pos, filename);
-                }
-                else
-                {
-                    printf("Invalid seek position\n");
-                }
-            }
-            else
-            {
-                printf(COLOR_RED "File not found\n" COLOR_RESET);
-            }
+            show_seek(filename, offset, whence);
         }
         else
         {
@@ -166,24 +905,24 @@ void execute_job(Job job)
     else if (strcmp(command, "tree") == 0)
     {
         // Basic tree command without inodes
-        tree_command(0);
+        show_tree(0);
     }
     else if (strcmp(command, "tree -i") == 0)
     {
         // Tree command with inodes
-        tree_command(1);
+        show_tree(1);
     }
     else if (strncmp(command, "cd", 2) == 0)
     {
         char dirname[MAX_FILENAME];
         if (sscanf(command, "cd %s", dirname) == 1)
         {
-            change_directory(dirname);
+            show_change_directory(dirname);
         }
         else
         {
             // If no argument given, go to home directory
-            change_directory("/");
+            show_change_directory("/");
         }
     }
     else if (strcmp(command, "help") == 0)
@@ -205,7 +944,6 @@ void execute_job(Job job)
             else
             {
                 printf(COLOR_RED "Usage: write [-a] <filename> <data>\n" COLOR_RESET);
-                free(job.command);
                 return;
             }
         }
@@ -214,19 +952,18 @@ void execute_job(Job job)
             if (sscanf(command, "write %s %[^\n]", filename, data) != 2)
             {
                 printf(COLOR_RED "Usage: write [-a] <filename> <data>\n" COLOR_RESET);
-                free(job.command);
                 return;
             }
         }
 
-        write_to_file(filename, data, append);
+        show_write(filename, data, append);
     }
     else if (strncmp(command, "open", 4) == 0)
     {
         char filename[MAX_FILENAME];
         if (sscanf(command, "open %s", filename) == 1)
         {
-            open_file(filename);
+            show_open(filename);
         }
         else
         {
@@ -238,7 +975,7 @@ void execute_job(Job job)
         char filename[MAX_FILENAME];
         if (sscanf(command, "close %s", filename) == 1)
         {
-            close_file(filename);
+            show_close(filename);
         }
         else
         {
@@ -254,12 +991,7 @@ void execute_job(Job job)
         // Parse either "read <filename>", "read <filename> <bytes>", or "read <filename> <offset> <bytes>"
         if (sscanf(command, "read %s %d %d", filename, &offset, &bytes_to_read) >= 1)
         {
-            char *content = read_from_file(filename, bytes_to_read, offset);
-            if (content)
-            {
-                printf("File content [%d bytes]: %s\n", (int)strlen(content), content);
-                free(content);
-            }
+            show_read(filename, bytes_to_read, offset);
         }
         else
         {
@@ -277,7 +1009,7 @@ void execute_job(Job job)
             char dirname[MAX_FILENAME];
             if (sscanf(command, "delete -d %s", dirname) == 1)
             {
-                delete_directory(dirname);
+                show_delete_directory(dirname);
             }
             else
             {
@@ -289,7 +1021,7 @@ void execute_job(Job job)
             char filename[MAX_FILENAME];
             if (sscanf(command, "delete %s", filename) == 1)
             {
-                delete_file(filename);
+                show_delete_file(filename);
             }
             else
             {
@@ -302,13 +1034,25 @@ void execute_job(Job job)
         char filename[MAX_FILENAME], dirname[MAX_FILENAME];
         if (sscanf(command, "copy %s %s", filename, dirname) == 2)
         {
-            copy_file_to_dir(filename, dirname);
+            show_copy(filename, dirname);
         }
         else
         {
             printf(COLOR_RED "Usage: copy <filename> <directory>\n" COLOR_RESET);
         }
     }
+    else if (strncmp(command, "clone", 5) == 0)
+    {
+        char src[MAX_FILENAME], dest[MAX_FILENAME];
+        if (sscanf(command, "clone %s %s", src, dest) == 2)
+        {
+            show_clone(src, dest);
+        }
+        else
+        {
+            printf(COLOR_RED "Usage: clone <src> <dest>\n" COLOR_RESET);
+        }
+    }
 
     else if (strncmp(command, "move", 4) == 0)
     {
@@ -342,7 +1086,7 @@ void execute_job(Job job)
                 while (end > dest_dir && (*end == '/' || *end == ' '))
                     *end-- = '\0';
 
-                move_directory(src_dir, dest_dir, new_name[0] ? new_name : NULL);
+                show_move_directory(src_dir, dest_dir, new_name[0] ? new_name : NULL);
             }
             else
             {
@@ -361,14 +1105,14 @@ void execute_job(Job job)
                 {
                     printf(COLOR_RED "Error: Use '-d' flag for directory moves\n" COLOR_RESET);
                     printf(COLOR_RED "Usage: move -d <src_dir> <dest_dir> [newname]\n" COLOR_RESET);
-                    free(job.command);
                     return;
                 }
             }
             // Handle file move (existing code)
             char src_path[MAX_FILENAME], dest_path[MAX_FILENAME], new_name[MAX_FILENAME] = {0};
 
-            char *token = strtok((char *)command + 5, " ");
+            char *save = NULL;
+            char *token = strtok_r((char *)command + 5, " ", &save);
             if (!token)
             {
                 printf(COLOR_RED "Usage: move <src> <dest> [newname]\n" COLOR_RESET);
@@ -376,7 +1120,7 @@ void execute_job(Job job)
             }
             strncpy(src_path, token, MAX_FILENAME - 1);
 
-            token = strtok(NULL, " ");
+            token = strtok_r(NULL, " ", &save);
             if (!token)
             {
                 printf(COLOR_RED "Usage: move <src> <dest> [newname]\n" COLOR_RESET);
@@ -384,7 +1128,7 @@ void execute_job(Job job)
             }
             strncpy(dest_path, token, MAX_FILENAME - 1);
 
-            token = strtok(NULL, " ");
+            token = strtok_r(NULL, " ", &save);
             if (token)
             {
                 strncpy(new_name, token, MAX_FILENAME - 1);
@@ -395,7 +1139,7 @@ void execute_job(Job job)
             while (end > dest_path && (*end == '/' || *end == ' '))
                 *end-- = '\0';
 
-            move_file_to_dir(src_path, dest_path, new_name[0] ? new_name : NULL);
+            show_move_file(src_path, dest_path, new_name[0] ? new_name : NULL);
         }
     }
     else if (strncmp(command, "chmod", 5) == 0)
@@ -404,7 +1148,7 @@ void execute_job(Job job)
         int mode;
         if (sscanf(command, "chmod %o %s", &mode, filename) == 2)
         {
-            change_permissions(filename, mode);
+            show_chmod(filename, mode);
         }
         else
         {
@@ -417,7 +1161,7 @@ void execute_job(Job job)
         char filename[MAX_FILENAME];
         if (sscanf(command, "stat %s", filename) == 1)
         {
-            print_file_info(filename);
+            show_stat(filename);
         }
         else
         {
@@ -430,11 +1174,11 @@ void execute_job(Job job)
         char filename[MAX_FILENAME];
         if (sscanf(command, "showpages %s", filename) == 1)
         {
-            print_page_table(filename);
+            show_page_table(filename);
         }
         else
         {
-            print_page_bitmap();
+            show_page_bitmap();
         }
     }
     else if (strncmp(command, "ln", 2) == 0)
@@ -444,7 +1188,7 @@ void execute_job(Job job)
             char source[MAX_FILENAME], link[MAX_FILENAME];
             if (sscanf(command, "ln -s %s %s", source, link) == 2)
             {
-                create_symbolic_link(source, link);
+                show_symbolic_link(source, link);
             }
             else
             {
@@ -456,7 +1200,7 @@ void execute_job(Job job)
             char source[MAX_FILENAME], link[MAX_FILENAME];
             if (sscanf(command, "ln %s %s", source, link) == 2)
             {
-                create_hard_link(source, link);
+                show_hard_link(source, link);
             }
             else
             {
@@ -473,5 +1217,4 @@ void execute_job(Job job)
         printf(COLOR_RED "Error: Unknown command '%s'\n" COLOR_RESET, command);
         printf(COLOR_YELLOW "Type 'help' for a list of available commands\n" COLOR_RESET);
     }
-    free(job.command);
 }
\ No newline at end of file
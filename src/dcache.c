@@ -0,0 +1,263 @@
+#include <stdint.h>
+#include "../include/dcache.h"
+#include "../include/epoch.h"
+
+// Direct-mapped on (start, path). Lookups take no lock: a slot holds a
+// pointer to an entry that never changes once published, and an entry
+// replaced or dropped is retired to the epoch reclaimer. Inserts and
+// invalidations serialize on dcache_lock. Entries depending on the same
+// name are chained from key_heads so a name change finds them without a
+// scan; a full invalidation just advances the generation (by two, so its
+// parity still says whether a reshape is under way).
+
+typedef struct
+{
+    DcacheKind kind;
+    int start;
+    uint32_t hash;
+    unsigned int generation;
+    DcacheResult result;
+    size_t length;
+    char path[]; // length bytes, not terminated
+} DcacheEntry;
+
+#define DCACHE_STRIPES 16 // Hit and miss counters, spread over cache lines
+
+typedef struct
+{
+    uint64_t hits, misses;
+} __attribute__((aligned(64))) DcacheCounters;
+
+static pthread_mutex_t dcache_lock = PTHREAD_MUTEX_INITIALIZER;
+static DcacheEntry *slots[DCACHE_SIZE]; // Read without the lock
+static int key_next[DCACHE_SIZE];       // Next slot on the same key chain (-1 = end)
+static int key_heads[DCACHE_SIZE];
+static int initialized = 0;
+static unsigned int generation = 0; // Read without the lock; odd during a reshape
+static unsigned int version = 0;    // Read without the lock, see dcache_version()
+
+static DcacheCounters counters[DCACHE_STRIPES];
+static int next_stripe = 0;
+static __thread int stripe = -1;
+static uint64_t dropped = 0, flushes = 0;
+
+static uint32_t fnv_step(uint32_t h, const char *s, size_t length)
+{
+    for (size_t i = 0; i < length; i++)
+        h = (h ^ (unsigned char)s[i]) * 16777619u;
+    return h;
+}
+
+static uint32_t path_hash(int start, const char *path, size_t length, DcacheKind kind)
+{
+    uint32_t h = (2166136261u ^ (uint32_t)start) * 16777619u;
+    h = (h ^ (uint32_t)kind) * 16777619u;
+    return fnv_step(h, path, length);
+}
+
+static unsigned int key_bucket(int dir_idx, const char *name)
+{
+    uint32_t h = (2166136261u ^ (uint32_t)dir_idx) * 16777619u;
+    return fnv_step(h, name, strlen(name)) & (DCACHE_SIZE - 1);
+}
+
+static void init_cache()
+{
+    for (int i = 0; i < DCACHE_SIZE; i++)
+        key_heads[i] = -1;
+    initialized = 1;
+}
+
+static int entry_live(const DcacheEntry *entry)
+{
+    return entry && entry->generation == __atomic_load_n(&generation, __ATOMIC_ACQUIRE);
+}
+
+// Each thread counts in its own stripe, so lookups share no written line
+static void count_lookup(int hit)
+{
+    if (stripe < 0)
+        stripe = __atomic_fetch_add(&next_stripe, 1, __ATOMIC_RELAXED) % DCACHE_STRIPES;
+    __atomic_fetch_add(hit ? &counters[stripe].hits : &counters[stripe].misses, 1, __ATOMIC_RELAXED);
+}
+
+// Take the entry in slot off its key chain, unpublish and retire it
+static void drop_entry(int slot)
+{
+    DcacheEntry *entry = slots[slot];
+    if (!entry)
+        return;
+    if (entry->result.key_dir >= 0)
+    {
+        int *link = &key_heads[key_bucket(entry->result.key_dir, entry->result.key_name)];
+        while (*link != -1 && *link != slot)
+            link = &key_next[*link];
+        if (*link == slot)
+            *link = key_next[slot];
+    }
+    __atomic_store_n(&slots[slot], NULL, __ATOMIC_RELEASE);
+    epoch_retire(entry);
+}
+
+int dcache_lookup(int start, const char *path, size_t length, DcacheKind kind, DcacheResult *result)
+{
+    uint32_t hash = path_hash(start, path, length, kind);
+    int hit = 0;
+
+    epoch_enter();
+    DcacheEntry *entry = __atomic_load_n(&slots[hash & (DCACHE_SIZE - 1)], __ATOMIC_ACQUIRE);
+    if (entry_live(entry) && entry->hash == hash && entry->kind == kind && entry->start == start &&
+        entry->length == length && memcmp(entry->path, path, length) == 0)
+    {
+        *result = entry->result;
+        hit = 1;
+    }
+    epoch_exit();
+
+    count_lookup(hit);
+    return hit;
+}
+
+unsigned int dcache_version()
+{
+    return __atomic_load_n(&version, __ATOMIC_ACQUIRE);
+}
+
+void dcache_insert(int start, const char *path, size_t length, DcacheKind kind,
+                   const DcacheResult *result, unsigned int seen)
+{
+    if (length > DCACHE_PATH_MAX)
+        return;
+
+    DcacheEntry *entry = malloc(sizeof(DcacheEntry) + length);
+    if (!entry)
+        return;
+    uint32_t hash = path_hash(start, path, length, kind);
+    int slot = hash & (DCACHE_SIZE - 1);
+    entry->kind = kind;
+    entry->start = start;
+    entry->hash = hash;
+    entry->length = length;
+    memcpy(entry->path, path, length);
+    entry->result = *result;
+    entry->result.key_name[MAX_FILENAME - 1] = '\0';
+
+    pthread_mutex_lock(&dcache_lock);
+    // A name changed since the lookup began, so the result may be stale
+    if (seen != version)
+    {
+        pthread_mutex_unlock(&dcache_lock);
+        free(entry);
+        return;
+    }
+    if (!initialized)
+        init_cache();
+    drop_entry(slot);
+
+    entry->generation = generation;
+    key_next[slot] = -1;
+    if (result->key_dir >= 0)
+    {
+        int *head = &key_heads[key_bucket(result->key_dir, entry->result.key_name)];
+        key_next[slot] = *head;
+        *head = slot;
+    }
+    __atomic_store_n(&slots[slot], entry, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&dcache_lock);
+}
+
+void dcache_invalidate_name(int dir_idx, const char *name)
+{
+    pthread_mutex_lock(&dcache_lock);
+    __atomic_store_n(&version, version + 1, __ATOMIC_RELEASE);
+    if (!initialized)
+    {
+        pthread_mutex_unlock(&dcache_lock);
+        return;
+    }
+
+    int slot = key_heads[key_bucket(dir_idx, name)];
+    while (slot != -1)
+    {
+        DcacheEntry *entry = slots[slot];
+        int next = key_next[slot];
+        if (entry->result.key_dir == dir_idx && strcmp(entry->result.key_name, name) == 0)
+        {
+            if (entry_live(entry))
+                dropped++;
+            drop_entry(slot);
+        }
+        slot = next;
+    }
+    pthread_mutex_unlock(&dcache_lock);
+}
+
+void dcache_invalidate_all()
+{
+    pthread_mutex_lock(&dcache_lock);
+    __atomic_store_n(&version, version + 1, __ATOMIC_RELEASE);
+    __atomic_store_n(&generation, generation + 2, __ATOMIC_RELEASE);
+    flushes++;
+    pthread_mutex_unlock(&dcache_lock);
+}
+
+unsigned int dcache_generation()
+{
+    return __atomic_load_n(&generation, __ATOMIC_ACQUIRE);
+}
+
+int dcache_reshaped(unsigned int seen)
+{
+    // Whatever the reader looked at is read before the generation again
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return (seen & 1) || __atomic_load_n(&generation, __ATOMIC_RELAXED) != seen;
+}
+
+void dcache_reshape_begin()
+{
+    pthread_mutex_lock(&dcache_lock);
+    __atomic_store_n(&version, version + 1, __ATOMIC_RELEASE);
+    __atomic_store_n(&generation, generation + 1, __ATOMIC_RELAXED);
+    flushes++;
+    pthread_mutex_unlock(&dcache_lock);
+    // The odd generation is visible before any change it covers
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+void dcache_reshape_end()
+{
+    pthread_mutex_lock(&dcache_lock);
+    __atomic_store_n(&version, version + 1, __ATOMIC_RELEASE);
+    __atomic_store_n(&generation, generation + 1, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&dcache_lock);
+}
+
+void dcache_print_stats()
+{
+    pthread_mutex_lock(&dcache_lock);
+    int live = 0, negative = 0;
+    for (int i = 0; i < DCACHE_SIZE; i++)
+    {
+        if (!entry_live(slots[i]))
+            continue;
+        live++;
+        if (slots[i]->result.dir_idx == -1 || (slots[i]->kind == DCACHE_FILE && !slots[i]->result.inode))
+            negative++;
+    }
+    uint64_t dropped_count = dropped, flush_count = flushes;
+    pthread_mutex_unlock(&dcache_lock);
+
+    uint64_t hit_count = 0, miss_count = 0;
+    for (int i = 0; i < DCACHE_STRIPES; i++)
+    {
+        hit_count += __atomic_load_n(&counters[i].hits, __ATOMIC_RELAXED);
+        miss_count += __atomic_load_n(&counters[i].misses, __ATOMIC_RELAXED);
+    }
+    uint64_t lookups = hit_count + miss_count;
+
+    printf("Path cache: %d of %d entries in use (%d negative)\n", live, DCACHE_SIZE, negative);
+    printf("  %llu hits, %llu misses (%.1f%% hit rate)\n", (unsigned long long)hit_count,
+           (unsigned long long)miss_count, lookups ? 100.0 * hit_count / lookups : 0.0);
+    printf("  %llu entries invalidated by name, %llu full flushes\n", (unsigned long long)dropped_count,
+           (unsigned long long)flush_count);
+}
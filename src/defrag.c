@@ -0,0 +1,307 @@
+#include "../include/defrag.h"
+#include "../include/paging.h"
+#include "../include/globals.h"
+#include "../include/journal.h"
+#include "../include/volume.h"
+#include "../include/inode.h"
+
+// Online defragmenter. A pass walks the inode table and moves each
+// file mapped by several extents into fewer (ideally one). The destination
+// is reserved up front and filled at most DEFRAG_PAGES_PER_TICK pages per
+// tick under the exclusive filesystem lock, so a foreground command waits for one
+// tick at most. The file switches to its new extents only after the last
+// page is copied; if it is written, resized or deleted in between, the
+// move is dropped and the reservation released.
+//
+// Pass state is protected by the filesystem lock. Writers hold it shared
+// and only ever set stale, under the inode lock of the file being moved;
+// defrag_lock only guards the worker's wake-up flags. Lock order:
+// fs_lock -> defrag_lock
+
+typedef struct
+{
+    int active; // Pass in progress
+    int cursor; // Next inode table slot to examine
+
+    // File being moved (inode 0 when none)
+    ino_t inode;
+    Extent *source; // The file's extent list when the move began
+    File target;    // Reserved destination pages
+    int copied;     // Pages of target already filled
+    int stale;      // File written since the move began
+
+    int files_moved, pages_moved, files_skipped;
+    FragmentationReport before, after;
+    int completed; // At least one pass has finished
+} DefragPass;
+
+static DefragPass pass = {0};
+
+static int pass_requested = 0;
+static int worker_running = 0;
+static pthread_mutex_t defrag_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t defrag_cond = PTHREAD_COND_INITIALIZER;
+
+void defrag_report(FragmentationReport *report)
+{
+    memset(report, 0, sizeof(*report));
+    int cursor = 0;
+    File *file;
+    while ((file = inode_next(&cursor)) != NULL)
+    {
+        if (file->is_symlink || file->extent_count == 0)
+            continue;
+        report->files++;
+        report->extents += file->extent_count;
+        if (file->extent_count > 1)
+            report->fragmented_files++;
+        if (file->extent_count > report->max_extents)
+            report->max_extents = file->extent_count;
+    }
+    report->free_pages = free_page_total();
+    report->largest_free_run = largest_free_run();
+}
+
+// Forget the current move; release_pages gives the reservation back
+static void drop_move(int release_pages)
+{
+    if (release_pages)
+    {
+        free_pages(&pass.target);
+        free(pass.target.extents);
+    }
+    memset(&pass.target, 0, sizeof(pass.target));
+    pass.inode = 0;
+    pass.source = NULL;
+    pass.copied = 0;
+    pass.stale = 0;
+}
+
+// Reserve a destination for the next fragmented file; 0 once the pass has
+// looked at every inode
+static int begin_next_move()
+{
+    File *file;
+    while ((file = inode_next(&pass.cursor)) != NULL)
+    {
+        if (file->is_symlink || file->extent_count <= 1)
+            continue;
+
+        // Moving pages shared with a copy would split them apart
+        if (shared_pages_in(file->extents, file->extent_count) > 0)
+        {
+            pass.files_skipped++;
+            continue;
+        }
+
+        File target;
+        memset(&target, 0, sizeof(target));
+        if (allocate_pages(file->page_count, &target.extents, &target.extent_count) != 0)
+        {
+            pass.files_skipped++;
+            continue;
+        }
+        target.page_count = file->page_count;
+
+        // Only worth the copy when the result is less fragmented
+        if (target.extent_count >= file->extent_count)
+        {
+            free_pages(&target);
+            free(target.extents);
+            pass.files_skipped++;
+            continue;
+        }
+
+        pass.inode = file->inode;
+        pass.source = file->extents;
+        pass.target = target;
+        pass.copied = 0;
+        pass.stale = 0;
+
+        // Bytes still in the image have nothing to copy, so the move
+        // completes within this tick
+        if (file->data_offset > 0)
+            pass.copied = file->page_count;
+        return 1;
+    }
+    return 0;
+}
+
+// Switch the file (and so every link to it) to the filled destination
+static void commit_move(File *file)
+{
+    free_pages(file);
+    free(file->extents);
+    file->extents = pass.target.extents;
+    file->extent_count = pass.target.extent_count;
+    file->page_count = pass.target.page_count;
+
+    journal_log_move_pages(file);
+    pass.files_moved++;
+    pass.pages_moved += pass.target.page_count;
+    drop_move(0);
+}
+
+// One tick: copy up to budget pages, committing moves as they complete.
+// Returns 0 once the pass is over.
+static int defrag_step(int budget)
+{
+    if (!pass.active)
+        return 0;
+
+    while (budget > 0)
+    {
+        if (!pass.inode && !begin_next_move())
+        {
+            pass.active = 0;
+            pass.completed = 1;
+            defrag_report(&pass.after);
+            return 0;
+        }
+
+        // Deleted, resized or rewritten since the move began
+        File *file = inode_get(pass.inode);
+        if (!file || file->is_symlink || pass.stale || file->extents != pass.source ||
+            file->page_count != pass.target.page_count)
+        {
+            drop_move(1);
+            pass.files_skipped++;
+            continue;
+        }
+
+        int pages = pass.target.page_count - pass.copied;
+        if (pages > budget)
+            pages = budget;
+        if (pages > 0 && volume_copy_range(file, &pass.target, pass.copied, pages) != 0)
+        {
+            drop_move(1);
+            pass.files_skipped++;
+            continue;
+        }
+        pass.copied += pages;
+        budget -= pages;
+
+        // Readers hold only the inode lock, not the filesystem lock
+        if (pass.copied == pass.target.page_count)
+        {
+            inode_lock(file, 1);
+            commit_move(file);
+            inode_unlock(file);
+        }
+    }
+    return 1;
+}
+
+DefragStart defrag_start(FragmentationReport *before, FragmentationReport *after)
+{
+    if (pass.active)
+        return DEFRAG_ALREADY_RUNNING;
+
+    drop_move(0);
+    pass.active = 1;
+    pass.cursor = 0;
+    pass.files_moved = 0;
+    pass.pages_moved = 0;
+    pass.files_skipped = 0;
+    defrag_report(&pass.before);
+    *before = pass.before;
+
+    pthread_mutex_lock(&defrag_lock);
+    int background = worker_running;
+    if (background)
+    {
+        pass_requested = 1;
+        pthread_cond_signal(&defrag_cond);
+    }
+    pthread_mutex_unlock(&defrag_lock);
+
+    if (background)
+        return DEFRAG_BACKGROUND;
+
+    // No worker thread: run the whole pass now
+    while (defrag_step(DEFRAG_PAGES_PER_TICK))
+        ;
+    *after = pass.after;
+    return DEFRAG_DONE;
+}
+
+// The filesystem state is being replaced: abandon the pass without touching
+// the bitmap, which is about to be rebuilt
+void defrag_cancel()
+{
+    free(pass.target.extents);
+    drop_move(0);
+    pass.active = 0;
+}
+
+void defrag_note_write(ino_t inode)
+{
+    if (pass.inode && pass.inode == inode)
+        pass.stale = 1;
+}
+
+void defrag_status(DefragStatus *status)
+{
+    status->active = pass.active;
+    status->completed = pass.completed;
+    status->files_moved = pass.files_moved;
+    status->pages_moved = pass.pages_moved;
+    status->files_skipped = pass.files_skipped;
+    status->inode = pass.inode;
+    status->copied = pass.copied;
+    status->target_pages = pass.target.page_count;
+    status->before = pass.before;
+    status->after = pass.after;
+    defrag_report(&status->now);
+}
+
+void *defrag_worker(void *arg)
+{
+    (void)arg;
+
+    pthread_mutex_lock(&defrag_lock);
+    worker_running = 1;
+    while (worker_running)
+    {
+        if (!pass_requested)
+        {
+            pthread_cond_wait(&defrag_cond, &defrag_lock);
+            continue;
+        }
+        pass_requested = 0;
+
+        int more = 1;
+        while (more && worker_running)
+        {
+            pthread_mutex_unlock(&defrag_lock);
+            pthread_rwlock_wrlock(&fs_lock);
+            more = defrag_step(DEFRAG_PAGES_PER_TICK);
+            pthread_rwlock_unlock(&fs_lock);
+            pthread_mutex_lock(&defrag_lock);
+
+            // Let foreground commands in between ticks
+            if (more && worker_running)
+            {
+                struct timespec deadline;
+                clock_gettime(CLOCK_REALTIME, &deadline);
+                deadline.tv_nsec += (long)DEFRAG_TICK_MS * 1000000L;
+                if (deadline.tv_nsec >= 1000000000L)
+                {
+                    deadline.tv_sec++;
+                    deadline.tv_nsec -= 1000000000L;
+                }
+                pthread_cond_timedwait(&defrag_cond, &defrag_lock, &deadline);
+            }
+        }
+    }
+    pthread_mutex_unlock(&defrag_lock);
+    return NULL;
+}
+
+void defrag_shutdown()
+{
+    pthread_mutex_lock(&defrag_lock);
+    worker_running = 0;
+    pthread_cond_signal(&defrag_cond);
+    pthread_mutex_unlock(&defrag_lock);
+}
@@ -0,0 +1,504 @@
+#include <stdint.h>
+#include "../include/directory.h"
+#include "../include/globals.h"
+#include "../include/dcache.h"
+#include "../include/lockorder.h"
+#include "../include/epoch.h"
+
+// Slot of a directory in the table (-1 for one outside it)
+static int table_slot(const Directory *dir)
+{
+    if (dir < fs_state.directories || dir >= fs_state.directories + fs_state.directory_count)
+        return -1;
+    return (int)(dir - fs_state.directories);
+}
+
+static unsigned int name_hash(const char *name)
+{
+    uint32_t h = 2166136261u; // FNV-1a
+    for (; *name; name++)
+        h = (h ^ (unsigned char)*name) * 16777619u;
+    return h;
+}
+
+// Names change under the directory's lock while other threads look them up
+// without one. Each file entry, and each child directory, is a node of its
+// own that never changes once published; an EntryIndex maps names to nodes
+// with linear probing. Readers load the index and its buckets atomically.
+// A removed name leaves a REMOVED marker, so no probe sequence ever breaks
+// under a reader, and the node goes to the epoch reclaimer. When an index
+// fills up, a new one is built, published in its place, and the old one
+// retired the same way. A directory has one index for its file entries and
+// one for its child directories.
+
+struct EntryIndex
+{
+    unsigned int capacity; // Power of two
+    unsigned int used;     // Buckets not empty, REMOVED ones included
+    DirEntry *buckets[];   // NULL = empty
+};
+
+typedef struct
+{
+    DirEntry entry; // First, so the DirEntry pointers in files lead here
+    int item;       // Position in files or subdirs; read and written under the directory lock
+    int slot;       // Child directories: the child's table slot
+} EntryNode;
+
+static DirEntry removed_marker;
+#define REMOVED (&removed_marker)
+
+// Entry named name, without locks (NULL if there is none). bucket, if given,
+// gets the bucket holding it or the empty bucket ending its probe.
+static DirEntry *entry_probe(const EntryIndex *index, const char *name, unsigned int *bucket)
+{
+    unsigned int mask = index->capacity - 1;
+    for (unsigned int i = name_hash(name) & mask;; i = (i + 1) & mask)
+    {
+        DirEntry *entry = __atomic_load_n(&index->buckets[i], __ATOMIC_ACQUIRE);
+        if (!entry || (entry != REMOVED && strcmp(entry->filename, name) == 0))
+        {
+            if (bucket)
+                *bucket = i;
+            return entry;
+        }
+    }
+}
+
+// Node named name in the index at *names, without locks (NULL if none)
+static EntryNode *index_find(EntryIndex *const *names, const char *name)
+{
+    EntryIndex *index = __atomic_load_n(names, __ATOMIC_ACQUIRE);
+    return index ? (EntryNode *)entry_probe(index, name, NULL) : NULL;
+}
+
+// Replace the index at *names with one sized for count nodes, a quarter
+// full, holding the nodes the old one still names
+static int index_rebuild(EntryIndex **names, int count)
+{
+    unsigned int capacity = 16;
+    while (capacity < (unsigned int)count * 4)
+        capacity *= 2;
+    EntryIndex *index = calloc(1, sizeof(EntryIndex) + capacity * sizeof(DirEntry *));
+    if (!index)
+        return -1;
+
+    index->capacity = capacity;
+    EntryIndex *old = *names;
+    for (unsigned int b = 0; old && b < old->capacity; b++)
+    {
+        DirEntry *entry = old->buckets[b];
+        if (!entry || entry == REMOVED)
+            continue;
+        unsigned int i = name_hash(entry->filename) & (capacity - 1);
+        while (index->buckets[i])
+            i = (i + 1) & (capacity - 1);
+        index->buckets[i] = entry;
+        index->used++;
+    }
+
+    __atomic_store_n(names, index, __ATOMIC_RELEASE);
+    epoch_retire(old);
+    return 0;
+}
+
+// Publish node in the index at *names, which holds count nodes; -1 if its
+// name is taken or out of memory
+static int index_add(EntryIndex **names, int count, EntryNode *node)
+{
+    EntryIndex *index = *names;
+    if (!index || (index->used + 1) * 2 > index->capacity)
+    {
+        if (index_rebuild(names, count + 1) != 0)
+            return -1;
+        index = *names;
+    }
+
+    unsigned int i;
+    if (entry_probe(index, node->entry.filename, &i))
+        return -1;
+    // A REMOVED bucket earlier in the probe is reused
+    unsigned int mask = index->capacity - 1;
+    for (unsigned int j = name_hash(node->entry.filename) & mask; j != i; j = (j + 1) & mask)
+    {
+        if (index->buckets[j] == REMOVED)
+        {
+            i = j;
+            break;
+        }
+    }
+    if (!index->buckets[i])
+        index->used++;
+    __atomic_store_n(&index->buckets[i], &node->entry, __ATOMIC_RELEASE);
+    return 0;
+}
+
+// Unpublish a node; the caller retires it
+static void index_drop(EntryIndex *index, const DirEntry *entry)
+{
+    unsigned int i;
+    if (entry_probe(index, entry->filename, &i) == entry)
+        __atomic_store_n(&index->buckets[i], REMOVED, __ATOMIC_RELEASE);
+}
+
+// A node named name (stored truncated, as the index compares it)
+static EntryNode *new_node(const char *name, ino_t inode)
+{
+    EntryNode *node = calloc(1, sizeof(EntryNode));
+    if (!node)
+        return NULL;
+    snprintf(node->entry.filename, sizeof(node->entry.filename), "%s", name);
+    node->entry.inode = inode;
+    node->slot = -1;
+    return node;
+}
+
+DirEntry *dir_find(const Directory *dir, const char *name)
+{
+    EntryNode *node = index_find(&dir->file_names, name);
+    return node ? &node->entry : NULL;
+}
+
+int dir_lookup(const Directory *dir, const char *name)
+{
+    EntryNode *node = index_find(&dir->file_names, name);
+    return node ? node->item : -1;
+}
+
+DirEntry *dir_insert(Directory *dir, const char *name, ino_t inode)
+{
+    if (dir->file_count == dir->file_capacity)
+    {
+        int capacity = dir->file_capacity ? dir->file_capacity * 2 : 8;
+        DirEntry **grown = realloc(dir->files, capacity * sizeof(DirEntry *));
+        if (!grown)
+            return NULL;
+        dir->files = grown;
+        dir->file_capacity = capacity;
+    }
+
+    EntryNode *node = new_node(name, inode);
+    if (!node)
+        return NULL;
+    node->item = dir->file_count;
+    if (index_add(&dir->file_names, dir->file_count, node) != 0)
+    {
+        free(node);
+        return NULL;
+    }
+    dir->files[dir->file_count++] = &node->entry;
+    dcache_invalidate_name(table_slot(dir), node->entry.filename);
+    return &node->entry;
+}
+
+void dir_remove(Directory *dir, int index)
+{
+    if (index < 0 || index >= dir->file_count)
+        return;
+
+    DirEntry *entry = dir->files[index];
+    index_drop(dir->file_names, entry);
+
+    int last = dir->file_count - 1;
+    dir->files[index] = dir->files[last];
+    ((EntryNode *)dir->files[index])->item = index;
+    dir->files[last] = NULL;
+    dir->file_count--;
+
+    // Invalidated after the change, see dcache.h
+    dcache_invalidate_name(table_slot(dir), entry->filename);
+    epoch_retire(entry);
+}
+
+int dir_child(int parent, const char *name)
+{
+    epoch_enter();
+    Directory *dir = dir_get(parent);
+    EntryNode *node = dir ? index_find(&dir->subdir_names, name) : NULL;
+    int slot = node ? node->slot : -1;
+    epoch_exit();
+    return slot;
+}
+
+int dir_attach(int parent, int child)
+{
+    Directory *dir = dir_get(parent);
+    if (!dir || parent == child)
+        return -1;
+    Directory *sub = &fs_state.directories[child];
+    EntryNode *node = new_node(sub->dirname, sub->inode);
+    if (!node)
+        return -1;
+    node->slot = child;
+
+    dir_lock(parent, 1);
+    int result = -1;
+    if (dir->subdir_count == dir->subdir_capacity)
+    {
+        int capacity = dir->subdir_capacity ? dir->subdir_capacity * 2 : 8;
+        int *grown = realloc(dir->subdirs, capacity * sizeof(int));
+        if (!grown)
+            goto out;
+        dir->subdirs = grown;
+        dir->subdir_capacity = capacity;
+    }
+
+    // Parent first: a walk that finds the child may go back up through it
+    sub->parent_directory = parent;
+    node->item = dir->subdir_count;
+    if (index_add(&dir->subdir_names, dir->subdir_count, node) != 0)
+    {
+        sub->parent_directory = -1;
+        goto out;
+    }
+    dir->subdirs[dir->subdir_count++] = child;
+    dcache_invalidate_name(parent, node->entry.filename);
+    node = NULL;
+    result = 0;
+out:
+    dir_unlock(parent);
+    free(node);
+    return result;
+}
+
+void dir_detach(int child)
+{
+    int parent = fs_state.directories[child].parent_directory;
+    Directory *dir = dir_get(parent);
+    fs_state.directories[child].parent_directory = -1;
+    if (!dir)
+        return;
+
+    dir_lock(parent, 1);
+    EntryNode *node = index_find(&dir->subdir_names, fs_state.directories[child].dirname);
+    if (node && node->slot == child)
+    {
+        index_drop(dir->subdir_names, &node->entry);
+        dcache_invalidate_all(); // Every path through child now leads elsewhere
+
+        int last = dir->subdir_count - 1;
+        if (node->item != last)
+        {
+            int moved = dir->subdirs[last];
+            dir->subdirs[node->item] = moved;
+            index_find(&dir->subdir_names, fs_state.directories[moved].dirname)->item = node->item;
+        }
+        dir->subdir_count--;
+        epoch_retire(node);
+    }
+    dir_unlock(parent);
+}
+
+// Directory locks, one per slot, in chunks that never move or go away: the
+// table itself is replaced as it grows. Lock-free readers take them too, so
+// the array of chunks is replaced the same way, published atomically and
+// the old one retired (see epoch.h).
+#define DIR_LOCK_CHUNK 64
+
+static pthread_rwlock_t **lock_chunks = NULL;
+static int lock_chunk_count = 0;
+
+static int reserve_locks(int slots)
+{
+    while (lock_chunk_count * DIR_LOCK_CHUNK < slots)
+    {
+        pthread_rwlock_t *locks = malloc(DIR_LOCK_CHUNK * sizeof(pthread_rwlock_t));
+        pthread_rwlock_t **grown = malloc((lock_chunk_count + 1) * sizeof(pthread_rwlock_t *));
+        if (!locks || !grown)
+        {
+            free(locks);
+            free(grown);
+            return -1;
+        }
+        for (int i = 0; i < DIR_LOCK_CHUNK; i++)
+            pthread_rwlock_init(&locks[i], NULL);
+        if (lock_chunk_count)
+            memcpy(grown, lock_chunks, lock_chunk_count * sizeof(pthread_rwlock_t *));
+        grown[lock_chunk_count] = locks;
+
+        pthread_rwlock_t **old = lock_chunks;
+        __atomic_store_n(&lock_chunks, grown, __ATOMIC_RELEASE);
+        epoch_retire(old);
+        lock_chunk_count++;
+    }
+    return 0;
+}
+
+static pthread_rwlock_t *slot_lock(int index)
+{
+    epoch_enter();
+    pthread_rwlock_t **chunks = __atomic_load_n(&lock_chunks, __ATOMIC_ACQUIRE);
+    pthread_rwlock_t *lock = &chunks[index / DIR_LOCK_CHUNK][index % DIR_LOCK_CHUNK];
+    epoch_exit();
+    return lock;
+}
+
+void dir_lock(int index, int exclusive)
+{
+    lock_order_acquire(LOCK_DIRECTORY, index);
+    if (exclusive)
+        pthread_rwlock_wrlock(slot_lock(index));
+    else
+        pthread_rwlock_rdlock(slot_lock(index));
+}
+
+void dir_unlock(int index)
+{
+    lock_order_release(LOCK_DIRECTORY, index);
+    pthread_rwlock_unlock(slot_lock(index));
+}
+
+void dir_lock_pair(int a, int b)
+{
+    dir_lock(a < b ? a : b, 1);
+    if (a != b)
+        dir_lock(a < b ? b : a, 1);
+}
+
+void dir_unlock_pair(int a, int b)
+{
+    dir_unlock(a);
+    if (a != b)
+        dir_unlock(b);
+}
+
+// Freed table slots, reused before the table grows. A slot can be listed
+// twice or be back in use; dir_table_alloc() skips those.
+static int *free_slots = NULL;
+static int free_count = 0, free_capacity = 0;
+
+static void push_free_slot(int index)
+{
+    if (free_count == free_capacity)
+    {
+        int capacity = free_capacity ? free_capacity * 2 : 64;
+        int *grown = realloc(free_slots, capacity * sizeof(int));
+        if (!grown)
+            return; // The slot is simply not reused
+        free_slots = grown;
+        free_capacity = capacity;
+    }
+    free_slots[free_count++] = index;
+}
+
+// Readers without locks may still be walking it, so everything they can
+// reach goes to the epoch reclaimer; listers are kept out by the caller
+static void free_directory(Directory *dir)
+{
+    for (int i = 0; i < dir->file_count; i++)
+        epoch_retire(dir->files[i]);
+    EntryIndex *children = dir->subdir_names;
+    for (unsigned int b = 0; children && b < children->capacity; b++)
+    {
+        if (children->buckets[b] && children->buckets[b] != REMOVED)
+            epoch_retire(children->buckets[b]);
+    }
+    epoch_retire(dir->files);
+    epoch_retire(dir->subdirs);
+    epoch_retire(dir->file_names);
+    epoch_retire(children);
+    memset(dir, 0, sizeof(Directory));
+    dir->parent_directory = -1;
+}
+
+// Only once no reader can be looking (see epoch_synchronize())
+void dir_table_reset()
+{
+    dcache_invalidate_all();
+    for (int i = 0; i < fs_state.directory_count; i++)
+        free_directory(&fs_state.directories[i]);
+    free(fs_state.directories);
+    fs_state.directories = NULL;
+    fs_state.directory_count = 0;
+    fs_state.directory_capacity = 0;
+
+    free(free_slots);
+    free_slots = NULL;
+    free_count = free_capacity = 0;
+}
+
+Directory *dir_table_claim(int index)
+{
+    if (index < 0)
+        return NULL;
+
+    // A bigger table is copied and published, and the old one retired:
+    // readers without locks may still be looking at it
+    if (index >= fs_state.directory_capacity)
+    {
+        int capacity = fs_state.directory_capacity ? fs_state.directory_capacity : 16;
+        while (capacity <= index)
+            capacity *= 2;
+        if (reserve_locks(capacity) != 0)
+            return NULL;
+        Directory *grown = malloc(capacity * sizeof(Directory));
+        if (!grown)
+            return NULL;
+        if (fs_state.directory_count)
+            memcpy(grown, fs_state.directories, fs_state.directory_count * sizeof(Directory));
+        Directory *old = fs_state.directories;
+        __atomic_store_n(&fs_state.directories, grown, __ATOMIC_RELEASE);
+        epoch_retire(old);
+        fs_state.directory_capacity = capacity;
+    }
+
+    // A slot is cleared before the count takes it in
+    while (fs_state.directory_count <= index)
+    {
+        int slot = fs_state.directory_count;
+        memset(&fs_state.directories[slot], 0, sizeof(Directory));
+        fs_state.directories[slot].parent_directory = -1;
+        __atomic_store_n(&fs_state.directory_count, slot + 1, __ATOMIC_RELEASE);
+        if (slot != index)
+            push_free_slot(slot);
+    }
+    return &fs_state.directories[index];
+}
+
+int dir_table_alloc()
+{
+    while (free_count > 0)
+    {
+        int slot = free_slots[--free_count];
+        if (slot < fs_state.directory_count && !fs_state.directories[slot].dirname[0])
+            return slot;
+    }
+    int slot = fs_state.directory_count;
+    return dir_table_claim(slot) ? slot : -1;
+}
+
+void dir_table_release(int index)
+{
+    Directory *dir = dir_get(index);
+    if (!dir)
+        return;
+    dir_detach(index);
+    dir_lock(index, 1);
+    free_directory(dir);
+    dir_unlock(index);
+    dcache_invalidate_all(); // Cached results may name the slot
+    push_free_slot(index);
+}
+
+void dir_table_attach_all()
+{
+    for (int i = 0; i < fs_state.directory_count; i++)
+    {
+        Directory *dir = &fs_state.directories[i];
+        int parent = dir->parent_directory;
+        dir->parent_directory = -1;
+        if (dir->dirname[0] && parent >= 0)
+            dir_attach(parent, i);
+    }
+}
+
+// The count is read first: the table it was read with, or any later one,
+// has room for that many slots
+Directory *dir_get(int index)
+{
+    int count = __atomic_load_n(&fs_state.directory_count, __ATOMIC_ACQUIRE);
+    Directory *table = __atomic_load_n(&fs_state.directories, __ATOMIC_ACQUIRE);
+    if (index < 0 || index >= count || !table[index].dirname[0])
+        return NULL;
+    return &table[index];
+}
@@ -0,0 +1,165 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <sched.h>
+#include "../include/epoch.h"
+
+// Three-epoch scheme. A reader inside a section publishes the global epoch
+// it saw; the global epoch only advances once every such reader has seen
+// the current one. Memory retired at epoch e was unpublished before any
+// reader that entered at e + 1 looked, so once the epoch reaches e + 2 no
+// reader can still hold it.
+
+#define EPOCH_MAX_READERS 128  // Threads that have ever entered a section at once
+#define EPOCH_RECLAIM_BATCH 64 // Retirements between reclaim attempts
+
+typedef struct
+{
+    unsigned long state; // (epoch << 1) | 1 inside a section, 0 outside
+    int in_use;          // Claimed by a live thread
+} __attribute__((aligned(64))) ReaderSlot; // One cache line each
+
+typedef struct
+{
+    void *ptr;
+    unsigned long epoch; // Global epoch when retired
+} Retired;
+
+static ReaderSlot readers[EPOCH_MAX_READERS];
+static unsigned long global_epoch = 0;
+
+static __thread ReaderSlot *self = NULL;
+static __thread int depth = 0;
+static pthread_key_t slot_key;
+static pthread_once_t slot_once = PTHREAD_ONCE_INIT;
+
+// Writers only
+static pthread_mutex_t retire_lock = PTHREAD_MUTEX_INITIALIZER;
+static Retired *retired = NULL;
+static int retired_count = 0, retired_capacity = 0;
+static int reclaim_at = EPOCH_RECLAIM_BATCH;
+
+// A thread's slot goes back when it exits, outside any section
+static void release_slot(void *slot)
+{
+    __atomic_store_n(&((ReaderSlot *)slot)->in_use, 0, __ATOMIC_RELEASE);
+}
+
+static void create_key()
+{
+    pthread_key_create(&slot_key, release_slot);
+}
+
+static ReaderSlot *claim_slot()
+{
+    pthread_once(&slot_once, create_key);
+    for (int i = 0; i < EPOCH_MAX_READERS; i++)
+    {
+        int expected = 0;
+        if (__atomic_compare_exchange_n(&readers[i].in_use, &expected, 1, 0, __ATOMIC_ACQUIRE,
+                                        __ATOMIC_RELAXED))
+        {
+            pthread_setspecific(slot_key, &readers[i]);
+            return &readers[i];
+        }
+    }
+    fprintf(stderr, "Epoch reclaimer: more than %d reader threads\n", EPOCH_MAX_READERS);
+    abort();
+}
+
+void epoch_enter()
+{
+    if (depth++ > 0)
+        return;
+    if (!self)
+        self = claim_slot();
+
+    // The slot must be visible before anything shared is read: either a
+    // writer scanning the slots sees it, or this reader sees the writer's
+    // unpublishing store. A sequentially consistent exchange orders both
+    // ways, and costs less than a store and a full fence.
+    unsigned long epoch = __atomic_load_n(&global_epoch, __ATOMIC_ACQUIRE);
+    __atomic_exchange_n(&self->state, (epoch << 1) | 1, __ATOMIC_SEQ_CST);
+}
+
+void epoch_exit()
+{
+    if (--depth > 0)
+        return;
+    __atomic_store_n(&self->state, 0, __ATOMIC_RELEASE);
+}
+
+// Advance the global epoch if no reader is behind it
+static int try_advance()
+{
+    __atomic_thread_fence(__ATOMIC_SEQ_CST); // Pairs with the exchange in epoch_enter()
+    unsigned long epoch = global_epoch;
+    for (int i = 0; i < EPOCH_MAX_READERS; i++)
+    {
+        unsigned long state = __atomic_load_n(&readers[i].state, __ATOMIC_ACQUIRE);
+        if ((state & 1) && (state >> 1) != epoch)
+            return 0;
+    }
+    __atomic_store_n(&global_epoch, epoch + 1, __ATOMIC_RELEASE);
+    return 1;
+}
+
+// Free everything retired two or more epochs ago
+static void reclaim()
+{
+    for (int i = 0; i < 2 && try_advance(); i++)
+        ;
+
+    int kept = 0;
+    for (int i = 0; i < retired_count; i++)
+    {
+        if (retired[i].epoch + 2 <= global_epoch)
+            free(retired[i].ptr);
+        else
+            retired[kept++] = retired[i];
+    }
+    retired_count = kept;
+    reclaim_at = retired_count + EPOCH_RECLAIM_BATCH;
+}
+
+void epoch_retire(void *ptr)
+{
+    if (!ptr)
+        return;
+
+    pthread_mutex_lock(&retire_lock);
+    if (retired_count == retired_capacity)
+    {
+        int capacity = retired_capacity ? retired_capacity * 2 : 256;
+        Retired *grown = realloc(retired, capacity * sizeof(Retired));
+        if (!grown)
+        {
+            // Waiting for readers here could deadlock; the block is simply not freed
+            pthread_mutex_unlock(&retire_lock);
+            return;
+        }
+        retired = grown;
+        retired_capacity = capacity;
+    }
+    retired[retired_count].ptr = ptr;
+    retired[retired_count].epoch = global_epoch;
+    retired_count++;
+
+    if (retired_count >= reclaim_at)
+        reclaim();
+    pthread_mutex_unlock(&retire_lock);
+}
+
+void epoch_synchronize()
+{
+    __atomic_thread_fence(__ATOMIC_SEQ_CST); // Pairs with the exchange in epoch_enter()
+    for (int i = 0; i < EPOCH_MAX_READERS; i++)
+    {
+        if (&readers[i] == self)
+            continue;
+        // A section still open is left, or replaced by a later one
+        unsigned long state = __atomic_load_n(&readers[i].state, __ATOMIC_ACQUIRE);
+        while ((state & 1) && __atomic_load_n(&readers[i].state, __ATOMIC_ACQUIRE) == state)
+            sched_yield();
+    }
+}
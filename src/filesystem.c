@@ -1,254 +1,278 @@
 #include "../include/filesystem.h"
 #include "../include/paging.h"
 #include "../include/globals.h"
+#include "../include/journal.h"
+#include "../include/storage.h"
+#include "../include/volume.h"
+#include "../include/defrag.h"
+#include "../include/inode.h"
+#include "../include/directory.h"
+#include "../include/dcache.h"
+#include "../include/epoch.h"
+#include <sched.h>
+
+
+// Directory a walk of path starts from
+static int path_start(const char *path) {
+    return (path[0] == '/') ? 0 : fs_state.current_directory;
+}
 
-
-// Helper to split path into directory and filename components
-void split_path(const char *path, char **dir, char **file) {
-    char *last_slash = strrchr(path, '/');
-    if (last_slash) {
-        *dir = strndup(path, last_slash - path);
-        *file = strdup(last_slash + 1);
-    } else {
-        *dir = strdup(".");
-        *file = strdup(path);
-    }
+// Last component of path, in place ("" when path ends in '/')
+static const char *path_last(const char *path) {
+    const char *slash = strrchr(path, '/');
+    return slash ? slash + 1 : path;
 }
 
-// Helper to find directory index from path (absolute or relative)
-int find_directory_from_path(const char *path) {
-    if (strcmp(path, ".") == 0) return fs_state.current_directory;
-    if (strcmp(path, "..") == 0) {
-        return (fs_state.directories[fs_state.current_directory].parent_directory != -1) ? 
-               fs_state.directories[fs_state.current_directory].parent_directory : 
-               fs_state.current_directory;
-    }
+// Bytes of path naming the directory that holds last ("/" stays "/")
+static size_t path_parent_length(const char *path, const char *last) {
+    size_t length = last - path;
+    return (length > 1) ? length - 1 : length;
+}
 
-    int current_dir = (path[0] == '/') ? 0 : fs_state.current_directory;
-    char *path_copy = strdup(path + (path[0] == '/'));
-    char *token = strtok(path_copy, "/");
+// Walk the first length bytes of path to a directory. Components are
+// scanned in place: nothing is copied, allocated or kept between calls, so
+// walks are reentrant. When a component is missing, *fail_dir and
+// fail_name (MAX_FILENAME bytes) say which.
+static int walk_path(const char *path, size_t length, int *fail_dir, char *fail_name) {
+    int current_dir = path_start(path);
+    const char *end = path + length;
+
+    for (const char *p = path; p < end; ) {
+        if (*p == '/') {
+            p++;
+            continue;
+        }
+        const char *next = memchr(p, '/', end - p);
+        if (!next) next = end;
+        size_t len = next - p;
 
-    while (token) {
         // Handle special directory components
-        if (strcmp(token, ".") == 0) {
-            token = strtok(NULL, "/");
+        if (len == 1 && p[0] == '.') {
+            p = next;
             continue;
         }
-        if (strcmp(token, "..") == 0) {
-            if (fs_state.directories[current_dir].parent_directory != -1) {
-                current_dir = fs_state.directories[current_dir].parent_directory;
+        if (len == 2 && p[0] == '.' && p[1] == '.') {
+            Directory *dir = dir_get(current_dir);
+            if (dir && dir->parent_directory != -1) {
+                current_dir = dir->parent_directory;
             }
-            token = strtok(NULL, "/");
+            p = next;
             continue;
         }
 
-        // Look for matching subdirectory
-        int found = -1;
-        for (int i = 0; i < MAX_DIRECTORIES; i++) {
-            if (strcmp(fs_state.directories[i].dirname, token) == 0 &&
-                fs_state.directories[i].parent_directory == current_dir) {
-                found = i;
-                break;
-            }
-        }
+        // Look for matching subdirectory; no directory has a longer name
+        char name[MAX_FILENAME];
+        size_t copied = (len < MAX_FILENAME) ? len : MAX_FILENAME - 1;
+        memcpy(name, p, copied);
+        name[copied] = '\0';
+        int found = (len < MAX_FILENAME) ? dir_child(current_dir, name) : -1;
         if (found == -1) {
-            free(path_copy);
+            *fail_dir = current_dir;
+            memcpy(fail_name, name, copied + 1);
             return -1;
         }
         current_dir = found;
-        token = strtok(NULL, "/");
+        p = next;
     }
-    free(path_copy);
     return current_dir;
 }
 
-// Helper to find a file in a directory
-File* find_file_in_dir(int dir_idx, const char *filename) {
-    if (dir_idx < 0 || dir_idx >= MAX_DIRECTORIES) return NULL;
-    
-    for (int i = 0; i < fs_state.directories[dir_idx].file_count; i++) {
-        if (strcmp(fs_state.directories[dir_idx].files[i].filename, filename) == 0) {
-            return &fs_state.directories[dir_idx].files[i];
-        }
-    }
-    return NULL;
+// Resolve the first length bytes of path to a directory through the dentry cache
+static void lookup_directory(const char *path, size_t length, DcacheResult *result) {
+    int start = path_start(path);
+    if (dcache_lookup(start, path, length, DCACHE_DIRECTORY, result))
+        return;
+
+    unsigned int version = dcache_version();
+    memset(result, 0, sizeof(*result));
+    result->key_dir = -1;
+    result->dir_idx = walk_path(path, length, &result->key_dir, result->key_name);
+    dcache_insert(start, path, length, DCACHE_DIRECTORY, result, version);
 }
 
-// Helper to resolve a file path to its actual file (handles symlinks)
-File* resolve_file_path(const char *path, int *dir_idx, char **filename) {
-    char *dir_path = NULL;
-    split_path(path, &dir_path, filename);
-    
-    *dir_idx = find_directory_from_path(dir_path);
-    if (*dir_idx == -1) {
-        free(dir_path);
-        free(*filename);
-        return NULL;
-    }
+// Helper to find directory index from path (absolute or relative)
+int find_directory_from_path(const char *path) {
+    DcacheResult result;
+    lookup_directory(path, strlen(path), &result);
+    return result.dir_idx;
+}
 
-    File *file = find_file_in_dir(*dir_idx, *filename);
-    if (!file) {
-        free(dir_path);
-        free(*filename);
-        return NULL;
-    }
+// Helper to find the directory that would hold path's last component
+int resolve_parent(const char *path, char *name) {
+    const char *last = path_last(path);
+    strncpy(name, last, MAX_FILENAME - 1);
+    name[MAX_FILENAME - 1] = '\0';
 
-    // Special handling for deletion commands - don't follow symlinks
-    if (strstr(path, "delete") != NULL && file->is_symlink) {
-        free(dir_path);
-        return file; // Return the symlink itself for deletion
-    }
+    DcacheResult result;
+    lookup_directory(path, path_parent_length(path, last), &result);
+    return result.dir_idx;
+}
 
-    // Handle symlink resolution for non-deletion operations
-    if (file->is_symlink && file->link_target) {
-        free(dir_path);
-        free(*filename);
-        return resolve_file_path(file->link_target, dir_idx, filename);
-    }
+// Helper to find a directory entry by name. Takes no lock; the entry stays
+// readable while the directory's lock or an epoch section is held.
+DirEntry* find_entry_in_dir(int dir_idx, const char *filename) {
+    Directory *dir = dir_get(dir_idx);
+    return dir ? dir_find(dir, filename) : NULL;
+}
 
-    free(dir_path);
+// Helper to find the inode a directory entry names, without locks
+File* find_file_in_dir(int dir_idx, const char *filename) {
+    epoch_enter();
+    DirEntry *entry = find_entry_in_dir(dir_idx, filename);
+    File *file = entry ? inode_get(entry->inode) : NULL;
+    epoch_exit();
     return file;
 }
 
+// Name an inode in a directory; the inode gains a link
+static int add_entry(int dir_idx, const char *name, File *file) {
+    if (!dir_insert(&fs_state.directories[dir_idx], name, file->inode))
+        return -1;
+    file->ref_count++;
+    return 0;
+}
 
-// Helper function to resolve paths (returns directory index or -1 if not found)
-int resolve_path(const char *path)
-{
-    // Handle absolute paths
-    if (path[0] == '/')
-    {
-        int current_dir = 0;                // Start at root
-        char *path_copy = strdup(path + 1); // Skip leading slash
-        char *token = strtok(path_copy, "/");
+// Drop entry index of a directory without touching its inode
+static void remove_entry(int dir_idx, int index) {
+    dir_remove(&fs_state.directories[dir_idx], index);
+}
 
-        while (token)
-        {
-            int found = -1;
-            for (int i = 0; i < MAX_DIRECTORIES; i++)
-            {
-                if (strcmp(fs_state.directories[i].dirname, token) == 0 &&
-                    fs_state.directories[i].parent_directory == current_dir)
-                {
-                    found = i;
-                    break;
-                }
-            }
-            if (found == -1)
-            {
-                free(path_copy);
-                return -1;
-            }
-            current_dir = found;
-            token = strtok(NULL, "/");
-        }
-        free(path_copy);
-        return current_dir;
+// An inode lost a link; the last one returns its pages and the record.
+// Readers without the filesystem lock may hold the inode, so it is locked.
+static void release_link(File *file) {
+    inode_lock(file, 1);
+    if (--file->ref_count > 0) {
+        inode_unlock(file);
+        return;
     }
+    free_pages(file);
+    inode_free(file); // Unlocks it
+}
 
-    // Handle relative paths
-    char *path_copy = strdup(path);
-    char *token = strtok(path_copy, "/");
-    int current_dir = fs_state.current_directory;
+// Resolve path to a directory entry through the dentry cache. The parent
+// part is looked up in place, so it shares cache entries with directory lookups.
+static void lookup_entry(const char *path, DcacheResult *result) {
+    int start = path_start(path);
+    size_t length = strlen(path);
+    if (dcache_lookup(start, path, length, DCACHE_FILE, result))
+        return;
 
-    while (token)
-    {
-        // Handle special cases
-        if (strcmp(token, ".") == 0)
-        {
-            token = strtok(NULL, "/");
-            continue;
+    unsigned int version = dcache_version();
+    const char *last = path_last(path);
+    lookup_directory(path, path_parent_length(path, last), result);
+
+    // Found the directory: the result hangs on the entry's name
+    if (result->dir_idx != -1) {
+        result->key_dir = result->dir_idx;
+        strncpy(result->key_name, last, MAX_FILENAME - 1);
+        result->key_name[MAX_FILENAME - 1] = '\0';
+        epoch_enter();
+        DirEntry *found = find_entry_in_dir(result->dir_idx, result->key_name);
+        result->inode = found ? found->inode : 0;
+        epoch_exit();
+    }
+    dcache_insert(start, path, length, DCACHE_FILE, result, version);
+}
+
+// *number gets the inode reached. Symlinks are followed without their
+// inode locks: a link target is retired rather than freed, and the record
+// is checked to still be the same inode once its target has been read.
+static File *follow_path(const char *path, int *dir_idx, char *filename, ino_t *number) {
+    for (int hops = 0; ; hops++) {
+        DcacheResult entry;
+        lookup_entry(path, &entry);
+
+        *dir_idx = entry.dir_idx;
+        File *file = (entry.dir_idx != -1) ? inode_get(entry.inode) : NULL;
+        if (!file) {
+            filename[0] = '\0';
+            return NULL;
         }
-        if (strcmp(token, "..") == 0)
-        {
-            if (fs_state.directories[current_dir].parent_directory != -1)
-            {
-                current_dir = fs_state.directories[current_dir].parent_directory;
-            }
-            token = strtok(NULL, "/");
-            continue;
+        memcpy(filename, entry.key_name, MAX_FILENAME);
+        *number = entry.inode;
+
+        // Special handling for deletion commands - don't follow symlinks
+        if (strstr(path, "delete") != NULL && file->is_symlink) {
+            return file; // Return the symlink itself for deletion
         }
 
-        int found = -1;
-        for (int i = 0; i < MAX_DIRECTORIES; i++)
-        {
-            if (strcmp(fs_state.directories[i].dirname, token) == 0 &&
-                fs_state.directories[i].parent_directory == current_dir)
-            {
-                found = i;
-                break;
-            }
+        // Handle symlink resolution for non-deletion operations
+        const char *target = __atomic_load_n(&file->link_target, __ATOMIC_ACQUIRE);
+        if (!file->is_symlink || !target) {
+            return file;
         }
-        if (found == -1)
-        {
-            free(path_copy);
-            return -1;
+        if (hops == MAX_SYMLINK_HOPS || __atomic_load_n(&file->inode, __ATOMIC_ACQUIRE) != entry.inode) {
+            filename[0] = '\0';
+            return NULL; // A symlink loop, a chain too long to follow, or a link just deleted
         }
-        current_dir = found;
-        token = strtok(NULL, "/");
+        path = target;
     }
-    free(path_copy);
-    return current_dir;
 }
 
-// Add this new function implementation
-void defragment_filesystem()
-{
-    printf("Running defragmentation...\n");
-
-    // Create a list of all allocated pages across all files
-    int total_pages_used = 0;
-    for (int d = 0; d < MAX_DIRECTORIES; d++)
-    {
-        if (strlen(fs_state.directories[d].dirname))
-        {
-            for (int f = 0; f < fs_state.directories[d].file_count; f++)
-            {
-                File *file = &fs_state.directories[d].files[f];
-                total_pages_used += file->page_table_size;
-            }
-        }
-    }
+// Helper to resolve a file path to its actual file (handles symlinks).
+// filename (MAX_FILENAME bytes) gets the name of the entry finally reached.
+File* resolve_file_path(const char *path, int *dir_idx, char *filename) {
+    ino_t number;
+    epoch_enter(); // One section for the whole walk; the lookups inside nest
+    File *file = follow_path(path, dir_idx, filename, &number);
+    epoch_exit();
+    return file;
+}
 
-    // If we're using less than 90% of pages, no need to defragment
-    if (total_pages_used < (TOTAL_PAGES * 0.9))
-    {
-        printf("Defragmentation not needed (fragmentation level is low)\n");
-        return;
+// Readers take no filesystem lock. A read section is an epoch section, so
+// nothing a reader finds is freed under it; it is only begun while no
+// directory is being moved or deleted, and what it found is trusted only
+// if none was since (see dcache.h). Otherwise the reader starts over.
+// Waiting for a reshape to end happens outside the section, so format and
+// restore can wait for every section to drain (epoch_synchronize()).
+unsigned int read_begin() {
+    for (;;) {
+        while (dcache_generation() & 1)
+            sched_yield();
+        epoch_enter();
+        unsigned int generation = dcache_generation();
+        if (!(generation & 1))
+            return generation;
+        epoch_exit();
     }
+}
 
-    // Compact pages by moving files to lower-numbered pages
-    int next_free_page = 0;
-    for (int d = 0; d < MAX_DIRECTORIES; d++)
-    {
-        if (strlen(fs_state.directories[d].dirname))
-        {
-            for (int f = 0; f < fs_state.directories[d].file_count; f++)
-            {
-                File *file = &fs_state.directories[d].files[f];
-
-                for (int p = 0; p < file->page_table_size; p++)
-                {
-                    int old_page = file->page_table[p].physical_page;
-
-                    if (old_page > next_free_page)
-                    {
-                        // Move this page to the next free spot
-                        file->page_table[p].physical_page = next_free_page;
-
-                        // Update bitmap
-                        page_bitmap[old_page / 8] &= ~(1 << (old_page % 8));
-                        page_bitmap[next_free_page / 8] |= (1 << (next_free_page % 8));
-                    }
+void read_end() {
+    epoch_exit();
+}
 
-                    next_free_page++;
-                }
-            }
-        }
+// Resolve path and lock the inode it reaches. Opens a read section, which
+// the caller ends with read_end() whether or not a file was found;
+// *generation, if given, gets the section's generation.
+static File *lock_path(const char *path, int exclusive, int *dir_idx, char *filename,
+                       unsigned int *generation) {
+    for (;;) {
+        unsigned int seen = read_begin();
+        ino_t number;
+        File *file = follow_path(path, dir_idx, filename, &number) ? inode_get_locked(number, exclusive) : NULL;
+        if (!dcache_reshaped(seen)) {
+            if (generation)
+                *generation = seen;
+            return file;
+        }
+        if (file)
+            inode_unlock(file);
+        read_end();
     }
-
-    printf("Defragmentation completed. %d pages compacted.\n", total_pages_used);
 }
 
+File *lock_file_in_dir(int dir_idx, const char *filename, int exclusive) {
+    for (;;) {
+        unsigned int seen = read_begin();
+        DirEntry *entry = find_entry_in_dir(dir_idx, filename);
+        File *file = entry ? inode_get_locked(entry->inode, exclusive) : NULL;
+        if (!dcache_reshaped(seen))
+            return file;
+        if (file)
+            inode_unlock(file);
+        read_end();
+    }
+}
 
 // Helper to check file permissions
 int check_file_permissions(File *file, int required_perms) {
@@ -262,20 +286,116 @@ int check_file_permissions(File *file, int required_perms) {
     return (file->permissions & required_perms);
 }
 
+static const char *const status_messages[FS_STATUS_COUNT] = {
+    [FS_OK] = "Success",
+    [FS_ERR_NOT_FOUND] = "File not found",
+    [FS_ERR_DIR_NOT_FOUND] = "Directory not found",
+    [FS_ERR_DEST_NOT_FOUND] = "Destination directory not found",
+    [FS_ERR_EXISTS] = "File already exists",
+    [FS_ERR_PERMISSION] = "Permission denied",
+    [FS_ERR_NO_SPACE] = "Not enough space",
+    [FS_ERR_NO_MEMORY] = "Memory allocation failed",
+    [FS_ERR_IO] = "Could not load file content",
+    [FS_ERR_INVALID] = "Invalid argument",
+    [FS_ERR_NAME_TOO_LONG] = "Filename too long",
+    [FS_ERR_NOT_OPEN] = "File not open",
+    [FS_ERR_IS_SYMLINK] = "Cannot create hard link to symbolic link",
+    [FS_ERR_NOT_EMPTY] = "Directory not empty",
+    [FS_ERR_BUSY] = "Cannot delete current directory",
+    [FS_ERR_ROOT] = "Cannot delete root directory",
+    [FS_ERR_CYCLE] = "Would create directory cycle",
+};
+
+const char *fs_strerror(FsStatus status) {
+    if ((int)status < 0 || status >= FS_STATUS_COUNT)
+        return "Unknown error";
+    return status_messages[status];
+}
+
+// Copy what a caller may want to know about file, reached as name in
+// dir_idx. The caller holds the inode's lock, or the filesystem lock
+// exclusively.
+static void fill_file_info(FsFileInfo *info, File *file, int dir_idx, const char *name) {
+    if (!info)
+        return;
+    memset(info, 0, sizeof(*info));
+    snprintf(info->name, sizeof(info->name), "%s", name);
+    snprintf(info->dirname, sizeof(info->dirname), "%s", fs_state.directories[dir_idx].dirname);
+    info->inode = file->inode;
+    info->size = file->size;
+    snprintf(info->owner, sizeof(info->owner), "%s", file->owner);
+    info->permissions = file->permissions;
+    info->is_symlink = file->is_symlink;
+    if (file->is_symlink && file->link_target) {
+        info->has_target = 1;
+        snprintf(info->link_target, sizeof(info->link_target), "%s", file->link_target);
+    }
+    info->link_count = file->ref_count;
+    info->creation_time = file->creation_time;
+    info->modification_time = file->modification_time;
+    info->open_count = file->open_count;
+    info->page_count = file->page_count;
+    info->extent_count = file->extent_count;
+    info->shared_pages = shared_pages_in(file->extents, file->extent_count);
+}
+
+// Path of a directory from the root's own name ("~/home")
+static void directory_display_path(int dir_idx, char *path, size_t size) {
+    char *ptr = path + size - 1;
+    *ptr = '\0';
+
+    for (int current = dir_idx; current != -1; current = fs_state.directories[current].parent_directory) {
+        const char *name = fs_state.directories[current].dirname;
+        size_t len = strlen(name);
+        if ((size_t)(ptr - path) < len + 1)
+            break;
+
+        ptr -= len;
+        memcpy(ptr, name, len);
+        if (fs_state.directories[current].parent_directory != -1) {
+            *--ptr = '/';
+        }
+    }
+    memmove(path, ptr, strlen(ptr) + 1);
+}
 
+// The caller holds the filesystem lock, or is in a read section
+static void fill_dir_info(FsDirInfo *info, int dir_idx) {
+    if (!info)
+        return;
+    Directory *dir = &fs_state.directories[dir_idx];
+    memset(info, 0, sizeof(*info));
+    snprintf(info->name, sizeof(info->name), "%s", dir->dirname);
+    directory_display_path(dir_idx, info->path, sizeof(info->path));
+    info->index = dir_idx;
+    info->inode = dir->inode;
+    info->file_count = dir->file_count;
+    info->subdir_count = dir->subdir_count;
+    info->creation_time = dir->creation_time;
+}
 
+// Room for one more entry, NULL without memory
+static FsFileInfo *listing_add(FsListing *listing) {
+    if (listing->count == listing->capacity) {
+        int capacity = listing->capacity ? listing->capacity * 2 : 16;
+        FsFileInfo *entries = realloc(listing->entries, capacity * sizeof(FsFileInfo));
+        if (!entries)
+            return NULL;
+        listing->entries = entries;
+        listing->capacity = capacity;
+    }
+    return &listing->entries[listing->count++];
+}
 
-int login()
-{
-    char username[20], password[20];
-    printf("Username: ");
-    fgets(username, sizeof(username), stdin);
-    username[strcspn(username, "\n")] = 0;
+void free_listing(FsListing *listing) {
+    free(listing->entries);
+    listing->entries = NULL;
+    listing->count = listing->capacity = 0;
+}
 
-    printf("Password: ");
-    fgets(password, sizeof(password), stdin);
-    password[strcspn(password, "\n")] = 0;
 
+int find_user(const char *username, const char *password)
+{
     for (int i = 0; i < MAX_USERS; i++)
     {
         if (strcmp(fs_state.users[i].username, username) == 0 &&
@@ -291,22 +411,24 @@ int login()
 void initialize_directories()
 {
     // Clear the entire filesystem state first (avoid garbage data)
+    dir_table_reset();
     memset(&fs_state, 0, sizeof(fs_state));
-    memset(page_bitmap, 0, TOTAL_PAGES / 8);
+    inode_table_reset();
+    initialize_paging();
 
     // Initialize root directory (ID 0)
-    strcpy(fs_state.directories[0].dirname, "~");
-    fs_state.directories[0].file_count = 0;
-    fs_state.directories[0].parent_directory = -1; // Root has no parent
-    fs_state.directories[0].creation_time = time(NULL);
-    fs_state.directories[0].inode = (ino_t)(time(NULL) + rand() + (long)&fs_state); // More unique inode
+    Directory *root = dir_table_claim(0);
+    strcpy(root->dirname, "~");
+    root->parent_directory = -1; // Root has no parent
+    root->creation_time = time(NULL);
+    root->inode = (ino_t)(time(NULL) + rand() + (long)&fs_state); // More unique inode
 
     // Create a default home directory (ID 1)
-    strcpy(fs_state.directories[1].dirname, "home");
-    fs_state.directories[1].file_count = 0;
-    fs_state.directories[1].parent_directory = 0; // Parent is root
-    fs_state.directories[1].creation_time = time(NULL);
-    fs_state.directories[1].inode = (ino_t)(time(NULL) + rand() + (long)&fs_state); // More unique inode
+    Directory *home = dir_table_claim(1);
+    strcpy(home->dirname, "home");
+    home->creation_time = time(NULL);
+    home->inode = (ino_t)(time(NULL) + rand() + (long)&fs_state); // More unique inode
+    dir_attach(0, 1); // Parent is root
 
     // Set current directory to root
     fs_state.current_directory = 0;
@@ -315,260 +437,94 @@ void initialize_directories()
     strcpy(fs_state.users[0].username, "user");
     strcpy(fs_state.users[0].password, "pass");
 
-    // Create default files (readme.txt, notes.txt)
-    PageTableEntry *file1_pages = malloc(sizeof(PageTableEntry));
-    PageTableEntry *file2_pages = malloc(sizeof(PageTableEntry));
-
-    if (!file1_pages || !file2_pages)
+    // Create default files (readme.txt, notes.txt), one page each
+    Extent *file1_pages = NULL, *file2_pages = NULL;
+    int file1_extents = 0, file2_extents = 0;
+    if (allocate_pages(1, &file1_pages, &file1_extents) != 0 ||
+        allocate_pages(1, &file2_pages, &file2_extents) != 0)
     {
         free(file1_pages);
         free(file2_pages);
         return;
     }
 
-    // Allocate pages (physical page numbers 0 and 1)
-    file1_pages[0].physical_page = 0;
-    file1_pages[0].is_allocated = 1;
-    file2_pages[0].physical_page = 1;
-    file2_pages[0].is_allocated = 1;
-
-    // Mark pages as used in bitmap
-    page_bitmap[0 / 8] |= (1 << (0 % 8)); // Page 0
-    page_bitmap[1 / 8] |= (1 << (1 % 8)); // Page 1
-
-    // Create default files with inode numbers
-    File file1 = {
-        .filename = "readme.txt",
-        .size = 16,
-        .owner = "root",
-        .permissions = 0777,
-        .creation_time = time(NULL),
-        .modification_time = time(NULL),
-        .content_size = strlen("HELLO WORLD") + 1,
-        .content = strdup("HELLO WORLD"),
-        .file_position = 0,
-        .page_table = file1_pages,
-        .page_table_size = 1,
-        .inode = (ino_t)(time(NULL) + rand() + (long)&file1),
-        .ref_count = 1,
-        .is_symlink = 0,
-        .link_target = NULL
-    };
-
-    File file2 = {
-        .filename = "notes.txt",
-        .size = 8,
-        .owner = "root",
-        .permissions = 0777,
-        .creation_time = time(NULL),
-        .modification_time = time(NULL),
-        .content_size = strlen("HELLO WORLD") + 1,
-        .content = strdup("HELLO WORLD"),
-        .file_position = 0,
-        .page_table = file2_pages,
-        .page_table_size = 1,
-        .inode = (ino_t)(time(NULL) + rand() + (long)&file2),
-        .ref_count = 1,
-        .is_symlink = 0,
-        .link_target = NULL
-    };
-
-    // Add files to root directory
-    fs_state.directories[0].files[fs_state.directories[0].file_count++] = file1;
-    fs_state.directories[0].files[fs_state.directories[0].file_count++] = file2;
-
-    // Save the initial state
-    save_state();
-}
-
-void save_state()
-{
-    FILE *fp = fopen(STORAGE_FILE, "wb");
-    if (fp)
+    // Create default files in the root directory
+    const char *names[] = {"readme.txt", "notes.txt"};
+    const int sizes[] = {16, 8};
+    Extent *pages[] = {file1_pages, file2_pages};
+    const int extents[] = {file1_extents, file2_extents};
+    for (int i = 0; i < 2; i++)
     {
-        // Save main structure without dynamic content
-        FileSystemState temp_state = fs_state;
-        for (int i = 0; i < MAX_DIRECTORIES; i++)
+        File *file = inode_alloc(0);
+        if (!file)
         {
-            for (int j = 0; j < temp_state.directories[i].file_count; j++)
-            {
-                temp_state.directories[i].files[j].content = NULL;
-                temp_state.directories[i].files[j].page_table = NULL;
-            }
+            free(pages[i]);
+            continue;
         }
-        fwrite(&temp_state, sizeof(temp_state), 1, fp);
-
-        // Save page bitmap
-        fwrite(page_bitmap, TOTAL_PAGES / 8, 1, fp);
-
-        // Save file contents and page tables
-        for (int i = 0; i < MAX_DIRECTORIES; i++)
-        {
-            for (int j = 0; j < fs_state.directories[i].file_count; j++)
-            {
-                File *file = &fs_state.directories[i].files[j];
-
-                // Save content size and content
-                fwrite(&file->content_size, sizeof(size_t), 1, fp);
-                if (file->content && file->content_size > 0)
-                {
-                    fwrite(file->content, 1, file->content_size, fp);
-                }
+        file->size = sizes[i];
+        strcpy(file->owner, "root");
+        file->permissions = 0777;
+        file->creation_time = time(NULL);
+        file->modification_time = time(NULL);
+        file->content_size = strlen("HELLO WORLD");
+        file->extents = pages[i];
+        file->extent_count = extents[i];
+        file->page_count = 1;
+        add_entry(0, names[i], file);
 
-                // Save page table
-                fwrite(&file->page_table_size, sizeof(int), 1, fp);
-                if (file->page_table && file->page_table_size > 0)
-                {
-                    fwrite(file->page_table, sizeof(PageTableEntry), file->page_table_size, fp);
-                }
-            }
-        }
-        fclose(fp);
+        // File bytes live in the files' pages
+        volume_write(file, 0, "HELLO WORLD", strlen("HELLO WORLD"));
     }
-}
-
-void load_state()
-{
-    printf("Attempting to load state...\n");
-    FILE *fp = fopen(STORAGE_FILE, "rb");
-    if (fp)
-    {
-        // Load main structure
-        printf("Found existing filesystem.dat\n");
-        if (fread(&fs_state, sizeof(fs_state), 1, fp) != 1)
-        {
-            printf("Error reading filesystem state, initializing new one\n");
-            fclose(fp);
-            initialize_directories();
-            return;
-        }
-
-        // Load page bitmap
-        if (fread(page_bitmap, TOTAL_PAGES / 8, 1, fp) != 1)
-        {
-            fclose(fp);
-            initialize_directories();
-            return;
-        }
-
-        // Load file contents and page tables
-        for (int i = 0; i < MAX_DIRECTORIES; i++)
-        {
-            for (int j = 0; j < fs_state.directories[i].file_count; j++)
-            {
-                File *file = &fs_state.directories[i].files[j];
-
-                // Load content
-                if (fread(&file->content_size, sizeof(size_t), 1, fp) != 1)
-                {
-                    file->content = NULL;
-                    file->content_size = 0;
-                    continue;
-                }
-
-                if (file->content_size > 0)
-                {
-                    file->content = malloc(file->content_size);
-                    if (!file->content)
-                    {
-                        printf("Error allocating memory for file content\n");
-                        file->content_size = 0;
-                        continue;
-                    }
-                    if (fread(file->content, 1, file->content_size, fp) != file->content_size)
-                    {
-                        free(file->content);
-                        file->content = NULL;
-                        file->content_size = 0;
-                    }
-                }
 
-                // Load page table
-                if (fread(&file->page_table_size, sizeof(int), 1, fp) != 1)
-                {
-                    file->page_table = NULL;
-                    file->page_table_size = 0;
-                    continue;
-                }
-
-                if (file->page_table_size > 0)
-                {
-                    file->page_table = malloc(file->page_table_size * sizeof(PageTableEntry));
-                    if (!file->page_table)
-                    {
-                        file->page_table_size = 0;
-                        continue;
-                    }
-                    if (fread(file->page_table, sizeof(PageTableEntry), file->page_table_size, fp) != file->page_table_size)
-                    {
-                        free(file->page_table);
-                        file->page_table = NULL;
-                        file->page_table_size = 0;
-                    }
-                }
-            }
-        }
-        fclose(fp);
-    }
-    else
-    {
-        printf("No existing filesystem found, initializing new one\n");
-        initialize_directories();
-    }
+    // Save the initial state (also discards any stale journal)
+    checkpoint_filesystem();
 }
 
-
-
-int open_file(const char *filename) {
-    pthread_mutex_lock(&mutex);
-    
-    char *dir_path = NULL, *file_name = NULL;
+FsStatus open_file(const char *filename, int *open_count) {
+    char file_name[MAX_FILENAME];
     int dir_idx = -1;
-    File *file = resolve_file_path(filename, &dir_idx, &file_name);
+    File *file = lock_path(filename, 1, &dir_idx, file_name, NULL);
     
     if (!file) {
-        printf(COLOR_RED "Error: File not found\n" COLOR_RESET);
-        pthread_mutex_unlock(&mutex);
-        return -1;
+        read_end();
+        return FS_ERR_NOT_FOUND;
     }
 
     file->is_open = 1;
     file->open_count++;
-    printf("File '%s' opened (count: %d)\n", filename, file->open_count);
+    if (open_count)
+        *open_count = file->open_count;
+    inode_unlock(file);
     
-    free(dir_path);
-    free(file_name);
-    pthread_mutex_unlock(&mutex);
-    return 0;
+    read_end();
+    return FS_OK;
 }
 
-int close_file(const char *filename) {
-    pthread_mutex_lock(&mutex);
-    
-    char *dir_path = NULL, *file_name = NULL;
+FsStatus close_file(const char *filename, int *open_count) {
+    char file_name[MAX_FILENAME];
     int dir_idx = -1;
-    File *file = resolve_file_path(filename, &dir_idx, &file_name);
+    File *file = lock_path(filename, 1, &dir_idx, file_name, NULL);
     
     if (!file) {
-        printf("Error: File not found\n");
-        pthread_mutex_unlock(&mutex);
-        return -1;
+        read_end();
+        return FS_ERR_NOT_FOUND;
     }
 
+    FsStatus status = FS_OK;
     if (file->open_count > 0) {
         file->open_count--;
         if (file->open_count == 0) {
             file->is_open = 0;
         }
-        printf("File '%s' closed (count: %d)\n", filename, file->open_count);
+        if (open_count)
+            *open_count = file->open_count;
     } else {
-        printf("Error: File not open\n");
+        status = FS_ERR_NOT_OPEN;
     }
+    inode_unlock(file);
     
-    free(dir_path);
-    free(file_name);
-    pthread_mutex_unlock(&mutex);
-    return 0;
+    read_end();
+    return status;
 }
 
 int file_seek(File *file, int offset, int whence)
@@ -600,679 +556,600 @@ int file_seek(File *file, int offset, int whence)
     return new_position;
 }
 
-int create_file(char *path, int permissions)
+FsStatus seek_file(const char *filename, int offset, int whence, int *position)
 {
-    pthread_mutex_lock(&mutex);
+    // The position is state, so the inode is locked exclusively
+    File *file = lock_file_in_dir(fs_state.current_directory, filename, 1);
+    int new_position = -1;
+    if (file)
+    {
+        new_position = file_seek(file, offset, whence);
+        inode_unlock(file);
+    }
+    read_end();
+
+    if (!file)
+        return FS_ERR_NOT_FOUND;
+    if (new_position == -1)
+        return FS_ERR_INVALID;
+    if (position)
+        *position = new_position;
+    return FS_OK;
+}
 
-    // Split path into directory and filename
-    char *dir_path = NULL, *filename = NULL;
-    split_path(path, &dir_path, &filename);
+FsStatus create_file(const char *path, int permissions, FsFileInfo *info)
+{
+    pthread_rwlock_rdlock(&fs_lock);
 
-    // Find target directory
-    int dir_idx = find_directory_from_path(dir_path);
+    // Find target directory and filename
+    char filename[MAX_FILENAME];
+    int dir_idx = resolve_parent(path, filename);
     if (dir_idx == -1)
     {
-        printf(COLOR_RED "Error: Directory not found: %s\n" COLOR_RESET, dir_path);
-        free(dir_path);
-        free(filename);
-        pthread_mutex_unlock(&mutex);
-        return -1;
+        pthread_rwlock_unlock(&fs_lock);
+        return FS_ERR_DIR_NOT_FOUND;
     }
 
     // Check if file exists
-    for (int i = 0; i < fs_state.directories[dir_idx].file_count; i++)
+    dir_lock(dir_idx, 1);
+    if (find_entry_in_dir(dir_idx, filename))
     {
-        if (strcmp(fs_state.directories[dir_idx].files[i].filename, filename) == 0)
-        {
-            printf(COLOR_RED "Error: File already exists: %s\n" COLOR_RESET, path);
-            free(dir_path);
-            free(filename);
-            pthread_mutex_unlock(&mutex);
-            return -1;
-        }
+        dir_unlock(dir_idx);
+        pthread_rwlock_unlock(&fs_lock);
+        return FS_ERR_EXISTS;
     }
 
     // Create new file with default content
     File new_file;
     memset(&new_file, 0, sizeof(File));
 
-    strncpy(new_file.filename, filename, MAX_FILENAME - 1);
     strcpy(new_file.owner, fs_state.users[0].username); // Current user
     new_file.permissions = permissions & 0777;
     new_file.creation_time = time(NULL);
     new_file.modification_time = new_file.creation_time;
-    new_file.ref_count = 1;
-    new_file.inode = (ino_t)(time(NULL) + rand() + (long)&new_file); // More unique inode
 
 
     // Set default content
     const char *default_content = "HELLO WORLD";
-    new_file.content = strdup(default_content);
-    new_file.content_size = strlen(default_content) + 1;
+    new_file.content_size = strlen(default_content);
     new_file.size = new_file.content_size; // Automatic size calculation
 
     // Allocate pages based on content size
     int pages_needed = (new_file.content_size + PAGE_SIZE - 1) / PAGE_SIZE;
-    if (allocate_pages(pages_needed, &new_file.page_table) != 0)
+    if (allocate_pages(pages_needed, &new_file.extents, &new_file.extent_count) != 0)
     {
-        printf(COLOR_RED "Error: Not enough space\n" COLOR_RESET);
-        free(new_file.content);
-        free(dir_path);
-        free(filename);
-        pthread_mutex_unlock(&mutex);
-        return -1;
+        dir_unlock(dir_idx);
+        pthread_rwlock_unlock(&fs_lock);
+        return FS_ERR_NO_SPACE;
     }
-    new_file.page_table_size = pages_needed;
+    new_file.page_count = pages_needed;
 
     // Add to directory
-    if (fs_state.directories[dir_idx].file_count >= MAX_FILES)
+    File *stored = inode_alloc(0);
+    if (!stored)
     {
-        printf(COLOR_RED "Error: Directory full\n" COLOR_RESET);
         free_pages(&new_file);
-        free(new_file.content);
-        free(dir_path);
-        free(filename);
-        pthread_mutex_unlock(&mutex);
-        return -1;
-    }
-
-    fs_state.directories[dir_idx].files[fs_state.directories[dir_idx].file_count++] = new_file;
-
-    save_state();
-    printf(COLOR_GREEN "Created file %s (size: %d bytes, inode: %lu)\n" COLOR_RESET,
-           path, new_file.size, new_file.inode);
-
-    free(dir_path);
-    free(filename);
-    pthread_mutex_unlock(&mutex);
-    return 0;
+        free(new_file.extents);
+        dir_unlock(dir_idx);
+        pthread_rwlock_unlock(&fs_lock);
+        return FS_ERR_NO_MEMORY;
+    }
+
+    // Filled and logged before anyone else can reach it: a reader finding
+    // the entry early would see the pages' previous bytes
+    inode_lock(stored, 1);
+    new_file.inode = stored->inode;
+    *stored = new_file;
+    volume_write(stored, 0, default_content, stored->content_size);
+    if (add_entry(dir_idx, filename, stored) != 0)
+    {
+        free_pages(stored);
+        inode_free(stored); // Unlocks it
+        dir_unlock(dir_idx);
+        pthread_rwlock_unlock(&fs_lock);
+        return FS_ERR_NO_MEMORY;
+    }
+
+    journal_log_put_inode(stored, 0);
+    journal_log_link(dir_idx, filename, stored->inode);
+    journal_log_write(stored, 0, default_content, stored->content_size);
+    fill_file_info(info, stored, dir_idx, filename);
+
+    inode_unlock(stored);
+    dir_unlock(dir_idx);
+    pthread_rwlock_unlock(&fs_lock);
+    return FS_OK;
 }
 
-int create_directory(char *path)
+FsStatus create_directory(const char *path, FsDirInfo *info)
 {
-    pthread_mutex_lock(&mutex);
-
-    // Split path into parent directory and new directory name
-    char *parent_path = NULL, *dirname = NULL;
-    split_path(path, &parent_path, &dirname);
+    pthread_rwlock_wrlock(&fs_lock);
 
     // Validate directory name
-    if (strlen(dirname) == 0 || strlen(dirname) >= MAX_FILENAME)
+    const char *last = path_last(path);
+    if (strlen(last) == 0 || strlen(last) >= MAX_FILENAME)
     {
-        printf(COLOR_RED "Error: Invalid directory name\n" COLOR_RESET);
-        free(parent_path);
-        free(dirname);
-        pthread_mutex_unlock(&mutex);
-        return -1;
+        pthread_rwlock_unlock(&fs_lock);
+        return FS_ERR_INVALID;
     }
 
     // Find parent directory
-    int parent_dir_idx = find_directory_from_path(parent_path);
+    char dirname[MAX_FILENAME];
+    int parent_dir_idx = resolve_parent(path, dirname);
     if (parent_dir_idx == -1)
     {
-        printf(COLOR_RED "Error: Parent directory not found: %s\n" COLOR_RESET, parent_path);
-        free(parent_path);
-        free(dirname);
-        pthread_mutex_unlock(&mutex);
-        return -1;
+        pthread_rwlock_unlock(&fs_lock);
+        return FS_ERR_DIR_NOT_FOUND;
     }
 
     // Check if directory already exists
-    for (int i = 0; i < MAX_DIRECTORIES; i++)
-    {
-        if (fs_state.directories[i].parent_directory == parent_dir_idx &&
-            strcmp(fs_state.directories[i].dirname, dirname) == 0)
-        {
-            printf(COLOR_RED "Error: Directory already exists: %s\n" COLOR_RESET, path);
-            free(parent_path);
-            free(dirname);
-            pthread_mutex_unlock(&mutex);
-            return -1;
-        }
-    }
-
-    // Find empty slot for new directory
-    int new_dir_idx = -1;
-    for (int i = 0; i < MAX_DIRECTORIES; i++)
+    if (dir_child(parent_dir_idx, dirname) != -1)
     {
-        if (strlen(fs_state.directories[i].dirname) == 0)
-        {
-            new_dir_idx = i;
-            break;
-        }
+        pthread_rwlock_unlock(&fs_lock);
+        return FS_ERR_EXISTS;
     }
 
+    // Find a slot for the new directory
+    int new_dir_idx = dir_table_alloc();
     if (new_dir_idx == -1)
     {
-        printf(COLOR_RED "Error: Maximum number of directories reached\n" COLOR_RESET);
-        free(parent_path);
-        free(dirname);
-        pthread_mutex_unlock(&mutex);
-        return -1;
+        pthread_rwlock_unlock(&fs_lock);
+        return FS_ERR_NO_MEMORY;
     }
 
     // Create new directory
-    Directory new_dir;
-    memset(&new_dir, 0, sizeof(Directory));
-
-    strncpy(new_dir.dirname, dirname, MAX_FILENAME - 1);
-    new_dir.parent_directory = parent_dir_idx;
-    new_dir.creation_time = time(NULL);
-    new_dir.inode = (ino_t)(time(NULL) + rand() + (long)&new_dir); // More unique inode
+    Directory *new_dir = &fs_state.directories[new_dir_idx];
+    snprintf(new_dir->dirname, sizeof(new_dir->dirname), "%s", dirname);
+    new_dir->creation_time = time(NULL);
+    new_dir->inode = (ino_t)(time(NULL) + rand() + (long)new_dir); // More unique inode
 
-    // Initialize directory contents
-    new_dir.file_count = 0;
-    for (int i = 0; i < MAX_FILES; i++)
+    // Add to its parent
+    if (dir_attach(parent_dir_idx, new_dir_idx) != 0)
     {
-        memset(&new_dir.files[i], 0, sizeof(File));
+        dir_table_release(new_dir_idx);
+        pthread_rwlock_unlock(&fs_lock);
+        return FS_ERR_NO_MEMORY;
     }
 
-    // Add to filesystem
-    fs_state.directories[new_dir_idx] = new_dir;
+    journal_log_put_directory(new_dir_idx);
+    fill_dir_info(info, new_dir_idx);
 
-    save_state();
-    printf(COLOR_GREEN "Created directory %s (inode: %lu)\n" COLOR_RESET,
-           path, new_dir.inode);
-
-    free(parent_path);
-    free(dirname);
-    pthread_mutex_unlock(&mutex);
-    return 0;
+    pthread_rwlock_unlock(&fs_lock);
+    return FS_OK;
 }
 
 char *get_current_working_directory()
 {
-    pthread_mutex_lock(&mutex);
+    static __thread char path[1024] = {0}; // One per thread: readers run concurrently
+    char *ptr;
+    unsigned int generation;
 
-    static char path[1024] = {0};
-    int current = fs_state.current_directory;
-    int parent = fs_state.directories[current].parent_directory;
-
-    // Start from current directory and work backwards to root
-    char *ptr = path + sizeof(path) - 1;
-    *ptr = '\0';
-
-    while (current != -1)
+    // Built again if a directory on the way up moved meanwhile
+    do
     {
-        const char *dirname = fs_state.directories[current].dirname;
-        size_t len = strlen(dirname);
+        generation = read_begin();
+        int current = fs_state.current_directory;
+        Directory *dir = dir_get(current);
+        int parent = dir ? dir->parent_directory : -1;
 
-        ptr -= len;
-        memcpy(ptr, dirname, len);
+        // Start from current directory and work backwards to root
+        ptr = path + sizeof(path) - 1;
+        *ptr = '\0';
 
-        if (parent != -1)
+        while (dir)
         {
-            *--ptr = '/';
+            const char *dirname = dir->dirname;
+            size_t len = strnlen(dirname, MAX_FILENAME - 1);
+            if ((size_t)(ptr - path) < len + 2)
+                break;
+
+            ptr -= len;
+            memcpy(ptr, dirname, len);
+
+            if (parent != -1)
+            {
+                *--ptr = '/';
+            }
+
+            current = parent;
+            dir = dir_get(current);
+            if (dir)
+            {
+                parent = dir->parent_directory;
+            }
         }
 
-        current = parent;
-        if (current != -1)
+        // If we're at root, make sure we have a leading slash
+        if (*ptr != '/')
         {
-            parent = fs_state.directories[current].parent_directory;
+            *--ptr = '/';
         }
-    }
+        read_end();
+    } while (dcache_reshaped(generation));
 
-    // If we're at root, make sure we have a leading slash
-    if (*ptr != '/')
-    {
-        *--ptr = '/';
-    }
-
-    pthread_mutex_unlock(&mutex);
     return ptr;
 }
 
 
 
-void delete_file(char *path) {
-    pthread_mutex_lock(&mutex);
-    
-    char *dir_path = NULL, *filename = NULL;
-    int dir_idx = -1;
+FsStatus delete_file(const char *path, FsDeleteInfo *info) {
+    pthread_rwlock_wrlock(&fs_lock);
+    FsStatus status;
     
     // First try to find the file without following symlinks
-    split_path(path, &dir_path, &filename);
-    dir_idx = find_directory_from_path(dir_path);
+    char filename[MAX_FILENAME];
+    int dir_idx = resolve_parent(path, filename);
     
     if (dir_idx == -1) {
-        printf(COLOR_RED "Error: Directory not found: %s\n" COLOR_RESET, dir_path);
+        status = FS_ERR_DIR_NOT_FOUND;
         goto cleanup;
     }
     
     Directory *dir = &fs_state.directories[dir_idx];
     
     // Find the file in the directory without resolving symlinks
-    File *file = NULL;
-    int file_idx = -1;
-    for (int i = 0; i < dir->file_count; i++) {
-        if (strcmp(dir->files[i].filename, filename) == 0) {
-            file = &dir->files[i];
-            file_idx = i;
-            break;
-        }
-    }
+    int file_idx = dir_lookup(dir, filename);
+    File *file = file_idx >= 0 ? inode_get(dir->files[file_idx]->inode) : NULL;
     
     if (!file) {
-        printf(COLOR_RED "Error: File not found: %s\n" COLOR_RESET, path);
+        status = FS_ERR_NOT_FOUND;
         goto cleanup;
     }
 
-    if (file->is_symlink) {
-        // Case 1: Deleting a symbolic link - just remove the link itself
-        printf(COLOR_BLUE "Deleting symbolic link (inode: %lu): %s -> %s\n" COLOR_RESET,
-               file->inode, path, file->link_target ? file->link_target : "(null)");
-        
-        // Remove from directory
-        for (int i = file_idx; i < dir->file_count - 1; i++) {
-            dir->files[i] = dir->files[i + 1];
-        }
-        
-        memset(&dir->files[dir->file_count - 1], 0, sizeof(File));
-        dir->file_count--;
-    } 
-    else {
-        // Case 2: Deleting a regular file or hard link
-        printf(COLOR_BLUE "Deleting %s (inode: %lu): %s\n" COLOR_RESET,
-               (file->ref_count > 1) ? "hard link" : "file",
-               file->inode, path);
-
-        // Decrement reference count
-        if (--file->ref_count <= 0) {
-            // This was the last reference - actually delete the file
-            
-            // First, find and invalidate all symbolic links pointing to this file
-            for (int d = 0; d < MAX_DIRECTORIES; d++) {
-                if (strlen(fs_state.directories[d].dirname) > 0) {
-                    for (int f = 0; f < fs_state.directories[d].file_count; f++) {
-                        File *potential_link = &fs_state.directories[d].files[f];
-                        if (potential_link->is_symlink && potential_link->link_target) {
-                            // Resolve the link target to see if it points to our file
-                            char *link_dir_path = NULL, *link_filename = NULL;
-                            int link_dir_idx = -1;
-                            File *target = resolve_file_path(potential_link->link_target, &link_dir_idx, &link_filename);
-                            
-                            if (target && target->inode == file->inode) {
-                                printf(COLOR_YELLOW "  Invalidating symlink: %s/%s -> %s\n" COLOR_RESET,
-                                       fs_state.directories[d].dirname, 
-                                       potential_link->filename,
-                                       potential_link->link_target);
-                                
-                                free(potential_link->link_target);
-                                potential_link->link_target = NULL;
+    if (info) {
+        memset(info, 0, sizeof(*info));
+        fill_file_info(&info->file, file, dir_idx, filename);
+    }
+
+    // Deleting a symbolic link, or a link to a file that has others, just
+    // removes the entry. The last link also invalidates the symlinks to it.
+    if (!file->is_symlink && file->ref_count <= 1) {
+        for (int d = 0; d < fs_state.directory_count; d++) {
+            if (strlen(fs_state.directories[d].dirname) > 0) {
+                for (int f = 0; f < fs_state.directories[d].file_count; f++) {
+                    DirEntry *entry = fs_state.directories[d].files[f];
+                    File *potential_link = inode_get(entry->inode);
+                    if (potential_link && potential_link->is_symlink && potential_link->link_target) {
+                        // Resolve the link target to see if it points to our file
+                        char link_filename[MAX_FILENAME];
+                        int link_dir_idx = -1;
+                        File *target = resolve_file_path(potential_link->link_target, &link_dir_idx, link_filename);
+                        
+                        if (target == file) {
+                            if (info && info->invalidated < FS_REPORTED_LINKS) {
+                                int n = info->invalidated;
+                                snprintf(info->invalidated_links[n].path, sizeof(info->invalidated_links[n].path),
+                                         "%s/%s", fs_state.directories[d].dirname, entry->filename);
+                                snprintf(info->invalidated_links[n].target, sizeof(info->invalidated_links[n].target),
+                                         "%s", potential_link->link_target);
                             }
+                            if (info)
+                                info->invalidated++;
                             
-                            free(link_dir_path);
+                            // Path walks read the target without the lock
+                            inode_lock(potential_link, 1);
+                            char *old_target = potential_link->link_target;
+                            __atomic_store_n(&potential_link->link_target, NULL, __ATOMIC_RELEASE);
+                            epoch_retire(old_target);
+                            journal_log_put_inode(potential_link, 0);
+                            inode_unlock(potential_link);
                         }
                     }
                 }
             }
-
-            // Now free the file resources
-            free_pages(file);
-            if (file->content) {
-                free(file->content);
-            }
-            if (file->page_table) {
-                free(file->page_table);
-            }
-            if (file->link_target) {
-                free(file->link_target);
-            }
         }
-        
-        // Remove from directory
-        for (int i = file_idx; i < dir->file_count - 1; i++) {
-            dir->files[i] = dir->files[i + 1];
-        }
-        memset(&dir->files[dir->file_count - 1], 0, sizeof(File));
-        dir->file_count--;
     }
 
-    save_state();
-    printf(COLOR_GREEN "Successfully deleted: %s\n" COLOR_RESET, path);
+    // Remove from directory; the last link frees the inode and its pages.
+    // Listers hold the directory's lock instead of the filesystem lock.
+    dir_lock(dir_idx, 1);
+    remove_entry(dir_idx, file_idx);
+    release_link(file);
+    dir_unlock(dir_idx);
+
+    journal_log_delete_file(dir_idx, filename);
+    status = FS_OK;
 
 cleanup:
-    free(dir_path);
-    free(filename);
-    pthread_mutex_unlock(&mutex);
+    pthread_rwlock_unlock(&fs_lock);
+    return status;
 }
 
 
-void delete_directory(const char *dirname)
+// Delete a directory, everything in it and every directory below it.
+// Children go first, so each logged deletion is of an empty tree.
+static void remove_directory_tree(int dir_index)
 {
-    pthread_mutex_lock(&mutex);
-
-    int dir_index = -1;
-    int parent_dir = fs_state.current_directory;
-
-    // Find the directory
-    for (int i = 0; i < MAX_DIRECTORIES; i++)
+    Directory *dir = &fs_state.directories[dir_index];
+    while (dir->subdir_count > 0)
     {
-        if (strcmp(fs_state.directories[i].dirname, dirname) == 0 &&
-            fs_state.directories[i].parent_directory == parent_dir)
-        {
-            dir_index = i;
-            break;
-        }
+        remove_directory_tree(dir->subdirs[dir->subdir_count - 1]);
+        dir = &fs_state.directories[dir_index];
     }
 
-    if (dir_index == -1)
+    // Files without other links return their pages
+    dir_lock(dir_index, 1);
+    for (int i = dir->file_count - 1; i >= 0; i--)
     {
-        printf(COLOR_RED "Error: Directory '%s' not found\n" COLOR_RESET, dirname);
-        pthread_mutex_unlock(&mutex);
-        return;
+        File *file = inode_get(dir->files[i]->inode);
+        remove_entry(dir_index, i);
+        if (file)
+            release_link(file);
     }
+    dir_unlock(dir_index);
 
-    // Don't allow deleting root directory
-    if (dir_index == 0)
-    {
-        printf(COLOR_RED "Error: Cannot delete root directory\n" COLOR_RESET);
-        pthread_mutex_unlock(&mutex);
-        return;
-    }
+    dir_table_release(dir_index);
+    journal_log_delete_directory(dir_index);
+}
 
-    // Don't allow deleting current directory
-    if (dir_index == fs_state.current_directory)
-    {
-        printf(COLOR_RED "Error: Cannot delete current directory\n" COLOR_RESET);
-        pthread_mutex_unlock(&mutex);
-        return;
-    }
+FsStatus delete_directory(const char *dirname, int recursive, FsDirInfo *info)
+{
+    pthread_rwlock_wrlock(&fs_lock);
 
-    // Check if directory is empty or has subdirectories
-    int needs_confirmation = 0;
-    if (fs_state.directories[dir_index].file_count > 0)
-    {
-        needs_confirmation = 1;
-        printf(COLOR_RED "Warning: Directory '%s' is not empty (%d files)\n" COLOR_RESET,
-               dirname, fs_state.directories[dir_index].file_count);
-    }
+    // Find the directory
+    int dir_index = dir_child(fs_state.current_directory, dirname);
 
-    // Check for subdirectories
-    for (int i = 0; i < MAX_DIRECTORIES; i++)
+    if (dir_index == -1)
     {
-        if (fs_state.directories[i].parent_directory == dir_index &&
-            strlen(fs_state.directories[i].dirname) > 0)
-        {
-            needs_confirmation = 1;
-            printf(COLOR_RED "Warning: Directory '%s' contains subdirectories\n" COLOR_RESET, dirname);
-            break;
-        }
+        pthread_rwlock_unlock(&fs_lock);
+        return FS_ERR_NOT_FOUND;
     }
 
-    // Ask for confirmation if not empty
-    if (needs_confirmation)
+    // Don't allow deleting root directory
+    if (dir_index == 0)
     {
-        printf(COLOR_RED "Are you sure you want to delete '%s' and all its contents? [Y/n] " COLOR_RESET, dirname);
-        fflush(stdout);
-
-        char response[10];
-        if (fgets(response, sizeof(response), stdin) == NULL)
-        {
-            pthread_mutex_unlock(&mutex);
-            return;
-        }
-
-        // Check response (default to 'Y' if empty)
-        if (response[0] != '\n' && tolower(response[0]) != 'y')
-        {
-            printf("Deletion cancelled\n");
-            pthread_mutex_unlock(&mutex);
-            return;
-        }
+        pthread_rwlock_unlock(&fs_lock);
+        return FS_ERR_ROOT;
     }
 
-    // Delete all files in the directory first
-    for (int i = 0; i < fs_state.directories[dir_index].file_count; i++)
+    // Don't allow deleting current directory (or one above it)
+    for (int d = fs_state.current_directory; d != -1; d = fs_state.directories[d].parent_directory)
     {
-        File *file = &fs_state.directories[dir_index].files[i];
-        if (file->content)
+        if (d == dir_index)
         {
-            free(file->content);
+            pthread_rwlock_unlock(&fs_lock);
+            return FS_ERR_BUSY;
         }
     }
-    fs_state.directories[dir_index].file_count = 0;
 
-    // Delete any subdirectories (recursive)
-    for (int i = 0; i < MAX_DIRECTORIES; i++)
+    // Files or subdirectories go only when asked for; info says how many
+    fill_dir_info(info, dir_index);
+    Directory *dir = &fs_state.directories[dir_index];
+    if (!recursive && (dir->file_count > 0 || dir->subdir_count > 0))
     {
-        if (fs_state.directories[i].parent_directory == dir_index &&
-            strlen(fs_state.directories[i].dirname) > 0)
-        {
-            // Temporarily unlock mutex for recursive call
-            pthread_mutex_unlock(&mutex);
-            delete_directory(fs_state.directories[i].dirname);
-            pthread_mutex_lock(&mutex);
-        }
+        pthread_rwlock_unlock(&fs_lock);
+        return FS_ERR_NOT_EMPTY;
     }
 
-    // Clear the directory entry
-    memset(fs_state.directories[dir_index].dirname, 0, MAX_FILENAME);
-    fs_state.directories[dir_index].parent_directory = -1;
-
-    save_state();
-    printf(COLOR_GREEN "Directory '%s' deleted successfully\n" COLOR_RESET, dirname);
-    pthread_mutex_unlock(&mutex);
+    // Readers walking into the tree meanwhile start over (see read_begin())
+    dcache_reshape_begin();
+    remove_directory_tree(dir_index);
+    dcache_reshape_end();
+    pthread_rwlock_unlock(&fs_lock);
+    return FS_OK;
 }
 
-void list_files() {
-    pthread_mutex_lock(&mutex);
+// Run a lister in a read section, over again if a directory moved or was
+// deleted meanwhile
+static FsStatus read_listing(FsListing *listing, FsStatus (*collect)(FsListing *)) {
+    for (;;) {
+        memset(listing, 0, sizeof(*listing));
+        unsigned int generation = read_begin();
+        FsStatus status = collect(listing);
+        read_end();
+
+        int reshaped = dcache_reshaped(generation);
+        if (status != FS_OK || reshaped)
+            free_listing(listing);
+        if (!reshaped)
+            return status;
+    }
+}
 
+// Subdirectories, then files with non-empty names. Child directories only
+// change under their parent's lock, so their names hold still while it is held.
+static FsStatus collect_directory(FsListing *listing) {
     // Count actual existing directories
-    int dir_count = 0;
-    for (int i = 0; i < MAX_DIRECTORIES; i++) {
-        if (strlen(fs_state.directories[i].dirname) > 0) {
-            dir_count++;
+    int directory_count = __atomic_load_n(&fs_state.directory_count, __ATOMIC_ACQUIRE);
+    for (int i = 0; i < directory_count; i++) {
+        if (dir_get(i)) {
+            listing->directory_count++;
         }
     }
 
-    printf("\nCurrent directory: %d (%s)\n", fs_state.current_directory,
-           fs_state.directories[fs_state.current_directory].dirname);
-    printf("Existing directories: %d\n", dir_count);
-    printf("File count: %d\n", fs_state.directories[fs_state.current_directory].file_count);
-
-    printf("\nContents of directory '%s':\n", fs_state.directories[fs_state.current_directory].dirname);
-    printf("--------------------------------\n");
-
-    // List directories
-    printf("[Directories]\n");
-    for (int i = 0; i < MAX_DIRECTORIES; i++) {
-        if (i != fs_state.current_directory &&
-            fs_state.directories[i].parent_directory == fs_state.current_directory &&
-            strlen(fs_state.directories[i].dirname) > 0) {
-            printf("  %s/\n", fs_state.directories[i].dirname);
+    int current = fs_state.current_directory;
+    dir_lock(current, 0);
+    Directory *cwd = dir_get(current);
+    if (!cwd) {
+        dir_unlock(current);
+        return FS_ERR_NOT_FOUND; // Deleted since the section began; it starts over
+    }
+    fill_dir_info(&listing->dir, current);
+
+    FsStatus status = FS_OK;
+    for (int i = 0; i < cwd->subdir_count; i++) {
+        FsFileInfo *entry = listing_add(listing);
+        if (!entry) {
+            status = FS_ERR_NO_MEMORY;
+            break;
         }
+        Directory *sub = dir_get(cwd->subdirs[i]);
+        memset(entry, 0, sizeof(*entry));
+        snprintf(entry->name, sizeof(entry->name), "%s", sub->dirname);
+        snprintf(entry->dirname, sizeof(entry->dirname), "%s", cwd->dirname);
+        entry->is_directory = 1;
+        entry->inode = sub->inode;
+        entry->creation_time = sub->creation_time;
     }
 
-    // List files - only show entries with non-empty filenames
-    printf("\n[Files]\n");
-    Directory *dir = &fs_state.directories[fs_state.current_directory];
-    for (int i = 0; i < dir->file_count; i++) {
-        if (strlen(dir->files[i].filename) == 0) continue;
+    for (int i = 0; i < cwd->file_count && status == FS_OK; i++) {
+        if (strlen(cwd->files[i]->filename) == 0) continue;
         
-        File *f = &dir->files[i];
-        printf("  %-15s %6d bytes  %04o  %s",
-               f->filename, f->size, f->permissions, f->owner);
-        
-        if (f->is_symlink) {
-            printf(" -> %s", f->link_target ? f->link_target : "(null)");
+        File *f = inode_get_locked(cwd->files[i]->inode, 0);
+        if (!f) continue;
+        FsFileInfo *entry = listing_add(listing);
+        if (!entry) {
+            inode_unlock(f);
+            status = FS_ERR_NO_MEMORY;
+            break;
         }
-        printf("\n");
+        fill_file_info(entry, f, current, cwd->files[i]->filename);
+        inode_unlock(f);
     }
-    printf("--------------------------------\n");
-    pthread_mutex_unlock(&mutex);
+    dir_unlock(current);
+    return status;
+}
+
+FsStatus list_directory(FsListing *listing) {
+    return read_listing(listing, collect_directory);
 }
 
 
-int write_to_file(const char *path, const char *data, int append) {
-    pthread_mutex_lock(&mutex);
+FsStatus write_file_range(const char *path, const char *data, int data_len, int append, int *new_size) {
+    pthread_rwlock_rdlock(&fs_lock);
     
-    char *dir_path = NULL, *filename = NULL;
+    char filename[MAX_FILENAME];
     int dir_idx = -1;
-    File *file = resolve_file_path(path, &dir_idx, &filename);
+    File *file = resolve_file_path(path, &dir_idx, filename);
     
     if (!file) {
-        printf(COLOR_RED "Error: File not found\n" COLOR_RESET);
-        pthread_mutex_unlock(&mutex);
-        return -1;
+        pthread_rwlock_unlock(&fs_lock);
+        return FS_ERR_NOT_FOUND;
     }
 
+    inode_lock(file, 1);
     if (!check_file_permissions(file, 2)) { // 2 = write permission
-        printf(COLOR_RED "Error: Permission denied\n" COLOR_RESET);
-        free(dir_path);
-        free(filename);
-        pthread_mutex_unlock(&mutex);
-        return -1;
+        inode_unlock(file);
+        pthread_rwlock_unlock(&fs_lock);
+        return FS_ERR_PERMISSION;
     }
 
-    int data_len = strlen(data);
-    int new_content_size;
-    char *new_content;
-
-    if (append) {
-        // Append mode - all hardlinks will see the appended content
-        new_content_size = file->content_size + data_len;
-        new_content = realloc(file->content, new_content_size + 1);
-        if (!new_content) {
-            printf(COLOR_RED "Error: Memory allocation failed\n" COLOR_RESET);
-            free(dir_path);
-            free(filename);
-            pthread_mutex_unlock(&mutex);
-            return -1;
-        }
-        strcat(new_content, data);
-    } else {
-        // Overwrite mode - all hardlinks will see the new content
-        new_content_size = data_len;
-        new_content = strdup(data);
-        if (!new_content) {
-            printf(COLOR_RED "Error: Memory allocation failed\n" COLOR_RESET);
-            free(dir_path);
-            free(filename);
-            pthread_mutex_unlock(&mutex);
-            return -1;
-        }
-        // Don't free old content yet - other hardlinks might still need it
+    // An append keeps the existing bytes, so they must be in the pages first
+    if (append && load_file_content(file) != 0) {
+        inode_unlock(file);
+        pthread_rwlock_unlock(&fs_lock);
+        return FS_ERR_IO;
     }
 
+    // Appends land after the existing bytes; only the pages they cover are touched
+    int write_offset = append ? file->content_size : 0;
+    int new_content_size = write_offset + data_len;
+
     // Check if we need more pages
     int pages_needed = (new_content_size + PAGE_SIZE - 1) / PAGE_SIZE;
-    if (pages_needed > file->page_table_size) {
-        PageTableEntry *new_table = realloc(file->page_table, pages_needed * sizeof(PageTableEntry));
-        if (!new_table) {
-            printf(COLOR_RED "Error: Could not expand page table\n" COLOR_RESET);
-            free(new_content);
-            free(dir_path);
-            free(filename);
-            pthread_mutex_unlock(&mutex);
-            return -1;
-        }
-
-        // Initialize new page table entries
-        for (int i = file->page_table_size; i < pages_needed; i++) {
-            new_table[i].physical_page = -1;
-            new_table[i].is_allocated = 0;
-        }
+    if (pages_needed > file->page_count) {
+        // Allocate only the new tail pages, growing the last extent in place when possible
+        Extent *new_extents = file->extents;
+        int new_count = file->extent_count;
+        int result = allocate_extents(&new_extents, &new_count, pages_needed - file->page_count);
 
-        // Allocate new pages
-        for (int i = file->page_table_size; i < pages_needed; i++) {
-            int page_found = 0;
-            for (int j = 0; j < TOTAL_PAGES; j++) {
-                if (!(page_bitmap[j / 8] & (1 << (j % 8)))) {
-                    page_bitmap[j / 8] |= (1 << (j % 8));
-                    new_table[i].physical_page = j;
-                    new_table[i].is_allocated = 1;
-                    page_found = 1;
-                    break;
-                }
-            }
-            if (!page_found) {
-                // Cleanup already allocated pages
-                for (int k = file->page_table_size; k < i; k++) {
-                    page_bitmap[new_table[k].physical_page / 8] &= ~(1 << (new_table[k].physical_page % 8));
-                }
-                free(new_content);
-                free(new_table);
-                free(dir_path);
-                free(filename);
-                pthread_mutex_unlock(&mutex);
-                return -1;
-            }
-        }
+        // Hard links share the inode, so they all see the new extents (the list may move even on failure)
+        file->extents = new_extents;
+        file->extent_count = new_count;
+        file->page_count = extent_page_count(new_extents, new_count);
 
-        // Update all hardlinks to use the new page table
-        for (int d = 0; d < MAX_DIRECTORIES; d++) {
-            if (strlen(fs_state.directories[d].dirname) > 0) {
-                for (int f = 0; f < fs_state.directories[d].file_count; f++) {
-                    if (fs_state.directories[d].files[f].inode == file->inode) {
-                        // Free old page table if it's different from the new one
-                        if (fs_state.directories[d].files[f].page_table != file->page_table) {
-                            free(fs_state.directories[d].files[f].page_table);
-                        }
-                        fs_state.directories[d].files[f].page_table = new_table;
-                        fs_state.directories[d].files[f].page_table_size = pages_needed;
-                    }
-                }
-            }
+        if (result != 0) {
+            inode_unlock(file);
+            pthread_rwlock_unlock(&fs_lock);
+            return FS_ERR_NO_SPACE;
         }
-
-        file->page_table = new_table;
-        file->page_table_size = pages_needed;
     }
 
-    // Update content for all hardlinks
-    for (int d = 0; d < MAX_DIRECTORIES; d++) {
-        if (strlen(fs_state.directories[d].dirname) > 0) {
-            for (int f = 0; f < fs_state.directories[d].file_count; f++) {
-                if (fs_state.directories[d].files[f].inode == file->inode) {
-                    // Free old content if it's different from the new content
-                    if (!append && fs_state.directories[d].files[f].content != file->content) {
-                        free(fs_state.directories[d].files[f].content);
-                    }
-                    fs_state.directories[d].files[f].content = new_content;
-                    fs_state.directories[d].files[f].content_size = new_content_size;
-                    fs_state.directories[d].files[f].size = new_content_size;
-                    fs_state.directories[d].files[f].modification_time = time(NULL);
-                }
-            }
+    // Pages still shared with a copy get private copies before the write
+    if (data_len > 0) {
+        int first = write_offset / PAGE_SIZE;
+        int result = volume_unshare(file, first, (new_content_size - 1) / PAGE_SIZE - first + 1);
+        file->page_count = extent_page_count(file->extents, file->extent_count);
+
+        if (result < 0) {
+            inode_unlock(file);
+            pthread_rwlock_unlock(&fs_lock);
+            return FS_ERR_NO_SPACE;
         }
     }
 
-    save_state();
-    printf(COLOR_GREEN "Successfully wrote %d bytes to %s (new size: %d bytes)\n" COLOR_RESET,
-           data_len, path, new_content_size);
+    defrag_note_write(file->inode);
+    volume_write(file, write_offset, data, data_len);
+
+    // One inode for all hard links; an overwrite replaces whatever was still in the image
+    file->data_offset = 0;
+    file->content_size = new_content_size;
+    file->size = new_content_size;
+    file->modification_time = time(NULL);
+
+    // Log only the new bytes, not the whole file
+    journal_log_write(file, write_offset, data, data_len);
 
-    free(dir_path);
-    free(filename);
-    pthread_mutex_unlock(&mutex);
-    return data_len;
+    inode_unlock(file);
+    pthread_rwlock_unlock(&fs_lock);
+    if (new_size)
+        *new_size = new_content_size;
+    return FS_OK;
 }
 
 
-char *read_from_file(const char *path, int bytes_to_read, int offset) {
-    pthread_mutex_lock(&mutex);
-    
-    char *dir_path = NULL, *filename = NULL;
+// Resolve a file for reading and fault its bytes in. On success the inode
+// is locked in a read section (see lock_path()); on failure neither is held
+static File *lock_for_read(const char *path, FsStatus *status) {
+    char filename[MAX_FILENAME];
     int dir_idx = -1;
-    File *file = resolve_file_path(path, &dir_idx, &filename);
+
+    // Reads share the inode; only faulting bytes in from the image needs it
+    // exclusively, and the filesystem lock shared as well, since a
+    // checkpoint rewrites the image under the exclusive one. data_offset is
+    // checked again under those locks.
+    int exclusive = 0;
+    File *file = lock_path(path, 0, &dir_idx, filename, NULL);
+    if (file && file->data_offset > 0) {
+        inode_unlock(file);
+        read_end();
+        pthread_rwlock_rdlock(&fs_lock);
+        file = lock_path(path, 1, &dir_idx, filename, NULL);
+        exclusive = 1;
+    }
     
     if (!file) {
-        printf(COLOR_RED "Error: File not found\n" COLOR_RESET);
-        pthread_mutex_unlock(&mutex);
+        read_end();
+        if (exclusive)
+            pthread_rwlock_unlock(&fs_lock);
+        *status = FS_ERR_NOT_FOUND;
         return NULL;
     }
 
     if (!check_file_permissions(file, 4)) { // 4 = read permission
-        printf(COLOR_RED "Error: Permission denied\n" COLOR_RESET);
-        free(dir_path);
-        free(filename);
-        pthread_mutex_unlock(&mutex);
+        inode_unlock(file);
+        read_end();
+        if (exclusive)
+            pthread_rwlock_unlock(&fs_lock);
+        *status = FS_ERR_PERMISSION;
         return NULL;
     }
 
+    // Fault the bytes in from the image on first access
+    if (exclusive) {
+        int loaded = load_file_content(file);
+        pthread_rwlock_unlock(&fs_lock);
+        if (loaded != 0) {
+            inode_unlock(file);
+            read_end();
+            *status = FS_ERR_IO;
+            return NULL;
+        }
+    }
+    *status = FS_OK;
+    return file;
+}
+
+FsStatus read_from_file(const char *path, int bytes_to_read, int offset, char **content) {
+    FsStatus status;
+    File *file = lock_for_read(path, &status);
+    *content = NULL;
+    if (!file)
+        return status;
+
     // Read the actual content
     char *buffer = NULL;
-    if (file->content && file->content_size > 0) {
+    if (file->content_size > 0) {
         // Handle offset and length calculations
         if (offset < 0) offset = 0;
         if (offset > file->content_size) offset = file->content_size;
@@ -1281,107 +1158,96 @@ char *read_from_file(const char *path, int bytes_to_read, int offset) {
         int read_bytes = (bytes_to_read <= 0) ? remaining : 
                         (bytes_to_read < remaining) ? bytes_to_read : remaining;
 
+        // Copy only the requested range out of the pages
         buffer = malloc(read_bytes + 1);
         if (buffer) {
-            memcpy(buffer, file->content + offset, read_bytes);
-            buffer[read_bytes] = '\0';
+            int got = volume_read(file, offset, buffer, read_bytes);
+            buffer[got] = '\0';
         }
     } else {
         buffer = strdup("");
     }
 
-    // Update access time
-    file->modification_time = time(NULL);
+    inode_unlock(file);
+    read_end();
+    if (!buffer)
+        return FS_ERR_NO_MEMORY;
+    *content = buffer;
+    return FS_OK;
+}
 
-    free(dir_path);
-    free(filename);
-    pthread_mutex_unlock(&mutex);
-    return buffer;
+FsStatus read_file_range(const char *path, int offset, char *buffer, int length, int *copied, int *content_size) {
+    FsStatus status;
+    File *file = lock_for_read(path, &status);
+    if (!file)
+        return status;
+
+    if (offset < 0) offset = 0;
+    if (offset > file->content_size) offset = file->content_size;
+    int remaining = file->content_size - offset;
+    int got = volume_read(file, offset, buffer, length < remaining ? length : remaining);
+    if (copied)
+        *copied = got;
+    if (content_size)
+        *content_size = file->content_size;
+
+    inode_unlock(file);
+    read_end();
+    return FS_OK;
 }
 
 
-void change_permissions(char *path, int mode) {
-    pthread_mutex_lock(&mutex);
+FsStatus change_permissions(const char *path, int mode) {
+    pthread_rwlock_rdlock(&fs_lock);
     
-    char *dir_path = NULL, *filename = NULL;
+    char filename[MAX_FILENAME];
     int dir_idx = -1;
-    File *file = resolve_file_path(path, &dir_idx, &filename);
+    File *file = resolve_file_path(path, &dir_idx, filename);
     
     if (!file) {
-        printf(COLOR_RED "Error: File not found: %s\n" COLOR_RESET, path);
-        goto cleanup;
+        pthread_rwlock_unlock(&fs_lock);
+        return FS_ERR_NOT_FOUND;
     }
 
     // Ensure we only change permission bits (last 9 bits)
+    inode_lock(file, 1);
     file->permissions = mode & 0777;
     file->modification_time = time(NULL);
 
-    save_state();
-    printf(COLOR_GREEN "Permissions of '%s' changed to %04o\n" COLOR_RESET, path, mode);
+    journal_log_put_inode(file, 0);
+    inode_unlock(file);
 
-cleanup:
-    free(dir_path);
-    free(filename);
-    pthread_mutex_unlock(&mutex);
+    pthread_rwlock_unlock(&fs_lock);
+    return FS_OK;
 }
 
 
 
-void print_file_info(const char *path) {
-    pthread_mutex_lock(&mutex);
-    
-    char *dir_path = NULL, *filename = NULL;
+FsStatus stat_file(const char *path, FsFileInfo *info) {
+    char filename[MAX_FILENAME];
     int dir_idx = -1;
-    File *file = resolve_file_path(path, &dir_idx, &filename);
-    
-    if (!file) {
-        printf(COLOR_RED "Error: File not found: %s\n" COLOR_RESET, path);
-        pthread_mutex_unlock(&mutex);
-        return;
-    }
-
-    printf("\nFile: %s\n", file->filename);
-    printf("Path: %s/%s\n", fs_state.directories[dir_idx].dirname, file->filename);
-    printf("Size: %d bytes\n", file->size);
-    printf("Owner: %s\n", file->owner);
-    printf("Permissions: %04o ", file->permissions);
-
-    // Show permission interpretation
-    printf("(%c%c%c%c%c%c%c%c%c)\n",
-           (file->permissions & 0400) ? 'r' : '-',
-           (file->permissions & 0200) ? 'w' : '-',
-           (file->permissions & 0100) ? 'x' : '-',
-           (file->permissions & 0040) ? 'r' : '-',
-           (file->permissions & 0020) ? 'w' : '-',
-           (file->permissions & 0010) ? 'x' : '-',
-           (file->permissions & 0004) ? 'r' : '-',
-           (file->permissions & 0002) ? 'w' : '-',
-           (file->permissions & 0001) ? 'x' : '-');
-
-    printf("Type: %s\n", file->is_symlink ? "Symbolic link" : 
-                        (file->ref_count > 1) ? "Hard link" : "Regular file");
-    
-    if (file->is_symlink) {
-        printf("Link target: %s\n", file->link_target ? file->link_target : "(null)");
-    } else if (file->ref_count > 1) {
-        printf("Link count: %d\n", file->ref_count);
-    }
-    
-    printf("Inode: %lu\n", file->inode);
-    printf("Created: %s", ctime(&file->creation_time));
-    printf("Modified: %s", ctime(&file->modification_time));
-    printf("Open count: %d\n", file->open_count);
-    printf("Pages allocated: %d\n", file->page_table_size);
-
-    free(dir_path);
-    free(filename);
-    pthread_mutex_unlock(&mutex);
+    unsigned int generation;
+
+    // The name of the directory holding it is copied too, so a move of
+    // that directory meanwhile means starting over
+    do {
+        File *file = lock_path(path, 0, &dir_idx, filename, &generation);
+        if (!file) {
+            read_end();
+            return FS_ERR_NOT_FOUND;
+        }
+        fill_file_info(info, file, dir_idx, filename);
+        inode_unlock(file);
+        read_end();
+    } while (dcache_reshaped(generation));
+
+    return FS_OK;
 }
 
 
-void change_directory(char *path)
+FsStatus change_directory(const char *path, FsDirInfo *info)
 {
-    pthread_mutex_lock(&mutex);
+    pthread_rwlock_wrlock(&fs_lock);
 
     // Handle special cases
     if (path == NULL || strcmp(path, "") == 0)
@@ -1395,256 +1261,218 @@ void change_directory(char *path)
         path = "/";
     }
 
-    // Handle absolute paths
-    if (path[0] == '/')
+    int current_dir = find_directory_from_path(path);
+    if (current_dir == -1)
     {
-        int current_dir = 0;                // Start at root
-        char *path_copy = strdup(path + 1); // Skip leading slash
-        char *token = strtok(path_copy, "/");
+        pthread_rwlock_unlock(&fs_lock);
+        return FS_ERR_NOT_FOUND;
+    }
 
-        while (token != NULL)
-        {
-            int found = -1;
-            for (int i = 0; i < MAX_DIRECTORIES; i++)
-            {
-                if (strcmp(fs_state.directories[i].dirname, token) == 0 &&
-                    fs_state.directories[i].parent_directory == current_dir)
-                {
-                    found = i;
-                    break;
-                }
-            }
+    fs_state.current_directory = current_dir;
+    fill_dir_info(info, current_dir);
+    pthread_rwlock_unlock(&fs_lock);
+    return FS_OK;
+}
 
-            if (found == -1)
-            {
-                printf(COLOR_RED "Directory not found: %s\n" COLOR_RESET, path);
-                free(path_copy);
-                pthread_mutex_unlock(&mutex);
-                return;
-            }
-            current_dir = found;
-            token = strtok(NULL, "/");
-        }
+// Add a copy of src_file named dest_name to dest_dir_idx. The copy shares
+// the source's pages; each side gets private pages only when it writes.
+static FsStatus share_file(File *src_file, int dest_dir_idx, const char *dest_name, FsFileInfo *info) {
+    dir_lock(dest_dir_idx, 1);
 
-        fs_state.current_directory = current_dir;
-        free(path_copy);
-        printf("Changed to directory: %s\n", fs_state.directories[current_dir].dirname);
-        pthread_mutex_unlock(&mutex);
-        return;
+    // Check if file already exists in destination
+    if (find_entry_in_dir(dest_dir_idx, dest_name)) {
+        dir_unlock(dest_dir_idx);
+        return FS_ERR_EXISTS;
     }
 
-    // Handle relative paths
-    int current_dir = fs_state.current_directory;
-    char *path_copy = strdup(path);
-    char *token = strtok(path_copy, "/");
-
-    while (token != NULL)
-    {
-        // Handle special directory components
-        if (strcmp(token, ".") == 0)
-        {
-            // Do nothing, stay in current directory
-            token = strtok(NULL, "/");
-            continue;
-        }
-        else if (strcmp(token, "..") == 0)
-        {
-            // Move to parent directory if possible
-            if (fs_state.directories[current_dir].parent_directory != -1)
-            {
-                current_dir = fs_state.directories[current_dir].parent_directory;
-            }
-            token = strtok(NULL, "/");
-            continue;
-        }
+    // The copy's inode is locked before it gets a name, so nothing reaches
+    // it half made; the two locks go in inode number order
+    File *stored = inode_alloc(0);
+    if (!stored) {
+        dir_unlock(dest_dir_idx);
+        return FS_ERR_NO_MEMORY;
+    }
+    File *first = stored->inode < src_file->inode ? stored : src_file;
+    File *second = first == stored ? src_file : stored;
+    inode_lock(first, first == stored);
+    inode_lock(second, second == stored);
+    FsStatus status = FS_ERR_NO_MEMORY;
 
-        // Look for matching subdirectory
-        int found = -1;
-        for (int i = 0; i < MAX_DIRECTORIES; i++)
-        {
-            if (strcmp(fs_state.directories[i].dirname, token) == 0 &&
-                fs_state.directories[i].parent_directory == current_dir)
-            {
-                found = i;
-                break;
-            }
-        }
+    // Create the copy with a new inode
+    File new_file = *src_file;
+    new_file.creation_time = time(NULL);
+    new_file.modification_time = new_file.creation_time;
+    new_file.open_count = 0;
+    new_file.is_open = 0;
+    new_file.file_position = 0;
+
+    // Same pages, own extent list; bytes still in the image are read from the
+    // same data_offset as the source's
+    if (src_file->extents && src_file->extent_count > 0) {
+        new_file.extents = malloc(src_file->extent_count * sizeof(Extent));
+        if (!new_file.extents)
+            goto out;
+        memcpy(new_file.extents, src_file->extents, src_file->extent_count * sizeof(Extent));
+        share_pages(new_file.extents, new_file.extent_count);
+    }
+    
+    // A copy is a new independent file; its only link is the new entry
+    new_file.ref_count = 0;
+    new_file.inode = stored->inode;
+    *stored = new_file;
 
-        if (found == -1)
-        {
-            printf(COLOR_RED "Directory not found: %s\n" COLOR_RESET, path);
-            free(path_copy);
-            pthread_mutex_unlock(&mutex);
-            return;
-        }
-        current_dir = found;
-        token = strtok(NULL, "/");
+    // Add to destination directory
+    if (add_entry(dest_dir_idx, dest_name, stored) != 0) {
+        free_pages(stored);
+        goto out;
     }
 
-    fs_state.current_directory = current_dir;
-    printf("Changed to directory: %s\n", fs_state.directories[current_dir].dirname);
-    free(path_copy);
-    pthread_mutex_unlock(&mutex);
+    journal_log_put_inode(stored, src_file->inode);
+    journal_log_link(dest_dir_idx, dest_name, stored->inode);
+    fill_file_info(info, stored, dest_dir_idx, dest_name);
+    status = FS_OK;
+
+out:
+    if (status == FS_OK) {
+        inode_unlock(second);
+        inode_unlock(first);
+    } else {
+        inode_unlock(src_file);
+        inode_free(stored); // Unlocks it
+    }
+    dir_unlock(dest_dir_idx);
+    return status;
 }
 
-void copy_file_to_dir(const char *src_path, const char *dest_dir_path) {
-    pthread_mutex_lock(&mutex);
+FsStatus copy_file_to_dir(const char *src_path, const char *dest_dir_path, FsFileInfo *info) {
+    pthread_rwlock_rdlock(&fs_lock);
+    FsStatus status;
     
     // Resolve source file
-    char *src_dir_path = NULL, *src_filename = NULL;
+    char src_filename[MAX_FILENAME];
     int src_dir_idx = -1;
-    File *src_file = resolve_file_path(src_path, &src_dir_idx, &src_filename);
+    File *src_file = resolve_file_path(src_path, &src_dir_idx, src_filename);
     
-    if (!src_file) {
-        printf(COLOR_RED "Error: Source file not found: %s\n" COLOR_RESET, src_path);
+    if (!src_file || src_file->is_symlink) {
+        status = FS_ERR_NOT_FOUND;
         goto cleanup;
     }
 
     // Resolve destination directory
     int dest_dir_idx = find_directory_from_path(dest_dir_path);
     if (dest_dir_idx == -1) {
-        printf(COLOR_RED "Error: Destination directory not found: %s\n" COLOR_RESET, dest_dir_path);
+        status = FS_ERR_DEST_NOT_FOUND;
         goto cleanup;
     }
 
-    // Check if file already exists in destination
-    for (int i = 0; i < fs_state.directories[dest_dir_idx].file_count; i++) {
-        if (strcmp(fs_state.directories[dest_dir_idx].files[i].filename, src_filename) == 0) {
-            printf(COLOR_RED "Error: File already exists in destination directory\n" COLOR_RESET);
-            goto cleanup;
-        }
-    }
+    status = share_file(src_file, dest_dir_idx, src_filename, info);
+
+cleanup:
+    pthread_rwlock_unlock(&fs_lock);
+    return status;
+}
+
+FsStatus clone_file(const char *src_path, const char *dest_path, FsFileInfo *info) {
+    pthread_rwlock_rdlock(&fs_lock);
+    FsStatus status;
+
+    char src_filename[MAX_FILENAME], dest_name[MAX_FILENAME];
+    int src_dir_idx = -1;
+    File *src_file = resolve_file_path(src_path, &src_dir_idx, src_filename);
 
-    // Check space in destination
-    if (fs_state.directories[dest_dir_idx].file_count >= MAX_FILES) {
-        printf(COLOR_RED "Error: Destination directory is full\n" COLOR_RESET);
+    if (!src_file || src_file->is_symlink) {
+        status = FS_ERR_NOT_FOUND;
         goto cleanup;
     }
 
-    // Create the copy with a new inode
-    File new_file = *src_file;
-    new_file.inode = (ino_t)(time(NULL) + rand() + (long)&new_file); // New unique inode
-    new_file.creation_time = time(NULL);
-    new_file.modification_time = new_file.creation_time;
-    
-    // For copies, we don't share content - make a deep copy
-    if (new_file.content) {
-        new_file.content = strdup(src_file->content);
-        if (!new_file.content) {
-            printf(COLOR_RED "Error: Failed to copy file content\n" COLOR_RESET);
-            goto cleanup;
-        }
+    int dest_dir_idx = resolve_parent(dest_path, dest_name);
+    if (dest_dir_idx == -1 || strlen(dest_name) == 0) {
+        status = FS_ERR_INVALID;
+        goto cleanup;
     }
-    
-    // Copy page table if it exists
-    if (new_file.page_table && new_file.page_table_size > 0) {
-        new_file.page_table = malloc(new_file.page_table_size * sizeof(PageTableEntry));
-        if (!new_file.page_table) {
-            printf(COLOR_RED "Error: Failed to copy page table\n" COLOR_RESET);
-            if (new_file.content) free(new_file.content);
-            goto cleanup;
-        }
-        memcpy(new_file.page_table, src_file->page_table, 
-               new_file.page_table_size * sizeof(PageTableEntry));
+    if (strlen(path_last(dest_path)) >= MAX_FILENAME) {
+        status = FS_ERR_NAME_TOO_LONG;
+        goto cleanup;
     }
-    
-    // For copies, reset ref_count to 1 (it's a new independent file)
-    new_file.ref_count = 1;
-    
-    // Add to destination directory
-    fs_state.directories[dest_dir_idx].files[fs_state.directories[dest_dir_idx].file_count++] = new_file;
 
-    save_state();
-    printf(COLOR_GREEN "Copied '%s' to '%s/%s' (new inode: %lu)\n" COLOR_RESET, 
-           src_path, fs_state.directories[dest_dir_idx].dirname, src_filename, new_file.inode);
+    status = share_file(src_file, dest_dir_idx, dest_name, info);
 
 cleanup:
-    free(src_dir_path);
-    free(src_filename);
-    pthread_mutex_unlock(&mutex);
+    pthread_rwlock_unlock(&fs_lock);
+    return status;
 }
 
 
-void move_file_to_dir(const char *path, const char *dest_dir_path, const char *new_name) {
-    pthread_mutex_lock(&mutex);
+FsStatus move_file_to_dir(const char *path, const char *dest_dir_path, const char *new_name, FsFileInfo *info) {
+    pthread_rwlock_rdlock(&fs_lock);
+    FsStatus status;
     
     // Resolve source file
-    char *src_dir_path = NULL, *src_filename = NULL;
+    char src_filename[MAX_FILENAME];
     int src_dir_idx = -1;
-    File *src_file = resolve_file_path(path, &src_dir_idx, &src_filename);
+    File *src_file = resolve_file_path(path, &src_dir_idx, src_filename);
     
     if (!src_file) {
-        printf(COLOR_RED "Error: Source file not found: %s\n" COLOR_RESET, path);
+        status = FS_ERR_NOT_FOUND;
         goto cleanup;
     }
 
     // Resolve destination directory
     int dest_dir_idx = find_directory_from_path(dest_dir_path);
     if (dest_dir_idx == -1) {
-        printf(COLOR_RED "Error: Destination directory not found: %s\n" COLOR_RESET, dest_dir_path);
+        status = FS_ERR_DEST_NOT_FOUND;
         goto cleanup;
     }
 
     // Determine final filename
     const char *final_name = new_name ? new_name : src_filename;
 
-    // Check if file already exists in destination
-    for (int i = 0; i < fs_state.directories[dest_dir_idx].file_count; i++) {
-        if (strcmp(fs_state.directories[dest_dir_idx].files[i].filename, final_name) == 0) {
-            printf(COLOR_RED "Error: File already exists in destination directory\n" COLOR_RESET);
-            goto cleanup;
-        }
-    }
+    // Both entries change together; the lookup above is confirmed below
+    dir_lock_pair(src_dir_idx, dest_dir_idx);
 
-    // Check space in destination
-    if (fs_state.directories[dest_dir_idx].file_count >= MAX_FILES) {
-        printf(COLOR_RED "Error: Destination directory is full\n" COLOR_RESET);
-        goto cleanup;
+    // Check if file already exists in destination
+    if (find_entry_in_dir(dest_dir_idx, final_name)) {
+        status = FS_ERR_EXISTS;
+        goto unlock;
     }
 
-    // Find source file index
-    int src_file_idx = -1;
-    for (int i = 0; i < fs_state.directories[src_dir_idx].file_count; i++) {
-        if (&fs_state.directories[src_dir_idx].files[i] == src_file) {
-            src_file_idx = i;
-            break;
-        }
+    // Find source file index; it may have gone since the lookup
+    Directory *src_dir = &fs_state.directories[src_dir_idx];
+    int src_file_idx = dir_lookup(src_dir, src_filename);
+    if (src_file_idx == -1 || src_dir->files[src_file_idx]->inode != src_file->inode) {
+        status = FS_ERR_NOT_FOUND;
+        goto unlock;
     }
 
-    if (src_file_idx == -1) {
-        printf(COLOR_RED "Error: Could not locate file in source directory\n" COLOR_RESET);
-        goto cleanup;
+    // Only the entry moves; the inode and its pages stay put
+    DirEntry *moved_entry = dir_insert(&fs_state.directories[dest_dir_idx], final_name, src_file->inode);
+    if (!moved_entry) {
+        status = FS_ERR_NO_MEMORY;
+        goto unlock;
     }
+    journal_log_link(dest_dir_idx, moved_entry->filename, moved_entry->inode);
 
-    // Create copy in destination directory with new name if specified
-    File moved_file = *src_file;
-    if (new_name) {
-        strncpy(moved_file.filename, new_name, MAX_FILENAME-1);
-        moved_file.filename[MAX_FILENAME-1] = '\0';
-    }
-    
-    // Add to destination directory
-    fs_state.directories[dest_dir_idx].files[fs_state.directories[dest_dir_idx].file_count++] = moved_file;
+    // Remove from source directory (the insert left its index alone)
+    remove_entry(src_dir_idx, src_file_idx);
 
-    // Remove from source directory
-    for (int i = src_file_idx; i < fs_state.directories[src_dir_idx].file_count - 1; i++) {
-        fs_state.directories[src_dir_idx].files[i] = fs_state.directories[src_dir_idx].files[i + 1];
+    journal_log_delete_file(src_dir_idx, src_filename);
+    if (info) {
+        inode_lock(src_file, 0);
+        fill_file_info(info, src_file, dest_dir_idx, final_name);
+        inode_unlock(src_file);
     }
-    fs_state.directories[src_dir_idx].file_count--;
-
-    save_state();
-    printf(COLOR_GREEN "Moved '%s' to '%s/%s'\n" COLOR_RESET, 
-           path, fs_state.directories[dest_dir_idx].dirname, final_name);
+    status = FS_OK;
 
+unlock:
+    dir_unlock_pair(src_dir_idx, dest_dir_idx);
 cleanup:
-    free(src_dir_path);
-    free(src_filename);
-    pthread_mutex_unlock(&mutex);
+    pthread_rwlock_unlock(&fs_lock);
+    return status;
 }
 
 // Helper function to get the full path of a directory from its index
 void get_directory_path(int dir_idx, char *path_buffer, size_t buffer_size) {
-    if (dir_idx < 0 || dir_idx >= MAX_DIRECTORIES || !path_buffer || buffer_size == 0) {
+    if (!dir_get(dir_idx) || !path_buffer || buffer_size == 0) {
         if (buffer_size > 0) path_buffer[0] = '\0';
         return;
     }
@@ -1656,89 +1484,61 @@ void get_directory_path(int dir_idx, char *path_buffer, size_t buffer_size) {
         return;
     }
 
-    // Temporary stack to reverse the path components
-    int stack[MAX_DIRECTORIES] = {0};
-    int stack_top = 0;
-    int current = dir_idx;
-
-    // Push all directory indices onto the stack
-    while (current != -1 && current != 0 && stack_top < MAX_DIRECTORIES) {
-        stack[stack_top++] = current;
-        current = fs_state.directories[current].parent_directory;
+    // Measure the path, then fill it in from the end walking up to the root
+    size_t length = 0;
+    for (int current = dir_idx; current > 0; current = fs_state.directories[current].parent_directory) {
+        length += strlen(fs_state.directories[current].dirname) + 1;
+    }
+    if (length >= buffer_size) {
+        path_buffer[0] = '\0';
+        return;
     }
 
-    // Start building the path from root
-    size_t pos = 0;
-    path_buffer[pos++] = '/';
-    path_buffer[pos] = '\0';
-
-    // Pop from stack and append directory names
-    while (stack_top > 0 && pos < buffer_size - 1) {
-        int idx = stack[--stack_top];
-        const char *name = fs_state.directories[idx].dirname;
+    path_buffer[length] = '\0';
+    for (int current = dir_idx; current > 0; current = fs_state.directories[current].parent_directory) {
+        const char *name = fs_state.directories[current].dirname;
         size_t name_len = strlen(name);
-
-        // Check if we have space for this component plus a slash
-        if (pos + name_len + 1 >= buffer_size) {
-            break;
-        }
-
-        strcpy(path_buffer + pos, name);
-        pos += name_len;
-
-        // Add trailing slash if not last component
-        if (stack_top > 0) {
-            path_buffer[pos++] = '/';
-            path_buffer[pos] = '\0';
-        }
+        length -= name_len;
+        memcpy(path_buffer + length, name, name_len);
+        path_buffer[--length] = '/';
     }
-
-    // Ensure null termination
-    path_buffer[buffer_size - 1] = '\0';
 }
 
-void move_directory(const char *src_path, const char *dest_path, const char *new_name) {
-    pthread_mutex_lock(&mutex);
-    
-    char *src_dir_path = NULL;
-    char *src_dirname = NULL;
-    char *dest_dir_path = NULL;
-    char *dest_dirname = NULL;
-    
-    // Split source path
-    split_path(src_path, &src_dir_path, &src_dirname);
+FsStatus move_directory(const char *src_path, const char *dest_path, const char *new_name, FsDirInfo *info) {
+    pthread_rwlock_wrlock(&fs_lock);
+    FsStatus status;
     
     // Find source directory
-    int src_parent_idx = find_directory_from_path(src_dir_path);
+    char src_dirname[MAX_FILENAME];
+    int src_parent_idx = resolve_parent(src_path, src_dirname);
     if (src_parent_idx == -1) {
-        printf(COLOR_RED "Error: Source parent directory not found\n" COLOR_RESET);
+        status = FS_ERR_DIR_NOT_FOUND;
         goto cleanup;
     }
     
-    int src_dir_idx = -1;
-    for (int i = 0; i < MAX_DIRECTORIES; i++) {
-        if (strcmp(fs_state.directories[i].dirname, src_dirname) == 0 && 
-            fs_state.directories[i].parent_directory == src_parent_idx) {
-            src_dir_idx = i;
-            break;
-        }
-    }
+    int src_dir_idx = dir_child(src_parent_idx, src_dirname);
     
     if (src_dir_idx == -1) {
-        printf(COLOR_RED "Error: Source directory not found\n" COLOR_RESET);
+        status = FS_ERR_NOT_FOUND;
         goto cleanup;
     }
     
     // Find destination directory (treat dest_path as absolute path)
     int dest_dir_idx = find_directory_from_path(dest_path);
     if (dest_dir_idx == -1) {
-        printf(COLOR_RED "Error: Destination directory not found\n" COLOR_RESET);
+        status = FS_ERR_DEST_NOT_FOUND;
         goto cleanup;
     }
+
+    const char *target_name = new_name ? new_name : src_dirname;
+    if (info) {
+        memset(info, 0, sizeof(*info));
+        snprintf(info->name, sizeof(info->name), "%s", target_name);
+    }
     
     // Validate not moving to self or creating cycles
     if (src_dir_idx == dest_dir_idx) {
-        printf(COLOR_RED "Error: Cannot move directory into itself\n" COLOR_RESET);
+        status = FS_ERR_INVALID;
         goto cleanup;
     }
     
@@ -1746,196 +1546,146 @@ void move_directory(const char *src_path, const char *dest_path, const char *new
     int current = dest_dir_idx;
     while (current != -1) {
         if (current == src_dir_idx) {
-            printf(COLOR_RED "Error: Would create directory cycle\n" COLOR_RESET);
+            status = FS_ERR_CYCLE;
             goto cleanup;
         }
         current = fs_state.directories[current].parent_directory;
     }
     
     // Check if name exists in destination
-    const char *target_name = new_name ? new_name : src_dirname;
-    for (int i = 0; i < MAX_DIRECTORIES; i++) {
-        if (i != src_dir_idx && 
-            fs_state.directories[i].parent_directory == dest_dir_idx &&
-            strcmp(fs_state.directories[i].dirname, target_name) == 0) {
-            printf(COLOR_RED "Error: Directory '%s' already exists in destination\n" COLOR_RESET, target_name);
-            goto cleanup;
-        }
+    int existing = dir_child(dest_dir_idx, target_name);
+    if (existing != -1 && existing != src_dir_idx) {
+        status = FS_ERR_EXISTS;
+        goto cleanup;
     }
     
-    // ACTUALLY MOVE THE DIRECTORY
-    fs_state.directories[src_dir_idx].parent_directory = dest_dir_idx;
-    if (new_name) {
-        strncpy(fs_state.directories[src_dir_idx].dirname, new_name, MAX_FILENAME-1);
-        fs_state.directories[src_dir_idx].dirname[MAX_FILENAME-1] = '\0';
+    // ACTUALLY MOVE THE DIRECTORY: out of the old parent's index, renamed, into
+    // the new one. Readers that saw it half moved start over (see read_begin()).
+    Directory *moved = &fs_state.directories[src_dir_idx];
+    char old_name[MAX_FILENAME];
+    memcpy(old_name, moved->dirname, MAX_FILENAME);
+    dcache_reshape_begin();
+    dir_detach(src_dir_idx);
+    strncpy(moved->dirname, target_name, MAX_FILENAME-1);
+    moved->dirname[MAX_FILENAME-1] = '\0';
+    if (dir_attach(dest_dir_idx, src_dir_idx) != 0) {
+        memcpy(moved->dirname, old_name, MAX_FILENAME);
+        dir_attach(src_parent_idx, src_dir_idx);
+        dcache_reshape_end();
+        status = FS_ERR_NO_MEMORY;
+        goto cleanup;
     }
+    dcache_reshape_end();
     
-    save_state();
+    journal_log_put_directory(src_dir_idx);
     
-    // Get proper path for success message
-    char dest_display_path[1024] = {0};
-    get_directory_path(dest_dir_idx, dest_display_path, sizeof(dest_display_path));
-    
-    printf(COLOR_GREEN "Moved directory '%s' to '%s/%s'\n" COLOR_RESET,
-           src_dirname, dest_display_path, target_name);
+    // The rest of info is the moved directory's, but the path is where it went
+    if (info) {
+        fill_dir_info(info, src_dir_idx);
+        get_directory_path(dest_dir_idx, info->path, sizeof(info->path));
+    }
+    status = FS_OK;
 
 cleanup:
-    if (src_dir_path) free(src_dir_path);
-    if (src_dirname) free(src_dirname);
-    if (dest_dir_path) free(dest_dir_path);
-    if (dest_dirname) free(dest_dirname);
-    pthread_mutex_unlock(&mutex);
+    pthread_rwlock_unlock(&fs_lock);
+    return status;
 }
 
 
-void create_hard_link(const char *source_path, const char *link_path)
+FsStatus create_hard_link(const char *source_path, const char *link_path, FsFileInfo *info)
 {
-    pthread_mutex_lock(&mutex);
+    pthread_rwlock_rdlock(&fs_lock);
+    FsStatus status;
 
-    // Split paths
-    char *src_dir = NULL, *src_file = NULL;
-    split_path(source_path, &src_dir, &src_file);
-    char *link_dir = NULL, *link_file = NULL;
-    split_path(link_path, &link_dir, &link_file);
+    char src_file[MAX_FILENAME], link_file[MAX_FILENAME];
 
     // Find source directory
-    int src_dir_idx = find_directory_from_path(src_dir);
+    int src_dir_idx = resolve_parent(source_path, src_file);
     if (src_dir_idx == -1)
     {
-        printf(COLOR_RED "Error: Source directory not found: %s\n" COLOR_RESET, src_dir);
-        goto cleanup;
+        pthread_rwlock_unlock(&fs_lock);
+        return FS_ERR_DIR_NOT_FOUND;
     }
 
+    // Both directories are found before either is locked; a missing link
+    // directory is reported after the source checks, as before
+    int link_dir_idx = resolve_parent(link_path, link_file);
+    int locked_dir_idx = (link_dir_idx == -1) ? src_dir_idx : link_dir_idx;
+    dir_lock_pair(src_dir_idx, locked_dir_idx);
+
     // Find source file
-    File *src_file_ptr = NULL;
-    int src_file_idx = -1;
-    for (int i = 0; i < fs_state.directories[src_dir_idx].file_count; i++)
-    {
-        if (strcmp(fs_state.directories[src_dir_idx].files[i].filename, src_file) == 0)
-        {
-            src_file_ptr = &fs_state.directories[src_dir_idx].files[i];
-            src_file_idx = i;
-            break;
-        }
-    }
+    File *src_file_ptr = find_file_in_dir(src_dir_idx, src_file);
 
     if (!src_file_ptr)
     {
-        printf(COLOR_RED "Error: Source file not found: %s\n" COLOR_RESET, source_path);
-        goto cleanup;
+        status = FS_ERR_NOT_FOUND;
+        goto unlock;
     }
 
     // Don't allow hard links to symlinks
     if (src_file_ptr->is_symlink)
     {
-        printf(COLOR_RED "Error: Cannot create hard link to symbolic link\n" COLOR_RESET);
-        goto cleanup;
+        status = FS_ERR_IS_SYMLINK;
+        goto unlock;
     }
 
     // Find link directory
-    int link_dir_idx = find_directory_from_path(link_dir);
     if (link_dir_idx == -1)
     {
-        printf(COLOR_RED "Error: Link directory not found: %s\n" COLOR_RESET, link_dir);
-        goto cleanup;
+        status = FS_ERR_DEST_NOT_FOUND;
+        goto unlock;
     }
 
     // Check for existing link
-    for (int i = 0; i < fs_state.directories[link_dir_idx].file_count; i++)
-    {
-        if (strcmp(fs_state.directories[link_dir_idx].files[i].filename, link_file) == 0)
-        {
-            printf(COLOR_RED "Error: Link already exists: %s\n" COLOR_RESET, link_path);
-            goto cleanup;
-        }
-    }
-
-    // Create hard link (shares all data with original)
-    File new_link;
-    memset(&new_link, 0, sizeof(File));
-    
-    // Copy all metadata
-    new_link = *src_file_ptr;
-    
-    // Set new filename
-    strncpy(new_link.filename, link_file, MAX_FILENAME - 1);
-    new_link.filename[MAX_FILENAME - 1] = '\0';
-    
-    // Set new creation time
-    new_link.creation_time = time(NULL);
-    
-    // Share the same inode, content, and page table
-    new_link.inode = src_file_ptr->inode;
-    new_link.content = src_file_ptr->content;
-    new_link.page_table = src_file_ptr->page_table;
-    new_link.is_symlink = 0;
-    new_link.link_target = NULL;
-    new_link.ref_count = src_file_ptr->ref_count + 1; // Increment ref count
-
-    // Update reference count on original and all other links
-    for (int d = 0; d < MAX_DIRECTORIES; d++)
+    if (find_entry_in_dir(link_dir_idx, link_file))
     {
-        if (strlen(fs_state.directories[d].dirname))
-        {
-            for (int f = 0; f < fs_state.directories[d].file_count; f++)
-            {
-                if (fs_state.directories[d].files[f].inode == src_file_ptr->inode)
-                {
-                    fs_state.directories[d].files[f].ref_count = new_link.ref_count;
-                }
-            }
-        }
+        status = FS_ERR_EXISTS;
+        goto unlock;
     }
 
-    // Add to directory
-    if (fs_state.directories[link_dir_idx].file_count >= MAX_FILES)
+    // A hard link is just another entry naming the same inode (and so the same pages)
+    inode_lock(src_file_ptr, 1);
+    if (add_entry(link_dir_idx, link_file, src_file_ptr) != 0)
     {
-        printf(COLOR_RED "Error: Directory is full\n" COLOR_RESET);
-        goto cleanup;
+        inode_unlock(src_file_ptr);
+        status = FS_ERR_NO_MEMORY;
+        goto unlock;
     }
 
-    fs_state.directories[link_dir_idx].files[fs_state.directories[link_dir_idx].file_count++] = new_link;
-
-    save_state();
-    printf(COLOR_GREEN "Created hard link: %s -> %s (inode: %lu, refcount: %d)\n" COLOR_RESET, 
-           link_path, source_path, new_link.inode, new_link.ref_count);
+    journal_log_link(link_dir_idx, link_file, src_file_ptr->inode);
+    fill_file_info(info, src_file_ptr, link_dir_idx, link_file);
+    inode_unlock(src_file_ptr);
+    status = FS_OK;
 
-cleanup:
-    free(src_dir);
-    free(src_file);
-    free(link_dir);
-    free(link_file);
-    pthread_mutex_unlock(&mutex);
+unlock:
+    dir_unlock_pair(src_dir_idx, locked_dir_idx);
+    pthread_rwlock_unlock(&fs_lock);
+    return status;
 }
 
-void create_symbolic_link(const char *source, const char *link_path) {
-    pthread_mutex_lock(&mutex);
-
-    // Split paths
-    char *link_dir = NULL, *link_file = NULL;
-    split_path(link_path, &link_dir, &link_file);
+FsStatus create_symbolic_link(const char *source, const char *link_path, FsFileInfo *info) {
+    pthread_rwlock_rdlock(&fs_lock);
+    FsStatus status = FS_ERR_NO_MEMORY;
 
     // Find link directory
-    int link_dir_idx = find_directory_from_path(link_dir);
+    char link_file[MAX_FILENAME];
+    int link_dir_idx = resolve_parent(link_path, link_file);
     if (link_dir_idx == -1) {
-        printf(COLOR_RED "Error: Link directory not found: %s\n" COLOR_RESET, link_dir);
-        goto cleanup;
+        pthread_rwlock_unlock(&fs_lock);
+        return FS_ERR_DEST_NOT_FOUND;
     }
 
     // Check for existing link
-    for (int i = 0; i < fs_state.directories[link_dir_idx].file_count; i++) {
-        if (strcmp(fs_state.directories[link_dir_idx].files[i].filename, link_file) == 0) {
-            printf(COLOR_RED "Error: Link already exists: %s\n" COLOR_RESET, link_path);
-            goto cleanup;
-        }
+    dir_lock(link_dir_idx, 1);
+    if (find_entry_in_dir(link_dir_idx, link_file)) {
+        status = FS_ERR_EXISTS;
+        goto unlock;
     }
 
     // Create symbolic link with unique inode
     File symlink;
     memset(&symlink, 0, sizeof(File));
 
-    strncpy(symlink.filename, link_file, MAX_FILENAME - 1);
-    symlink.filename[MAX_FILENAME - 1] = '\0';
     symlink.size = strlen(source); // Size of link content (path string)
     strcpy(symlink.owner, fs_state.users[0].username);
     symlink.permissions = 0777; // Default permissions for symlinks
@@ -1943,96 +1693,131 @@ void create_symbolic_link(const char *source, const char *link_path) {
     symlink.modification_time = symlink.creation_time;
     symlink.is_symlink = 1;
     symlink.link_target = strdup(source);
-    symlink.inode = (ino_t)(time(NULL) + rand()); // Unique inode
-    symlink.ref_count = 1;
-    symlink.content = NULL; // Symlinks don't have content
     symlink.content_size = 0;
-    symlink.page_table = NULL; // No pages needed for symlinks
-    symlink.page_table_size = 0;
+    symlink.extents = NULL; // No pages needed for symlinks
+    symlink.extent_count = 0;
+    symlink.page_count = 0;
 
-    if (!symlink.link_target) {
-        printf(COLOR_RED "Error: Failed to allocate memory for symlink target\n" COLOR_RESET);
-        goto cleanup;
-    }
+    if (!symlink.link_target)
+        goto unlock;
 
     // Add to directory
-    if (fs_state.directories[link_dir_idx].file_count >= MAX_FILES) {
-        printf(COLOR_RED "Error: Directory is full\n" COLOR_RESET);
+    File *stored = inode_alloc(0);
+    if (!stored) {
         free(symlink.link_target);
-        goto cleanup;
+        goto unlock;
     }
 
-    fs_state.directories[link_dir_idx].files[fs_state.directories[link_dir_idx].file_count++] = symlink;
+    symlink.inode = stored->inode;
+    *stored = symlink;
+    if (add_entry(link_dir_idx, link_file, stored) != 0) {
+        inode_lock(stored, 1);
+        inode_free(stored); // Unlocks it
+        goto unlock;
+    }
 
-    save_state();
-    printf(COLOR_GREEN "Created symbolic link: %s -> %s (inode: %lu)\n" COLOR_RESET, 
-           link_path, source, symlink.inode);
+    journal_log_put_inode(stored, 0);
+    journal_log_link(link_dir_idx, link_file, stored->inode);
+    fill_file_info(info, stored, link_dir_idx, link_file);
+    status = FS_OK;
 
-cleanup:
-    free(link_dir);
-    free(link_file);
-    pthread_mutex_unlock(&mutex);
+unlock:
+    dir_unlock(link_dir_idx);
+    pthread_rwlock_unlock(&fs_lock);
+    return status;
 }
 
-void format_filesystem()
+FsStatus format_filesystem(int mmap_volume, int pages, FsFormatInfo *info)
 {
-    pthread_mutex_lock(&mutex);
-    printf(COLOR_RED "WARNING: This will erase ALL data! Continue? [y/N] " COLOR_RESET);
-    char response[10];
-    fgets(response, sizeof(response), stdin);
+    pthread_rwlock_wrlock(&fs_lock);
+    FsFormatInfo result = {0};
 
-    if (tolower(response[0]) == 'y')
-    {
-        // Wipe the storage file
-        FILE *fp = fopen(STORAGE_FILE, "wb");
-        if (fp)
-            fclose(fp);
+    // Everything readers could be looking at goes, the volume included, so
+    // they are let drain first and kept out until the new tree is up
+    dcache_reshape_begin();
+    epoch_synchronize();
+
+    // Wipe the storage file
+    FILE *fp = fopen(STORAGE_FILE, "wb");
+    if (fp)
+        fclose(fp);
 
-        // Reinitialize everything
-        initialize_directories();
-        initialize_paging();
-        printf(COLOR_GREEN "File system formatted successfully\n" COLOR_RESET);
+    // Size and pick the data store before the default files are created
+    defrag_cancel();
+    volume_close();
+    if (paging_set_total(pages) != 0)
+    {
+        result.size_kept = 1;
     }
-    else
+    if (mmap_volume)
     {
-        printf("Format cancelled\n");
+        if (volume_open(1) != 0)
+        {
+            result.map_failed = 1;
+        }
+    }
+
+    // Reinitialize everything
+    initialize_paging();
+    initialize_directories();
+    result.pages = total_pages;
+    result.mapped = volume_mode;
+    dcache_reshape_end();
+    pthread_rwlock_unlock(&fs_lock);
+
+    if (info)
+        *info = result;
+    return FS_OK;
+}
+
+// Byte copy used for the volume that sits beside an image
+static int copy_volume_file(const char *from, const char *to)
+{
+    FILE *src = fopen(from, "rb");
+    FILE *dst = src ? fopen(to, "wb") : NULL;
+    int result = (src && dst) ? 0 : -1;
+
+    char buffer[PAGE_SIZE];
+    size_t bytes;
+    while (result == 0 && (bytes = fread(buffer, 1, sizeof(buffer), src)) > 0) {
+        if (fwrite(buffer, 1, bytes, dst) != bytes)
+            result = -1;
     }
-    pthread_mutex_unlock(&mutex);
+    if (src && ferror(src))
+        result = -1;
+
+    if (src) fclose(src);
+    if (dst && fclose(dst) != 0)
+        result = -1;
+    return result;
+}
+
+int backup_exists(const char *backup_name) {
+    char backup_file[256];
+    snprintf(backup_file, sizeof(backup_file), "%s.bak", backup_name);
+    return access(backup_file, F_OK) == 0;
 }
 
-void backup_filesystem(const char *backup_name) {
-    pthread_mutex_lock(&mutex);
+FsStatus backup_filesystem(const char *backup_name) {
+    pthread_rwlock_wrlock(&fs_lock);
     
     char backup_file[256];
     snprintf(backup_file, sizeof(backup_file), "%s.bak", backup_name);
 
-    // Check if backup file already exists
-    if (access(backup_file, F_OK) == 0) {
-        printf(COLOR_YELLOW "Warning: Backup file '%s' already exists!\n" COLOR_RESET, backup_file);
-        printf(COLOR_RED "This operation will overwrite it. Continue? [y/N] " COLOR_RESET);
-        
-        char response[10];
-        if (fgets(response, sizeof(response), stdin) == NULL || 
-            (response[0] != 'y' && response[0] != 'Y')) {
-            printf(COLOR_BLUE "Backup cancelled\n" COLOR_RESET);
-            pthread_mutex_unlock(&mutex);
-            return;
-        }
-    }
+    // The backup is a copy of the image, so fold pending journal records into it first
+    checkpoint_filesystem();
 
     FILE *src = fopen(STORAGE_FILE, "rb");
     if (!src) {
-        printf(COLOR_RED "Error: Could not open source file '%s' for reading\n" COLOR_RESET, STORAGE_FILE);
-        pthread_mutex_unlock(&mutex);
-        return;
+        pthread_rwlock_unlock(&fs_lock);
+        return FS_ERR_IO;
     }
 
     FILE *dst = fopen(backup_file, "wb");
     if (!dst) {
-        printf(COLOR_RED "Error: Could not open backup file '%s' for writing\n" COLOR_RESET, backup_file);
         fclose(src);
-        pthread_mutex_unlock(&mutex);
-        return;
+        pthread_rwlock_unlock(&fs_lock);
+        return FS_ERR_IO;
     }
 
     char buffer[4096];
@@ -2041,61 +1826,56 @@ void backup_filesystem(const char *backup_name) {
     
     while ((bytes = fread(buffer, 1, sizeof(buffer), src)) > 0) {
         if (fwrite(buffer, 1, bytes, dst) != bytes) {
-            printf(COLOR_RED "Error: Failed to write to backup file\n" COLOR_RESET);
             error_occurred = 1;
             break;
         }
     }
 
     if (ferror(src)) {
-        printf(COLOR_RED "Error: Failed to read from source file\n" COLOR_RESET);
         error_occurred = 1;
     }
 
     fclose(src);
     fclose(dst);
 
+    // A mapped volume holds the file bytes, so it is backed up next to the image
+    char volume_backup[280];
+    snprintf(volume_backup, sizeof(volume_backup), "%s.vol", backup_file);
+    if (!error_occurred && volume_mode && copy_volume_file(VOLUME_FILE, volume_backup) != 0) {
+        remove(volume_backup);
+        error_occurred = 1;
+    }
+    if (!error_occurred && !volume_mode) {
+        remove(volume_backup);
+    }
+
     if (error_occurred) {
         // Delete the partial backup file if there was an error
         remove(backup_file);
-        printf(COLOR_RED "Backup failed - no files were changed\n" COLOR_RESET);
-    } else {
-        printf(COLOR_GREEN "Backup successfully created: %s\n" COLOR_RESET, backup_file);
     }
 
-    pthread_mutex_unlock(&mutex);
+    pthread_rwlock_unlock(&fs_lock);
+    return error_occurred ? FS_ERR_IO : FS_OK;
 }
 
 
-void restore_filesystem(const char *backup_name)
+FsStatus restore_filesystem(const char *backup_name)
 {
-    pthread_mutex_lock(&mutex);
+    pthread_rwlock_wrlock(&fs_lock);
     char backup_file[256];
     snprintf(backup_file, sizeof(backup_file), "%s.bak", backup_name);
 
-    printf(COLOR_RED "WARNING: This will overwrite current filesystem! Continue? [y/N] " COLOR_RESET);
-    char response[10];
-    fgets(response, sizeof(response), stdin);
-
-    if (tolower(response[0]) != 'y')
-    {
-        printf("Restore cancelled\n");
-        pthread_mutex_unlock(&mutex);
-        return;
-    }
-
     FILE *src = fopen(backup_file, "rb");
     FILE *dst = fopen(STORAGE_FILE, "wb");
 
     if (!src || !dst)
     {
-        printf("Error restoring backup\n");
         if (src)
             fclose(src);
         if (dst)
             fclose(dst);
-        pthread_mutex_unlock(&mutex);
-        return;
+        pthread_rwlock_unlock(&fs_lock);
+        return FS_ERR_NOT_FOUND;
     }
 
     char buffer[4096];
@@ -2108,148 +1888,126 @@ void restore_filesystem(const char *backup_name)
     fclose(src);
     fclose(dst);
 
-    // Reload the restored state
+    // As for a format: readers drain before the state is replaced
+    dcache_reshape_begin();
+    epoch_synchronize();
+
+    FsStatus status = FS_OK;
+    char volume_backup[280];
+    snprintf(volume_backup, sizeof(volume_backup), "%s.vol", backup_file);
+    if (access(volume_backup, F_OK) == 0) {
+        volume_close();
+        if (copy_volume_file(volume_backup, VOLUME_FILE) != 0)
+            status = FS_ERR_IO;
+    }
+
+    // Reload the restored state (the current journal belongs to the old image)
+    journal_reset();
     load_state();
-    printf("Filesystem restored from: %s\n", backup_file);
-    pthread_mutex_unlock(&mutex);
+    dcache_reshape_end();
+    pthread_rwlock_unlock(&fs_lock);
+    return status;
 }
 
 
-void show_directory_info(const char *dirname)
+FsStatus directory_info(const char *dirname, FsDirInfo *info)
 {
-    pthread_mutex_lock(&mutex);
-
-    // First gather all needed information while holding the lock
-    int target_dir = fs_state.current_directory;
-    char dirname_copy[MAX_FILENAME] = {0};
-    char path[1024] = {0};
-
-    if (dirname == NULL || strcmp(dirname, ".") == 0)
-    {
-        // Use current directory
-        strncpy(dirname_copy, fs_state.directories[target_dir].dirname, MAX_FILENAME - 1);
-    }
-    else
+    FsStatus status;
+    unsigned int generation;
+    do
     {
-        // Find the target directory
-        int found = 0;
-        for (int i = 0; i < MAX_DIRECTORIES; i++)
+        generation = read_begin();
+        status = FS_OK;
+        int target_dir = fs_state.current_directory;
+        if (dirname != NULL && strcmp(dirname, ".") != 0)
         {
-            if (strcmp(fs_state.directories[i].dirname, dirname) == 0 &&
-                fs_state.directories[i].parent_directory == fs_state.current_directory)
-            {
-                target_dir = i;
-                strncpy(dirname_copy, dirname, MAX_FILENAME - 1);
-                found = 1;
-                break;
-            }
+            // Find the target directory
+            target_dir = dir_child(fs_state.current_directory, dirname);
         }
-        if (!found)
+
+        if (target_dir == -1)
         {
-            pthread_mutex_unlock(&mutex);
-            printf(COLOR_RED "Directory not found\n" COLOR_RESET);
-            return;
+            status = FS_ERR_NOT_FOUND;
         }
-    }
-
-    // Build path without calling pwd (to avoid deadlock)
-    int current = target_dir;
-    char *ptr = path + sizeof(path) - 1;
-    *ptr = '\0';
-
-    while (current != -1)
-    {
-        const char *name = fs_state.directories[current].dirname;
-        size_t len = strlen(name);
-
-        ptr -= len;
-        memcpy(ptr, name, len);
-
-        if (fs_state.directories[current].parent_directory != -1)
+        else
         {
-            *--ptr = '/';
+            dir_lock(target_dir, 0);
+            fill_dir_info(info, target_dir);
+            dir_unlock(target_dir);
         }
+        read_end();
+    } while (dcache_reshaped(generation));
 
-        current = fs_state.directories[current].parent_directory;
-    }
-
-    Directory *dir = &fs_state.directories[target_dir];
-
-    // Now we can release the lock before printing
-    pthread_mutex_unlock(&mutex);
-
-    // Print the information
-    printf("\nDirectory: %s\n", dirname_copy);
-    printf("Path: %s\n", ptr);
-    printf("Files: %d\n", dir->file_count);
-    printf("Created: %s", ctime(&dir->creation_time));
+    return status;
 }
 
 
 
-void print_tree_recursive(int dir_idx, int depth, int show_inodes) {
-    Directory *dir = &fs_state.directories[dir_idx];
-
-    // Print current directory
-    for (int i = 0; i < depth; i++) {
-        printf("│   ");
+// A directory at depth, then its files a level deeper, then its subtrees.
+// Each directory is locked only while its own entries are copied; the
+// subtrees are walked from a copy of its child list.
+static FsStatus collect_subtree(FsListing *listing, int dir_idx, int depth) {
+    dir_lock(dir_idx, 0);
+    Directory *dir = dir_get(dir_idx);
+    if (!dir) {
+        dir_unlock(dir_idx);
+        return FS_ERR_NOT_FOUND; // Deleted since the section began; it starts over
     }
-    if (show_inodes) {
-        printf("├── [%lu] " COLOR_BLUE "%s" COLOR_RESET "\n", dir->inode, dir->dirname);
-    } else {
-        printf("├── " COLOR_BLUE "%s" COLOR_RESET "\n", dir->dirname);
+
+    FsFileInfo *entry = listing_add(listing);
+    if (!entry) {
+        dir_unlock(dir_idx);
+        return FS_ERR_NO_MEMORY;
     }
+    memset(entry, 0, sizeof(*entry));
+    snprintf(entry->name, sizeof(entry->name), "%s", dir->dirname);
+    entry->is_directory = 1;
+    entry->depth = depth;
+    entry->inode = dir->inode;
+    entry->creation_time = dir->creation_time;
 
-    // Print files in this directory - skip empty entries
+    // Files in this directory - skip empty entries
+    FsStatus status = FS_OK;
     for (int i = 0; i < dir->file_count; i++) {
-        if (strlen(dir->files[i].filename) == 0) continue;
+        if (strlen(dir->files[i]->filename) == 0) continue;
         
-        File *file = &dir->files[i];
-        for (int j = 0; j < depth + 1; j++) {
-            printf("│   ");
+        File *file = inode_get_locked(dir->files[i]->inode, 0);
+        if (!file) continue;
+        if (!(entry = listing_add(listing))) {
+            inode_unlock(file);
+            status = FS_ERR_NO_MEMORY;
+            break;
         }
+        fill_file_info(entry, file, dir_idx, dir->files[i]->filename);
+        inode_unlock(file);
+        entry->depth = depth + 1;
+    }
 
-        if (show_inodes) {
-            if (file->is_symlink) {
-                printf("├── [%lu] " COLOR_YELLOW "%s" COLOR_RESET " -> %s\n",
-                       file->inode, file->filename, 
-                       file->link_target ? file->link_target : "(null)");
-            } else if (file->ref_count > 1) {
-                printf("├── [%lu] " COLOR_GREEN "%s" COLOR_RESET "\n",
-                       file->inode, file->filename);
-            } else {
-                printf("├── [%lu] %s\n", file->inode, file->filename);
-            }
-        } else {
-            if (file->is_symlink) {
-                printf("├── " COLOR_YELLOW "%s" COLOR_RESET " -> %s\n",
-                       file->filename,
-                       file->link_target ? file->link_target : "(null)");
-            } else if (file->ref_count > 1) {
-                printf("├── " COLOR_GREEN "%s" COLOR_RESET "\n", file->filename);
-            } else {
-                printf("├── %s\n", file->filename);
-            }
-        }
+    int subdir_count = dir->subdir_count;
+    int *subdirs = NULL;
+    if (status == FS_OK && subdir_count > 0) {
+        subdirs = malloc(subdir_count * sizeof(int));
+        if (subdirs)
+            memcpy(subdirs, dir->subdirs, subdir_count * sizeof(int));
+        else
+            status = FS_ERR_NO_MEMORY;
     }
+    dir_unlock(dir_idx);
 
-    // Recursively print subdirectories
-    for (int i = 0; i < MAX_DIRECTORIES; i++) {
-        if (fs_state.directories[i].parent_directory == dir_idx &&
-            strlen(fs_state.directories[i].dirname) > 0) {
-            print_tree_recursive(i, depth + 1, show_inodes);
-        }
+    for (int i = 0; i < subdir_count && status == FS_OK; i++) {
+        status = collect_subtree(listing, subdirs[i], depth + 1);
     }
+    free(subdirs);
+    return status;
 }
 
+static FsStatus collect_tree(FsListing *listing) {
+    int current = fs_state.current_directory;
+    fill_dir_info(&listing->dir, current);
+    return collect_subtree(listing, current, 0);
+}
 
-void tree_command(int show_inodes)
+FsStatus list_tree(FsListing *listing)
 {
-    pthread_mutex_lock(&mutex);
-
-    printf(".\n");
-    print_tree_recursive(fs_state.current_directory, 0, show_inodes);
-
-    pthread_mutex_unlock(&mutex);
+    return read_listing(listing, collect_tree);
 }
-
@@ -0,0 +1,199 @@
+#include "../include/fsring.h"
+#include "../include/scheduler.h"
+#include "../include/globals.h"
+
+struct FsRingEntry
+{
+    FsSubmission op;
+    char path[256]; // Same limit as a command line
+    FsCompletion completion;
+    FsRing *ring;
+};
+
+// Metadata lookups take the fast lane, the rest is normal
+static const int op_classes[FS_OP_COUNT] = {JOB_FAST,   JOB_NORMAL, JOB_NORMAL, JOB_NORMAL,
+                                            JOB_NORMAL, JOB_FAST,   JOB_NORMAL};
+
+int fs_ring_init(FsRing *ring, int entries, int user)
+{
+    memset(ring, 0, sizeof(*ring));
+    if (entries <= 0 || (entries & (entries - 1)) != 0)
+        return -1;
+    ring->entries = calloc(entries, sizeof(FsRingEntry));
+    ring->free = malloc(entries * sizeof(FsRingEntry *));
+    ring->waiting = malloc(entries * sizeof(FsRingEntry *));
+    if (!ring->entries || !ring->free || !ring->waiting || jobqueue_init(&ring->completed, entries) != 0)
+    {
+        free(ring->entries);
+        free(ring->free);
+        free(ring->waiting);
+        return -1;
+    }
+
+    ring->capacity = entries;
+    ring->user = user;
+    for (int i = 0; i < entries; i++)
+    {
+        ring->entries[i].ring = ring;
+        ring->free[ring->free_count++] = &ring->entries[entries - 1 - i];
+    }
+    pthread_mutex_init(&ring->lock, NULL);
+    pthread_cond_init(&ring->completion, NULL);
+    return 0;
+}
+
+// Called by a worker, or by the driving thread for an operation that never
+// reached one. The lock is held across the push so the ring outlives the
+// wake-up even if the completion is reaped at once.
+static void complete(FsRingEntry *entry, int status, int result, FsStatus error)
+{
+    FsRing *ring = entry->ring;
+    entry->completion.user_data = entry->op.user_data;
+    entry->completion.status = status;
+    entry->completion.result = result;
+    entry->completion.error = error;
+
+    pthread_mutex_lock(&ring->lock);
+    jobqueue_push(&ring->completed, entry);
+    if (ring->sleeping)
+        pthread_cond_signal(&ring->completion);
+    pthread_mutex_unlock(&ring->lock);
+}
+
+static void run_entry(void *arg)
+{
+    FsRingEntry *entry = arg;
+    FsSubmission *op = &entry->op;
+    FsStatus error = FS_OK;
+    int result = 0;
+
+    switch (op->opcode)
+    {
+    case FS_OP_NOP:
+        break;
+    case FS_OP_CREATE:
+        error = create_file(entry->path, op->mode, NULL);
+        break;
+    case FS_OP_MKDIR:
+        error = create_directory(entry->path, NULL);
+        break;
+    case FS_OP_READ:
+        error = read_file_range(entry->path, op->offset, op->buffer, op->length, &result, NULL);
+        break;
+    case FS_OP_WRITE:
+        error = write_file_range(entry->path, op->buffer, op->length, op->flags & FS_RING_APPEND, &result);
+        break;
+    case FS_OP_STAT:
+        error = read_file_range(entry->path, 0, NULL, 0, NULL, &result);
+        break;
+    case FS_OP_DELETE:
+        error = delete_file(entry->path, NULL);
+        break;
+    }
+
+    __atomic_sub_fetch(&entry->ring->scheduled, 1, __ATOMIC_RELEASE);
+    complete(entry, error != FS_OK ? FS_RING_FAILED : FS_RING_OK, error != FS_OK ? 0 : result, error);
+}
+
+// Hand waiting submissions to the workers in order, until the pool is full.
+// With wait, the first one waits for room instead.
+static void feed(FsRing *ring, int wait)
+{
+    while (ring->waiting_count > 0)
+    {
+        FsRingEntry *entry = ring->waiting[ring->waiting_head];
+        const char *path = entry->op.opcode == FS_OP_NOP ? NULL : entry->path;
+
+        // Counted first: it may complete before add_call() returns
+        __atomic_add_fetch(&ring->scheduled, 1, __ATOMIC_RELAXED);
+        if (!add_call(path, op_classes[entry->op.opcode], run_entry, entry, ring->user, wait))
+        {
+            __atomic_sub_fetch(&ring->scheduled, 1, __ATOMIC_RELAXED);
+            if (running)
+                return;
+            complete(entry, FS_RING_SHUTDOWN, 0, FS_OK);
+        }
+        ring->waiting_head = (ring->waiting_head + 1) % ring->capacity;
+        ring->waiting_count--;
+        wait = 0;
+    }
+}
+
+int fs_ring_submit(FsRing *ring, const FsSubmission *ops, int count)
+{
+    int taken = 0;
+    for (; taken < count && ring->free_count > 0; taken++)
+    {
+        FsRingEntry *entry = ring->free[--ring->free_count];
+        const FsSubmission *op = &ops[taken];
+        entry->op = *op;
+
+        int valid = op->opcode >= 0 && op->opcode < FS_OP_COUNT;
+        if (valid && op->opcode != FS_OP_NOP)
+            valid = op->path && strlen(op->path) < sizeof(entry->path);
+        if (valid && (op->opcode == FS_OP_READ || op->opcode == FS_OP_WRITE))
+            valid = op->length >= 0 && (op->buffer || op->length == 0);
+        if (!valid)
+        {
+            complete(entry, FS_RING_INVALID, 0, FS_ERR_INVALID);
+            continue;
+        }
+        snprintf(entry->path, sizeof(entry->path), "%s", op->opcode == FS_OP_NOP ? "" : op->path);
+
+        int tail = (ring->waiting_head + ring->waiting_count) % ring->capacity;
+        ring->waiting[tail] = entry;
+        ring->waiting_count++;
+    }
+    feed(ring, 0);
+    return taken;
+}
+
+int fs_ring_reap(FsRing *ring, FsCompletion *out, int max, int min_complete)
+{
+    int got = 0;
+    for (;;)
+    {
+        feed(ring, 0);
+
+        FsRingEntry *entry;
+        while (got < max && (entry = jobqueue_pop(&ring->completed)))
+        {
+            out[got++] = entry->completion;
+            ring->free[ring->free_count++] = entry;
+        }
+        if (got >= min_complete || got >= max || ring->free_count == ring->capacity)
+            return got;
+
+        // Nothing on the workers to wait for: wait for room for the next one
+        if (__atomic_load_n(&ring->scheduled, __ATOMIC_ACQUIRE) == 0 && ring->waiting_count > 0)
+        {
+            feed(ring, 1);
+            continue;
+        }
+
+        pthread_mutex_lock(&ring->lock);
+        ring->sleeping = 1;
+        while (jobqueue_size(&ring->completed) == 0)
+            pthread_cond_wait(&ring->completion, &ring->lock);
+        ring->sleeping = 0;
+        pthread_mutex_unlock(&ring->lock);
+    }
+}
+
+void fs_ring_destroy(FsRing *ring)
+{
+    FsCompletion discarded;
+    while (ring->free_count < ring->capacity)
+        fs_ring_reap(ring, &discarded, 1, 1);
+
+    // The last worker to complete may still hold the lock
+    pthread_mutex_lock(&ring->lock);
+    pthread_mutex_unlock(&ring->lock);
+    pthread_mutex_destroy(&ring->lock);
+    pthread_cond_destroy(&ring->completion);
+
+    jobqueue_destroy(&ring->completed);
+    free(ring->entries);
+    free(ring->free);
+    free(ring->waiting);
+}
@@ -1,15 +1,14 @@
+#define _GNU_SOURCE // Writer-preferring rwlock initializer
 #include "../include/globals.h"
 #include "../include/paging.h"  // For TOTAL_PAGES definition
 
 // ACTUAL DEFINITIONS (with initialization)
 FileSystemState fs_state;
-pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+// Writers are not starved by a steady stream of readers
+pthread_rwlock_t fs_lock = PTHREAD_RWLOCK_WRITER_NONRECURSIVE_INITIALIZER_NP;
 
-Job job_queue[MAX_JOBS];
-int front = 0;
-int rear = 0;
-int job_count = 0;
 pthread_mutex_t queue_lock = PTHREAD_MUTEX_INITIALIZER;
 pthread_cond_t job_available = PTHREAD_COND_INITIALIZER;
 int running = 1;
-unsigned char page_bitmap[TOTAL_PAGES / 8] = {0};  // Initialization happens here
\ No newline at end of file
+uint64_t *page_bitmap = NULL;  // Sized by initialize_paging()
+int total_pages = TOTAL_PAGES;
\ No newline at end of file
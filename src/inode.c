@@ -0,0 +1,375 @@
+#include <stdint.h>
+#include "../include/inode.h"
+#include "../include/lockorder.h"
+#include "../include/epoch.h"
+
+// Records are addressed by slot: chunks[slot / INODE_CHUNK][slot % INODE_CHUNK].
+// A slot is free when its inode number is 0; freed slots are reused first.
+// Each slot's lock sits at the same place in lock_chunks, and like the
+// record it never moves.
+//
+// inode_get() takes no lock. The chunk arrays and the index are replaced,
+// never resized in place: a new one is published with an atomic store and
+// the old one retired to the epoch reclaimer (see epoch.h).
+static File **chunks = NULL;
+static pthread_rwlock_t **lock_chunks = NULL;
+static int chunk_count = 0;
+static int lock_chunk_count = 0; // Lock chunks outlive a table reset
+
+// Guards the table itself (chunks, index, free list) for writers
+static pthread_mutex_t table_lock = PTHREAD_MUTEX_INITIALIZER;
+static int slots_used = 0; // Slots ever handed out (high-water mark)
+
+static int *free_slots = NULL;
+static int free_count = 0, free_capacity = 0;
+
+static int live_count = 0;
+static ino_t next_number = 1;
+
+// Open-addressed hash index, linear probing. A bucket holds an inode number
+// (0 = empty) and its slot + 1; a freed number keeps its bucket with slot
+// 0, so probes never break under a reader, and takes it back if reused.
+typedef struct
+{
+    ino_t number;
+    int slot;
+} IndexBucket;
+
+typedef struct
+{
+    unsigned int capacity; // Power of two
+    unsigned int used;     // Buckets with a number, freed ones included
+    IndexBucket buckets[];
+} InodeIndex;
+
+static InodeIndex *index_table = NULL;
+
+static File *slot_record(int slot)
+{
+    File **table = __atomic_load_n(&chunks, __ATOMIC_ACQUIRE);
+    return &table[slot / INODE_CHUNK][slot % INODE_CHUNK];
+}
+
+static unsigned int index_home(ino_t number, unsigned int capacity)
+{
+    uint64_t h = (uint64_t)number * 0x9E3779B97F4A7C15ULL;
+    return (unsigned int)(h >> 32) & (capacity - 1);
+}
+
+// Bucket holding number, or the empty bucket ending its probe
+static IndexBucket *index_find(InodeIndex *index, ino_t number)
+{
+    unsigned int mask = index->capacity - 1;
+    for (unsigned int i = index_home(number, index->capacity);; i = (i + 1) & mask)
+    {
+        ino_t found = __atomic_load_n(&index->buckets[i].number, __ATOMIC_ACQUIRE);
+        if (!found || found == number)
+            return &index->buckets[i];
+    }
+}
+
+// Slot + 1 of number, or 0; needs no lock inside an epoch section
+static int lookup_slot(ino_t number)
+{
+    InodeIndex *index = __atomic_load_n(&index_table, __ATOMIC_ACQUIRE);
+    if (!number || !index)
+        return 0;
+    return __atomic_load_n(&index_find(index, number)->slot, __ATOMIC_ACQUIRE);
+}
+
+// Replace the index with one sized for count live numbers, a quarter full
+static int index_rebuild(int count)
+{
+    unsigned int capacity = 1024;
+    while (capacity < (unsigned int)count * 4)
+        capacity *= 2;
+    InodeIndex *index = calloc(1, sizeof(InodeIndex) + capacity * sizeof(IndexBucket));
+    if (!index)
+        return -1;
+
+    // Copied from the old index, not the records: a new record may still
+    // be being filled in by its creator
+    index->capacity = capacity;
+    InodeIndex *old = index_table;
+    for (unsigned int i = 0; old && i < old->capacity; i++)
+    {
+        if (!old->buckets[i].slot)
+            continue;
+        IndexBucket *bucket = index_find(index, old->buckets[i].number);
+        bucket->number = old->buckets[i].number;
+        bucket->slot = old->buckets[i].slot;
+        index->used++;
+    }
+
+    __atomic_store_n(&index_table, index, __ATOMIC_RELEASE);
+    epoch_retire(old);
+    return 0;
+}
+
+// A copy of array (count pointers) with room for one more; the caller
+// publishes it and retires the original
+static void *grow_array(void *array, int count)
+{
+    void **grown = malloc((count + 1) * sizeof(void *));
+    if (grown && count)
+        memcpy(grown, array, count * sizeof(void *));
+    return grown;
+}
+
+// Locks for the records of chunk c
+static int add_lock_chunk(int c)
+{
+    if (c < lock_chunk_count)
+        return 0;
+    pthread_rwlock_t *locks = malloc(INODE_CHUNK * sizeof(pthread_rwlock_t));
+    pthread_rwlock_t **grown = grow_array(lock_chunks, lock_chunk_count);
+    if (!locks || !grown)
+    {
+        free(locks);
+        free(grown);
+        return -1;
+    }
+    for (int i = 0; i < INODE_CHUNK; i++)
+        pthread_rwlock_init(&locks[i], NULL);
+    grown[c] = locks;
+
+    pthread_rwlock_t **old = lock_chunks;
+    __atomic_store_n(&lock_chunks, grown, __ATOMIC_RELEASE);
+    epoch_retire(old);
+    lock_chunk_count++;
+    return 0;
+}
+
+static int take_slot()
+{
+    if (free_count > 0)
+        return free_slots[--free_count];
+
+    if (slots_used == chunk_count * INODE_CHUNK)
+    {
+        if (add_lock_chunk(chunk_count) != 0)
+            return -1;
+        File *records = calloc(INODE_CHUNK, sizeof(File));
+        File **grown = grow_array(chunks, chunk_count);
+        if (!records || !grown)
+        {
+            free(records);
+            free(grown);
+            return -1;
+        }
+        grown[chunk_count] = records;
+
+        File **old = chunks;
+        __atomic_store_n(&chunks, grown, __ATOMIC_RELEASE);
+        epoch_retire(old);
+        chunk_count++;
+    }
+    return slots_used++;
+}
+
+// Only once no reader can be looking (see epoch_synchronize())
+void inode_table_reset()
+{
+    pthread_mutex_lock(&table_lock);
+    for (int slot = 0; slot < slots_used; slot++)
+    {
+        File *file = slot_record(slot);
+        if (file->inode)
+        {
+            free(file->extents);
+            free(file->link_target);
+        }
+    }
+    for (int c = 0; c < chunk_count; c++)
+        free(chunks[c]);
+    free(chunks);
+    free(free_slots);
+    free(index_table);
+
+    chunks = NULL;
+    chunk_count = 0;
+    slots_used = 0;
+    free_slots = NULL;
+    free_count = free_capacity = 0;
+    index_table = NULL;
+    live_count = 0;
+    next_number = 1;
+    pthread_mutex_unlock(&table_lock);
+}
+
+File *inode_get(ino_t number)
+{
+    epoch_enter();
+    int slot = lookup_slot(number);
+    File *file = slot ? slot_record(slot - 1) : NULL;
+    epoch_exit();
+    return file;
+}
+
+// A zeroed record numbered number (NULL if that number is taken)
+File *inode_alloc(ino_t number)
+{
+    File *file = NULL;
+    pthread_mutex_lock(&table_lock);
+    if (number == 0)
+    {
+        while (lookup_slot(next_number))
+            next_number++;
+        number = next_number;
+    }
+    else if (lookup_slot(number))
+    {
+        goto out;
+    }
+
+    // Keep the load factor, freed numbers included, under one half
+    if ((!index_table || (index_table->used + 1) * 2 > index_table->capacity) &&
+        index_rebuild(live_count + 1) != 0)
+        goto out;
+
+    int slot = take_slot();
+    if (slot < 0)
+        goto out;
+
+    file = slot_record(slot);
+    memset(file, 0, sizeof(File));
+    file->inode = number;
+
+    // The slot goes in before the number: a reader that sees the number sees it
+    IndexBucket *bucket = index_find(index_table, number);
+    if (!bucket->number)
+        index_table->used++;
+    __atomic_store_n(&bucket->slot, slot + 1, __ATOMIC_RELEASE);
+    __atomic_store_n(&bucket->number, number, __ATOMIC_RELEASE);
+    live_count++;
+    if (number >= next_number)
+        next_number = number + 1;
+out:
+    pthread_mutex_unlock(&table_lock);
+    return file;
+}
+
+// The lock of a live record's slot, found without locks
+static pthread_rwlock_t *record_lock(const File *file)
+{
+    epoch_enter();
+    int slot = lookup_slot(file->inode) - 1;
+    pthread_rwlock_t **locks = __atomic_load_n(&lock_chunks, __ATOMIC_ACQUIRE);
+    pthread_rwlock_t *lock = &locks[slot / INODE_CHUNK][slot % INODE_CHUNK];
+    epoch_exit();
+    return lock;
+}
+
+// Drop a record along with its extent list and link target. The caller
+// returns its pages first, with the record locked exclusively; the lock is
+// released here. The link target is retired rather than freed: path walks
+// read it without the lock.
+void inode_free(File *file)
+{
+    if (!file || !file->inode)
+        return;
+
+    ino_t number = file->inode;
+    pthread_rwlock_t *lock = record_lock(file);
+    pthread_mutex_lock(&table_lock);
+    IndexBucket *bucket = index_find(index_table, number);
+    int slot = bucket->slot - 1;
+    if (slot < 0 || slot_record(slot) != file)
+    {
+        pthread_mutex_unlock(&table_lock);
+        lock_order_release(LOCK_INODE, number);
+        pthread_rwlock_unlock(lock);
+        return;
+    }
+    __atomic_store_n(&bucket->slot, 0, __ATOMIC_RELEASE);
+
+    free(file->extents);
+    epoch_retire(file->link_target);
+    memset(file, 0, sizeof(File));
+    live_count--;
+
+    if (free_count == free_capacity)
+    {
+        int capacity = free_capacity ? free_capacity * 2 : 64;
+        int *grown = realloc(free_slots, capacity * sizeof(int));
+        if (grown)
+        {
+            free_slots = grown;
+            free_capacity = capacity;
+        }
+    }
+    if (free_count < free_capacity)
+        free_slots[free_count++] = slot; // Otherwise the slot is simply not reused
+    pthread_mutex_unlock(&table_lock);
+    lock_order_release(LOCK_INODE, number);
+    pthread_rwlock_unlock(lock);
+}
+
+File *inode_next(int *cursor)
+{
+    File *found = NULL;
+    pthread_mutex_lock(&table_lock);
+    while (!found && *cursor < slots_used)
+    {
+        File *file = slot_record((*cursor)++);
+        if (file->inode)
+            found = file;
+    }
+    pthread_mutex_unlock(&table_lock);
+    return found;
+}
+
+int inode_count()
+{
+    pthread_mutex_lock(&table_lock);
+    int count = live_count;
+    pthread_mutex_unlock(&table_lock);
+    return count;
+}
+
+void inode_lock(const File *file, int exclusive)
+{
+    pthread_rwlock_t *lock = record_lock(file);
+    lock_order_acquire(LOCK_INODE, file->inode);
+    if (exclusive)
+        pthread_rwlock_wrlock(lock);
+    else
+        pthread_rwlock_rdlock(lock);
+}
+
+void inode_unlock(const File *file)
+{
+    lock_order_release(LOCK_INODE, file->inode);
+    pthread_rwlock_unlock(record_lock(file));
+}
+
+// The number is checked again under the lock: a record is only freed, or
+// its slot reused, with its lock held exclusively
+File *inode_get_locked(ino_t number, int exclusive)
+{
+    epoch_enter();
+    int slot = lookup_slot(number) - 1;
+    File *file = NULL;
+    if (slot >= 0)
+    {
+        pthread_rwlock_t **locks = __atomic_load_n(&lock_chunks, __ATOMIC_ACQUIRE);
+        pthread_rwlock_t *lock = &locks[slot / INODE_CHUNK][slot % INODE_CHUNK];
+        lock_order_acquire(LOCK_INODE, number);
+        if (exclusive)
+            pthread_rwlock_wrlock(lock);
+        else
+            pthread_rwlock_rdlock(lock);
+
+        if (lookup_slot(number) - 1 == slot)
+        {
+            file = slot_record(slot);
+        }
+        else
+        {
+            lock_order_release(LOCK_INODE, number);
+            pthread_rwlock_unlock(lock);
+        }
+    }
+    epoch_exit();
+    return file;
+}
@@ -0,0 +1,80 @@
+#include <stdlib.h>
+#include "../include/jobqueue.h"
+
+int jobqueue_init(JobQueue *queue, unsigned long capacity)
+{
+    queue->cells = malloc(capacity * sizeof(JobQueueCell));
+    if (!queue->cells)
+        return -1;
+    queue->mask = capacity - 1;
+    for (unsigned long i = 0; i < capacity; i++)
+        queue->cells[i].sequence = i;
+    queue->enqueue_pos = 0;
+    queue->dequeue_pos = 0;
+    return 0;
+}
+
+void jobqueue_destroy(JobQueue *queue)
+{
+    free(queue->cells);
+    queue->cells = NULL;
+}
+
+int jobqueue_push(JobQueue *queue, void *value)
+{
+    unsigned long pos = __atomic_load_n(&queue->enqueue_pos, __ATOMIC_RELAXED);
+    JobQueueCell *cell;
+    for (;;)
+    {
+        cell = &queue->cells[pos & queue->mask];
+        unsigned long sequence = __atomic_load_n(&cell->sequence, __ATOMIC_ACQUIRE);
+        long diff = (long)(sequence - pos);
+        if (diff == 0)
+        {
+            // The cell is free for this lap: claim it
+            if (__atomic_compare_exchange_n(&queue->enqueue_pos, &pos, pos + 1, 1, __ATOMIC_RELAXED,
+                                            __ATOMIC_RELAXED))
+                break;
+        }
+        else if (diff < 0)
+            return 0; // Still holds last lap's value
+        else
+            pos = __atomic_load_n(&queue->enqueue_pos, __ATOMIC_RELAXED);
+    }
+    cell->value = value;
+    __atomic_store_n(&cell->sequence, pos + 1, __ATOMIC_RELEASE);
+    return 1;
+}
+
+void *jobqueue_pop(JobQueue *queue)
+{
+    unsigned long pos = __atomic_load_n(&queue->dequeue_pos, __ATOMIC_RELAXED);
+    JobQueueCell *cell;
+    for (;;)
+    {
+        cell = &queue->cells[pos & queue->mask];
+        unsigned long sequence = __atomic_load_n(&cell->sequence, __ATOMIC_ACQUIRE);
+        long diff = (long)(sequence - (pos + 1));
+        if (diff == 0)
+        {
+            if (__atomic_compare_exchange_n(&queue->dequeue_pos, &pos, pos + 1, 1, __ATOMIC_RELAXED,
+                                            __ATOMIC_RELAXED))
+                break;
+        }
+        else if (diff < 0)
+            return NULL; // Not filled yet
+        else
+            pos = __atomic_load_n(&queue->dequeue_pos, __ATOMIC_RELAXED);
+    }
+    void *value = cell->value;
+    // Free the cell for the producer one lap ahead
+    __atomic_store_n(&cell->sequence, pos + queue->mask + 1, __ATOMIC_RELEASE);
+    return value;
+}
+
+unsigned long jobqueue_size(const JobQueue *queue)
+{
+    unsigned long tail = __atomic_load_n(&queue->enqueue_pos, __ATOMIC_RELAXED);
+    unsigned long head = __atomic_load_n(&queue->dequeue_pos, __ATOMIC_RELAXED);
+    return tail > head ? tail - head : 0;
+}
@@ -0,0 +1,964 @@
+#include "../include/journal.h"
+#include "../include/paging.h"
+#include "../include/globals.h"
+#include "../include/storage.h"
+#include "../include/volume.h"
+#include "../include/inode.h"
+#include "../include/directory.h"
+
+// Append-only operation journal kept next to STORAGE_FILE.
+// Every mutation appends one record; load_state() replays the records
+// over the last checkpoint image and checkpoint_filesystem() folds them
+// back into the image once the journal grows past JOURNAL_CHECKPOINT_SIZE.
+
+//
+// Group commit: records are buffered in memory and made durable by the
+// flusher thread, one write + fdatasync per batch of JOURNAL_BATCH_OPS
+// records or per flush interval. In DURABILITY_PER_OP mode (or before the
+// flusher runs) every record is flushed by the caller.
+//
+// Batches: between journal_begin() and the matching journal_commit() records
+// are only buffered, whatever the durability mode, and the commit makes them
+// durable with one flush. A batch that outgrows JOURNAL_CHECKPOINT_SIZE
+// stops buffering altogether: its commit writes one full image instead.
+//
+// Lock order: fs_lock -> flush_lock -> journal_lock
+
+typedef struct
+{
+    char *data;
+    size_t len;
+    size_t cap;
+} RecordBuffer;
+
+static FILE *journal_fp = NULL;
+static long journal_size = 0;      // Bytes already written to JOURNAL_FILE
+static RecordBuffer pending = {0}; // Records not yet written
+static int pending_ops = 0;
+static int checkpoint_requested = 0;
+static int write_failures = 0; // Flushes that fell back to a checkpoint
+
+static int durability = JOURNAL_DEFAULT_DURABILITY;
+static int batch_ops = JOURNAL_BATCH_OPS;
+static int flush_interval_ms = JOURNAL_FLUSH_INTERVAL_MS;
+static int flusher_running = 0;
+
+static int batch_depth = 0;    // journal_begin() calls not yet committed
+static int batch_records = 0;  // Records logged since the outermost one
+static int batch_overflow = 0; // Past the checkpoint size: the commit writes an image
+
+static pthread_mutex_t journal_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t flush_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t journal_cond = PTHREAD_COND_INITIALIZER;
+
+typedef struct
+{
+    const char *data;
+    size_t len;
+    size_t pos;
+} RecordReader;
+
+static unsigned int journal_checksum(const char *data, size_t len)
+{
+    unsigned int hash = 2166136261u;
+    for (size_t i = 0; i < len; i++)
+    {
+        hash ^= (unsigned char)data[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static int buffer_put(RecordBuffer *buf, const void *ptr, size_t n)
+{
+    if (buf->len + n > buf->cap)
+    {
+        size_t new_cap = buf->cap ? buf->cap * 2 : 256;
+        while (new_cap < buf->len + n)
+            new_cap *= 2;
+        char *new_data = realloc(buf->data, new_cap);
+        if (!new_data)
+            return -1;
+        buf->data = new_data;
+        buf->cap = new_cap;
+    }
+    memcpy(buf->data + buf->len, ptr, n);
+    buf->len += n;
+    return 0;
+}
+
+static int reader_get(RecordReader *rd, void *ptr, size_t n)
+{
+    if (rd->pos + n > rd->len)
+        return -1;
+    memcpy(ptr, rd->data + rd->pos, n);
+    rd->pos += n;
+    return 0;
+}
+
+// Tag a fresh journal with the record layout it is written in. Returns the
+// bytes written.
+static long write_format_record(FILE *fp)
+{
+    unsigned int version = JOURNAL_VERSION;
+    JournalRecordHeader header;
+    header.op = JOURNAL_FORMAT;
+    header.length = sizeof(version);
+    header.checksum = journal_checksum((const char *)&version, sizeof(version));
+    if (fwrite(&header, sizeof(header), 1, fp) == 1 && fwrite(&version, sizeof(version), 1, fp) == 1)
+        return sizeof(header) + sizeof(version);
+    return 0;
+}
+
+// Write every buffered record to the journal with a single durable write.
+// Returns the number of records flushed.
+int journal_flush()
+{
+    pthread_mutex_lock(&flush_lock);
+
+    pthread_mutex_lock(&journal_lock);
+    RecordBuffer batch = pending;
+    int ops = pending_ops;
+    memset(&pending, 0, sizeof(pending));
+    pending_ops = 0;
+    pthread_mutex_unlock(&journal_lock);
+
+    // Page contents must be durable before the records that point at them
+    if (batch.len > 0 && volume_mode)
+        volume_sync();
+
+    if (batch.len > 0)
+    {
+        if (!journal_fp)
+        {
+            journal_fp = fopen(JOURNAL_FILE, "ab");
+            if (journal_fp)
+            {
+                fseek(journal_fp, 0, SEEK_END);
+                long size = ftell(journal_fp);
+                if (size == 0)
+                    size = write_format_record(journal_fp);
+                pthread_mutex_lock(&journal_lock);
+                journal_size = size;
+                pthread_mutex_unlock(&journal_lock);
+            }
+        }
+
+        if (journal_fp && fwrite(batch.data, 1, batch.len, journal_fp) == batch.len &&
+            fflush(journal_fp) == 0)
+        {
+            fdatasync(fileno(journal_fp));
+            pthread_mutex_lock(&journal_lock);
+            journal_size += batch.len;
+            pthread_mutex_unlock(&journal_lock);
+        }
+        else
+        {
+            // Keep the changes by folding them into the image at the next
+            // opportunity; journal_print_status() reports the failure
+            pthread_mutex_lock(&journal_lock);
+            write_failures++;
+            checkpoint_requested = 1;
+            pthread_cond_signal(&journal_cond);
+            pthread_mutex_unlock(&journal_lock);
+        }
+    }
+    free(batch.data);
+
+    pthread_mutex_unlock(&flush_lock);
+    return ops;
+}
+
+static void journal_append(JournalOp op, RecordBuffer *payload)
+{
+    JournalRecordHeader header;
+    header.op = op;
+    header.length = payload->len;
+    header.checksum = journal_checksum(payload->data, payload->len);
+
+    pthread_mutex_lock(&journal_lock);
+    if (batch_depth > 0)
+    {
+        // Held for the commit; once it must write an image they are not kept
+        batch_records++;
+        if (!batch_overflow)
+        {
+            buffer_put(&pending, &header, sizeof(header));
+            if (payload->len > 0)
+                buffer_put(&pending, payload->data, payload->len);
+            pending_ops++;
+        }
+        if (!batch_overflow && journal_size + (long)pending.len >= JOURNAL_CHECKPOINT_SIZE)
+        {
+            batch_overflow = 1;
+            free(pending.data);
+            memset(&pending, 0, sizeof(pending));
+            pending_ops = 0;
+        }
+        pthread_mutex_unlock(&journal_lock);
+        free(payload->data);
+        return;
+    }
+
+    buffer_put(&pending, &header, sizeof(header));
+    if (payload->len > 0)
+        buffer_put(&pending, payload->data, payload->len);
+    pending_ops++;
+
+    int flush_now = (durability == DURABILITY_PER_OP || !flusher_running);
+    int over_threshold = (journal_size + (long)pending.len >= JOURNAL_CHECKPOINT_SIZE);
+
+    // A checkpoint needs the filesystem lock exclusively, and the caller may
+    // hold it shared: the flusher runs checkpoints whenever it is up
+    int checkpoint_here = over_threshold && !flusher_running;
+    if (over_threshold && flusher_running)
+    {
+        checkpoint_requested = 1;
+        pthread_cond_signal(&journal_cond);
+    }
+    else if (!flush_now && durability == DURABILITY_PER_BATCH && pending_ops >= batch_ops)
+    {
+        pthread_cond_signal(&journal_cond);
+    }
+    pthread_mutex_unlock(&journal_lock);
+    free(payload->data);
+
+    if (checkpoint_here)
+        checkpoint_filesystem(); // No flusher: startup or shutdown, nothing runs alongside
+    else if (flush_now)
+        journal_flush(); // Synchronous commit
+}
+
+// Extents are stored after the File header, never as pointers
+static void put_file_header(RecordBuffer *buf, const File *file)
+{
+    File meta = *file;
+    meta.extents = NULL;
+    meta.link_target = NULL;
+    meta.data_offset = 0;
+    buffer_put(buf, &meta, sizeof(meta));
+
+    buffer_put(buf, &file->extent_count, sizeof(int));
+    if (file->extents && file->extent_count > 0)
+        buffer_put(buf, file->extents, file->extent_count * sizeof(Extent));
+}
+
+void journal_log_put_inode(const File *file, ino_t content_source)
+{
+    RecordBuffer buf = {0};
+    put_file_header(&buf, file);
+
+    int target_len = file->link_target ? (int)strlen(file->link_target) : 0;
+    buffer_put(&buf, &target_len, sizeof(int));
+    if (target_len > 0)
+        buffer_put(&buf, file->link_target, target_len);
+
+    buffer_put(&buf, &content_source, sizeof(ino_t));
+    journal_append(JOURNAL_PUT_INODE, &buf);
+}
+
+void journal_log_link(int dir_idx, const char *filename, ino_t inode)
+{
+    RecordBuffer buf = {0};
+    char name[MAX_FILENAME] = {0};
+    strncpy(name, filename, MAX_FILENAME - 1);
+    buffer_put(&buf, &dir_idx, sizeof(int));
+    buffer_put(&buf, name, MAX_FILENAME);
+    buffer_put(&buf, &inode, sizeof(ino_t));
+    journal_append(JOURNAL_LINK, &buf);
+}
+
+void journal_log_write(const File *file, int offset, const char *data, int len)
+{
+    RecordBuffer buf = {0};
+    buffer_put(&buf, &file->inode, sizeof(ino_t));
+    buffer_put(&buf, &offset, sizeof(int));
+    buffer_put(&buf, &file->modification_time, sizeof(time_t));
+
+    buffer_put(&buf, &file->extent_count, sizeof(int));
+    if (file->extents && file->extent_count > 0)
+        buffer_put(&buf, file->extents, file->extent_count * sizeof(Extent));
+
+    buffer_put(&buf, &len, sizeof(int));
+
+    // On a mapped volume the bytes are flushed with the pages, not logged
+    if (volume_mode)
+    {
+        journal_append(JOURNAL_WRITE_PAGES, &buf);
+        return;
+    }
+    if (len > 0)
+        buffer_put(&buf, data, len);
+    journal_append(JOURNAL_WRITE, &buf);
+}
+
+void journal_log_delete_file(int dir_idx, const char *filename)
+{
+    RecordBuffer buf = {0};
+    char name[MAX_FILENAME] = {0};
+    strncpy(name, filename, MAX_FILENAME - 1);
+    buffer_put(&buf, &dir_idx, sizeof(int));
+    buffer_put(&buf, name, MAX_FILENAME);
+    journal_append(JOURNAL_DELETE_FILE, &buf);
+}
+
+void journal_log_put_directory(int dir_idx)
+{
+    RecordBuffer buf = {0};
+    Directory *dir = &fs_state.directories[dir_idx];
+    buffer_put(&buf, &dir_idx, sizeof(int));
+    buffer_put(&buf, dir->dirname, MAX_FILENAME);
+    buffer_put(&buf, &dir->parent_directory, sizeof(int));
+    buffer_put(&buf, &dir->creation_time, sizeof(time_t));
+    buffer_put(&buf, &dir->inode, sizeof(ino_t));
+    journal_append(JOURNAL_PUT_DIRECTORY, &buf);
+}
+
+void journal_log_delete_directory(int dir_idx)
+{
+    RecordBuffer buf = {0};
+    buffer_put(&buf, &dir_idx, sizeof(int));
+    journal_append(JOURNAL_DELETE_DIRECTORY, &buf);
+}
+
+void journal_log_move_pages(const File *file)
+{
+    RecordBuffer buf = {0};
+    buffer_put(&buf, &file->inode, sizeof(ino_t));
+    buffer_put(&buf, &file->extent_count, sizeof(int));
+    if (file->extents && file->extent_count > 0)
+        buffer_put(&buf, file->extents, file->extent_count * sizeof(Extent));
+    journal_append(JOURNAL_MOVE_PAGES, &buf);
+}
+
+// Logical pages from index on, shared at source, were copied to fresh
+void journal_log_unshare(const File *file, int index, int source, const Extent *fresh,
+                         int fresh_count)
+{
+    RecordBuffer buf = {0};
+    buffer_put(&buf, &file->inode, sizeof(ino_t));
+    buffer_put(&buf, &index, sizeof(int));
+    buffer_put(&buf, &source, sizeof(int));
+    buffer_put(&buf, &fresh_count, sizeof(int));
+    buffer_put(&buf, fresh, fresh_count * sizeof(Extent));
+    journal_append(JOURNAL_UNSHARE, &buf);
+}
+
+// Replay helpers (operate on fs_state directly, never log)
+
+static Extent *read_extents(RecordReader *rd, int *count)
+{
+    if (reader_get(rd, count, sizeof(int)) != 0 || *count < 0)
+        return NULL;
+    if (*count == 0)
+        return NULL;
+
+    Extent *extents = malloc(*count * sizeof(Extent));
+    if (!extents || reader_get(rd, extents, *count * sizeof(Extent)) != 0)
+    {
+        free(extents);
+        *count = 0;
+        return NULL;
+    }
+    return extents;
+}
+
+// Give an inode its own copy of the replayed extents
+static void set_extents(File *file, const Extent *extents, int count)
+{
+    free(file->extents);
+    file->extents = NULL;
+    file->extent_count = 0;
+    file->page_count = 0;
+    if (count > 0)
+    {
+        file->extents = malloc(count * sizeof(Extent));
+        if (file->extents)
+        {
+            memcpy(file->extents, extents, count * sizeof(Extent));
+            file->extent_count = count;
+            file->page_count = extent_page_count(extents, count);
+        }
+    }
+}
+
+static int replay_put_inode(RecordReader *rd)
+{
+    File meta;
+    if (reader_get(rd, &meta, sizeof(File)) != 0 || meta.inode == 0)
+        return -1;
+
+    int extent_count = 0;
+    Extent *extents = read_extents(rd, &extent_count);
+
+    int target_len = 0;
+    char *target = NULL;
+    ino_t content_source = 0;
+    if (reader_get(rd, &target_len, sizeof(int)) != 0 || target_len < 0)
+    {
+        free(extents);
+        return -1;
+    }
+    if (target_len > 0)
+    {
+        target = calloc(target_len + 1, 1);
+        if (!target || reader_get(rd, target, target_len) != 0)
+        {
+            free(extents);
+            free(target);
+            return -1;
+        }
+    }
+    reader_get(rd, &content_source, sizeof(ino_t));
+
+    File *file = inode_get(meta.inode);
+    File *source = NULL;
+    int content_size = 0;
+    off_t data_offset = 0;
+    int links = 0;
+    if (file)
+    {
+        // Metadata update: keep the bytes (in the pages or still in the image)
+        content_size = file->content_size;
+        data_offset = file->data_offset;
+        links = file->ref_count;
+        free(file->extents);
+        free(file->link_target);
+    }
+    else
+    {
+        file = inode_alloc(meta.inode);
+        if (!file)
+        {
+            free(extents);
+            free(target);
+            return -1;
+        }
+        source = content_source ? inode_get(content_source) : NULL;
+        if (source && load_file_content(source) == 0)
+            content_size = source->content_size;
+        else
+            source = NULL;
+    }
+
+    // The link count follows the replayed entries, not the logged value
+    *file = meta;
+    file->ref_count = links;
+    file->content_size = content_size;
+    file->data_offset = data_offset;
+    file->extents = extents;
+    file->extent_count = extent_count;
+    file->page_count = extent_page_count(extents, extent_count);
+    file->link_target = target;
+
+    // A copy starts with the source's bytes in its own pages
+    if (source)
+        volume_copy_pages(source, file);
+    return 0;
+}
+
+static int replay_link(RecordReader *rd)
+{
+    int dir_idx;
+    char name[MAX_FILENAME];
+    ino_t inode;
+    if (reader_get(rd, &dir_idx, sizeof(int)) != 0 || reader_get(rd, name, MAX_FILENAME) != 0 ||
+        reader_get(rd, &inode, sizeof(ino_t)) != 0)
+        return -1;
+    name[MAX_FILENAME - 1] = '\0';
+
+    File *file = inode_get(inode);
+    Directory *dir = dir_get(dir_idx);
+    if (!file || !dir || !dir_insert(dir, name, inode))
+        return -1;
+    file->ref_count++;
+    return 0;
+}
+
+static int replay_write(RecordReader *rd)
+{
+    ino_t inode;
+    int offset, len;
+    time_t mtime;
+    if (reader_get(rd, &inode, sizeof(ino_t)) != 0 ||
+        reader_get(rd, &offset, sizeof(int)) != 0 ||
+        reader_get(rd, &mtime, sizeof(time_t)) != 0)
+        return -1;
+
+    int extent_count = 0;
+    Extent *extents = read_extents(rd, &extent_count);
+    if (reader_get(rd, &len, sizeof(int)) != 0 || len < 0 || offset < 0 ||
+        rd->pos + len > rd->len)
+    {
+        free(extents);
+        return -1;
+    }
+    const char *data = rd->data + rd->pos;
+    rd->pos += len;
+
+    // Hard links share the inode, so one update covers them all
+    File *file = inode_get(inode);
+    if (file && !file->is_symlink)
+    {
+        // Bytes before the offset may still be in the image
+        if (offset > 0)
+            load_file_content(file);
+
+        // Pages copied on write were copied by their JOURNAL_UNSHARE records
+        file->data_offset = 0;
+        file->content_size = offset + len;
+        file->size = offset + len;
+        file->modification_time = mtime;
+
+        set_extents(file, extents, extent_count);
+        volume_write(file, offset, data, len);
+    }
+    free(extents);
+    return 0;
+}
+
+static int replay_move_pages(RecordReader *rd)
+{
+    ino_t inode;
+    if (reader_get(rd, &inode, sizeof(ino_t)) != 0)
+        return -1;
+    int extent_count = 0;
+    Extent *extents = read_extents(rd, &extent_count);
+
+    File *file = inode_get(inode);
+    if (!file || file->is_symlink)
+    {
+        free(extents);
+        return 0;
+    }
+
+    // A mapped volume already holds the bytes at their new pages. Replayed
+    // in-memory bytes were written at the old pages and move with them.
+    if (!volume_mode && file->data_offset == 0)
+    {
+        File moved = *file;
+        moved.extents = extents;
+        moved.extent_count = extent_count;
+        moved.page_count = extent_page_count(extents, extent_count);
+        volume_copy_pages(file, &moved);
+    }
+
+    set_extents(file, extents, extent_count);
+    free(extents);
+    return 0;
+}
+
+// Redo a copy on write at its place in the log: the shared pages still hold
+// what both files had, as the other owner only writes them once released
+static int replay_unshare(RecordReader *rd)
+{
+    ino_t inode;
+    int index, source;
+    if (reader_get(rd, &inode, sizeof(ino_t)) != 0 || reader_get(rd, &index, sizeof(int)) != 0 ||
+        reader_get(rd, &source, sizeof(int)) != 0)
+        return -1;
+    int fresh_count = 0;
+    Extent *fresh = read_extents(rd, &fresh_count);
+    if (!fresh || index < 0 || source < 0)
+    {
+        free(fresh);
+        return -1;
+    }
+
+    File *file = inode_get(inode);
+    if (!file || file->is_symlink)
+    {
+        free(fresh);
+        return 0;
+    }
+
+    // A mapped volume already holds the copies
+    int length = extent_page_count(fresh, fresh_count);
+    if (!volume_mode)
+    {
+        load_file_content(file);
+        int done = 0;
+        for (int f = 0; f < fresh_count; f++)
+        {
+            char *from = volume_page(source + done);
+            char *to = volume_page(fresh[f].start_page);
+            if (from && to)
+                memcpy(to, from, (size_t)fresh[f].length * PAGE_SIZE);
+            done += fresh[f].length;
+        }
+    }
+
+    int result = splice_extents(&file->extents, &file->extent_count, index, length, fresh, fresh_count);
+    file->page_count = extent_page_count(file->extents, file->extent_count);
+    free(fresh);
+    return result;
+}
+
+static int replay_write_pages(RecordReader *rd)
+{
+    ino_t inode;
+    int offset, len;
+    time_t mtime;
+    if (reader_get(rd, &inode, sizeof(ino_t)) != 0 ||
+        reader_get(rd, &offset, sizeof(int)) != 0 ||
+        reader_get(rd, &mtime, sizeof(time_t)) != 0)
+        return -1;
+
+    int extent_count = 0;
+    Extent *extents = read_extents(rd, &extent_count);
+    if (reader_get(rd, &len, sizeof(int)) != 0 || len < 0 || offset < 0)
+    {
+        free(extents);
+        return -1;
+    }
+
+    File *file = inode_get(inode);
+    if (file && !file->is_symlink)
+    {
+        file->content_size = offset + len;
+        file->size = offset + len;
+        file->modification_time = mtime;
+
+        set_extents(file, extents, extent_count);
+    }
+    free(extents);
+    return 0;
+}
+
+// Drop entry index of a directory; the inode goes with its last link.
+// Pages are released by rebuild_page_bitmap() once replay finishes.
+static void unlink_entry(Directory *dir, int index)
+{
+    File *file = inode_get(dir->files[index]->inode);
+    if (file && --file->ref_count <= 0)
+    {
+        inode_lock(file, 1);
+        inode_free(file);
+    }
+    dir_remove(dir, index);
+}
+
+static int replay_delete_file(RecordReader *rd)
+{
+    int dir_idx;
+    char name[MAX_FILENAME];
+    if (reader_get(rd, &dir_idx, sizeof(int)) != 0 || reader_get(rd, name, MAX_FILENAME) != 0)
+        return -1;
+    name[MAX_FILENAME - 1] = '\0';
+
+    Directory *dir = dir_get(dir_idx);
+    if (!dir)
+        return 0;
+    int index = dir_lookup(dir, name);
+    if (index >= 0)
+        unlink_entry(dir, index);
+    return 0;
+}
+
+static int replay_put_directory(RecordReader *rd)
+{
+    int dir_idx, parent;
+    char name[MAX_FILENAME];
+    time_t created;
+    ino_t inode;
+    if (reader_get(rd, &dir_idx, sizeof(int)) != 0 ||
+        reader_get(rd, name, MAX_FILENAME) != 0 ||
+        reader_get(rd, &parent, sizeof(int)) != 0 ||
+        reader_get(rd, &created, sizeof(time_t)) != 0 ||
+        reader_get(rd, &inode, sizeof(ino_t)) != 0)
+        return -1;
+    name[MAX_FILENAME - 1] = '\0';
+    if (!name[0])
+        return -1;
+
+    // Created, renamed or moved: reindex it under its (new) parent
+    Directory *dir = dir_table_claim(dir_idx);
+    if (!dir)
+        return -1;
+    dir_detach(dir_idx);
+    memcpy(dir->dirname, name, MAX_FILENAME);
+    dir->creation_time = created;
+    dir->inode = inode;
+    if (parent >= 0 && dir_attach(parent, dir_idx) != 0)
+        return -1;
+    return 0;
+}
+
+static int replay_delete_directory(RecordReader *rd)
+{
+    int dir_idx;
+    if (reader_get(rd, &dir_idx, sizeof(int)) != 0)
+        return -1;
+    Directory *dir = dir_get(dir_idx);
+    if (!dir)
+        return -1;
+
+    while (dir->file_count > 0)
+        unlink_entry(dir, dir->file_count - 1);
+    dir_table_release(dir_idx);
+    return 0;
+}
+
+// Replay the journal over the state loaded from the image.
+// Returns the number of records applied; a torn or corrupt tail is ignored.
+int journal_replay()
+{
+    FILE *fp = fopen(JOURNAL_FILE, "rb");
+    if (!fp)
+        return 0;
+
+    // Records written by a build with another File layout cannot be decoded;
+    // keep them aside instead of replaying garbage over the image
+    JournalRecordHeader header;
+    unsigned int version = 0;
+    if (fread(&header, sizeof(header), 1, fp) == 1)
+    {
+        if (header.op != JOURNAL_FORMAT || header.length != sizeof(version) ||
+            fread(&version, sizeof(version), 1, fp) != 1 || version != JOURNAL_VERSION)
+        {
+            fclose(fp);
+            rename(JOURNAL_FILE, JOURNAL_FILE ".old");
+            printf(COLOR_YELLOW "Journal: unsupported record format, moved to %s\n" COLOR_RESET,
+                   JOURNAL_FILE ".old");
+            return 0;
+        }
+    }
+
+    int applied = 0;
+    while (fread(&header, sizeof(header), 1, fp) == 1)
+    {
+        char *payload = malloc(header.length ? header.length : 1);
+        if (!payload)
+            break;
+        if (header.length > 0 && fread(payload, 1, header.length, fp) != header.length)
+        {
+            free(payload);
+            break;
+        }
+        if (journal_checksum(payload, header.length) != header.checksum)
+        {
+            printf(COLOR_YELLOW "Journal: stopping at corrupt record %d\n" COLOR_RESET, applied + 1);
+            free(payload);
+            break;
+        }
+
+        RecordReader rd = {payload, header.length, 0};
+        int result = -1;
+        switch (header.op)
+        {
+        case JOURNAL_PUT_INODE:
+            result = replay_put_inode(&rd);
+            break;
+        case JOURNAL_LINK:
+            result = replay_link(&rd);
+            break;
+        case JOURNAL_WRITE:
+            result = replay_write(&rd);
+            break;
+        case JOURNAL_WRITE_PAGES:
+            result = replay_write_pages(&rd);
+            break;
+        case JOURNAL_MOVE_PAGES:
+            result = replay_move_pages(&rd);
+            break;
+        case JOURNAL_UNSHARE:
+            result = replay_unshare(&rd);
+            break;
+        case JOURNAL_DELETE_FILE:
+            result = replay_delete_file(&rd);
+            break;
+        case JOURNAL_PUT_DIRECTORY:
+            result = replay_put_directory(&rd);
+            break;
+        case JOURNAL_DELETE_DIRECTORY:
+            result = replay_delete_directory(&rd);
+            break;
+        }
+        free(payload);
+        if (result != 0)
+        {
+            printf(COLOR_YELLOW "Journal: skipping malformed record %d\n" COLOR_RESET, applied + 1);
+            continue;
+        }
+        applied++;
+    }
+    fclose(fp);
+
+    if (applied > 0)
+    {
+        // Page ownership is fully described by the replayed extents
+        rebuild_page_bitmap();
+        printf("Replayed %d journal records\n", applied);
+    }
+    return applied;
+}
+
+// Discard all journal records, written or pending (the image now contains them)
+void journal_reset()
+{
+    pthread_mutex_lock(&flush_lock);
+    pthread_mutex_lock(&journal_lock);
+    if (journal_fp)
+    {
+        fclose(journal_fp);
+        journal_fp = NULL;
+    }
+    FILE *fp = fopen(JOURNAL_FILE, "wb");
+    if (fp)
+        fclose(fp);
+    journal_size = 0;
+
+    free(pending.data);
+    memset(&pending, 0, sizeof(pending));
+    pending_ops = 0;
+    checkpoint_requested = 0;
+    batch_overflow = 0;
+    pthread_mutex_unlock(&journal_lock);
+    pthread_mutex_unlock(&flush_lock);
+}
+
+// Fold the journal into the image: write a full image, then truncate the journal.
+// Records are idempotent, so a crash between the two steps only replays them again.
+void checkpoint_filesystem()
+{
+    save_state();
+    journal_reset();
+}
+
+// Background flusher: commits buffered records once per interval, or as soon
+// as a batch fills up, and runs checkpoints requested by journal_append().
+void *journal_flusher(void *arg)
+{
+    (void)arg;
+
+    pthread_mutex_lock(&journal_lock);
+    flusher_running = 1;
+    while (flusher_running)
+    {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += flush_interval_ms / 1000;
+        deadline.tv_nsec += (long)(flush_interval_ms % 1000) * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L)
+        {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+        pthread_cond_timedwait(&journal_cond, &journal_lock, &deadline);
+
+        int do_checkpoint = checkpoint_requested;
+        int has_pending = pending_ops > 0 && batch_depth == 0;
+        pthread_mutex_unlock(&journal_lock);
+
+        if (do_checkpoint)
+        {
+            pthread_rwlock_wrlock(&fs_lock);
+            checkpoint_filesystem();
+            pthread_rwlock_unlock(&fs_lock);
+        }
+        else if (has_pending)
+        {
+            journal_flush();
+        }
+
+        pthread_mutex_lock(&journal_lock);
+    }
+    pthread_mutex_unlock(&journal_lock);
+    return NULL;
+}
+
+void journal_begin()
+{
+    pthread_mutex_lock(&journal_lock);
+    int outermost = batch_depth == 0;
+    pthread_mutex_unlock(&journal_lock);
+
+    // Records from before keep the durability they were logged with
+    if (outermost)
+        journal_flush();
+
+    pthread_mutex_lock(&journal_lock);
+    if (batch_depth++ == 0)
+        batch_records = 0;
+    pthread_mutex_unlock(&journal_lock);
+}
+
+int journal_commit(int *records)
+{
+    // Exclusive, so nothing is logged between closing the batch and writing it
+    pthread_rwlock_wrlock(&fs_lock);
+    pthread_mutex_lock(&journal_lock);
+    int depth = batch_depth - 1;
+    if (depth >= 0)
+        batch_depth = depth;
+    if (records)
+        *records = batch_records;
+    int overflow = batch_overflow;
+    pthread_mutex_unlock(&journal_lock);
+
+    if (depth == 0 && overflow)
+        checkpoint_filesystem();
+    else if (depth == 0)
+        journal_flush();
+    pthread_rwlock_unlock(&fs_lock);
+    return depth;
+}
+
+// Stop group commit and make everything buffered durable
+void journal_shutdown()
+{
+    // An open batch was applied, so it is committed rather than dropped
+    pthread_mutex_lock(&journal_lock);
+    int open = batch_depth > 0;
+    if (open)
+        batch_depth = 1;
+    pthread_mutex_unlock(&journal_lock);
+    if (open)
+        journal_commit(NULL);
+
+    pthread_mutex_lock(&journal_lock);
+    flusher_running = 0;
+    pthread_cond_signal(&journal_cond);
+    pthread_mutex_unlock(&journal_lock);
+    journal_flush();
+}
+
+void journal_set_durability(int mode, int value)
+{
+    pthread_mutex_lock(&journal_lock);
+    durability = mode;
+    if (value > 0)
+    {
+        if (mode == DURABILITY_PER_BATCH)
+            batch_ops = value;
+        else if (mode == DURABILITY_INTERVAL)
+            flush_interval_ms = value;
+    }
+    pthread_cond_signal(&journal_cond);
+    pthread_mutex_unlock(&journal_lock);
+
+    // Switching to per-op must not leave earlier records behind
+    if (mode == DURABILITY_PER_OP)
+        journal_flush();
+}
+
+void journal_print_status()
+{
+    static const char *names[] = {"", "op", "batch", "interval"};
+
+    pthread_mutex_lock(&journal_lock);
+    printf("Durability: %s", names[durability]);
+    if (durability == DURABILITY_PER_BATCH)
+        printf(" (%d ops or %d ms)", batch_ops, flush_interval_ms);
+    else if (durability == DURABILITY_INTERVAL)
+        printf(" (%d ms)", flush_interval_ms);
+    printf("\nPending operations: %d (%zu bytes)\n", pending_ops, pending.len);
+    if (batch_depth > 0)
+        printf("Batch open: %d operations, committed %s\n", batch_records,
+               batch_overflow ? "as a full image" : "with one flush");
+    printf("Journal size: %ld bytes\n", journal_size);
+    if (write_failures > 0)
+        printf(COLOR_RED "Journal writes failed: %d, changes kept by checkpoints instead\n" COLOR_RESET,
+               write_failures);
+    pthread_mutex_unlock(&journal_lock);
+}
@@ -0,0 +1,59 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "../include/lockorder.h"
+
+#ifdef LOCK_DEBUG
+
+#define LOCK_ORDER_DEPTH 16 // Locks one thread may hold at once
+
+typedef struct
+{
+    LockClass lock_class;
+    unsigned long key;
+} HeldLock;
+
+static __thread HeldLock held[LOCK_ORDER_DEPTH];
+static __thread int held_count = 0;
+
+static const char *class_name(LockClass lock_class)
+{
+    return lock_class == LOCK_DIRECTORY ? "directory" : "inode";
+}
+
+// Every lock held must rank strictly before the one being taken
+void lock_order_acquire(LockClass lock_class, unsigned long key)
+{
+    for (int i = 0; i < held_count; i++)
+    {
+        if (held[i].lock_class < lock_class || (held[i].lock_class == lock_class && held[i].key < key))
+            continue;
+        fprintf(stderr, "Lock order violation: taking %s lock %lu while holding %s lock %lu\n",
+                class_name(lock_class), key, class_name(held[i].lock_class), held[i].key);
+        abort();
+    }
+    if (held_count == LOCK_ORDER_DEPTH)
+    {
+        fprintf(stderr, "Lock order checker: more than %d locks held\n", LOCK_ORDER_DEPTH);
+        abort();
+    }
+    held[held_count].lock_class = lock_class;
+    held[held_count].key = key;
+    held_count++;
+}
+
+void lock_order_release(LockClass lock_class, unsigned long key)
+{
+    for (int i = held_count - 1; i >= 0; i--)
+    {
+        if (held[i].lock_class == lock_class && held[i].key == key)
+        {
+            held[i] = held[--held_count];
+            return;
+        }
+    }
+    fprintf(stderr, "Lock order checker: releasing %s lock %lu, which is not held\n",
+            class_name(lock_class), key);
+    abort();
+}
+
+#endif // LOCK_DEBUG
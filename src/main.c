@@ -2,16 +2,112 @@
 #include "../include/scheduler.h"
 #include "../include/commands.h"
 #include "../include/globals.h"
+#include "../include/directory.h"
+#include "../include/dcache.h"
+#include "../include/journal.h"
+#include "../include/defrag.h"
+#include "../include/pipeline.h"
 
 
-int main()
+// Run one line of input, as typed or read from a script
+static void run_line(char *input, int user_index)
 {
+    if (strcmp(input, "quit") == 0)
+    {
+        handle_signal(SIGINT);
+    }
+    else if (strchr(input, '|') != NULL && pipeline_run(input))
+    {
+        // Stages streamed into each other and have all finished
+    }
+    else if (strchr(input, '|') != NULL)
+    {
+        // Otherwise each part is queued as its own command
+        char *token = strtok(input, "|");
+        while (token != NULL)
+        {
+            while (*token == ' ')
+                token++;
+            char *end = token + strlen(token) - 1;
+            while (end > token && *end == ' ')
+                end--;
+            *(end + 1) = '\0';
+            add_job(token, user_index);
+            token = strtok(NULL, "|");
+        }
+    }
+    else
+    {
+        // For single commands, execute immediately without queue
+        Job job = {input};
+        execute_job(job);
+    }
+}
+
+// Every line of script after one login, as a single batch: changes become
+// durable together at the end instead of command by command
+static int run_batch(FILE *script, int user_index)
+{
+    char input[256];
+    int commands = 0;
+
+    journal_begin();
+    while (fgets(input, sizeof(input), script))
+    {
+        input[strcspn(input, "\n")] = 0;
+        if (input[0] == '\0' || input[0] == '#')
+            continue;
+        run_line(input, user_index);
+        commands++;
+    }
+    fclose(script);
+
+    // Queued parts of pipelines belong to the batch too
+    scheduler_drain(user_index);
+
+    // Batches the script left open close with it
+    int records = 0;
+    int open = journal_commit(&records);
+    while (open > 0)
+        open = journal_commit(&records);
+
+    if (open < 0) // The script committed the batch itself
+        printf(COLOR_GREEN "Batch done: %d commands\n" COLOR_RESET, commands);
+    else
+        printf(COLOR_GREEN "Batch done: %d commands, %d operations committed\n" COLOR_RESET, commands, records);
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    FILE *script = NULL;
+    if (argc == 3 && strcmp(argv[1], "--batch") == 0)
+    {
+        script = fopen(argv[2], "r");
+        if (!script)
+        {
+            printf(COLOR_RED "Error: Could not open script '%s'\n" COLOR_RESET, argv[2]);
+            return 1;
+        }
+    }
+    else if (argc != 1)
+    {
+        printf("Usage: %s [--batch <script>]\n", argv[0]);
+        return 1;
+    }
+
     signal(SIGINT, handle_signal);
-    pthread_t scheduler_thread;
-    pthread_create(&scheduler_thread, NULL, scheduler, NULL);
+    scheduler_start(execute_job);
 
+    // Loading replays and may checkpoint without the filesystem lock, so
+    // nothing else touches the state until it is done
     load_state(); // Load previous state or initialize
 
+    pthread_t flusher_thread;
+    pthread_create(&flusher_thread, NULL, journal_flusher, NULL);
+    pthread_t defrag_thread;
+    pthread_create(&defrag_thread, NULL, defrag_worker, NULL);
+
     int user_index = login();
     if (user_index == -1)
     {
@@ -19,15 +115,31 @@ int main()
         return 1;
     }
 
+    if (script)
+    {
+        int result = run_batch(script, user_index);
+        cleanup();
+        return result;
+    }
+
     printf(COLOR_GREEN "\nWelcome to the Mini UNIX-like File System!\n" COLOR_RESET);
     printf("Type 'help' for a list of commands\n\n");
 
     char input[256];
     while (1)
     {
+        // Queued commands may be changing the tree meanwhile
+        char dirname[MAX_FILENAME];
+        unsigned int generation;
+        do
+        {
+            generation = read_begin();
+            Directory *cwd = dir_get(fs_state.current_directory);
+            snprintf(dirname, sizeof(dirname), "%s", cwd ? cwd->dirname : "");
+            read_end();
+        } while (dcache_reshaped(generation));
         printf(COLOR_BLUE "%s@%s> " COLOR_RESET,
-               fs_state.users[user_index].username,
-               fs_state.directories[fs_state.current_directory].dirname);
+               fs_state.users[user_index].username, dirname);
         fflush(stdout);
 
         if (!fgets(input, sizeof(input), stdin))
@@ -36,34 +148,8 @@ int main()
         }
 
         input[strcspn(input, "\n")] = 0;
-
-        if (strcmp(input, "quit") == 0)
-        {
-            handle_signal(SIGINT);
-        }
-        else if (strchr(input, '|') != NULL)
-        {
-            // Handle piped commands
-            char *token = strtok(input, "|");
-            while (token != NULL)
-            {
-                while (*token == ' ')
-                    token++;
-                char *end = token + strlen(token) - 1;
-                while (end > token && *end == ' ')
-                    end--;
-                *(end + 1) = '\0';
-                add_job(token);
-                token = strtok(NULL, "|");
-            }
-        }
-        else
-        {
-            // For single commands, execute immediately without queue
-            Job job;
-            job.command = strdup(input);
-            execute_job(job);
-        }
+        run_line(input, user_index);
     }
+    cleanup();
     return 0;
-}
\ No newline at end of file
+}
@@ -1,113 +1,768 @@
+#include <errno.h>
 #include "../include/paging.h"
 #include "../include/filesystem.h"
 #include "../include/globals.h"
+#include "../include/inode.h"
 
-// Initialize paging system
-void initialize_paging() {
-    memset(page_bitmap, 0, TOTAL_PAGES / 8);
+// Free-space index over page_bitmap: an implicit binary tree whose leaves
+// summarize INDEX_LEAF_WORDS bitmap words and whose nodes keep the free run
+// at each end of their span plus the longest run inside it. Finding a run
+// of N pages walks one root-to-leaf path, whatever the volume size.
+typedef struct
+{
+    int prefix;  // Free pages at the start of the span
+    int suffix;  // Free pages at the end of the span
+    int longest; // Longest free run within the span
+} FreeSpan;
+
+#define LEAF_PAGES (INDEX_LEAF_WORDS * 64)
+
+static FreeSpan *free_index = NULL; // Node i has children 2i and 2i + 1
+static int index_leaves = 0;        // Power of two; leaf i is node index_leaves + i
+static int bitmap_pages = 0;        // Pages page_bitmap is allocated for
+static int free_page_count = 0;
+
+// Pages owned by more than one file (copy-on-write clones), kept as sorted,
+// non-overlapping runs with the number of owners beyond the first. Pages
+// not covered by a run have a single owner when their bitmap bit is set.
+typedef struct
+{
+    int start;
+    int length;
+    int extra; // Owners beyond the first
+} SharedRun;
+
+static SharedRun *shared_runs = NULL;
+static int shared_count = 0;
+static int shared_capacity = 0;
+
+// Writers to different files allocate and release pages concurrently, so
+// the functions they call take this lock. Setup (initialize, resize,
+// rebuild, bitmap import) runs under the exclusive filesystem lock, and
+// the free-space totals are read under it or under this one.
+static pthread_mutex_t alloc_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Bits past total_pages in the last word are never handed out
+static uint64_t word_mask(int word)
+{
+    int bits = total_pages - word * 64;
+    return bits >= 64 ? ~0ULL : ((1ULL << bits) - 1);
 }
 
-void free_pages(File *file) {
-    if (!file || !file->page_table) return;
-    
-    for (int i = 0; i < file->page_table_size; i++) {
-        int page_num = file->page_table[i].physical_page;
-        page_bitmap[page_num / 8] &= ~(1 << (page_num % 8));
-    }
-    file->page_table_size = 0;
+static uint64_t free_bits(int word)
+{
+    return word < BITMAP_WORDS ? ~page_bitmap[word] & word_mask(word) : 0;
 }
 
-// Add this to your file system code
-void print_page_table(const char *filename)
+static FreeSpan combine(FreeSpan left, int left_span, FreeSpan right, int right_span)
 {
-    pthread_mutex_lock(&mutex);
+    FreeSpan span;
+    span.prefix = left.prefix == left_span ? left_span + right.prefix : left.prefix;
+    span.suffix = right.suffix == right_span ? right_span + left.suffix : right.suffix;
+    span.longest = left.suffix + right.prefix;
+    if (left.longest > span.longest)
+        span.longest = left.longest;
+    if (right.longest > span.longest)
+        span.longest = right.longest;
+    return span;
+}
 
-    File *file = NULL;
-    for (int i = 0; i < fs_state.directories[fs_state.current_directory].file_count; i++)
+// Bit p of x stays set while pages p .. p + n - 1 are free: double n while
+// such runs exist, then binary-search the remainder
+static int longest_run(uint64_t x)
+{
+    if (!x)
+        return 0;
+    int n = 1;
+    while (n < 64 && (x & (x >> n)))
+    {
+        x &= x >> n;
+        n *= 2;
+    }
+    for (int step = n / 2; step > 0; step /= 2)
     {
-        if (strcmp(fs_state.directories[fs_state.current_directory].files[i].filename, filename) == 0)
+        uint64_t y = x & (x >> step);
+        if (y)
         {
-            file = &fs_state.directories[fs_state.current_directory].files[i];
-            break;
+            x = y;
+            n += step;
         }
     }
+    return n;
+}
 
-    if (!file)
+static FreeSpan word_span(int word)
+{
+    uint64_t bits = free_bits(word);
+    FreeSpan span = {64, 64, 64};
+    if (bits != ~0ULL)
     {
-        printf(COLOR_RED "File not found: %s\n" COLOR_RESET, filename);
-        pthread_mutex_unlock(&mutex);
-        return;
+        span.prefix = __builtin_ctzll(~bits);
+        span.suffix = __builtin_clzll(~bits);
+        span.longest = longest_run(bits);
     }
+    return span;
+}
 
-    printf("\nPage Table for %s (Size: %d bytes, Pages: %d):\n",
-           filename, file->size, file->page_table_size);
-    printf("----------------------------------------\n");
-    printf("Page | Physical Page | Status\n");
-    printf("-----|---------------|--------\n");
+// Recompute the leaves covering words [first_word, last_word] and their ancestors
+static void index_update(int first_word, int last_word)
+{
+    int lo = first_word / INDEX_LEAF_WORDS, hi = last_word / INDEX_LEAF_WORDS;
+    for (int leaf = lo; leaf <= hi; leaf++)
+    {
+        int word = leaf * INDEX_LEAF_WORDS;
+        FreeSpan span = word_span(word);
+        for (int w = 1; w < INDEX_LEAF_WORDS; w++)
+            span = combine(span, w * 64, word_span(word + w), 64);
+        free_index[index_leaves + leaf] = span;
+    }
 
-    for (int i = 0; i < file->page_table_size; i++)
+    int child_span = LEAF_PAGES;
+    for (lo = (lo + index_leaves) / 2, hi = (hi + index_leaves) / 2; lo >= 1; lo /= 2, hi /= 2)
     {
-        printf("%4d | %13d | %s\n",
-               i,
-               file->page_table[i].physical_page,
-               file->page_table[i].is_allocated ? "Allocated" : "Free");
+        for (int node = lo; node <= hi; node++)
+            free_index[node] = combine(free_index[2 * node], child_span, free_index[2 * node + 1], child_span);
+        child_span *= 2;
     }
+}
 
-    pthread_mutex_unlock(&mutex);
+static void index_build()
+{
+    index_update(0, index_leaves * INDEX_LEAF_WORDS - 1);
 }
 
-void print_page_bitmap()
+static void recount_free_pages()
 {
-    pthread_mutex_lock(&mutex);
+    int used = 0;
+    for (int w = 0; w < BITMAP_WORDS; w++)
+        used += __builtin_popcountll(page_bitmap[w] & word_mask(w));
+    free_page_count = total_pages - used;
+}
 
-    printf("\nPage Allocation Bitmap:\n");
-    printf("----------------------\n");
+// Allocate an empty bitmap and index for a volume of the given size
+static int resize_bitmap(int pages)
+{
+    int words = (pages + 63) / 64;
+    int leaves = 1;
+    while (leaves * INDEX_LEAF_WORDS < words)
+        leaves *= 2;
 
-    for (int i = 0; i < TOTAL_PAGES; i++)
+    uint64_t *bitmap = calloc(words, sizeof(uint64_t));
+    FreeSpan *index = calloc(2 * leaves, sizeof(FreeSpan));
+    if (!bitmap || !index)
     {
-        if (i % 64 == 0)
-            printf("\n%04d: ", i);
-        printf("%c", (page_bitmap[i / 8] & (1 << (i % 8))) ? 'X' : '.');
+        free(bitmap);
+        free(index);
+        return -1;
     }
+    free(page_bitmap);
+    free(free_index);
+    page_bitmap = bitmap;
+    free_index = index;
+    index_leaves = leaves;
+    bitmap_pages = pages;
+    total_pages = pages;
+    return 0;
+}
 
-    printf("\n\nX = Allocated, . = Free\n");
-    pthread_mutex_unlock(&mutex);
+// Initialize paging system
+void initialize_paging() {
+    if (bitmap_pages != total_pages && resize_bitmap(total_pages) != 0) {
+        printf(COLOR_RED "Error: Could not allocate page bitmap\n" COLOR_RESET);
+        return;
+    }
+    memset(page_bitmap, 0, sizeof(page_bitmap[0]) * BITMAP_WORDS);
+    free_page_count = total_pages;
+    shared_count = 0;
+    index_build();
 }
 
-// Allocate pages for a file
-int allocate_pages(int pages_needed, PageTableEntry **page_table)
-{
-    *page_table = malloc(pages_needed * sizeof(PageTableEntry));
-    if (*page_table == NULL)
-    {
+// Change the volume size; every page becomes free. -1, keeping the old
+// size, when out of range or out of memory
+int paging_set_total(int pages) {
+    if (pages <= 0 || pages > MAX_TOTAL_PAGES)
         return -1;
+    if (pages != bitmap_pages && resize_bitmap(pages) != 0)
+        return -1;
+    initialize_paging();
+    return 0;
+}
+
+int page_is_used(int page) {
+    return (page_bitmap[page / 64] >> (page % 64)) & 1;
+}
+
+void mark_page_used(int page) {
+    if (page < 0 || page >= total_pages || page_is_used(page)) return;
+    page_bitmap[page / 64] |= 1ULL << (page % 64);
+    free_page_count--;
+    index_update(page / 64, page / 64);
+}
+
+void mark_page_free(int page) {
+    if (page < 0 || page >= total_pages || !page_is_used(page)) return;
+    page_bitmap[page / 64] &= ~(1ULL << (page % 64));
+    free_page_count++;
+    index_update(page / 64, page / 64);
+}
+
+int free_page_total() {
+    return free_page_count;
+}
+
+int largest_free_run() {
+    return free_index ? free_index[1].longest : 0;
+}
+
+// Set or clear pages [start, start + length) a word at a time, keeping the free count
+static void set_range(int start, int length, int used) {
+    if (length <= 0)
+        return;
+    int page = start, end = start + length;
+    while (page < end) {
+        int w = page / 64, off = page % 64;
+        int bits = 64 - off < end - page ? 64 - off : end - page;
+        uint64_t mask = (bits == 64 ? ~0ULL : ((1ULL << bits) - 1)) << off;
+        int changed = __builtin_popcountll(used ? (mask & ~page_bitmap[w]) : (mask & page_bitmap[w]));
+        if (used) {
+            page_bitmap[w] |= mask;
+            free_page_count -= changed;
+        } else {
+            page_bitmap[w] &= ~mask;
+            free_page_count += changed;
+        }
+        page += bits;
     }
+    index_update(start / 64, (end - 1) / 64);
+}
 
-    for (int i = 0; i < pages_needed; i++)
-    {
-        int page = -1;
-        for (int j = 0; j < TOTAL_PAGES; j++)
-        {
-            if (!(page_bitmap[j / 8] & (1 << (j % 8))))
-            {
-                page_bitmap[j / 8] |= (1 << (j % 8));
-                (*page_table)[i].physical_page = j;
-                (*page_table)[i].is_allocated = 1;
-                page = j;
-                break;
+// Length of the free run starting at page, capped at max
+static int free_run_at(int page, int max) {
+    int run = 0;
+    while (run < max && page < total_pages) {
+        int off = page % 64;
+        uint64_t used = ~free_bits(page / 64) >> off;
+        int bits = used ? __builtin_ctzll(used) : 64 - off;
+        run += bits;
+        page += bits;
+        if (used)
+            break;
+    }
+    return run < max ? run : max;
+}
+
+// Length of the used run starting at page, capped at max
+static int used_run_at(int page, int max) {
+    int run = 0;
+    while (run < max && page < total_pages) {
+        int off = page % 64;
+        uint64_t free = free_bits(page / 64) >> off;
+        int bits = free ? __builtin_ctzll(free) : 64 - off;
+        run += bits;
+        page += bits;
+        if (free)
+            break;
+    }
+    return run < max ? run : max;
+}
+
+// Index of the first shared run that ends after page
+static int shared_lower_bound(int page) {
+    int lo = 0, hi = shared_count;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (shared_runs[mid].start + shared_runs[mid].length <= page)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+static int shared_insert(int at, int start, int length, int extra) {
+    if (shared_count == shared_capacity) {
+        int capacity = shared_capacity ? shared_capacity * 2 : 16;
+        SharedRun *runs = realloc(shared_runs, capacity * sizeof(SharedRun));
+        if (!runs)
+            return -1;
+        shared_runs = runs;
+        shared_capacity = capacity;
+    }
+    memmove(&shared_runs[at + 1], &shared_runs[at], (shared_count - at) * sizeof(SharedRun));
+    shared_runs[at].start = start;
+    shared_runs[at].length = length;
+    shared_runs[at].extra = extra;
+    shared_count++;
+    return 0;
+}
+
+static void shared_remove(int at) {
+    memmove(&shared_runs[at], &shared_runs[at + 1], (shared_count - at - 1) * sizeof(SharedRun));
+    shared_count--;
+}
+
+// Make a run boundary fall exactly on page
+static int shared_split(int page) {
+    int i = shared_lower_bound(page);
+    if (i < shared_count && shared_runs[i].start < page) {
+        SharedRun run = shared_runs[i];
+        shared_runs[i].length = page - run.start;
+        return shared_insert(i + 1, page, run.start + run.length - page, run.extra);
+    }
+    return 0;
+}
+
+// Add delta owners to every page of [start, start + length)
+static int shared_adjust(int start, int length, int delta) {
+    int end = start + length;
+    if (length <= 0 || shared_split(start) != 0 || shared_split(end) != 0)
+        return -1;
+
+    int i = shared_lower_bound(start);
+    int first = i > 0 ? i - 1 : 0;
+    int page = start;
+    while (page < end) {
+        if (i < shared_count && shared_runs[i].start == page) {
+            page += shared_runs[i].length;
+            shared_runs[i].extra += delta;
+            if (shared_runs[i].extra <= 0)
+                shared_remove(i);
+            else
+                i++;
+        } else {
+            int gap_end = i < shared_count && shared_runs[i].start < end ? shared_runs[i].start : end;
+            if (delta > 0) {
+                if (shared_insert(i, page, gap_end - page, delta) != 0)
+                    return -1;
+                i++;
             }
+            page = gap_end;
         }
-        if (page == -1)
-        {
-            // Cleanup already allocated pages
-            for (int k = 0; k < i; k++)
-            {
-                page_bitmap[(*page_table)[k].physical_page / 8] &= ~(1 << ((*page_table)[k].physical_page % 8));
+    }
+
+    // Coalesce neighbours that ended up adjacent with the same count
+    for (int j = first; j + 1 < shared_count && j <= i; ) {
+        SharedRun *run = &shared_runs[j], *next = &shared_runs[j + 1];
+        if (run->start + run->length == next->start && run->extra == next->extra) {
+            run->length += next->length;
+            shared_remove(j + 1);
+            i--;
+        } else {
+            j++;
+        }
+    }
+    return 0;
+}
+
+// Drop one owner of [start, start + length); pages nobody else owns become free
+static void release_range(int start, int length) {
+    int page = start, end = start + length;
+    while (page < end) {
+        int i = shared_lower_bound(page);
+        int shared_start = i < shared_count && shared_runs[i].start < end ? shared_runs[i].start : end;
+        if (shared_start > page) {
+            set_range(page, shared_start - page, 0);
+            page = shared_start;
+            continue;
+        }
+        int shared_end = shared_runs[i].start + shared_runs[i].length;
+        int stop = shared_end < end ? shared_end : end;
+        shared_adjust(page, stop - page, -1);
+        page = stop;
+    }
+}
+
+void release_pages(int start, int length) {
+    pthread_mutex_lock(&alloc_lock);
+    release_range(start, length);
+    pthread_mutex_unlock(&alloc_lock);
+}
+
+// Add an owner to every page of the extents (all in use already)
+int share_pages(const Extent *extents, int extent_count) {
+    int result = 0;
+    pthread_mutex_lock(&alloc_lock);
+    for (int e = 0; e < extent_count && result == 0; e++)
+        if (shared_adjust(extents[e].start_page, extents[e].length, 1) != 0)
+            result = -1;
+    pthread_mutex_unlock(&alloc_lock);
+    return result;
+}
+
+// Files owning the page (0 when free)
+int page_refs(int page) {
+    if (page < 0 || page >= total_pages)
+        return 0;
+    pthread_mutex_lock(&alloc_lock);
+    int refs = 0;
+    if (page_is_used(page)) {
+        int i = shared_lower_bound(page);
+        refs = i < shared_count && shared_runs[i].start <= page ? 1 + shared_runs[i].extra : 1;
+    }
+    pthread_mutex_unlock(&alloc_lock);
+    return refs;
+}
+
+// Pages of the extents that some other file owns too
+int shared_pages_in(const Extent *extents, int extent_count) {
+    pthread_mutex_lock(&alloc_lock);
+    int shared = 0;
+    for (int e = 0; shared_count && e < extent_count; e++) {
+        int start = extents[e].start_page, end = start + extents[e].length;
+        for (int i = shared_lower_bound(start); i < shared_count && shared_runs[i].start < end; i++) {
+            int lo = shared_runs[i].start > start ? shared_runs[i].start : start;
+            int hi = shared_runs[i].start + shared_runs[i].length < end ? shared_runs[i].start + shared_runs[i].length : end;
+            shared += hi - lo;
+        }
+    }
+    pthread_mutex_unlock(&alloc_lock);
+    return shared;
+}
+
+int shared_page_total() {
+    int shared = 0;
+    for (int i = 0; i < shared_count; i++)
+        shared += shared_runs[i].length;
+    return shared;
+}
+
+// Take one more owner of [start, start + length): free pages become used,
+// used ones gain an owner
+static void claim_range(int start, int length) {
+    int page = start, end = start + length;
+    while (page < end) {
+        int run = free_run_at(page, end - page);
+        if (run > 0) {
+            set_range(page, run, 1);
+        } else {
+            run = used_run_at(page, end - page);
+            shared_adjust(page, run, 1);
+        }
+        page += run;
+    }
+}
+
+// First run of want pages inside one index leaf (the index says there is one)
+static int find_in_leaf(int first_word, int want) {
+    int run_start = 0, run = 0;
+    for (int w = first_word; w < first_word + INDEX_LEAF_WORDS; w++) {
+        uint64_t bits = free_bits(w);
+        int prefix = bits == ~0ULL ? 64 : __builtin_ctzll(~bits);
+        if (run + prefix >= want)
+            return run ? run_start : w * 64;
+
+        if (want <= 64) {
+            // Bit p survives when pages p .. p + want - 1 are all free
+            uint64_t fit = bits;
+            for (int have = 1; have < want && fit; ) {
+                int step = have < want - have ? have : want - have;
+                fit &= fit >> step;
+                have += step;
+            }
+            if (fit)
+                return w * 64 + __builtin_ctzll(fit);
+        }
+
+        if (prefix == 64) {
+            if (!run)
+                run_start = w * 64;
+            run += 64;
+        } else {
+            run = __builtin_clzll(~bits);
+            run_start = w * 64 + 64 - run;
+        }
+    }
+    return -1;
+}
+
+// Lowest page starting a free run of at least want pages (-1 if none)
+static int find_run(int want) {
+    if (want <= 0 || !free_index || free_index[1].longest < want)
+        return -1;
+
+    int node = 1, start = 0, span = index_leaves * LEAF_PAGES;
+    while (node < index_leaves) {
+        span /= 2;
+        FreeSpan *left = &free_index[2 * node], *right = &free_index[2 * node + 1];
+        if (left->longest >= want) {
+            node = 2 * node;
+        } else if (left->suffix + right->prefix >= want) {
+            return start + span - left->suffix;
+        } else {
+            node = 2 * node + 1;
+            start += span;
+        }
+    }
+    return find_in_leaf(start / 64, want);
+}
+
+// Physical page backing logical page index of a file (-1 past the end)
+int file_page(const File *file, int index) {
+    for (int e = 0; e < file->extent_count; e++) {
+        if (index < file->extents[e].length)
+            return file->extents[e].start_page + index;
+        index -= file->extents[e].length;
+    }
+    return -1;
+}
+
+int extent_page_count(const Extent *extents, int extent_count) {
+    int pages = 0;
+    for (int e = 0; e < extent_count; e++)
+        pages += extents[e].length;
+    return pages;
+}
+
+// Append pages to an extent list, preferring to grow the last run in place
+// and then the fewest new runs. All or nothing: -ENOSPC leaves it unchanged.
+static int take_extents(Extent **extents, int *extent_count, int pages) {
+    if (pages <= 0)
+        return 0;
+    if (pages > free_page_count)
+        return -ENOSPC;
+
+    int old_count = *extent_count;
+    int grown = 0;
+    if (old_count > 0) {
+        Extent *last = &(*extents)[old_count - 1];
+        grown = free_run_at(last->start_page + last->length, pages);
+        set_range(last->start_page + last->length, grown, 1);
+        last->length += grown;
+    }
+
+    // One contiguous run if the volume has it, otherwise the largest runs first
+    int remaining = pages - grown;
+    while (remaining > 0) {
+        int length = remaining < largest_free_run() ? remaining : largest_free_run();
+        int start = find_run(length);
+        Extent *grown_list = start >= 0 ? realloc(*extents, (*extent_count + 1) * sizeof(Extent)) : NULL;
+        if (!grown_list) {
+            // Roll back to the list as it was
+            for (int e = old_count; e < *extent_count; e++)
+                set_range((*extents)[e].start_page, (*extents)[e].length, 0);
+            *extent_count = old_count;
+            if (old_count > 0) {
+                Extent *last = &(*extents)[old_count - 1];
+                last->length -= grown;
+                set_range(last->start_page + last->length, grown, 0);
             }
-            free(*page_table);
+            return start >= 0 ? -1 : -ENOSPC;
+        }
+        *extents = grown_list;
+        (*extents)[*extent_count].start_page = start;
+        (*extents)[*extent_count].length = length;
+        (*extent_count)++;
+        set_range(start, length, 1);
+        remaining -= length;
+    }
+    return 0;
+}
+
+int allocate_extents(Extent **extents, int *extent_count, int pages) {
+    pthread_mutex_lock(&alloc_lock);
+    int result = take_extents(extents, extent_count, pages);
+    pthread_mutex_unlock(&alloc_lock);
+    return result;
+}
+
+// Append a run to an extent list, extending the last extent when contiguous
+static void append_run(Extent *out, int *count, int start, int length) {
+    if (length <= 0)
+        return;
+    if (*count > 0 && out[*count - 1].start_page + out[*count - 1].length == start) {
+        out[*count - 1].length += length;
+        return;
+    }
+    out[*count].start_page = start;
+    out[*count].length = length;
+    (*count)++;
+}
+
+// Append the physical runs behind logical pages [from, to) of an extent list
+static void append_logical(const Extent *extents, int extent_count, int from, int to,
+                           Extent *out, int *count) {
+    int logical = 0;
+    for (int e = 0; e < extent_count && logical < to; e++) {
+        int lo = logical > from ? logical : from;
+        int hi = logical + extents[e].length < to ? logical + extents[e].length : to;
+        if (lo < hi)
+            append_run(out, count, extents[e].start_page + lo - logical, hi - lo);
+        logical += extents[e].length;
+    }
+}
+
+// Replace logical pages [index, index + pages) of an extent list with the
+// runs in with (covering as many pages), merging runs that become adjacent
+int splice_extents(Extent **extents, int *extent_count, int index, int pages,
+                   const Extent *with, int with_count) {
+    int total = extent_page_count(*extents, *extent_count);
+    Extent *out = malloc((*extent_count + with_count + 2) * sizeof(Extent));
+    if (!out)
+        return -1;
+
+    int count = 0;
+    append_logical(*extents, *extent_count, 0, index, out, &count);
+    for (int w = 0; w < with_count; w++)
+        append_run(out, &count, with[w].start_page, with[w].length);
+    append_logical(*extents, *extent_count, index + pages, total, out, &count);
+
+    free(*extents);
+    *extents = out;
+    *extent_count = count;
+    return 0;
+}
+
+// Coalesce a per-page list (older image formats) into extents
+int extents_from_pages(const int *pages, int page_count, Extent **extents, int *extent_count) {
+    *extents = NULL;
+    *extent_count = 0;
+    for (int i = 0; i < page_count; i++) {
+        if (*extent_count > 0) {
+            Extent *last = &(*extents)[*extent_count - 1];
+            if (last->start_page + last->length == pages[i]) {
+                last->length++;
+                continue;
+            }
+        }
+        Extent *grown = realloc(*extents, (*extent_count + 1) * sizeof(Extent));
+        if (!grown) {
+            free(*extents);
+            *extents = NULL;
+            *extent_count = 0;
             return -1;
         }
+        *extents = grown;
+        (*extents)[*extent_count].start_page = pages[i];
+        (*extents)[*extent_count].length = 1;
+        (*extent_count)++;
     }
     return 0;
 }
 
+void free_pages(File *file) {
+    if (!file || !file->extents) return;
+    
+    pthread_mutex_lock(&alloc_lock);
+    for (int e = 0; e < file->extent_count; e++) {
+        release_range(file->extents[e].start_page, file->extents[e].length);
+    }
+    pthread_mutex_unlock(&alloc_lock);
+    file->extent_count = 0;
+    file->page_count = 0;
+}
+
+// Byte-per-8-pages form used by the image format
+void page_bitmap_to_bytes(unsigned char *bytes) {
+    for (int i = 0; i < (total_pages + 7) / 8; i++)
+        bytes[i] = (unsigned char)(page_bitmap[i / 8] >> ((i % 8) * 8));
+}
+
+void page_bitmap_from_bytes(const unsigned char *bytes) {
+    memset(page_bitmap, 0, sizeof(page_bitmap[0]) * BITMAP_WORDS);
+    shared_count = 0;
+    for (int i = 0; i < (total_pages + 7) / 8; i++)
+        page_bitmap[i / 8] |= (uint64_t)bytes[i] << ((i % 8) * 8);
+    recount_free_pages();
+    index_build();
+}
+
+// Recompute the bitmap and shared-page counts from every file's extents
+// (after loading an image or replaying the journal). Each inode owns its
+// pages once, however many hard links name it.
+void rebuild_page_bitmap() {
+    initialize_paging();
+
+    int cursor = 0;
+    File *file;
+    while ((file = inode_next(&cursor)) != NULL) {
+        if (file->is_symlink || !file->extents)
+            continue;
+        for (int e = 0; e < file->extent_count; e++) {
+            Extent *extent = &file->extents[e];
+            if (extent->start_page >= 0 && extent->length > 0 &&
+                extent->start_page + extent->length <= total_pages)
+                claim_range(extent->start_page, extent->length);
+        }
+    }
+}
+
+// Copy out the extents of a file in the current directory, for showpages
+FsStatus file_extents(const char *filename, FileExtents *out)
+{
+    memset(out, 0, sizeof(*out));
+    File *file = lock_file_in_dir(fs_state.current_directory, filename, 0);
+    if (!file)
+    {
+        read_end();
+        return FS_ERR_NOT_FOUND;
+    }
+
+    FsStatus status = FS_OK;
+    if (file->extent_count > 0)
+    {
+        out->extents = malloc(file->extent_count * sizeof(Extent));
+        if (out->extents)
+            memcpy(out->extents, file->extents, file->extent_count * sizeof(Extent));
+        else
+            status = FS_ERR_NO_MEMORY;
+    }
+    if (status == FS_OK)
+    {
+        out->size = file->size;
+        out->page_count = file->page_count;
+        out->extent_count = file->extent_count;
+    }
+
+    inode_unlock(file);
+    read_end();
+    return status;
+}
+
+// Small volumes get one cell per page; larger ones one per group of pages,
+// shaded by how much of the group is in use
+void page_map(PageMap *map)
+{
+    pthread_rwlock_rdlock(&fs_lock);
+    pthread_mutex_lock(&alloc_lock);
+
+    map->pages = total_pages;
+    map->free_pages = free_page_count;
+    map->shared_pages = shared_page_total();
+    map->largest_free_run = largest_free_run();
+
+    if (total_pages <= PAGE_MAP_CELLS)
+    {
+        map->pages_per_cell = 1;
+        map->cell_count = total_pages;
+        for (int i = 0; i < total_pages; i++)
+            map->cells[i] = page_is_used(i) ? 'X' : '.';
+        pthread_mutex_unlock(&alloc_lock);
+        pthread_rwlock_unlock(&fs_lock);
+        return;
+    }
+
+    // At most PAGE_MAP_CELLS groups, each a whole number of words
+    int words_per_group = (BITMAP_WORDS + PAGE_MAP_CELLS - 1) / PAGE_MAP_CELLS;
+    map->pages_per_cell = words_per_group * 64;
+    map->cell_count = (BITMAP_WORDS + words_per_group - 1) / words_per_group;
+    for (int g = 0; g < map->cell_count; g++)
+    {
+        int used = 0, pages = 0;
+        for (int w = g * words_per_group; w < (g + 1) * words_per_group && w < BITMAP_WORDS; w++)
+        {
+            used += __builtin_popcountll(page_bitmap[w] & word_mask(w));
+            pages += __builtin_popcountll(word_mask(w));
+        }
+        map->cells[g] = used == 0 ? '.' : used == pages ? 'X' : used * 2 < pages ? '-' : '+';
+    }
+    pthread_mutex_unlock(&alloc_lock);
+    pthread_rwlock_unlock(&fs_lock);
+}
+
+// Allocate pages for a new file (-ENOSPC when the volume cannot hold them)
+int allocate_pages(int pages_needed, Extent **extents, int *extent_count)
+{
+    *extents = NULL;
+    *extent_count = 0;
+    return allocate_extents(extents, extent_count, pages_needed);
+}
@@ -0,0 +1,378 @@
+#include "../include/pipeline.h"
+
+// Each stage owns one thread. A stream is a ring of PIPE_BUFFER_SIZE bytes
+// with one writer (the stage before) and one reader (the stage after): the
+// writer waits while it is full, the reader while it is empty. A writer
+// closes its stream when done; a reader that stops early abandons its
+// input, which fails the writer's next write so the stop travels upstream.
+// Stages take filesystem locks one chunk at a time and never hold them
+// while waiting on a stream.
+
+typedef struct
+{
+    pthread_mutex_t lock;
+    pthread_cond_t readable, writable;
+    char data[PIPE_BUFFER_SIZE]; // Ring, oldest byte at head
+    int head, used;
+    int closed;    // Writer is done
+    int abandoned; // Reader is gone
+} Stream;
+
+typedef enum
+{
+    STAGE_READ,  // read <file> [offset] [bytes]
+    STAGE_GREP,  // grep [-v] <text>
+    STAGE_WRITE, // write [-a] <file>
+} StageKind;
+
+typedef struct
+{
+    StageKind kind;
+    char arg[256];      // File, or text to look for
+    int offset, length; // Range to read, length -1 for the rest
+    int flag;           // write -a, grep -v
+    Stream *in, *out;   // NULL at either end
+    int *failed;        // Set when the source could not be read
+    pthread_t thread;
+} Stage;
+
+static void stream_init(Stream *stream)
+{
+    pthread_mutex_init(&stream->lock, NULL);
+    pthread_cond_init(&stream->readable, NULL);
+    pthread_cond_init(&stream->writable, NULL);
+}
+
+static void stream_destroy(Stream *stream)
+{
+    pthread_mutex_destroy(&stream->lock);
+    pthread_cond_destroy(&stream->readable);
+    pthread_cond_destroy(&stream->writable);
+}
+
+// Blocks until all of data is buffered; -1 once the reader is gone
+static int stream_write(Stream *stream, const char *data, int length)
+{
+    pthread_mutex_lock(&stream->lock);
+    while (length > 0 && !stream->abandoned)
+    {
+        if (stream->used == PIPE_BUFFER_SIZE)
+        {
+            pthread_cond_wait(&stream->writable, &stream->lock);
+            continue;
+        }
+        int tail = (stream->head + stream->used) % PIPE_BUFFER_SIZE;
+        int n = PIPE_BUFFER_SIZE - stream->used;
+        if (n > PIPE_BUFFER_SIZE - tail)
+            n = PIPE_BUFFER_SIZE - tail;
+        if (n > length)
+            n = length;
+
+        memcpy(stream->data + tail, data, n);
+        stream->used += n;
+        data += n;
+        length -= n;
+        pthread_cond_signal(&stream->readable);
+    }
+    int result = stream->abandoned ? -1 : 0;
+    pthread_mutex_unlock(&stream->lock);
+    return result;
+}
+
+// Blocks until something is buffered; 0 once the writer closed and all was read
+static int stream_read(Stream *stream, char *buffer, int size)
+{
+    pthread_mutex_lock(&stream->lock);
+    while (stream->used == 0 && !stream->closed)
+        pthread_cond_wait(&stream->readable, &stream->lock);
+
+    int n = stream->used;
+    if (n > PIPE_BUFFER_SIZE - stream->head)
+        n = PIPE_BUFFER_SIZE - stream->head;
+    if (n > size)
+        n = size;
+
+    memcpy(buffer, stream->data + stream->head, n);
+    stream->head = (stream->head + n) % PIPE_BUFFER_SIZE;
+    stream->used -= n;
+    pthread_cond_signal(&stream->writable);
+    pthread_mutex_unlock(&stream->lock);
+    return n;
+}
+
+static void stream_close(Stream *stream)
+{
+    pthread_mutex_lock(&stream->lock);
+    stream->closed = 1;
+    pthread_cond_signal(&stream->readable);
+    pthread_mutex_unlock(&stream->lock);
+}
+
+static void stream_abandon(Stream *stream)
+{
+    pthread_mutex_lock(&stream->lock);
+    stream->abandoned = 1;
+    pthread_cond_signal(&stream->writable);
+    pthread_mutex_unlock(&stream->lock);
+}
+
+// The range is fixed when the stage starts, so a pipeline that appends to
+// its own source ends
+static void run_read(Stage *stage)
+{
+    char chunk[PAGE_SIZE];
+    int size;
+    FsStatus status = read_file_range(stage->arg, 0, chunk, 0, NULL, &size);
+    if (status != FS_OK)
+    {
+        printf(COLOR_RED "Error: %s\n" COLOR_RESET, fs_strerror(status));
+        *stage->failed = 1;
+        stream_close(stage->out);
+        return;
+    }
+
+    int offset = stage->offset < 0 ? 0 : stage->offset;
+    int end = size;
+    if (stage->length > 0 && offset + stage->length < end)
+        end = offset + stage->length;
+
+    while (offset < end)
+    {
+        int want = end - offset < PAGE_SIZE ? end - offset : PAGE_SIZE;
+        int got = 0;
+        status = read_file_range(stage->arg, offset, chunk, want, &got, NULL);
+        if (status != FS_OK)
+        {
+            printf(COLOR_RED "Error: %s\n" COLOR_RESET, fs_strerror(status));
+            *stage->failed = 1;
+        }
+        if (got <= 0 || stream_write(stage->out, chunk, got) < 0)
+            break;
+        offset += got;
+    }
+    stream_close(stage->out);
+}
+
+static int grep_line(Stage *stage, char *line, int length)
+{
+    line[length] = '\0';
+    int match = strstr(line, stage->arg) != NULL;
+    return match == !stage->flag ? stream_write(stage->out, line, length) : 0;
+}
+
+// Matches line by line; a line longer than the buffer is matched in pieces
+static void run_grep(Stage *stage)
+{
+    char chunk[PAGE_SIZE];
+    char line[PIPE_BUFFER_SIZE + 1];
+    int line_length = 0, result = 0, n;
+
+    while (result == 0 && (n = stream_read(stage->in, chunk, sizeof(chunk))) > 0)
+    {
+        for (int i = 0; i < n && result == 0;)
+        {
+            char *newline = memchr(chunk + i, '\n', n - i);
+            int take = newline ? (int)(newline - (chunk + i)) + 1 : n - i;
+            if (take > PIPE_BUFFER_SIZE - line_length)
+                take = PIPE_BUFFER_SIZE - line_length;
+
+            memcpy(line + line_length, chunk + i, take);
+            line_length += take;
+            i += take;
+            if (line[line_length - 1] == '\n' || line_length == PIPE_BUFFER_SIZE)
+            {
+                result = grep_line(stage, line, line_length);
+                line_length = 0;
+            }
+        }
+    }
+    if (result == 0 && line_length > 0)
+        grep_line(stage, line, line_length);
+
+    stream_abandon(stage->in);
+    stream_close(stage->out);
+}
+
+// Overwrites with the first chunk and appends the rest
+static void run_write(Stage *stage)
+{
+    char chunk[PAGE_SIZE];
+    int append = stage->flag, new_size = -1, n;
+    long written = 0;
+    FsStatus status = FS_OK;
+
+    while ((n = stream_read(stage->in, chunk, sizeof(chunk))) > 0)
+    {
+        status = write_file_range(stage->arg, chunk, n, append, &new_size);
+        if (status != FS_OK)
+            break;
+        append = 1;
+        written += n;
+    }
+    stream_abandon(stage->in);
+
+    // Nothing came through: an overwrite still empties the file, unless
+    // the source was never read
+    if (written == 0 && new_size == -1 && n == 0 && !*stage->failed)
+        status = write_file_range(stage->arg, "", 0, append, &new_size);
+
+    if (status != FS_OK)
+        printf(COLOR_RED "Error: %s\n" COLOR_RESET, fs_strerror(status));
+    else if (new_size >= 0)
+        printf(COLOR_GREEN "Successfully wrote %ld bytes to %s (new size: %d bytes)\n" COLOR_RESET,
+               written, stage->arg, new_size);
+}
+
+static void *stage_main(void *arg)
+{
+    Stage *stage = arg;
+    switch (stage->kind)
+    {
+    case STAGE_READ:
+        run_read(stage);
+        break;
+    case STAGE_GREP:
+        run_grep(stage);
+        break;
+    case STAGE_WRITE:
+        run_write(stage);
+        break;
+    }
+    return NULL;
+}
+
+// Fill stage from text: 1 for a pipeline stage, 0 for any other command,
+// -1 for a malformed stage
+static int parse_stage(const char *text, Stage *stage)
+{
+    memset(stage, 0, sizeof(*stage));
+    stage->length = -1;
+
+    size_t word = strcspn(text, " ");
+    const char *rest = text + word + strspn(text + word, " ");
+    char extra[2];
+
+    if (word == 4 && strncmp(text, "read", 4) == 0)
+    {
+        stage->kind = STAGE_READ;
+        return sscanf(text, "read %255s %d %d", stage->arg, &stage->offset, &stage->length) >= 1 ? 1 : -1;
+    }
+    if (word == 4 && strncmp(text, "grep", 4) == 0)
+    {
+        stage->kind = STAGE_GREP;
+        if (strncmp(rest, "-v ", 3) == 0)
+        {
+            stage->flag = 1;
+            rest += 3 + strspn(rest + 3, " ");
+        }
+        snprintf(stage->arg, sizeof(stage->arg), "%s", rest);
+        return stage->arg[0] ? 1 : -1;
+    }
+    // Only "write [-a] <file>" is a sink; a write with data is an ordinary command
+    if (word == 5 && strncmp(text, "write", 5) == 0)
+    {
+        stage->kind = STAGE_WRITE;
+        if (sscanf(text, "write -a %255s %1s", stage->arg, extra) == 1)
+            stage->flag = 1;
+        else if (strncmp(rest, "-a", 2) == 0 || sscanf(text, "write %255s %1s", stage->arg, extra) != 1)
+            return 0;
+        return 1;
+    }
+    return 0;
+}
+
+// Stages of line, 0 when it is not a data-flow pipeline and -1 when it is
+// a malformed one. grep exists only in pipelines, so a line using it is
+// always taken as one
+static int parse_pipeline(const char *line, Stage *stages)
+{
+    char copy[256];
+    snprintf(copy, sizeof(copy), "%s", line);
+
+    int count = 0, shaped = 1, malformed = 0, filtered = 0, ended = 0;
+    char *saveptr, *token = strtok_r(copy, "|", &saveptr);
+    for (; token; token = strtok_r(NULL, "|", &saveptr), count++)
+    {
+        while (*token == ' ')
+            token++;
+        char *end = token + strlen(token);
+        while (end > token && end[-1] == ' ')
+            *--end = '\0';
+
+        Stage stage;
+        int parsed = parse_stage(token, &stage);
+        malformed |= parsed < 0;
+        filtered |= parsed != 0 && stage.kind == STAGE_GREP;
+
+        // A read starts the pipeline, grep filters and a write can only end it
+        if (parsed == 0 || (count == 0) != (stage.kind == STAGE_READ) || ended)
+            shaped = 0;
+        ended = stage.kind == STAGE_WRITE;
+        if (count < PIPE_MAX_STAGES)
+            stages[count] = stage;
+        else
+            malformed = 1;
+    }
+    if (!filtered && (!shaped || count < 2))
+        return 0;
+
+    if (!shaped || count < 2 || malformed)
+    {
+        printf(COLOR_RED "Usage: read <file> [offset] [bytes] | grep [-v] <text> ... [| write [-a] <file>]\n" COLOR_RESET);
+        printf(COLOR_RED "       (at most %d stages)\n" COLOR_RESET, PIPE_MAX_STAGES);
+        return -1;
+    }
+    return count;
+}
+
+// The terminal is the reader when no stage writes a file
+static void drain_to_terminal(Stream *stream)
+{
+    char chunk[PAGE_SIZE];
+    char last = '\n';
+    int n;
+    while ((n = stream_read(stream, chunk, sizeof(chunk))) > 0)
+    {
+        fwrite(chunk, 1, n, stdout);
+        last = chunk[n - 1];
+    }
+    if (last != '\n')
+        putchar('\n');
+    fflush(stdout);
+}
+
+int pipeline_run(const char *line)
+{
+    Stage stages[PIPE_MAX_STAGES];
+    int count = parse_pipeline(line, stages);
+    if (count <= 0)
+        return count < 0;
+
+    Stream *streams = calloc(count, sizeof(Stream));
+    if (!streams)
+    {
+        printf(COLOR_RED "Error: Out of memory\n" COLOR_RESET);
+        return 1;
+    }
+
+    int failed = 0;
+    for (int i = 0; i < count; i++)
+    {
+        stream_init(&streams[i]);
+        stages[i].in = i > 0 ? &streams[i - 1] : NULL;
+        stages[i].out = stages[i].kind == STAGE_WRITE ? NULL : &streams[i];
+        stages[i].failed = &failed;
+    }
+    for (int i = 0; i < count; i++)
+        pthread_create(&stages[i].thread, NULL, stage_main, &stages[i]);
+
+    if (stages[count - 1].kind != STAGE_WRITE)
+        drain_to_terminal(&streams[count - 1]);
+
+    for (int i = 0; i < count; i++)
+        pthread_join(stages[i].thread, NULL);
+    for (int i = 0; i < count; i++)
+        stream_destroy(&streams[i]);
+    free(streams);
+    return 1;
+}
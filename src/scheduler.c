@@ -1,91 +1,568 @@
 #include "../include/scheduler.h"
 #include "../include/globals.h"
+#include "../include/journal.h"
+#include "../include/defrag.h"
+#include "../include/jobqueue.h"
+#include <sched.h>
 
+// Queued commands run on a pool of workers, one per core. Submitting and
+// taking a command are lock-free: each worker owns a ring of ready
+// commands (see jobqueue.h); a command that becomes ready goes on the ring
+// its path maps to, the owner takes from its ring and an idle worker steals
+// from the others. Commands and their text live in a fixed pool of
+// MAX_JOBS nodes per worker, kept on a free ring, so nothing is allocated
+// per command and a producer that finds the pool empty blocks until a
+// command finishes.
+//
+// Commands are ordered by the first component of the path they name:
+// those under the same name run one at a time in submission order, the
+// rest run concurrently. Anything else (cd, list, move, ln, format...) is
+// a barrier that waits for every earlier command and holds back every
+// later one. Keys are names, not inodes, so two links to one file are not
+// ordered against each other; the filesystem locks still keep each
+// command atomic.
+//
+// Order is kept by a chain per key stripe, as in an MCS lock: a command
+// swaps itself in as the stripe's tail and links behind the previous one,
+// which hands over when it finishes. A barrier joins every stripe. A
+// command goes on a ring only once each stripe it joined has handed over,
+// so workers never skip or requeue anything. Barriers join their stripes
+// one after another under barrier_lock: two joining at once could each get
+// ahead of the other on some stripe and wait on each other forever. Keyed
+// commands join a single stripe and never take it. queue_lock is only
+// taken to sleep and to wake sleepers.
+//
+// Among ready commands, each worker picks by class and user. Every command
+// has a class and an estimated cost from its name (see job_classes): cheap
+// metadata commands take the fast lane and run before anything else, so a
+// stat never waits behind someone's backup. The rest are shared between
+// users by deficit round-robin: on its turn a user gets SCHED_QUANTUM of
+// credit and runs commands, normal before bulk, until the credit is spent;
+// the last one may overdraw it, and the debt is paid on the next turn. A
+// user with nothing ready loses its credit. Each ring holds one user's
+// commands of one class, and the round-robin state is the owner's alone;
+// thieves take in class order without touching it. Priorities only reorder
+// commands that are already ready, never those the chains hold back.
+//
+// add_call() queues a function instead of a command line, keyed by a path
+// the same way; the asynchronous ring (see fsring.h) runs on it.
 
-void print_queue(int current_job_index)
+typedef struct JobNode
 {
-    printf(COLOR_YELLOW "Command Queue:\n" COLOR_RESET);
-    if (job_count == 0)
+    char command[256]; // Pooled copy of the command line
+    void (*run)(void *); // Called instead when queued by add_call()
+    void *arg;
+    int stripe;        // Key stripe, -1 for a barrier
+    int pending;       // Stripes still to hand over, plus one while submitting
+    int home;          // Worker whose rings it goes on when ready
+    int user;          // Submitted by, an index into fs_state.users
+    int job_class;     // JOB_FAST, JOB_NORMAL or JOB_BULK
+    int cost;          // Estimated, in round-robin credit
+    struct timespec submitted;
+    struct JobNode *successor[SCHED_KEY_STRIPES]; // Next command on each stripe joined
+} JobNode;
+
+static const char *const class_names[JOB_CLASSES] = {"fast lane", "normal", "bulk"};
+static const int class_costs[JOB_CLASSES] = {1, 4, SCHED_QUANTUM};
+
+typedef struct
+{
+    JobQueue ready[MAX_USERS][JOB_CLASSES];
+
+    // Deficit round-robin, touched by the owner only
+    int deficit[MAX_USERS]; // Credit left on each user's turn
+    int turn;               // User whose turn it is
+    int fast_turn;          // User the fast lane looks at first
+
+    // Written by the owner only, read by the stats
+    unsigned long executed; // Commands run by this worker
+    unsigned long stolen;   // ... of which taken from another worker's rings
+    unsigned long waits;    // Times it found nothing ready and slept
+    unsigned long cost_run[MAX_USERS];
+    unsigned long waited[JOB_CLASSES];       // Commands taken, by class
+    unsigned long wait_total[JOB_CLASSES];   // Their time from add_job() to start, in us
+    unsigned long wait_longest[JOB_CLASSES]; // ... the longest
+    unsigned long wait_histogram[JOB_CLASSES][SCHED_WAIT_BUCKETS];
+} __attribute__((aligned(64))) Worker;
+
+static Worker workers[SCHED_MAX_WORKERS];
+static pthread_t worker_threads[SCHED_MAX_WORKERS];
+static int worker_count = 0;
+
+static void (*execute_command)(Job job); // The shell's, set on start
+static JobNode nodes[SCHED_MAX_WORKERS * MAX_JOBS];
+static JobQueue free_nodes;
+static int pool_size = 0;
+
+static JobNode *stripe_tail[SCHED_KEY_STRIPES]; // Last command submitted on each stripe
+static unsigned long barriers_placed = 0;       // Spreads barriers over the workers
+static pthread_mutex_t barrier_lock = PTHREAD_MUTEX_INITIALIZER; // One barrier joins at a time
+
+// Sleeping and waking, the only state under queue_lock
+static int idle_workers = 0;
+static int producers_waiting = 0;
+static unsigned long producer_blocks = 0; // Times add_job() waited for a free node
+static pthread_cond_t space_available = PTHREAD_COND_INITIALIZER;
+
+static const char *const keyed_commands[] = {"create", "write", "read", "open",     "close",
+                                             "delete", "stat",  "seek", "showpages", "chmod"};
+
+// Commands not listed here are normal
+static const struct
+{
+    const char *name;
+    int job_class;
+} job_classes[] = {
+    {"stat", JOB_FAST},    {"list", JOB_FAST},      {"pwd", JOB_FAST},    {"tree", JOB_FAST},
+    {"dirinfo", JOB_FAST}, {"seek", JOB_FAST},      {"open", JOB_FAST},   {"close", JOB_FAST},
+    {"cd", JOB_FAST},      {"showpages", JOB_FAST}, {"dcache", JOB_FAST}, {"workers", JOB_FAST},
+    {"help", JOB_FAST},    {"copy", JOB_BULK},      {"clone", JOB_BULK},  {"backup", JOB_BULK},
+    {"restore", JOB_BULK}, {"format", JOB_BULK},    {"defrag", JOB_BULK}, {"sync", JOB_BULK},
+};
+
+static int job_class(const char *command)
+{
+    size_t word = strcspn(command, " ");
+    for (size_t i = 0; i < sizeof(job_classes) / sizeof(job_classes[0]); i++)
     {
-        printf(COLOR_YELLOW "  [Empty]\n" COLOR_RESET);
-        return;
+        if (strlen(job_classes[i].name) == word && strncmp(command, job_classes[i].name, word) == 0)
+            return job_classes[i].job_class;
+    }
+    return JOB_NORMAL;
+}
+
+// Stripe of the first component of path, or -1 when it must run alone
+static int path_stripe(const char *path)
+{
+    if (!path || *path == '\0')
+        return -1;
+    while (*path == '/' || (path[0] == '.' && path[1] == '/'))
+        path += *path == '/' ? 1 : 2;
+    if (path[0] == '.' && path[1] == '.')
+        return -1;
+
+    size_t length = strcspn(path, "/ ");
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < length; i++)
+        h = (h ^ (unsigned char)path[i]) * 16777619u;
+    return h % SCHED_KEY_STRIPES;
+}
+
+// Stripe of the path a command names, or -1 when it must run alone
+static int job_stripe(const char *command)
+{
+    size_t word = strcspn(command, " ");
+    int keyed = 0;
+    for (size_t i = 0; i < sizeof(keyed_commands) / sizeof(keyed_commands[0]); i++)
+    {
+        if (strlen(keyed_commands[i]) == word && strncmp(command, keyed_commands[i], word) == 0)
+            keyed = 1;
     }
+    if (!keyed)
+        return -1;
 
-    for (int i = 0; i < job_count; i++)
+    // chmod names its mode first; flags such as -d and -a are not paths
+    const char *arg = command + word;
+    int skip = strncmp(command, "chmod", word) == 0;
+    for (;;)
     {
-        int idx = (front + i) % MAX_JOBS;
-        if (i == current_job_index)
+        arg += strspn(arg, " ");
+        if (*arg != '-' && skip-- == 0)
+            break;
+        arg += strcspn(arg, " ");
+    }
+    return path_stripe(arg);
+}
+
+// Put a ready command on its ring and wake a sleeping worker. Rings hold
+// the whole pool, so the push cannot fail.
+static void make_ready(JobNode *node)
+{
+    jobqueue_push(&workers[node->home].ready[node->user][node->job_class], node);
+
+    // Pairs with the count in the idle path: either the worker sees the
+    // command on its last look, or this sees the worker going to sleep
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&idle_workers, __ATOMIC_RELAXED) > 0)
+    {
+        pthread_mutex_lock(&queue_lock);
+        pthread_cond_signal(&job_available);
+        pthread_mutex_unlock(&queue_lock);
+    }
+}
+
+static void release_pending(JobNode *node)
+{
+    if (__atomic_sub_fetch(&node->pending, 1, __ATOMIC_ACQ_REL) == 0)
+        make_ready(node);
+}
+
+// Queue node behind the last command on each stripe it joins
+static void submit(JobNode *node)
+{
+    int first = node->stripe < 0 ? 0 : node->stripe;
+    int last = node->stripe < 0 ? SCHED_KEY_STRIPES - 1 : node->stripe;
+
+    node->pending = last - first + 2;
+    for (int s = first; s <= last; s++)
+        node->successor[s] = NULL;
+
+    if (node->stripe < 0)
+        pthread_mutex_lock(&barrier_lock);
+    for (int s = first; s <= last; s++)
+    {
+        JobNode *prev = __atomic_exchange_n(&stripe_tail[s], node, __ATOMIC_ACQ_REL);
+        if (prev)
+            __atomic_store_n(&prev->successor[s], node, __ATOMIC_RELEASE);
+        else
+            release_pending(node);
+    }
+    if (node->stripe < 0)
+        pthread_mutex_unlock(&barrier_lock);
+    release_pending(node); // Submission is done
+}
+
+// Hand each stripe over to the next command, then return the node
+static void finish(JobNode *node)
+{
+    int first = node->stripe < 0 ? 0 : node->stripe;
+    int last = node->stripe < 0 ? SCHED_KEY_STRIPES - 1 : node->stripe;
+
+    for (int s = first; s <= last; s++)
+    {
+        JobNode *expected = node;
+        if (__atomic_compare_exchange_n(&stripe_tail[s], &expected, NULL, 0, __ATOMIC_ACQ_REL,
+                                        __ATOMIC_ACQUIRE))
+            continue;
+
+        // A successor swapped itself in; its link follows at once
+        JobNode *next;
+        while (!(next = __atomic_load_n(&node->successor[s], __ATOMIC_ACQUIRE)))
+            sched_yield();
+        release_pending(next);
+    }
+
+    jobqueue_push(&free_nodes, node);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST); // Pairs with the producer's count, as in make_ready()
+    if (__atomic_load_n(&producers_waiting, __ATOMIC_RELAXED) > 0)
+    {
+        pthread_mutex_lock(&queue_lock);
+        pthread_cond_broadcast(&space_available);
+        pthread_mutex_unlock(&queue_lock);
+    }
+}
+
+// The fast lane first, then the user whose turn it is
+static JobNode *take_own(Worker *own)
+{
+    for (int i = 0; i < MAX_USERS; i++)
+    {
+        int user = (own->fast_turn + i) % MAX_USERS;
+        JobNode *node = jobqueue_pop(&own->ready[user][JOB_FAST]);
+        if (node)
         {
-            printf(COLOR_YELLOW "  > %s (Running)\n" COLOR_RESET, job_queue[idx].command);
+            own->fast_turn = (user + 1) % MAX_USERS;
+            return node;
         }
-        else
+    }
+
+    // A turn's credit covers the costliest command, so one pass over the
+    // users finds whoever has something ready
+    for (int i = 0; i <= MAX_USERS; i++)
+    {
+        int user = own->turn;
+        if (own->deficit[user] > 0)
         {
-            printf(COLOR_YELLOW "  - %s\n" COLOR_RESET, job_queue[idx].command);
+            JobNode *node = jobqueue_pop(&own->ready[user][JOB_NORMAL]);
+            if (!node)
+                node = jobqueue_pop(&own->ready[user][JOB_BULK]);
+            if (node)
+            {
+                own->deficit[user] -= node->cost;
+                return node;
+            }
+            own->deficit[user] = 0;
         }
+        own->turn = (user + 1) % MAX_USERS;
+        own->deficit[own->turn] += SCHED_QUANTUM;
     }
+    return NULL;
+}
+
+// Own rings first, then steal by class
+static JobNode *take_job(int self, int *stolen)
+{
+    JobNode *node = take_own(&workers[self]);
+    *stolen = 0;
+    for (int c = 0; !node && c < JOB_CLASSES; c++)
+    {
+        for (int i = 1; !node && i < worker_count; i++)
+        {
+            for (int user = 0; !node && user < MAX_USERS; user++)
+                node = jobqueue_pop(&workers[(self + i) % worker_count].ready[user][c]);
+        }
+        *stolen = node != NULL;
+    }
+    return node;
+}
+
+// Time from add_job() to now, counted against the command's class
+static void record_wait(Worker *own, JobNode *node)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    long us = (now.tv_sec - node->submitted.tv_sec) * 1000000L +
+              (now.tv_nsec - node->submitted.tv_nsec) / 1000;
+    unsigned long wait = us < 0 ? 0 : us;
+
+    int bucket = 0;
+    while (bucket < SCHED_WAIT_BUCKETS - 1 && wait >= 1ul << bucket)
+        bucket++;
+
+    int c = node->job_class;
+    __atomic_fetch_add(&own->waited[c], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&own->wait_total[c], wait, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&own->wait_histogram[c][bucket], 1, __ATOMIC_RELAXED);
+    if (wait > own->wait_longest[c])
+        __atomic_store_n(&own->wait_longest[c], wait, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&own->cost_run[node->user], node->cost, __ATOMIC_RELAXED);
 }
 
 void *scheduler(void *arg)
 {
+    int self = (int)(intptr_t)arg;
+    Worker *own = &workers[self];
+
     while (running)
     {
-        pthread_mutex_lock(&queue_lock);
-        while (job_count == 0 && running)
+        int stolen;
+        JobNode *node = take_job(self, &stolen);
+        if (!node)
         {
-            pthread_cond_wait(&job_available, &queue_lock);
+            __atomic_fetch_add(&own->waits, 1, __ATOMIC_RELAXED);
+            pthread_mutex_lock(&queue_lock);
+            __atomic_fetch_add(&idle_workers, 1, __ATOMIC_SEQ_CST);
+            while (!(node = take_job(self, &stolen)) && running)
+                pthread_cond_wait(&job_available, &queue_lock);
+            __atomic_fetch_sub(&idle_workers, 1, __ATOMIC_SEQ_CST);
+            pthread_mutex_unlock(&queue_lock);
+            if (!node)
+                break;
         }
-        if (!running)
+
+        record_wait(own, node);
+        if (node->run)
+            node->run(node->arg);
+        else
         {
-            pthread_mutex_unlock(&queue_lock);
-            break;
+            Job job = {node->command};
+            execute_command(job);
         }
+        __atomic_fetch_add(&own->executed, 1, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&own->stolen, stolen, __ATOMIC_RELAXED);
+        finish(node);
+    }
+    return NULL;
+}
 
-        print_queue(0);
+void scheduler_start(void (*execute)(Job job))
+{
+    execute_command = execute;
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    worker_count = cores < 1 ? 1 : cores > SCHED_MAX_WORKERS ? SCHED_MAX_WORKERS : (int)cores;
+    pool_size = worker_count * MAX_JOBS;
 
-        Job job = job_queue[front];
-        front = (front + 1) % MAX_JOBS;
-        job_count--;
-        pthread_mutex_unlock(&queue_lock);
+    // Every ring is ready before the first worker looks for one to steal from
+    int failed = jobqueue_init(&free_nodes, SCHED_RING_SIZE);
+    for (int i = 0; i < worker_count; i++)
+    {
+        for (int user = 0; user < MAX_USERS; user++)
+        {
+            for (int c = 0; c < JOB_CLASSES; c++)
+                failed |= jobqueue_init(&workers[i].ready[user][c], SCHED_RING_SIZE);
+        }
+        workers[i].deficit[0] = SCHED_QUANTUM;
+    }
+    if (failed)
+    {
+        fprintf(stderr, "Scheduler: out of memory\n");
+        exit(1);
+    }
+
+    for (int i = 0; i < pool_size; i++)
+        jobqueue_push(&free_nodes, &nodes[i]);
+    for (int i = 0; i < worker_count; i++)
+        pthread_create(&worker_threads[i], NULL, scheduler, (void *)(intptr_t)i);
+}
 
-        execute_job(job);
+// A free node, waiting for one if asked; NULL once shutting down
+static JobNode *take_node(int wait)
+{
+    JobNode *node;
+    while (!(node = jobqueue_pop(&free_nodes)) && wait)
+    {
+        // Every node is in flight: wait for a command to finish
+        pthread_mutex_lock(&queue_lock);
+        __atomic_fetch_add(&producers_waiting, 1, __ATOMIC_SEQ_CST);
+        node = jobqueue_pop(&free_nodes);
+        if (!node && running)
+        {
+            producer_blocks++;
+            pthread_cond_wait(&space_available, &queue_lock);
+        }
+        __atomic_fetch_sub(&producers_waiting, 1, __ATOMIC_SEQ_CST);
+        pthread_mutex_unlock(&queue_lock);
+        if (node)
+            break;
+        if (!running)
+            return NULL;
     }
-    return NULL;
+    return node;
+}
+
+static void place(JobNode *node, int user, int job_class, int stripe)
+{
+    node->user = user >= 0 && user < MAX_USERS ? user : 0;
+    node->job_class = job_class;
+    node->cost = class_costs[job_class];
+    clock_gettime(CLOCK_MONOTONIC, &node->submitted);
+    node->stripe = stripe;
+    if (node->stripe >= 0)
+        node->home = node->stripe % worker_count;
+    else
+        node->home = __atomic_fetch_add(&barriers_placed, 1, __ATOMIC_RELAXED) % worker_count;
+    submit(node);
 }
 
-void add_job(const char *command)
+void add_job(const char *command, int user)
+{
+    JobNode *node = take_node(1);
+    if (!node)
+        return;
+    snprintf(node->command, sizeof(node->command), "%s", command);
+    node->run = NULL;
+    place(node, user, job_class(command), job_stripe(command));
+}
+
+int add_call(const char *path, int job_class, void (*run)(void *), void *arg, int user, int wait)
+{
+    JobNode *node = take_node(wait);
+    if (!node)
+        return 0;
+    node->command[0] = '\0';
+    node->run = run;
+    node->arg = arg;
+    place(node, user, job_class, path_stripe(path));
+    return 1;
+}
+
+typedef struct
+{
+    pthread_mutex_t lock;
+    pthread_cond_t reached;
+    int done;
+} Drain;
+
+static void drain_reached(void *arg)
+{
+    Drain *drain = arg;
+    pthread_mutex_lock(&drain->lock);
+    drain->done = 1;
+    pthread_cond_signal(&drain->reached);
+    pthread_mutex_unlock(&drain->lock);
+}
+
+void scheduler_drain(int user)
+{
+    // A call on no path runs after everything submitted before it
+    Drain drain = {PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, 0};
+    if (!add_call(NULL, JOB_NORMAL, drain_reached, &drain, user, 1))
+        return;
+
+    pthread_mutex_lock(&drain.lock);
+    while (!drain.done)
+        pthread_cond_wait(&drain.reached, &drain.lock);
+    pthread_mutex_unlock(&drain.lock);
+    pthread_mutex_destroy(&drain.lock);
+    pthread_cond_destroy(&drain.reached);
+}
+
+void scheduler_print_stats()
 {
     pthread_mutex_lock(&queue_lock);
-    if (job_count < MAX_JOBS)
+    unsigned long blocks = producer_blocks;
+    pthread_mutex_unlock(&queue_lock);
+    unsigned long in_flight = pool_size - jobqueue_size(&free_nodes), ready = 0;
+
+    printf("Workers: %d (%d commands in flight at most)\n", worker_count, pool_size);
+    for (int w = 0; w < worker_count; w++)
     {
-        job_queue[rear].command = strdup(command);
-        rear = (rear + 1) % MAX_JOBS;
-        job_count++;
-        pthread_cond_signal(&job_available);
+        unsigned long queued = 0;
+        for (int user = 0; user < MAX_USERS; user++)
+        {
+            for (int c = 0; c < JOB_CLASSES; c++)
+                queued += jobqueue_size(&workers[w].ready[user][c]);
+        }
+        ready += queued;
+        printf("  worker %d: %lu run (%lu stolen), %lu idle waits, %lu ready\n", w,
+               __atomic_load_n(&workers[w].executed, __ATOMIC_RELAXED),
+               __atomic_load_n(&workers[w].stolen, __ATOMIC_RELAXED),
+               __atomic_load_n(&workers[w].waits, __ATOMIC_RELAXED), queued);
     }
-    else
+    printf("  %lu commands in flight (%lu ready), producer blocked on a full pool %lu times\n",
+           in_flight, ready, blocks);
+
+    printf("Queue wait, from submission to start:\n");
+    for (int c = 0; c < JOB_CLASSES; c++)
+    {
+        unsigned long count = 0, total = 0, longest = 0, histogram[SCHED_WAIT_BUCKETS] = {0};
+        for (int w = 0; w < worker_count; w++)
+        {
+            count += __atomic_load_n(&workers[w].waited[c], __ATOMIC_RELAXED);
+            total += __atomic_load_n(&workers[w].wait_total[c], __ATOMIC_RELAXED);
+            unsigned long worker_longest = __atomic_load_n(&workers[w].wait_longest[c], __ATOMIC_RELAXED);
+            longest = worker_longest > longest ? worker_longest : longest;
+            for (int b = 0; b < SCHED_WAIT_BUCKETS; b++)
+                histogram[b] += __atomic_load_n(&workers[w].wait_histogram[c][b], __ATOMIC_RELAXED);
+        }
+        if (count == 0)
+        {
+            printf("  %-9s: none run\n", class_names[c]);
+            continue;
+        }
+
+        // The bucket holding the 99th percentile bounds it from above
+        unsigned long seen = 0;
+        int p99 = 0;
+        while (p99 < SCHED_WAIT_BUCKETS - 1 && (seen += histogram[p99]) * 100 < count * 99)
+            p99++;
+        unsigned long bound = p99 == SCHED_WAIT_BUCKETS - 1 ? longest : 1ul << p99;
+        printf("  %-9s: %lu run, mean %lu us, p99 under %lu us, longest %lu us\n", class_names[c],
+               count, total / count, bound, longest);
+    }
+
+    printf("Fair share, estimated cost run per user:\n");
+    for (int user = 0; user < MAX_USERS; user++)
     {
-        printf(COLOR_RED "Job queue is full!\n" COLOR_RESET);
+        if (fs_state.users[user].username[0] == '\0')
+            continue;
+        unsigned long cost = 0;
+        for (int w = 0; w < worker_count; w++)
+            cost += __atomic_load_n(&workers[w].cost_run[user], __ATOMIC_RELAXED);
+        printf("  %-9s: %lu\n", fs_state.users[user].username, cost);
     }
-    pthread_mutex_unlock(&queue_lock);
 }
 
 void cleanup()
 {
+    // Queued commands live in the pool and go with the process
     pthread_mutex_lock(&queue_lock);
     running = 0;
-    pthread_cond_signal(&job_available);
-    while (job_count > 0)
-    {
-        free(job_queue[front].command);
-        front = (front + 1) % MAX_JOBS;
-        job_count--;
-    }
+    pthread_cond_broadcast(&job_available);
+    pthread_cond_broadcast(&space_available);
     pthread_mutex_unlock(&queue_lock);
-}
 
-void handle_signal(int sig)
-{
-    printf("\nShutting down...\n");
-    cleanup();
-    exit(0);
+    // Commit whatever the flusher has not written yet
+    defrag_shutdown();
+    journal_shutdown();
 }
@@ -0,0 +1,760 @@
+#include <stddef.h>
+#include "../include/storage.h"
+#include "../include/paging.h"
+#include "../include/globals.h"
+#include "../include/journal.h"
+#include "../include/volume.h"
+#include "../include/defrag.h"
+#include "../include/inode.h"
+#include "../include/directory.h"
+
+// The image the current state was loaded from. File bytes that have not been
+// faulted in yet are read from here, at File.data_offset.
+static FILE *image_fp = NULL;
+
+// Version 1 image layout: a raw dump of the structures as they were declared
+// before the sectioned format, followed by the bitmap and per-file blobs.
+#define LEGACY_MAX_FILES 100      // Files embedded in each directory
+#define LEGACY_MAX_DIRECTORIES 10 // Directories embedded in the state
+
+typedef struct
+{
+    char filename[MAX_FILENAME];
+    int size;
+    PageTableEntry *page_table;
+    int page_table_size;
+    char owner[20];
+    int permissions;
+    time_t creation_time;
+    time_t modification_time;
+    int content_size;
+    char *content;
+    int file_position;
+    int is_open;
+    int open_count;
+    int is_symlink;
+    char *link_target;
+    int ref_count;
+    ino_t inode;
+} LegacyFile;
+
+typedef struct
+{
+    char dirname[MAX_FILENAME];
+    LegacyFile files[LEGACY_MAX_FILES];
+    int file_count;
+    int parent_directory;
+    time_t creation_time;
+    ino_t inode;
+} LegacyDirectory;
+
+typedef struct
+{
+    User users[MAX_USERS];
+    LegacyDirectory directories[LEGACY_MAX_DIRECTORIES];
+    int current_directory;
+} LegacyState;
+
+// Fault a file's bytes in from the image into its pages on first use
+int load_file_content(File *file)
+{
+    if (!file || file->data_offset <= 0)
+        return 0;
+
+    if (file->content_size <= 0 || !image_fp)
+    {
+        file->data_offset = 0;
+        return file->content_size <= 0 ? 0 : -1;
+    }
+
+    // One read per extent, straight into its contiguous pages
+    int done = 0;
+    for (int e = 0; e < file->extent_count && done < file->content_size; e++)
+    {
+        char *pages = volume_page(file->extents[e].start_page);
+        if (!pages)
+            return -1;
+
+        int chunk = file->extents[e].length * PAGE_SIZE;
+        if (chunk > file->content_size - done)
+            chunk = file->content_size - done;
+        if (pread(fileno(image_fp), pages, chunk, file->data_offset + done) != chunk)
+            return -1;
+        done += chunk;
+    }
+    if (done < file->content_size)
+        return -1;
+
+    file->data_offset = 0;
+    return 0;
+}
+
+// Copy a file's bytes into the new image, from its pages or from the old image
+static int write_file_bytes(FILE *fp, File *file)
+{
+    if (volume_mode || file->content_size <= 0)
+        return 0;
+
+    if (file->data_offset <= 0)
+    {
+        int done = 0;
+        for (int e = 0; e < file->extent_count && done < file->content_size; e++)
+        {
+            char *pages = volume_page(file->extents[e].start_page);
+            int chunk = file->extents[e].length * PAGE_SIZE;
+            if (chunk > file->content_size - done)
+                chunk = file->content_size - done;
+            if (!pages || fwrite(pages, 1, chunk, fp) != (size_t)chunk)
+                return -1;
+            done += chunk;
+        }
+        return done == file->content_size ? 0 : -1;
+    }
+
+    char buffer[4096];
+    int remaining = file->content_size;
+    off_t offset = file->data_offset;
+    while (remaining > 0)
+    {
+        int chunk = remaining < (int)sizeof(buffer) ? remaining : (int)sizeof(buffer);
+        ssize_t got = (image_fp && offset > 0) ? pread(fileno(image_fp), buffer, chunk, offset) : 0;
+        if (got != chunk)
+        {
+            memset(buffer, 0, chunk);
+        }
+        if (fwrite(buffer, 1, chunk, fp) != (size_t)chunk)
+            return -1;
+        remaining -= chunk;
+        offset += chunk;
+    }
+    return 0;
+}
+
+// Content bytes a file contributes to the data region
+static int stored_bytes(const File *file)
+{
+    if (volume_mode || file->content_size <= 0)
+        return 0;
+    return file->content_size;
+}
+
+static void set_section(DiskSection *section, uint64_t offset, uint32_t count, uint32_t record_size, uint64_t length)
+{
+    section->offset = offset;
+    section->count = count;
+    section->record_size = record_size;
+    section->length = length;
+}
+
+void save_state()
+{
+    // The image points into the volume, so its pages must reach disk first
+    if (volume_mode && volume_sync() < 0)
+    {
+        printf(COLOR_RED "Error: Could not sync %s\n" COLOR_RESET, VOLUME_FILE);
+        return;
+    }
+
+    // Write to a temporary image and rename it so a crash never leaves a torn image
+    FILE *fp = fopen(STORAGE_FILE ".tmp", "wb");
+    if (!fp)
+    {
+        printf(COLOR_RED "Error: Could not write %s\n" COLOR_RESET, STORAGE_FILE);
+        return;
+    }
+
+    Superblock sb;
+    memset(&sb, 0, sizeof(sb));
+    memcpy(sb.magic, STORAGE_MAGIC, sizeof(sb.magic));
+    sb.version = STORAGE_VERSION;
+    sb.superblock_size = sizeof(Superblock);
+    sb.page_size = PAGE_SIZE;
+    sb.total_pages = total_pages;
+    sb.current_directory = fs_state.current_directory;
+    sb.flags = volume_mode ? STORAGE_FLAG_MMAP_VOLUME : 0;
+
+    uint32_t dir_count = 0, entry_count = 0, inode_total = 0, extent_total = 0;
+    uint64_t data_length = 0;
+    for (int i = 0; i < fs_state.directory_count; i++)
+    {
+        if (strlen(fs_state.directories[i].dirname) == 0)
+            continue;
+        dir_count++;
+        entry_count += fs_state.directories[i].file_count;
+    }
+    int cursor = 0;
+    File *file;
+    while ((file = inode_next(&cursor)) != NULL)
+    {
+        inode_total++;
+        extent_total += file->extents ? file->extent_count : 0;
+        data_length += stored_bytes(file) +
+                       (file->link_target ? strlen(file->link_target) : 0);
+    }
+
+    uint64_t offset = sizeof(Superblock);
+    set_section(&sb.users, offset, MAX_USERS, sizeof(DiskUser), MAX_USERS * sizeof(DiskUser));
+    offset += sb.users.length;
+    set_section(&sb.directories, offset, dir_count, sizeof(DiskDirectory), dir_count * sizeof(DiskDirectory));
+    offset += sb.directories.length;
+    set_section(&sb.entries, offset, entry_count, sizeof(DiskEntry), entry_count * sizeof(DiskEntry));
+    offset += sb.entries.length;
+    set_section(&sb.inodes, offset, inode_total, sizeof(DiskInode), inode_total * sizeof(DiskInode));
+    offset += sb.inodes.length;
+    set_section(&sb.extents, offset, extent_total, sizeof(DiskExtent), extent_total * sizeof(DiskExtent));
+    offset += sb.extents.length;
+    set_section(&sb.bitmap, offset, total_pages, 0, (total_pages + 7) / 8);
+    offset += sb.bitmap.length;
+    set_section(&sb.data, offset, inode_total, 0, data_length);
+
+    fwrite(&sb, sizeof(sb), 1, fp);
+
+    // Users
+    for (int i = 0; i < MAX_USERS; i++)
+    {
+        DiskUser user;
+        memset(&user, 0, sizeof(user));
+        memcpy(user.username, fs_state.users[i].username, sizeof(user.username));
+        memcpy(user.password, fs_state.users[i].password, sizeof(user.password));
+        fwrite(&user, sizeof(user), 1, fp);
+    }
+
+    // Directory table
+    for (int i = 0; i < fs_state.directory_count; i++)
+    {
+        Directory *dir = &fs_state.directories[i];
+        if (strlen(dir->dirname) == 0)
+            continue;
+        DiskDirectory rec;
+        memset(&rec, 0, sizeof(rec));
+        rec.index = i;
+        rec.parent_directory = dir->parent_directory;
+        rec.file_count = dir->file_count;
+        rec.creation_time = dir->creation_time;
+        rec.inode = dir->inode;
+        memcpy(rec.dirname, dir->dirname, MAX_FILENAME);
+        fwrite(&rec, sizeof(rec), 1, fp);
+    }
+
+    // Directory entries
+    for (int i = 0; i < fs_state.directory_count; i++)
+    {
+        if (strlen(fs_state.directories[i].dirname) == 0)
+            continue;
+        for (int j = 0; j < fs_state.directories[i].file_count; j++)
+        {
+            DirEntry *entry = fs_state.directories[i].files[j];
+            DiskEntry rec;
+            memset(&rec, 0, sizeof(rec));
+            rec.dir_idx = i;
+            rec.inode = entry->inode;
+            memcpy(rec.filename, entry->filename, MAX_FILENAME);
+            fwrite(&rec, sizeof(rec), 1, fp);
+        }
+    }
+
+    // Inode table
+    uint64_t extent_index = 0, data_offset = 0;
+    cursor = 0;
+    while ((file = inode_next(&cursor)) != NULL)
+    {
+        DiskInode rec;
+        memset(&rec, 0, sizeof(rec));
+        rec.dir_idx = -1;
+        rec.size = file->size;
+        rec.permissions = file->permissions;
+        rec.content_size = file->content_size > 0 ? file->content_size : 0;
+        rec.is_symlink = file->is_symlink;
+        rec.ref_count = file->ref_count;
+        rec.extent_count = file->extents ? file->extent_count : 0;
+        rec.link_target_len = file->link_target ? strlen(file->link_target) : 0;
+        rec.creation_time = file->creation_time;
+        rec.modification_time = file->modification_time;
+        rec.inode = file->inode;
+        rec.extent_index = extent_index;
+        rec.data_offset = data_offset;
+        memcpy(rec.owner, file->owner, sizeof(rec.owner));
+        fwrite(&rec, sizeof(rec), 1, fp);
+
+        extent_index += rec.extent_count;
+        data_offset += stored_bytes(file) + rec.link_target_len;
+    }
+
+    // Extent section
+    cursor = 0;
+    while ((file = inode_next(&cursor)) != NULL)
+    {
+        for (int e = 0; file->extents && e < file->extent_count; e++)
+        {
+            DiskExtent extent = {file->extents[e].start_page, file->extents[e].length};
+            fwrite(&extent, sizeof(extent), 1, fp);
+        }
+    }
+
+    // Page bitmap
+    int error = 0;
+    unsigned char *bitmap_bytes = malloc(sb.bitmap.length);
+    if (bitmap_bytes)
+    {
+        page_bitmap_to_bytes(bitmap_bytes);
+        fwrite(bitmap_bytes, 1, sb.bitmap.length, fp);
+        free(bitmap_bytes);
+    }
+    else
+    {
+        error = 1;
+    }
+
+    // Data region
+    cursor = 0;
+    while (!error && (file = inode_next(&cursor)) != NULL)
+    {
+        error = write_file_bytes(fp, file);
+        if (file->link_target)
+            fwrite(file->link_target, 1, strlen(file->link_target), fp);
+    }
+
+    if (error || fflush(fp) != 0)
+    {
+        printf(COLOR_RED "Error: Failed to write %s\n" COLOR_RESET, STORAGE_FILE);
+        fclose(fp);
+        remove(STORAGE_FILE ".tmp");
+        return;
+    }
+    fdatasync(fileno(fp));
+    fclose(fp);
+    rename(STORAGE_FILE ".tmp", STORAGE_FILE);
+
+    // Files still on disk now live at their offsets in the new image
+    FILE *new_image = fopen(STORAGE_FILE, "rb");
+    data_offset = sb.data.offset;
+    cursor = 0;
+    while ((file = inode_next(&cursor)) != NULL)
+    {
+        int content_size = stored_bytes(file);
+        if (file->data_offset > 0 && content_size > 0)
+            file->data_offset = new_image ? (off_t)data_offset : 0;
+        data_offset += content_size + (file->link_target ? strlen(file->link_target) : 0);
+    }
+    if (image_fp)
+        fclose(image_fp);
+    image_fp = new_image;
+}
+
+// Read a section's records, tolerating records written with a different size
+static void *read_section(FILE *fp, const DiskSection *section, size_t record_size)
+{
+    if (section->count == 0)
+        return NULL;
+
+    size_t stored_size = section->record_size ? section->record_size : record_size;
+    char *raw = malloc((size_t)section->count * stored_size);
+    char *records = calloc(section->count, record_size);
+    if (!raw || !records || fseeko(fp, section->offset, SEEK_SET) != 0 ||
+        fread(raw, stored_size, section->count, fp) != section->count)
+    {
+        free(raw);
+        free(records);
+        return NULL;
+    }
+
+    size_t copy = stored_size < record_size ? stored_size : record_size;
+    for (uint32_t i = 0; i < section->count; i++)
+    {
+        memcpy(records + i * record_size, raw + i * stored_size, copy);
+    }
+    free(raw);
+    return records;
+}
+
+// Create the inode a stored record describes; its links are counted as
+// entries name it
+static File *load_inode(FILE *fp, const Superblock *sb, const DiskInode *rec, void *mappings, int in_volume)
+{
+    File *file = inode_alloc(rec->inode);
+    if (!file)
+        return NULL;
+
+    memcpy(file->owner, rec->owner, sizeof(file->owner));
+    file->owner[sizeof(file->owner) - 1] = '\0';
+    file->size = rec->size;
+    file->permissions = rec->permissions;
+    file->content_size = rec->content_size;
+    file->is_symlink = rec->is_symlink;
+    file->creation_time = rec->creation_time;
+    file->modification_time = rec->modification_time;
+
+    // Content is faulted in on first use
+    int stored = in_volume ? 0 : rec->content_size;
+    file->data_offset = stored > 0 ? (off_t)(sb->data.offset + rec->data_offset) : 0;
+
+    if (rec->extent_count > 0 && rec->extent_index + rec->extent_count <= sb->extents.count)
+    {
+        // Older images map every page separately; they are coalesced into extents
+        if (sb->version < STORAGE_FIRST_EXTENT_VERSION)
+        {
+            DiskPageEntry *entries = (DiskPageEntry *)mappings + rec->extent_index;
+            int *pages = malloc(rec->extent_count * sizeof(int));
+            for (int p = 0; pages && p < rec->extent_count; p++)
+                pages[p] = entries[p].physical_page;
+            if (pages)
+                extents_from_pages(pages, rec->extent_count, &file->extents, &file->extent_count);
+            free(pages);
+        }
+        else
+        {
+            DiskExtent *extents = (DiskExtent *)mappings + rec->extent_index;
+            file->extents = malloc(rec->extent_count * sizeof(Extent));
+            for (int e = 0; file->extents && e < rec->extent_count; e++)
+            {
+                file->extents[e].start_page = extents[e].start_page;
+                file->extents[e].length = extents[e].length;
+            }
+            file->extent_count = file->extents ? rec->extent_count : 0;
+        }
+        file->page_count = extent_page_count(file->extents, file->extent_count);
+    }
+
+    // Symlink targets are path metadata, so they are loaded eagerly
+    if (rec->link_target_len > 0)
+    {
+        file->link_target = calloc(rec->link_target_len + 1, 1);
+        if (file->link_target &&
+            pread(fileno(fp), file->link_target, rec->link_target_len,
+                  sb->data.offset + rec->data_offset + stored) != rec->link_target_len)
+        {
+            free(file->link_target);
+            file->link_target = NULL;
+        }
+    }
+    return file;
+}
+
+// Add a loaded directory entry naming file
+static void link_loaded(int dir_idx, const char *name, File *file)
+{
+    Directory *dir = dir_get(dir_idx);
+    if (!dir)
+        return;
+    char filename[MAX_FILENAME];
+    memcpy(filename, name, MAX_FILENAME);
+    filename[MAX_FILENAME - 1] = '\0';
+    if (dir_insert(dir, filename, file->inode))
+        file->ref_count++;
+}
+
+// Load a sectioned image: metadata only, file bytes stay in the image or volume
+static int load_sectioned_state(FILE *fp, const Superblock *sb)
+{
+    if (sb->version > STORAGE_VERSION || sb->page_size != PAGE_SIZE ||
+        sb->total_pages == 0 || sb->total_pages > MAX_TOTAL_PAGES)
+    {
+        printf(COLOR_RED "Unsupported image (version %u, %u pages of %u bytes)\n" COLOR_RESET,
+               sb->version, sb->total_pages, sb->page_size);
+        return -1;
+    }
+
+    DiskUser *users = read_section(fp, &sb->users, sizeof(DiskUser));
+    DiskDirectory *dirs = read_section(fp, &sb->directories, sizeof(DiskDirectory));
+    DiskInode *inodes = read_section(fp, &sb->inodes, sizeof(DiskInode));
+    // Before version 5 every inode record doubled as the directory entry
+    int has_entries = sb->version >= STORAGE_FIRST_ENTRY_VERSION;
+    DiskEntry *entries = has_entries ? read_section(fp, &sb->entries, sizeof(DiskEntry)) : NULL;
+    int per_page = sb->version < STORAGE_FIRST_EXTENT_VERSION;
+    void *mappings = read_section(fp, &sb->extents, per_page ? sizeof(DiskPageEntry) : sizeof(DiskExtent));
+    if ((sb->directories.count && !dirs) || (sb->inodes.count && !inodes) ||
+        (sb->extents.count && !mappings) || (has_entries && sb->entries.count && !entries))
+    {
+        free(users);
+        free(dirs);
+        free(inodes);
+        free(entries);
+        free(mappings);
+        return -1;
+    }
+
+    // The volume is sized before it is mapped
+    volume_close();
+    if (paging_set_total(sb->total_pages) != 0)
+    {
+        free(users);
+        free(dirs);
+        free(inodes);
+        free(entries);
+        free(mappings);
+        return -1;
+    }
+
+    if (sb->flags & STORAGE_FLAG_MMAP_VOLUME)
+    {
+        if (volume_open(0) != 0)
+        {
+            // Keep going with an empty volume so the metadata is still usable
+            printf(COLOR_YELLOW "Warning: %s missing, file contents are lost\n" COLOR_RESET, VOLUME_FILE);
+            volume_open(1);
+        }
+    }
+    else
+    {
+        volume_close();
+    }
+    int in_volume = volume_mode;
+
+    dir_table_reset();
+    memset(&fs_state, 0, sizeof(fs_state));
+    inode_table_reset();
+    fs_state.current_directory = sb->current_directory;
+
+    for (uint32_t i = 0; users && i < sb->users.count && i < MAX_USERS; i++)
+    {
+        memcpy(fs_state.users[i].username, users[i].username, sizeof(users[i].username));
+        memcpy(fs_state.users[i].password, users[i].password, sizeof(users[i].password));
+    }
+
+    for (uint32_t i = 0; i < sb->directories.count; i++)
+    {
+        Directory *dir = dir_table_claim(dirs[i].index);
+        if (!dir)
+            continue;
+        memcpy(dir->dirname, dirs[i].dirname, MAX_FILENAME);
+        dir->dirname[MAX_FILENAME - 1] = '\0';
+        dir->parent_directory = dirs[i].parent_directory;
+        dir->creation_time = dirs[i].creation_time;
+        dir->inode = dirs[i].inode;
+    }
+    dir_table_attach_all();
+    if (!dir_get(fs_state.current_directory))
+        fs_state.current_directory = 0;
+
+    for (uint32_t i = 0; i < sb->inodes.count; i++)
+    {
+        DiskInode *rec = &inodes[i];
+        File *file = inode_get(rec->inode);
+        if (!file)
+            file = load_inode(fp, sb, rec, mappings, in_volume);
+        if (!file || has_entries)
+            continue;
+        link_loaded(rec->dir_idx, rec->filename, file);
+    }
+    for (uint32_t i = 0; has_entries && i < sb->entries.count; i++)
+    {
+        File *file = inode_get(entries[i].inode);
+        if (file)
+            link_loaded(entries[i].dir_idx, entries[i].filename, file);
+    }
+
+    // Inodes no entry names are unreachable
+    int cursor = 0;
+    File *orphan;
+    while ((orphan = inode_next(&cursor)) != NULL)
+    {
+        if (orphan->ref_count == 0)
+        {
+            inode_lock(orphan, 1);
+            inode_free(orphan);
+        }
+    }
+
+    // The stored bitmap cannot say how many copies share a page, so both
+    // the bitmap and the shared counts are derived from the extents
+    rebuild_page_bitmap();
+
+    free(users);
+    free(dirs);
+    free(inodes);
+    free(entries);
+    free(mappings);
+    return 0;
+}
+
+// Load a version 1 image (raw FileSystemState dump) eagerly and convert it
+static int load_legacy_state(FILE *fp)
+{
+    LegacyState *legacy = malloc(sizeof(LegacyState));
+    if (!legacy)
+        return -1;
+
+    // Version 1 images always describe the compiled-in volume size
+    if (paging_set_total(TOTAL_PAGES) != 0)
+    {
+        free(legacy);
+        return -1;
+    }
+
+    rewind(fp);
+    unsigned char bitmap_bytes[TOTAL_PAGES / 8];
+    if (fread(legacy, sizeof(LegacyState), 1, fp) != 1 ||
+        fread(bitmap_bytes, sizeof(bitmap_bytes), 1, fp) != 1)
+    {
+        free(legacy);
+        return -1;
+    }
+    page_bitmap_from_bytes(bitmap_bytes);
+
+    dir_table_reset();
+    memset(&fs_state, 0, sizeof(fs_state));
+    inode_table_reset();
+    memcpy(fs_state.users, legacy->users, sizeof(fs_state.users));
+    fs_state.current_directory = legacy->current_directory;
+
+    for (int i = 0; i < LEGACY_MAX_DIRECTORIES; i++)
+    {
+        LegacyDirectory *old_dir = &legacy->directories[i];
+        Directory unused; // Unused slots still carry their files' blobs
+        Directory *dir = old_dir->dirname[0] ? dir_table_claim(i) : NULL;
+        if (!dir)
+        {
+            memset(&unused, 0, sizeof(unused));
+            dir = &unused;
+        }
+        memcpy(dir->dirname, old_dir->dirname, MAX_FILENAME);
+        dir->parent_directory = old_dir->parent_directory;
+        dir->creation_time = old_dir->creation_time;
+        dir->inode = old_dir->inode;
+
+        for (int j = 0; j < old_dir->file_count && j < LEGACY_MAX_FILES; j++)
+        {
+            // Version 1 stored every hard link as a full copy; the first one
+            // becomes the inode and the others only add their names
+            LegacyFile *old_file = &old_dir->files[j];
+            File scratch; // Receives the blobs of records that are not kept
+            memset(&scratch, 0, sizeof(scratch));
+            File *file = inode_get(old_file->inode);
+            if (file)
+            {
+                link_loaded(i, old_file->filename, file);
+                file = &scratch;
+            }
+            else if (dir != &unused && (file = inode_alloc(old_file->inode)) != NULL)
+                link_loaded(i, old_file->filename, file);
+            else
+                file = &scratch;
+
+            memcpy(file->owner, old_file->owner, sizeof(file->owner));
+            file->size = old_file->size;
+            file->permissions = old_file->permissions;
+            file->creation_time = old_file->creation_time;
+            file->modification_time = old_file->modification_time;
+            file->is_symlink = old_file->is_symlink;
+
+            // Version 1 wrote content_size as a size_t; only the int part is meaningful
+            unsigned char raw_size[sizeof(size_t)];
+            int content_size = 0;
+            if (fread(raw_size, sizeof(raw_size), 1, fp) != 1)
+                continue;
+            memcpy(&content_size, raw_size, sizeof(int));
+
+            char *content = NULL;
+            if (content_size > 0)
+            {
+                content = malloc(content_size + 1);
+                if (content && fread(content, 1, content_size, fp) == (size_t)content_size)
+                {
+                    content[content_size] = '\0';
+                }
+                else
+                {
+                    free(content);
+                    content = NULL;
+                }
+            }
+
+            int table_size = 0;
+            if (fread(&table_size, sizeof(int), 1, fp) != 1)
+            {
+                free(content);
+                continue;
+            }
+            if (table_size > 0)
+            {
+                PageTableEntry *table = malloc(table_size * sizeof(PageTableEntry));
+                int *pages = malloc(table_size * sizeof(int));
+                if (table && pages &&
+                    fread(table, sizeof(PageTableEntry), table_size, fp) == (size_t)table_size)
+                {
+                    for (int p = 0; p < table_size; p++)
+                        pages[p] = table[p].physical_page;
+                    extents_from_pages(pages, table_size, &file->extents, &file->extent_count);
+                    file->page_count = extent_page_count(file->extents, file->extent_count);
+                }
+                free(table);
+                free(pages);
+            }
+
+            // Move the bytes into the file's pages (the stored trailing NUL is not content)
+            if (content)
+            {
+                if (file != &scratch)
+                    file->content_size = volume_write(file, 0, content, strnlen(content, content_size));
+                free(content);
+            }
+            if (file == &scratch)
+                free(scratch.extents);
+        }
+    }
+
+    dir_table_attach_all();
+    if (!dir_get(fs_state.current_directory))
+        fs_state.current_directory = 0;
+
+    // Pages of dropped link copies are not owned by any inode
+    rebuild_page_bitmap();
+
+    free(legacy);
+    return 0;
+}
+
+void load_state()
+{
+    printf("Attempting to load state...\n");
+    defrag_cancel();
+    FILE *fp = fopen(STORAGE_FILE, "rb");
+    if (!fp)
+    {
+        printf("No existing filesystem found, initializing new one\n");
+        initialize_directories();
+        return;
+    }
+
+    printf("Found existing %s\n", STORAGE_FILE);
+    Superblock sb;
+    memset(&sb, 0, sizeof(sb));
+    size_t got = fread(&sb, 1, sizeof(sb), fp);
+
+    int result;
+    unsigned int version;
+    if (got >= offsetof(Superblock, superblock_size) && memcmp(sb.magic, STORAGE_MAGIC, sizeof(sb.magic)) == 0)
+    {
+        version = sb.version;
+        result = (got == sizeof(sb) || sb.superblock_size <= got) ? load_sectioned_state(fp, &sb) : -1;
+    }
+    else
+    {
+        version = 1;
+        volume_close();
+        result = load_legacy_state(fp);
+    }
+
+    if (result != 0)
+    {
+        printf("Error reading filesystem state, initializing new one\n");
+        fclose(fp);
+        initialize_directories();
+        return;
+    }
+
+    // Keep the image open: unloaded file bytes are read from it on demand
+    if (image_fp)
+        fclose(image_fp);
+    image_fp = fp;
+
+    // Apply the operations logged since the last checkpoint
+    journal_replay();
+
+    // Rewrite older images in the current format right away
+    if (version < STORAGE_VERSION)
+    {
+        checkpoint_filesystem();
+        printf("Upgraded version %u image to version %d\n", version, STORAGE_VERSION);
+    }
+}
@@ -0,0 +1,350 @@
+#include <errno.h>
+#include <sys/mman.h>
+#include "../include/volume.h"
+#include "../include/paging.h"
+#include "../include/globals.h"
+#include "../include/journal.h"
+
+int volume_mode = 0;
+
+static char *volume_base = NULL;
+static int volume_fd = -1;
+static int mapped_pages = 0; // Size of the current mapping
+
+// Pages written since the last volume_sync() (only tracked for VOLUME_FILE)
+static uint64_t *dirty_pages = NULL;
+static pthread_mutex_t volume_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Without a volume file the pages are private anonymous memory, only
+// backed once touched, so large volumes cost nothing up front
+static int map_memory()
+{
+    void *base = mmap(NULL, VOLUME_SIZE, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (base == MAP_FAILED)
+    {
+        printf(COLOR_RED "Error: Could not allocate page store\n" COLOR_RESET);
+        return -1;
+    }
+    mapped_pages = total_pages;
+    __atomic_store_n(&volume_base, base, __ATOMIC_RELEASE); // Published last, see volume_page()
+    return 0;
+}
+
+// Map the volume file, creating (and zero-filling) it if requested
+int volume_open(int create)
+{
+    volume_close();
+
+    int flags = O_RDWR | (create ? O_CREAT | O_TRUNC : 0);
+    volume_fd = open(VOLUME_FILE, flags, 0644);
+    if (volume_fd < 0)
+    {
+        printf(COLOR_RED "Error: Could not open volume %s\n" COLOR_RESET, VOLUME_FILE);
+        return -1;
+    }
+
+    if (ftruncate(volume_fd, VOLUME_SIZE) != 0)
+    {
+        printf(COLOR_RED "Error: Could not size volume %s\n" COLOR_RESET, VOLUME_FILE);
+        close(volume_fd);
+        volume_fd = -1;
+        return -1;
+    }
+
+    void *base = mmap(NULL, VOLUME_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, volume_fd, 0);
+    if (base == MAP_FAILED)
+    {
+        printf(COLOR_RED "Error: Could not map volume %s\n" COLOR_RESET, VOLUME_FILE);
+        close(volume_fd);
+        volume_fd = -1;
+        return -1;
+    }
+
+    dirty_pages = calloc((total_pages + 63) / 64, sizeof(uint64_t));
+    if (!dirty_pages)
+    {
+        munmap(base, VOLUME_SIZE);
+        close(volume_fd);
+        volume_fd = -1;
+        return -1;
+    }
+    volume_base = base;
+    mapped_pages = total_pages;
+    volume_mode = 1;
+    return 0;
+}
+
+// Drop the volume file; later accesses get a fresh in-memory store
+void volume_close()
+{
+    if (volume_base)
+    {
+        volume_sync();
+        munmap(volume_base, (size_t)mapped_pages * PAGE_SIZE);
+        volume_base = NULL;
+        mapped_pages = 0;
+    }
+    free(dirty_pages);
+    dirty_pages = NULL;
+    if (volume_fd >= 0)
+    {
+        close(volume_fd);
+        volume_fd = -1;
+    }
+    volume_mode = 0;
+}
+
+char *volume_page(int page)
+{
+    if (page < 0 || page >= total_pages)
+        return NULL;
+    // Writers to different files can both be first to touch the store
+    if (!__atomic_load_n(&volume_base, __ATOMIC_ACQUIRE))
+    {
+        pthread_mutex_lock(&volume_lock);
+        int result = volume_base ? 0 : map_memory();
+        pthread_mutex_unlock(&volume_lock);
+        if (result != 0)
+            return NULL;
+    }
+    return page < mapped_pages ? volume_base + (size_t)page * PAGE_SIZE : NULL;
+}
+
+static void mark_dirty_range(int first_page, int last_page)
+{
+    if (volume_fd < 0)
+        return;
+    pthread_mutex_lock(&volume_lock);
+    for (int page = first_page; page <= last_page; page++)
+        dirty_pages[page / 64] |= 1ULL << (page % 64);
+    pthread_mutex_unlock(&volume_lock);
+}
+
+// Walk the extents covering [offset, offset + len) and copy each contiguous
+// stretch in one go; to_pages selects the direction
+static int transfer(const File *file, int offset, char *buffer, int len, int to_pages)
+{
+    int done = 0;
+    long extent_offset = 0; // Byte offset of the current extent within the file
+    for (int e = 0; e < file->extent_count && done < len; e++)
+    {
+        const Extent *extent = &file->extents[e];
+        long extent_bytes = (long)extent->length * PAGE_SIZE;
+        long pos = offset + done;
+        if (pos >= extent_offset + extent_bytes)
+        {
+            extent_offset += extent_bytes;
+            continue;
+        }
+
+        char *base = volume_page(extent->start_page);
+        if (!base || extent->start_page + extent->length > mapped_pages)
+            break;
+
+        long in_extent = pos - extent_offset;
+        int chunk = extent_bytes - in_extent < len - done ? extent_bytes - in_extent : len - done;
+        if (to_pages)
+        {
+            memcpy(base + in_extent, buffer + done, chunk);
+            mark_dirty_range(extent->start_page + in_extent / PAGE_SIZE,
+                             extent->start_page + (in_extent + chunk - 1) / PAGE_SIZE);
+        }
+        else
+        {
+            memcpy(buffer + done, base + in_extent, chunk);
+        }
+        done += chunk;
+        extent_offset += extent_bytes;
+    }
+    return done;
+}
+
+// Copy len bytes starting at offset out of the file's pages
+int volume_read(const File *file, int offset, char *buffer, int len)
+{
+    return transfer(file, offset, buffer, len, 0);
+}
+
+// Store len bytes at offset, touching only the pages that cover the range
+int volume_write(const File *file, int offset, const char *data, int len)
+{
+    return transfer(file, offset, (char *)data, len, 1);
+}
+
+// Find the extent holding logical page index and the offset within it
+static int locate_page(const Extent *extents, int extent_count, int index, int *in_extent)
+{
+    for (int e = 0; e < extent_count; e++)
+    {
+        if (index < extents[e].length)
+        {
+            *in_extent = index;
+            return e;
+        }
+        index -= extents[e].length;
+    }
+    return extent_count;
+}
+
+// Duplicate logical pages [first, first + pages) of src into the same
+// logical pages of dst (already allocated), one memmove per shared run
+int volume_copy_range(const File *src, File *dst, int first, int pages)
+{
+    int copied = 0;
+    int src_in = 0, dst_in = 0;
+    int src_e = locate_page(src->extents, src->extent_count, first, &src_in);
+    int dst_e = locate_page(dst->extents, dst->extent_count, first, &dst_in);
+    while (copied < pages && src_e < src->extent_count && dst_e < dst->extent_count)
+    {
+        // Largest run that is contiguous in both files
+        int run = src->extents[src_e].length - src_in;
+        if (dst->extents[dst_e].length - dst_in < run)
+            run = dst->extents[dst_e].length - dst_in;
+        if (pages - copied < run)
+            run = pages - copied;
+
+        char *from = volume_page(src->extents[src_e].start_page + src_in);
+        char *to = volume_page(dst->extents[dst_e].start_page + dst_in);
+        if (!from || !to || src->extents[src_e].start_page + src_in + run > mapped_pages ||
+            dst->extents[dst_e].start_page + dst_in + run > mapped_pages)
+            return -1;
+        // Pages both files share need no copy
+        if (from != to)
+        {
+            memmove(to, from, (size_t)run * PAGE_SIZE);
+            mark_dirty_range(dst->extents[dst_e].start_page + dst_in,
+                             dst->extents[dst_e].start_page + dst_in + run - 1);
+        }
+
+        copied += run;
+        src_in += run;
+        dst_in += run;
+        if (src_in == src->extents[src_e].length)
+        {
+            src_e++;
+            src_in = 0;
+        }
+        if (dst_in == dst->extents[dst_e].length)
+        {
+            dst_e++;
+            dst_in = 0;
+        }
+    }
+    return 0;
+}
+
+// Duplicate the bytes of src into dst's (already allocated) pages
+int volume_copy_pages(const File *src, File *dst)
+{
+    int pages = src->page_count < dst->page_count ? src->page_count : dst->page_count;
+    return volume_copy_range(src, dst, 0, pages);
+}
+
+// Copy on write: give a file private copies of the pages other files still
+// share among logical pages [first, first + pages). Each shared stretch is
+// copied to newly allocated pages and the extents re-pointed there. The copy
+// is logged before the shared pages are released: from then on the other
+// owner may write them in place, and replay must copy them before that.
+// Returns the number of pages copied, or -ENOSPC.
+int volume_unshare(File *file, int first, int pages)
+{
+    Extent **extents = &file->extents;
+    int *extent_count = &file->extent_count;
+    int copied = 0;
+    int index = first;
+    while (index < first + pages)
+    {
+        int in;
+        int e = locate_page(*extents, *extent_count, index, &in);
+        if (e == *extent_count)
+            break;
+
+        // Stretch of pages within this extent that are all shared or all private
+        int physical = (*extents)[e].start_page + in;
+        int limit = (*extents)[e].length - in < first + pages - index ? (*extents)[e].length - in
+                                                                       : first + pages - index;
+        int shared = page_refs(physical) > 1;
+        int length = 1;
+        while (length < limit && (page_refs(physical + length) > 1) == shared)
+            length++;
+
+        if (shared)
+        {
+            Extent *fresh;
+            int fresh_count;
+            if (allocate_pages(length, &fresh, &fresh_count) != 0)
+                return -ENOSPC;
+
+            int done = 0;
+            for (int f = 0; f < fresh_count; f++)
+            {
+                char *from = volume_page(physical + done);
+                char *to = volume_page(fresh[f].start_page);
+                if (from && to)
+                    memcpy(to, from, (size_t)fresh[f].length * PAGE_SIZE);
+                mark_dirty_range(fresh[f].start_page, fresh[f].start_page + fresh[f].length - 1);
+                done += fresh[f].length;
+            }
+
+            journal_log_unshare(file, index, physical, fresh, fresh_count);
+            release_pages(physical, length);
+            if (splice_extents(extents, extent_count, index, length, fresh, fresh_count) != 0)
+            {
+                // Keep the new pages owned by nobody rather than lose the list
+                for (int f = 0; f < fresh_count; f++)
+                    release_pages(fresh[f].start_page, fresh[f].length);
+                free(fresh);
+                return -ENOSPC;
+            }
+            free(fresh);
+            copied += length;
+        }
+        index += length;
+    }
+    return copied;
+}
+
+// msync every dirty range, coalescing adjacent pages into one call
+int volume_sync()
+{
+    if (!volume_base || volume_fd < 0)
+        return 0;
+
+    // Swap in a clean set so writers are not held up by the msync calls
+    int words = (mapped_pages + 63) / 64;
+    uint64_t *fresh = calloc(words, sizeof(uint64_t));
+    if (!fresh)
+        return -1;
+    pthread_mutex_lock(&volume_lock);
+    uint64_t *dirty = dirty_pages;
+    dirty_pages = fresh;
+    pthread_mutex_unlock(&volume_lock);
+
+    int synced = 0;
+    int page = 0;
+    while (page < mapped_pages)
+    {
+        // Skip clean words whole
+        if (!(dirty[page / 64] >> (page % 64)))
+        {
+            page = (page / 64 + 1) * 64;
+            continue;
+        }
+        page += __builtin_ctzll(dirty[page / 64] >> (page % 64));
+
+        int start = page;
+        while (page < mapped_pages && (dirty[page / 64] & (1ULL << (page % 64))))
+            page++;
+
+        if (msync(volume_base + (size_t)start * PAGE_SIZE, (size_t)(page - start) * PAGE_SIZE, MS_SYNC) != 0)
+        {
+            printf(COLOR_RED "Error: msync failed for pages %d-%d\n" COLOR_RESET, start, page - 1);
+            free(dirty);
+            return -1;
+        }
+        synced += page - start;
+    }
+    free(dirty);
+    return synced;
+}
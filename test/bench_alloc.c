@@ -0,0 +1,176 @@
+// Page allocator benchmark: cost of allocate_pages() at 10%, 50% and 95% fill.
+// The comparison volume size comes from TOTAL_BLOCKS (see the bench target in
+// the Makefile); the scaling runs format larger volumes at run time.
+#include <errno.h>
+#include "test_utils.h"
+#include "../include/globals.h"
+
+#define ROUNDS 5000
+
+// The allocator this replaced: test one bit at a time from page 0
+static unsigned char linear_bitmap[TOTAL_PAGES / 8];
+
+static int linear_allocate(int pages_needed, void **handle)
+{
+    PageTableEntry **page_table = (PageTableEntry **)handle;
+    *page_table = malloc(pages_needed * sizeof(PageTableEntry));
+    if (*page_table == NULL)
+        return -1;
+
+    for (int i = 0; i < pages_needed; i++) {
+        int page = -1;
+        for (int j = 0; j < TOTAL_PAGES; j++) {
+            if (!(linear_bitmap[j / 8] & (1 << (j % 8)))) {
+                linear_bitmap[j / 8] |= (1 << (j % 8));
+                (*page_table)[i].physical_page = j;
+                page = j;
+                break;
+            }
+        }
+        if (page == -1) {
+            for (int k = 0; k < i; k++)
+                linear_bitmap[(*page_table)[k].physical_page / 8] &= ~(1 << ((*page_table)[k].physical_page % 8));
+            free(*page_table);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static void linear_free(void *handle, int pages)
+{
+    PageTableEntry *table = handle;
+    for (int p = 0; p < pages; p++)
+        linear_bitmap[table[p].physical_page / 8] &= ~(1 << (table[p].physical_page % 8));
+    free(table);
+}
+
+static int word_allocate(int pages_needed, void **handle)
+{
+    int extent_count;
+    return allocate_pages(pages_needed, (Extent **)handle, &extent_count);
+}
+
+static void word_free(void *handle, int pages)
+{
+    // The handle only carries the extents; count them from the page total
+    File file = {0};
+    file.extents = handle;
+    while (pages > 0)
+        pages -= file.extents[file.extent_count++].length;
+    free_pages(&file);
+    free(file.extents);
+}
+
+static double elapsed_ns(struct timespec *start, struct timespec *end)
+{
+    return (end->tv_sec - start->tv_sec) * 1e9 + (end->tv_nsec - start->tv_nsec);
+}
+
+// Mark a random fill% of the volume as used in both bitmaps
+static void fill_volume(int percent)
+{
+    paging_set_total(TOTAL_PAGES);
+    memset(linear_bitmap, 0, sizeof(linear_bitmap));
+    srand(42);
+
+    int target = (int)((long)TOTAL_PAGES * percent / 100);
+    int used = 0;
+    while (used < target) {
+        int page = rand() % TOTAL_PAGES;
+        if (page_is_used(page))
+            continue;
+        mark_page_used(page);
+        linear_bitmap[page / 8] |= (1 << (page % 8));
+        used++;
+    }
+}
+
+// Allocate FILES_PER_ROUND files, then free them, so each round eats into the free space
+#define FILES_PER_ROUND 32
+
+static double run(int (*allocate)(int, void **), void (*release)(void *, int),
+                  int pages_per_file, int rounds)
+{
+    struct timespec start, end;
+    void *tables[FILES_PER_ROUND];
+    long allocations = 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int r = 0; r < rounds; r++) {
+        int made = 0;
+        while (made < FILES_PER_ROUND && allocate(pages_per_file, &tables[made]) == 0)
+            made++;
+        for (int i = 0; i < made; i++)
+            release(tables[i], pages_per_file);
+        allocations += made;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return allocations ? elapsed_ns(&start, &end) / allocations : 0;
+}
+
+static void bench(int percent, int pages_per_file)
+{
+    fill_volume(percent);
+    double word_ns = run(word_allocate, word_free, pages_per_file, ROUNDS);
+    // The bit scan is far slower on large volumes, so it runs fewer rounds
+    double linear_ns = run(linear_allocate, linear_free, pages_per_file, ROUNDS / 50);
+
+    printf("  %3d%% full, %2d pages: %10.1f ns (word scan)  %12.1f ns (bit scan)\n",
+           percent, pages_per_file, word_ns, linear_ns);
+}
+
+// Half-full volume of the given size with pages in use at random
+static void fill_random(int pages)
+{
+    paging_set_total(pages);
+    unsigned char *bytes = malloc((pages + 7) / 8);
+    for (int i = 0; i < (pages + 7) / 8; i++)
+        bytes[i] = rand();
+    page_bitmap_from_bytes(bytes);
+    free(bytes);
+}
+
+int main()
+{
+    printf(COLOR_CYAN "Page allocator, %d pages of %d bytes\n" COLOR_RESET, TOTAL_PAGES, PAGE_SIZE);
+
+    int fills[] = {10, 50, 95};
+    for (int i = 0; i < 3; i++) {
+        bench(fills[i], 1);
+        bench(fills[i], 16);
+    }
+
+    // Extents needed to map one large file
+    int fills_for_mapping[] = {0, 50};
+    for (int i = 0; i < 2; i++) {
+        fill_volume(fills_for_mapping[i]);
+        int pages = TOTAL_PAGES * (100 - fills_for_mapping[i]) / 100 * 9 / 10;
+        Extent *extents;
+        int extent_count;
+        if (allocate_pages(pages, &extents, &extent_count) == 0) {
+            printf("  %3d%% full: %d pages (%ld MB) mapped by %d extents\n", fills_for_mapping[i],
+                   pages, (long)pages * PAGE_SIZE >> 20, extent_count);
+            free(extents);
+        }
+    }
+
+    // Contiguous runs are found through the free-space index, so the cost
+    // should barely move as the volume grows
+    long sizes_mb[] = {1024, 16 * 1024, 256 * 1024};
+    for (int i = 0; i < 3; i++) {
+        int pages = sizes_mb[i] * (1024 * 1024 / PAGE_SIZE);
+        fill_random(pages);
+        double ns = run(word_allocate, word_free, 16, ROUNDS);
+        printf("  %4ld GB half full, 16 pages: %8.1f ns  (largest free run %d pages)\n",
+               sizes_mb[i] / 1024, ns, largest_free_run());
+    }
+
+    // A request larger than the free count fails without scanning
+    fill_volume(95);
+    Extent *extents;
+    int extent_count;
+    int result = allocate_pages(TOTAL_PAGES, &extents, &extent_count);
+    printf("  oversized request: %s\n", result == -ENOSPC ? "ENOSPC" : "unexpected result");
+    return result == -ENOSPC ? 0 : 1;
+}
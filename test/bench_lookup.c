@@ -0,0 +1,175 @@
+// Path lookup benchmark: stat_file() latency as reader threads grow from 1
+// to 8, on a quiet tree and while a writer creates and deletes files and
+// moves a directory back and forth. Readers run lock-free; the comparison
+// wraps each stat in the shared filesystem lock, as every read took before.
+#include <dirent.h>
+#include <sched.h>
+#include "test_utils.h"
+#include "../include/globals.h"
+
+#define OPS 20000 // Per reader
+#define MAX_READERS 8
+#define DEPTH 4
+
+static char bench_dir[] = "/tmp/mini_fs_bench.XXXXXX";
+static char deep_path[128];
+
+static int take_fs_lock;
+static int readers_done;
+
+static long samples[MAX_READERS][OPS];
+
+static double elapsed_ns(struct timespec *start, struct timespec *end)
+{
+    return (end->tv_sec - start->tv_sec) * 1e9 + (end->tv_nsec - start->tv_nsec);
+}
+
+static void *reader(void *arg)
+{
+    long *latency = arg;
+    FsFileInfo info;
+    for (int i = 0; i < OPS; i++)
+    {
+        struct timespec start, end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        if (take_fs_lock)
+            pthread_rwlock_rdlock(&fs_lock);
+        FsStatus status = stat_file(deep_path, &info);
+        if (take_fs_lock)
+            pthread_rwlock_unlock(&fs_lock);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        latency[i] = status == FS_OK ? (long)elapsed_ns(&start, &end) : -1;
+    }
+    return NULL;
+}
+
+// Namespace changes that need the filesystem lock, and directory moves that
+// make readers revalidate
+static void *writer(void *arg)
+{
+    long *rounds = arg;
+    while (!__atomic_load_n(&readers_done, __ATOMIC_ACQUIRE))
+    {
+        create_file("/w/scratch", 0644, NULL);
+        delete_file("/w/scratch", NULL);
+        move_directory("/m/x", "/n", NULL, NULL);
+        move_directory("/n/x", "/m", NULL, NULL);
+        (*rounds)++;
+        sched_yield();
+    }
+    return NULL;
+}
+
+static int compare_long(const void *a, const void *b)
+{
+    long x = *(const long *)a, y = *(const long *)b;
+    return (x > y) - (x < y);
+}
+
+// Mean and 99th percentile in nanoseconds; -1 if a lookup failed
+static int run(int readers, int with_writer, double *mean, double *p99, long *writer_rounds)
+{
+    pthread_t threads[MAX_READERS], writer_thread;
+    readers_done = 0;
+    *writer_rounds = 0;
+
+    if (with_writer)
+        pthread_create(&writer_thread, NULL, writer, writer_rounds);
+    for (int i = 0; i < readers; i++)
+        pthread_create(&threads[i], NULL, reader, samples[i]);
+    for (int i = 0; i < readers; i++)
+        pthread_join(threads[i], NULL);
+    __atomic_store_n(&readers_done, 1, __ATOMIC_RELEASE);
+    if (with_writer)
+        pthread_join(writer_thread, NULL);
+
+    long *all = &samples[0][0];
+    int count = readers * OPS;
+    double total = 0;
+    for (int i = 0; i < count; i++)
+    {
+        if (all[i] < 0)
+            return -1;
+        total += all[i];
+    }
+    qsort(all, count, sizeof(long), compare_long);
+    *mean = total / count;
+    *p99 = all[count * 99 / 100];
+    return 0;
+}
+
+static void build_tree()
+{
+    char path[128] = "";
+    for (int i = 0; i < DEPTH; i++)
+    {
+        size_t length = strlen(path);
+        snprintf(path + length, sizeof(path) - length, "/d%d", i);
+        create_directory(path, NULL);
+    }
+    snprintf(deep_path, sizeof(deep_path), "%s/file", path);
+    create_file(deep_path, 0644, NULL);
+
+    create_directory("/w", NULL);
+    create_directory("/m", NULL);
+    create_directory("/m/x", NULL);
+    create_directory("/n", NULL);
+}
+
+static void remove_bench_dir()
+{
+    DIR *dir = opendir(".");
+    struct dirent *entry;
+    while (dir && (entry = readdir(dir)) != NULL)
+    {
+        if (strcmp(entry->d_name, ".") != 0 && strcmp(entry->d_name, "..") != 0)
+            unlink(entry->d_name);
+    }
+    if (dir)
+        closedir(dir);
+    if (chdir("/") == 0)
+        rmdir(bench_dir);
+}
+
+int main()
+{
+    // The image and journal go to a scratch directory
+    if (!mkdtemp(bench_dir) || chdir(bench_dir) != 0)
+    {
+        perror("Bench directory");
+        return 1;
+    }
+    initialize_directories();
+    format_filesystem(0, TOTAL_PAGES, NULL);
+    build_tree();
+
+    printf(COLOR_CYAN "stat_file(\"%s\"), %d lookups per reader, %ld cores\n" COLOR_RESET, deep_path, OPS,
+           sysconf(_SC_NPROCESSORS_ONLN));
+
+    int failed = 0;
+    int reader_counts[] = {1, 2, 4, 8};
+    for (int with_writer = 0; with_writer < 2; with_writer++)
+    {
+        printf("  %s\n", with_writer ? "with a writer" : "quiet");
+        for (int i = 0; i < 4; i++)
+        {
+            double mean[2], p99[2];
+            long rounds[2];
+            for (int locked = 0; locked < 2; locked++)
+            {
+                take_fs_lock = locked;
+                failed |= run(reader_counts[i], with_writer, &mean[locked], &p99[locked], &rounds[locked]) != 0;
+            }
+            printf("    %d readers: %8.0f ns mean %8.0f ns p99 (lock-free)  %8.0f ns mean %8.0f ns p99 (fs_lock)",
+                   reader_counts[i], mean[0], p99[0], mean[1], p99[1]);
+            if (with_writer)
+                printf("  writer rounds %ld / %ld", rounds[0], rounds[1]);
+            printf("\n");
+        }
+    }
+
+    remove_bench_dir();
+    if (failed)
+        printf(COLOR_RED "  a lookup failed\n" COLOR_RESET);
+    return failed;
+}
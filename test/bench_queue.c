@@ -0,0 +1,159 @@
+// Job queue benchmark: items per second through the lock-free ring and
+// through the mutex-and-condvar ring it replaced, with 1 to 8 producers
+// and 2 consumers. Both rings have the same capacity, so only the
+// synchronization differs.
+#include <sched.h>
+#include "test_utils.h"
+#include "../include/jobqueue.h"
+
+#define ITEMS (1 << 20)
+#define CAPACITY 256
+#define CONSUMERS 2
+
+// The queue this replaced: a ring under one lock, waiting on conditions
+typedef struct
+{
+    void *items[CAPACITY];
+    int front, count;
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty, not_full;
+} LockedRing;
+
+static LockedRing locked = {.lock = PTHREAD_MUTEX_INITIALIZER,
+                            .not_empty = PTHREAD_COND_INITIALIZER,
+                            .not_full = PTHREAD_COND_INITIALIZER};
+
+static void locked_push(void *item)
+{
+    pthread_mutex_lock(&locked.lock);
+    while (locked.count == CAPACITY)
+        pthread_cond_wait(&locked.not_full, &locked.lock);
+    locked.items[(locked.front + locked.count) % CAPACITY] = item;
+    locked.count++;
+    pthread_cond_signal(&locked.not_empty);
+    pthread_mutex_unlock(&locked.lock);
+}
+
+// NULL once the producers are done and the ring is empty
+static int producers_done = 0;
+
+static void *locked_pop()
+{
+    pthread_mutex_lock(&locked.lock);
+    while (locked.count == 0 && !producers_done)
+        pthread_cond_wait(&locked.not_empty, &locked.lock);
+    void *item = NULL;
+    if (locked.count > 0)
+    {
+        item = locked.items[locked.front];
+        locked.front = (locked.front + 1) % CAPACITY;
+        locked.count--;
+        pthread_cond_signal(&locked.not_full);
+    }
+    pthread_mutex_unlock(&locked.lock);
+    return item;
+}
+
+static JobQueue lockfree;
+static int use_lockfree;
+static int per_producer;
+
+static void *producer(void *arg)
+{
+    (void)arg;
+    for (long i = 1; i <= per_producer; i++)
+    {
+        if (!use_lockfree)
+            locked_push((void *)i);
+        else
+            while (!jobqueue_push(&lockfree, (void *)i))
+                sched_yield();
+    }
+    return NULL;
+}
+
+static void *consumer(void *arg)
+{
+    long *consumed = arg;
+    for (;;)
+    {
+        void *item;
+        if (!use_lockfree)
+            item = locked_pop();
+        else
+        {
+            while (!(item = jobqueue_pop(&lockfree)) && !__atomic_load_n(&producers_done, __ATOMIC_ACQUIRE))
+                sched_yield();
+            // The last items may land between the pop and the done check
+            if (!item)
+                item = jobqueue_pop(&lockfree);
+        }
+        if (!item)
+            return NULL;
+        (*consumed)++;
+    }
+}
+
+static double elapsed_ns(struct timespec *start, struct timespec *end)
+{
+    return (end->tv_sec - start->tv_sec) * 1e9 + (end->tv_nsec - start->tv_nsec);
+}
+
+// Millions of items per second, or -1 if any went missing
+static double run(int lockfree_ring, int producers)
+{
+    pthread_t threads[8 + CONSUMERS];
+    long consumed[CONSUMERS] = {0};
+    struct timespec start, end;
+
+    use_lockfree = lockfree_ring;
+    per_producer = ITEMS / producers;
+    producers_done = 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < CONSUMERS; i++)
+        pthread_create(&threads[producers + i], NULL, consumer, &consumed[i]);
+    for (int i = 0; i < producers; i++)
+        pthread_create(&threads[i], NULL, producer, NULL);
+    for (int i = 0; i < producers; i++)
+        pthread_join(threads[i], NULL);
+
+    pthread_mutex_lock(&locked.lock);
+    __atomic_store_n(&producers_done, 1, __ATOMIC_RELEASE);
+    pthread_cond_broadcast(&locked.not_empty);
+    pthread_mutex_unlock(&locked.lock);
+    for (int i = 0; i < CONSUMERS; i++)
+        pthread_join(threads[producers + i], NULL);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    long total = 0;
+    for (int i = 0; i < CONSUMERS; i++)
+        total += consumed[i];
+    if (total != (long)per_producer * producers)
+        return -1;
+    return total / elapsed_ns(&start, &end) * 1e3;
+}
+
+int main()
+{
+    printf(COLOR_CYAN "Job queue, %d items, %d slots, %d consumers, %ld cores\n" COLOR_RESET, ITEMS,
+           CAPACITY, CONSUMERS, sysconf(_SC_NPROCESSORS_ONLN));
+    if (jobqueue_init(&lockfree, CAPACITY) != 0)
+        return 1;
+
+    int failed = 0;
+    int producer_counts[] = {1, 2, 4, 8};
+    for (int i = 0; i < 4; i++)
+    {
+        double lockfree_rate = run(1, producer_counts[i]);
+        double locked_rate = run(0, producer_counts[i]);
+        failed |= lockfree_rate < 0 || locked_rate < 0;
+        printf("  %d producers: %8.2f M items/s (lock-free)  %8.2f M items/s (mutex and condvar)\n",
+               producer_counts[i], lockfree_rate, locked_rate);
+    }
+
+    jobqueue_destroy(&lockfree);
+    if (failed)
+        printf(COLOR_RED "  items were lost\n" COLOR_RESET);
+    return failed;
+}
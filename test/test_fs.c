@@ -1,79 +1,227 @@
 #include "test_utils.h"
 #include "../include/filesystem.h"
 #include "../include/paging.h"
+#include "../include/globals.h"
+#include "../include/directory.h"
 #include <pthread.h>
 #include <unistd.h>
 #include <time.h>
 #include <string.h>
+#include <dirent.h>
 
-// Test result constants
-#define TEST_PASSED 1
-#define TEST_FAILED 0
-
-// Global variables from filesystem.c needed for testing
-extern FileSystemState fs_state;
-extern unsigned char page_bitmap[TOTAL_PAGES / 8];
-extern pthread_mutex_t mutex;
+// The fixed limits directories and the directory table used to have; the
+// tests go well past them
+#define OLD_MAX_FILES 100
+#define OLD_MAX_DIRECTORIES 10
+#define TEST_VOLUME_PAGES 4096 // Every file takes a page; the default volume has 256
 
 // Test statistics
-typedef struct {
-    int total;
-    int passed;
-    int failed;
-} TestStats;
-
 TestStats test_stats = {0};
 
-// Forward declarations
-void initialize_test_environment();
-void cleanup_test_environment();
-
-// Helper macros
-#define ASSERT(condition, message) \
-    do { \
-        if (!(condition)) { \
-            printf("\033[1;31mAssertion failed: %s\033[0m\n", message); \
-            return TEST_FAILED; \
-        } \
-    } while (0)
+// The suite runs in a directory of its own, holding the image and journal
+static char test_dir[] = "/tmp/mini_fs_test.XXXXXX";
 
 // Test cases
-int test_file_creation();
-int test_directory_operations();
-int test_file_operations();
-int test_permissions();
-int test_paging_system();
-int test_concurrent_access();
-int test_path_resolution();
-int test_link_operations();
-int test_backup_restore();
-int test_special_commands();
-int test_user_management();
-int test_file_metadata();
-int test_directory_listing();
-int test_error_handling();
+int test_directory_growth();
+int test_directory_table_growth();
+int test_delete_and_reinsert();
+int test_copy_on_write();
 
 // Helper function to find file by name
 File* find_file(const char* filename) {
-    for (int i = 0; i < fs_state.directories[fs_state.current_directory].file_count; i++) {
-        if (strcmp(fs_state.directories[fs_state.current_directory].files[i].filename, filename) == 0) {
-            return &fs_state.directories[fs_state.current_directory].files[i];
-        }
-    }
-    return NULL;
+    return find_file_in_dir(fs_state.current_directory, filename);
 }
 
 // Helper to count allocated pages
 int count_allocated_pages() {
     int count = 0;
-    for (int i = 0; i < TOTAL_PAGES; i++) {
-        if (page_bitmap[i / 8] & (1 << (i % 8))) {
+    for (int i = 0; i < total_pages; i++) {
+        if (page_is_used(i)) {
             count++;
         }
     }
     return count;
 }
 
+// Every entry of a directory is found by its own name, and by nothing else
+static int entries_consistent(int dir_idx) {
+    Directory *dir = &fs_state.directories[dir_idx];
+    for (int j = 0; j < dir->file_count; j++) {
+        DirEntry *entry = dir->files[j];
+        if (dir_find(dir, entry->filename) != entry || dir_lookup(dir, entry->filename) != j)
+            return 0;
+    }
+    return 1;
+}
+
+// Directories hold far more entries than the old fixed array
+int test_directory_growth() {
+    int before = fs_state.directories[0].file_count;
+    char name[MAX_FILENAME];
+
+    for (int i = 0; i < OLD_MAX_FILES * 5; i++) {
+        snprintf(name, sizeof(name), "grow%04d.txt", i);
+        ASSERT_MSG(create_file(name, 0644, NULL) == FS_OK, "create %s", name);
+    }
+    ASSERT(fs_state.directories[0].file_count == before + OLD_MAX_FILES * 5,
+           "Directory holds five times the old file limit");
+
+    for (int i = 0; i < OLD_MAX_FILES * 5; i++) {
+        snprintf(name, sizeof(name), "grow%04d.txt", i);
+        File *file = find_file(name);
+        ASSERT_MSG(file != NULL, "find %s", name);
+        ASSERT_MSG(file->content_size == (int)strlen("HELLO WORLD"), "content of %s", name);
+    }
+    ASSERT(find_file("grow0500.txt") == NULL, "Names never created are not found");
+    ASSERT(entries_consistent(0), "Every entry is indexed under its own name");
+
+    FsListing listing;
+    ASSERT(list_directory(&listing) == FS_OK, "List the grown directory");
+    int listed = 0;
+    for (int i = 0; i < listing.count; i++)
+        listed += !listing.entries[i].is_directory;
+    free_listing(&listing);
+    ASSERT(listed == before + OLD_MAX_FILES * 5, "Listing shows every file");
+    return TEST_PASSED;
+}
+
+// The directory table grows past the old fixed number of directories
+int test_directory_table_growth() {
+    char path[64];
+    ASSERT(create_directory("tree", NULL) == FS_OK, "Create the parent directory");
+    for (int i = 0; i < OLD_MAX_DIRECTORIES * 3; i++) {
+        snprintf(path, sizeof(path), "tree/sub%02d", i);
+        ASSERT_MSG(create_directory(path, NULL) == FS_OK, "create %s", path);
+        snprintf(path, sizeof(path), "tree/sub%02d/inner.txt", i);
+        ASSERT_MSG(create_file(path, 0644, NULL) == FS_OK, "create %s", path);
+    }
+
+    FsDirInfo info;
+    ASSERT(directory_info("tree", &info) == FS_OK, "Find the parent directory");
+    ASSERT(info.subdir_count == OLD_MAX_DIRECTORIES * 3, "Parent lists every subdirectory");
+    for (int i = 0; i < OLD_MAX_DIRECTORIES * 3; i++) {
+        snprintf(path, sizeof(path), "tree/sub%02d/inner.txt", i);
+        FsFileInfo file;
+        ASSERT_MSG(stat_file(path, &file) == FS_OK, "stat %s", path);
+    }
+
+    ASSERT(delete_directory("tree", 1, NULL) == FS_OK, "Delete the whole tree");
+    ASSERT(find_directory_from_path("tree") == -1, "The tree is gone");
+    return TEST_PASSED;
+}
+
+// Deleted names leave tombstones in the lock-free index; re-inserting the
+// same names, over and over, must find every one of them again
+int test_delete_and_reinsert() {
+    const int count = OLD_MAX_FILES * 2;
+    char path[64];
+    ASSERT(create_directory("churn", NULL) == FS_OK, "Create the churn directory");
+    int dir_idx = find_directory_from_path("churn");
+
+    for (int i = 0; i < count; i++) {
+        snprintf(path, sizeof(path), "churn/f%03d", i);
+        ASSERT_MSG(create_file(path, 0644, NULL) == FS_OK, "create %s", path);
+    }
+
+    for (int round = 0; round < 5; round++) {
+        // Every other name goes, a different half each round
+        for (int i = round % 2; i < count; i += 2) {
+            snprintf(path, sizeof(path), "churn/f%03d", i);
+            ASSERT_MSG(delete_file(path, NULL) == FS_OK, "round %d: delete %s", round, path);
+        }
+        ASSERT_MSG(fs_state.directories[dir_idx].file_count == count / 2,
+                   "round %d: half the entries left", round);
+        for (int i = 0; i < count; i++) {
+            snprintf(path, sizeof(path), "f%03d", i);
+            int present = find_file_in_dir(dir_idx, path) != NULL;
+            ASSERT_MSG(present == (i % 2 != round % 2), "round %d: %s %s", round, path,
+                       present ? "still found" : "lost");
+        }
+        ASSERT_MSG(entries_consistent(dir_idx), "round %d: index consistent after deletes", round);
+
+        for (int i = round % 2; i < count; i += 2) {
+            snprintf(path, sizeof(path), "churn/f%03d", i);
+            ASSERT_MSG(create_file(path, 0644, NULL) == FS_OK, "round %d: re-create %s", round, path);
+        }
+        ASSERT_MSG(fs_state.directories[dir_idx].file_count == count, "round %d: all entries back", round);
+        ASSERT_MSG(entries_consistent(dir_idx), "round %d: index consistent after re-inserts", round);
+    }
+
+    for (int i = 0; i < count; i++) {
+        snprintf(path, sizeof(path), "churn/f%03d", i);
+        ASSERT_MSG(create_file(path, 0644, NULL) == FS_ERR_EXISTS, "%s is not duplicated", path);
+    }
+    ASSERT(delete_directory("churn", 1, NULL) == FS_OK, "Delete the churn directory");
+    return TEST_PASSED;
+}
+
+// The whole of a file's content matches what was written
+static int content_is(const char *path, const char *expected, int length) {
+    char *buffer = malloc(length + 1);
+    int copied = 0, size = 0;
+    int same = read_file_range(path, 0, buffer, length + 1, &copied, &size) == FS_OK &&
+               size == length && copied == length && memcmp(buffer, expected, length) == 0;
+    free(buffer);
+    return same;
+}
+
+// Copies and clones share pages until one side writes; a write unshares only
+// the pages it touches, and deleting one side leaves the others intact
+int test_copy_on_write() {
+    const int length = PAGE_SIZE * 3 + 100; // Four pages, the last partly used
+    char *data = malloc(length);
+    for (int i = 0; i < length; i++)
+        data[i] = 'a' + (i / PAGE_SIZE);
+    int free_before = free_page_total();
+
+    ASSERT(create_file("cow.txt", 0644, NULL) == FS_OK, "Create the original");
+    ASSERT(write_file_range("cow.txt", data, length, 0, NULL) == FS_OK, "Fill four pages");
+    ASSERT(create_directory("cowdir", NULL) == FS_OK, "Create the copy's directory");
+    ASSERT(clone_file("cow.txt", "clone.txt", NULL) == FS_OK, "Clone the original");
+    ASSERT(copy_file_to_dir("cow.txt", "cowdir", NULL) == FS_OK, "Copy the original");
+    ASSERT(free_page_total() == free_before - 4, "Clone and copy take no pages of their own");
+
+    FsFileInfo info;
+    ASSERT(stat_file("clone.txt", &info) == FS_OK && info.page_count == 4 && info.shared_pages == 4,
+           "The clone shares all four pages");
+    ASSERT(stat_file("cowdir/cow.txt", &info) == FS_OK && info.shared_pages == 4,
+           "The copy shares all four pages");
+
+    // The append lands in the last page only
+    const char tail[] = "tail";
+    ASSERT(write_file_range("clone.txt", tail, 4, 1, NULL) == FS_OK, "Append to the clone");
+    ASSERT(free_page_total() == free_before - 5, "The append copies exactly one page");
+    ASSERT(stat_file("clone.txt", &info) == FS_OK && info.page_count == 4 && info.shared_pages == 3,
+           "The clone still shares the pages it did not touch");
+    ASSERT(stat_file("cow.txt", &info) == FS_OK && info.shared_pages == 4,
+           "The original still shares its last page with the copy");
+
+    char *appended = malloc(length + 4);
+    memcpy(appended, data, length);
+    memcpy(appended + length, tail, 4);
+    ASSERT(content_is("clone.txt", appended, length + 4), "The clone reads back with the append");
+    ASSERT(content_is("cow.txt", data, length), "The original is unchanged");
+    ASSERT(content_is("cowdir/cow.txt", data, length), "The copy is unchanged");
+
+    ASSERT(delete_file("cow.txt", NULL) == FS_OK, "Delete the original");
+    ASSERT(free_page_total() == free_before - 5, "Pages still in use elsewhere stay allocated");
+    ASSERT(content_is("clone.txt", appended, length + 4), "The clone survives the original");
+    ASSERT(content_is("cowdir/cow.txt", data, length), "The copy survives the original");
+    ASSERT(stat_file("cowdir/cow.txt", &info) == FS_OK && info.shared_pages == 3,
+           "The copy's last page is its own now");
+
+    ASSERT(delete_file("clone.txt", NULL) == FS_OK, "Delete the clone");
+    ASSERT(stat_file("cowdir/cow.txt", &info) == FS_OK && info.shared_pages == 0,
+           "The copy is the last owner of its pages");
+    ASSERT(content_is("cowdir/cow.txt", data, length), "The copy survives the clone");
+    ASSERT(delete_directory("cowdir", 1, NULL) == FS_OK, "Delete the copy");
+    ASSERT(free_page_total() == free_before, "Every page is free again");
+
+    free(appended);
+    free(data);
+    return TEST_PASSED;
+}
+
 // Update the TEST macro to properly track statistics
 #undef TEST
 #define TEST(test_name) \
@@ -84,6 +232,7 @@ int count_allocated_pages() {
         clock_t end = clock(); \
         double elapsed = (double)(end - start) / CLOCKS_PER_SEC; \
         test_stats.total++; \
+        test_stats.total_time += elapsed; \
         if (result) { \
             printf("\033[1;32m=== Test %s PASSED (%.3fs) ===\033[0m\n", #test_name, elapsed); \
             test_stats.passed++; \
@@ -98,29 +247,19 @@ int main() {
     initialize_test_environment();
 
     printf("\n\033[1;34m=== Starting Test Suite ===\033[0m\n");
-    
+
     // Run all tests
-    TEST(test_file_creation);
-    TEST(test_directory_operations);
-    TEST(test_file_operations);
-    TEST(test_permissions);
-    TEST(test_paging_system);
-    TEST(test_concurrent_access);
-    TEST(test_path_resolution);
-    TEST(test_link_operations);
-    TEST(test_backup_restore);
-    TEST(test_special_commands);
-    TEST(test_user_management);
-    TEST(test_file_metadata);
-    TEST(test_directory_listing);
-    TEST(test_error_handling);
+    TEST(test_directory_growth);
+    TEST(test_directory_table_growth);
+    TEST(test_delete_and_reinsert);
+    TEST(test_copy_on_write);
 
     // Print summary
     printf("\n\033[1;34m=== Test Summary ===\033[0m\n");
     printf("\033[1;36mTotal Tests: %d\033[0m\n", test_stats.total);
     printf("\033[1;32mPassed: %d\033[0m\n", test_stats.passed);
     printf("\033[1;31mFailed: %d\033[0m\n", test_stats.failed);
-    
+
     // Calculate and print score
     float score = test_stats.total > 0 ? (test_stats.passed * 100.0f) / test_stats.total : 0;
     printf("\033[1;35mScore: %.1f%%\033[0m\n", score);
@@ -130,24 +269,30 @@ int main() {
     return test_stats.failed > 0 ? 1 : 0;
 }
 
-// [Rest of the test functions remain the same, but with the following fixes:]
-// 1. Ensure all ASSERT macros are properly closed with semicolons
-// 2. Add proper includes (unistd.h for sleep(), time.h for time())
-// 3. Fix the cleanup_test_environment() function:
+// A fresh filesystem in a scratch directory, so the image and journal the
+// tests write never touch the repository's
+void initialize_test_environment() {
+    if (!mkdtemp(test_dir) || chdir(test_dir) != 0) {
+        perror("Test directory");
+        exit(1);
+    }
+    initialize_directories();
+    format_filesystem(0, TEST_VOLUME_PAGES, NULL);
+}
+
 void cleanup_test_environment() {
-    // Clean up any remaining test files
-    for (int i = 0; i < MAX_DIRECTORIES; i++) {
-        if (strlen(fs_state.directories[i].dirname) > 0) {
-            for (int j = 0; j < fs_state.directories[i].file_count; j++) {
-                File* f = &fs_state.directories[i].files[j];
-                if (f->content) free(f->content);
-                if (f->page_table) free(f->page_table);
-                if (f->link_target) free(f->link_target);
-            }
-            fs_state.directories[i].file_count = 0;
-        }
+    // Remove the image, journal and anything else the tests wrote
+    DIR *dir = opendir(".");
+    struct dirent *entry;
+    while (dir && (entry = readdir(dir)) != NULL) {
+        if (strcmp(entry->d_name, ".") != 0 && strcmp(entry->d_name, "..") != 0)
+            unlink(entry->d_name);
     }
-    
-    // Destroy mutex
-    pthread_mutex_destroy(&mutex);
-}
\ No newline at end of file
+    if (dir)
+        closedir(dir);
+    if (chdir("/") == 0)
+        rmdir(test_dir);
+
+    // Destroy the filesystem lock
+    pthread_rwlock_destroy(&fs_lock);
+}
@@ -0,0 +1,571 @@
+// Journal replay and image upgrade tests. Each test starts from a fresh
+// filesystem, changes it, then loads it back from the image and the journal
+// the way a restart does and compares what it finds with what was there.
+// The journal is cut short or corrupted in between to check that a torn or
+// damaged tail loses only the operations it held.
+#include "test_utils.h"
+#include "../include/globals.h"
+#include "../include/journal.h"
+#include "../include/storage.h"
+#include "../include/paging.h"
+#include <dirent.h>
+#include <pthread.h>
+#include <sched.h>
+
+#define BIG_SIZE (PAGE_SIZE * 2 + PAGE_SIZE / 2) // Two and a half pages
+#define RACE_ROUNDS 200
+#define RACE_APPEND (PAGE_SIZE * 32) // Appended each round, from within the shared last page
+
+// Files whose bytes are compared, where they exist
+static const char *const content_paths[] = {
+    "readme.txt", "notes.txt", "docs/big.txt", "docs/clone.txt", "docs/moved.txt",
+    "home/big.txt", "after.txt",
+};
+#define CONTENT_PATHS (int)(sizeof(content_paths) / sizeof(content_paths[0]))
+
+typedef struct
+{
+    FsListing tree;
+    char *content[CONTENT_PATHS]; // NULL where the file does not exist
+    int size[CONTENT_PATHS];
+} Snapshot;
+
+static char test_dir[] = "/tmp/mini_fs_journal.XXXXXX";
+static char big_data[BIG_SIZE];
+
+// A file's bytes, allocated; NULL if it cannot be read
+static char *read_all(const char *path, int *size)
+{
+    FsFileInfo info;
+    if (stat_file(path, &info) != FS_OK)
+        return NULL;
+    char *buffer = malloc(info.size + 1);
+    int copied = 0;
+    if (read_file_range(path, 0, buffer, info.size + 1, &copied, size) != FS_OK || copied != *size)
+    {
+        free(buffer);
+        return NULL;
+    }
+    return buffer;
+}
+
+static void take_snapshot(Snapshot *snapshot)
+{
+    memset(snapshot, 0, sizeof(*snapshot));
+    change_directory("~", NULL);
+    list_tree(&snapshot->tree);
+    for (int i = 0; i < CONTENT_PATHS; i++)
+        snapshot->content[i] = read_all(content_paths[i], &snapshot->size[i]);
+}
+
+static void free_snapshot(Snapshot *snapshot)
+{
+    free_listing(&snapshot->tree);
+    for (int i = 0; i < CONTENT_PATHS; i++)
+        free(snapshot->content[i]);
+}
+
+// Same tree, same metadata, same bytes; prints the first difference
+static int same_state(const Snapshot *a, const Snapshot *b)
+{
+    if (a->tree.count != b->tree.count || a->tree.directory_count != b->tree.directory_count)
+    {
+        printf("%d entries in %d directories, then %d in %d\n", a->tree.count,
+               a->tree.directory_count, b->tree.count, b->tree.directory_count);
+        return 0;
+    }
+    for (int i = 0; i < a->tree.count; i++)
+    {
+        const FsFileInfo *x = &a->tree.entries[i], *y = &b->tree.entries[i];
+        if (strcmp(x->name, y->name) != 0 || strcmp(x->dirname, y->dirname) != 0 ||
+            x->is_directory != y->is_directory || x->depth != y->depth || x->inode != y->inode ||
+            x->size != y->size || x->permissions != y->permissions || x->is_symlink != y->is_symlink ||
+            x->has_target != y->has_target || strcmp(x->link_target, y->link_target) != 0 ||
+            x->link_count != y->link_count || x->page_count != y->page_count ||
+            x->shared_pages != y->shared_pages)
+        {
+            printf("%s/%s differs from %s/%s\n", x->dirname, x->name, y->dirname, y->name);
+            return 0;
+        }
+    }
+    for (int i = 0; i < CONTENT_PATHS; i++)
+    {
+        if (!a->content[i] != !b->content[i] || a->size[i] != b->size[i] ||
+            (a->content[i] && memcmp(a->content[i], b->content[i], a->size[i]) != 0))
+        {
+            printf("Content of %s differs\n", content_paths[i]);
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Load the image and replay the journal, as main() does on startup
+static void restart()
+{
+    load_state();
+    change_directory("~", NULL);
+}
+
+static long journal_length()
+{
+    struct stat st;
+    return stat(JOURNAL_FILE, &st) == 0 ? st.st_size : -1;
+}
+
+// The journal's bytes, allocated
+static char *read_journal(long *length)
+{
+    *length = journal_length();
+    FILE *fp = fopen(JOURNAL_FILE, "rb");
+    char *bytes = malloc(*length > 0 ? *length : 1);
+    if (!fp || fread(bytes, 1, *length, fp) != (size_t)*length)
+        *length = -1;
+    if (fp)
+        fclose(fp);
+    return bytes;
+}
+
+static void write_journal(const char *bytes, long length)
+{
+    FILE *fp = fopen(JOURNAL_FILE, "wb");
+    if (fp)
+    {
+        fwrite(bytes, 1, length, fp);
+        fclose(fp);
+    }
+}
+
+// Every kind of change the journal records: files, bytes, clones, copies,
+// links, permissions, moves and deletes
+static int change_everything()
+{
+    ASSERT_MSG(create_directory("docs", NULL) == FS_OK, "mkdir docs");
+    ASSERT_MSG(create_file("docs/big.txt", 0644, NULL) == FS_OK, "create docs/big.txt");
+    ASSERT_MSG(write_file_range("docs/big.txt", big_data, BIG_SIZE, 0, NULL) == FS_OK, "write docs/big.txt");
+    ASSERT_MSG(write_file_range("docs/big.txt", "more", 4, 1, NULL) == FS_OK, "append to docs/big.txt");
+    ASSERT_MSG(clone_file("docs/big.txt", "docs/clone.txt", NULL) == FS_OK, "clone docs/big.txt");
+    ASSERT_MSG(write_file_range("docs/clone.txt", "!", 1, 1, NULL) == FS_OK, "append to the clone");
+    ASSERT_MSG(copy_file_to_dir("docs/big.txt", "home", NULL) == FS_OK, "copy docs/big.txt to home");
+    ASSERT_MSG(create_hard_link("docs/big.txt", "hard.txt", NULL) == FS_OK, "link docs/big.txt");
+    ASSERT_MSG(create_symbolic_link("docs/clone.txt", "sym.txt", NULL) == FS_OK, "symlink docs/clone.txt");
+    ASSERT_MSG(change_permissions("docs/clone.txt", 0600) == FS_OK, "chmod docs/clone.txt");
+    ASSERT_MSG(move_file_to_dir("hard.txt", "docs", "moved.txt", NULL) == FS_OK, "move hard.txt");
+    ASSERT_MSG(delete_file("notes.txt", NULL) == FS_OK, "delete notes.txt");
+    ASSERT_MSG(create_directory("scratch", NULL) == FS_OK, "mkdir scratch");
+    ASSERT_MSG(create_file("scratch/gone.txt", 0644, NULL) == FS_OK, "create scratch/gone.txt");
+    ASSERT_MSG(delete_directory("scratch", 1, NULL) == FS_OK, "rmdir scratch");
+    return TEST_PASSED;
+}
+
+// Everything done since the last checkpoint comes back from the journal alone
+int test_replay_after_restart()
+{
+    if (!change_everything())
+        return TEST_FAILED;
+    ASSERT(journal_length() > (long)sizeof(JournalRecordHeader), "The changes are in the journal");
+
+    Snapshot before, after;
+    take_snapshot(&before);
+    restart();
+    take_snapshot(&after);
+    int same = same_state(&before, &after);
+    free_snapshot(&before);
+    free_snapshot(&after);
+    ASSERT(same, "Replay rebuilds the state as it was");
+    return TEST_PASSED;
+}
+
+// A journal cut anywhere inside its last record replays everything before it
+int test_truncated_tail()
+{
+    if (!change_everything())
+        return TEST_FAILED;
+    Snapshot before, after;
+    take_snapshot(&before);
+    long intact = journal_length();
+
+    // The clone's last page is already its own, so the append is one record
+    ASSERT(write_file_range("docs/clone.txt", "tail", 4, 1, NULL) == FS_OK, "Append the last record");
+    long length;
+    char *journal = read_journal(&length);
+    ASSERT(length > intact, "The append is in the journal");
+
+    // Torn header, torn payload, and one byte short
+    long cuts[] = {intact + 1, intact + (long)sizeof(JournalRecordHeader) + 2, length - 1};
+    int same = 1;
+    for (int i = 0; i < 3 && same; i++)
+    {
+        write_journal(journal, cuts[i]);
+        restart();
+        take_snapshot(&after);
+        same = same_state(&before, &after);
+        free_snapshot(&after);
+        ASSERT_MSG(same, "Journal cut at byte %ld of %ld", cuts[i], length);
+    }
+    ASSERT(same, "A torn last record is dropped, and only it");
+
+    // The whole journal still has the append
+    write_journal(journal, length);
+    restart();
+    int size = 0;
+    char *content = read_all("docs/clone.txt", &size);
+    ASSERT(content && size == BIG_SIZE + 9 && memcmp(content + BIG_SIZE, "more!tail", 9) == 0,
+           "The complete journal replays the last record");
+
+    free(content);
+    free(journal);
+    free_snapshot(&before);
+    return TEST_PASSED;
+}
+
+// Replay stops at a record whose checksum does not match, so neither it nor
+// anything after it is applied
+int test_corrupt_record()
+{
+    if (!change_everything())
+        return TEST_FAILED;
+    Snapshot before, after;
+    take_snapshot(&before);
+    long intact = journal_length();
+
+    ASSERT(write_file_range("docs/big.txt", "tail", 4, 1, NULL) == FS_OK, "Append after the snapshot");
+    ASSERT(create_file("after.txt", 0644, NULL) == FS_OK, "Create after the snapshot");
+    long length;
+    char *journal = read_journal(&length);
+    journal[intact + sizeof(JournalRecordHeader)] ^= 0x5a; // First payload byte of the append
+    write_journal(journal, length);
+
+    restart();
+    take_snapshot(&after);
+    int same = same_state(&before, &after);
+    free_snapshot(&before);
+    free_snapshot(&after);
+    free(journal);
+    ASSERT(same, "Nothing from the corrupt record on is replayed");
+    return TEST_PASSED;
+}
+
+// Changes folded into the image by a checkpoint and changes still in the
+// journal both survive a restart
+int test_checkpoint_then_replay()
+{
+    if (!change_everything())
+        return TEST_FAILED;
+    pthread_rwlock_wrlock(&fs_lock);
+    checkpoint_filesystem();
+    pthread_rwlock_unlock(&fs_lock);
+    ASSERT(journal_length() == 0, "The checkpoint empties the journal");
+
+    ASSERT(write_file_range("docs/clone.txt", "after", 5, 1, NULL) == FS_OK, "Append after the checkpoint");
+    ASSERT(create_file("after.txt", 0644, NULL) == FS_OK, "Create after the checkpoint");
+    ASSERT(delete_file("docs/moved.txt", NULL) == FS_OK, "Delete after the checkpoint");
+
+    Snapshot before, after;
+    take_snapshot(&before);
+    restart();
+    take_snapshot(&after);
+    int same = same_state(&before, &after);
+    free_snapshot(&before);
+    free_snapshot(&after);
+    ASSERT(same, "The image and the journal together rebuild the state");
+    return TEST_PASSED;
+}
+
+// Version 1 image layout: the raw structures as they were declared before
+// the sectioned format (see storage.c), written here byte for byte
+#define LEGACY_MAX_FILES 100
+#define LEGACY_MAX_DIRECTORIES 10
+
+typedef struct
+{
+    char filename[MAX_FILENAME];
+    int size;
+    PageTableEntry *page_table;
+    int page_table_size;
+    char owner[20];
+    int permissions;
+    time_t creation_time;
+    time_t modification_time;
+    int content_size;
+    char *content;
+    int file_position;
+    int is_open;
+    int open_count;
+    int is_symlink;
+    char *link_target;
+    int ref_count;
+    ino_t inode;
+} LegacyFile;
+
+typedef struct
+{
+    char dirname[MAX_FILENAME];
+    LegacyFile files[LEGACY_MAX_FILES];
+    int file_count;
+    int parent_directory;
+    time_t creation_time;
+    ino_t inode;
+} LegacyDirectory;
+
+typedef struct
+{
+    User users[MAX_USERS];
+    LegacyDirectory directories[LEGACY_MAX_DIRECTORIES];
+    int current_directory;
+} LegacyState;
+
+typedef struct
+{
+    int dir;
+    const char *name;
+    ino_t inode;
+    const char *content;
+    int first_page;
+} LegacyFileSpec;
+
+// Hard links were full copies in version 1: big_link.txt repeats big.txt
+static int write_legacy_image(const LegacyFileSpec *files, int count)
+{
+    LegacyState *state = calloc(1, sizeof(LegacyState));
+    unsigned char bitmap[TOTAL_PAGES / 8] = {0};
+    strcpy(state->users[0].username, "user");
+    strcpy(state->users[0].password, "pass");
+    strcpy(state->directories[0].dirname, "~");
+    state->directories[0].parent_directory = -1;
+    state->directories[0].inode = 1000;
+    strcpy(state->directories[1].dirname, "home");
+    state->directories[1].parent_directory = 0;
+    state->directories[1].inode = 1001;
+
+    for (int i = 0; i < count; i++)
+    {
+        LegacyDirectory *dir = &state->directories[files[i].dir];
+        LegacyFile *file = &dir->files[dir->file_count++];
+        strcpy(file->filename, files[i].name);
+        strcpy(file->owner, "user");
+        file->permissions = 0644;
+        file->content_size = strlen(files[i].content) + 1; // With its NUL, as version 1 kept it
+        file->size = file->content_size;
+        file->page_table_size = (file->content_size + PAGE_SIZE - 1) / PAGE_SIZE;
+        file->ref_count = 1;
+        file->inode = files[i].inode;
+        for (int p = 0; p < file->page_table_size; p++)
+            bitmap[(files[i].first_page + p) / 8] |= 1 << ((files[i].first_page + p) % 8);
+    }
+
+    FILE *fp = fopen(STORAGE_FILE, "wb");
+    if (!fp)
+    {
+        free(state);
+        return 0;
+    }
+    fwrite(state, sizeof(LegacyState), 1, fp);
+    fwrite(bitmap, sizeof(bitmap), 1, fp);
+
+    // Then each file's bytes and page table, directory by directory
+    for (int d = 0; d < LEGACY_MAX_DIRECTORIES; d++)
+    {
+        for (int i = 0; i < count; i++)
+        {
+            if (files[i].dir != d)
+                continue;
+            size_t content_size = strlen(files[i].content) + 1;
+            int table_size = (content_size + PAGE_SIZE - 1) / PAGE_SIZE;
+            fwrite(&content_size, sizeof(size_t), 1, fp);
+            fwrite(files[i].content, 1, content_size, fp);
+            fwrite(&table_size, sizeof(int), 1, fp);
+            for (int p = 0; p < table_size; p++)
+            {
+                PageTableEntry entry = {files[i].first_page + p, 1};
+                fwrite(&entry, sizeof(entry), 1, fp);
+            }
+        }
+    }
+    fclose(fp);
+    free(state);
+    return 1;
+}
+
+static int legacy_files_intact(const LegacyFileSpec *files, int count)
+{
+    char path[2 * MAX_FILENAME];
+    for (int i = 0; i < count; i++)
+    {
+        snprintf(path, sizeof(path), "%s%s", files[i].dir ? "home/" : "", files[i].name);
+        int size = 0;
+        char *content = read_all(path, &size);
+        int same = content && size == (int)strlen(files[i].content) &&
+                   memcmp(content, files[i].content, size) == 0;
+        free(content);
+        FsFileInfo info;
+        ASSERT_MSG(same && stat_file(path, &info) == FS_OK && info.inode == files[i].inode,
+                   "%s after the upgrade", path);
+    }
+    return 1;
+}
+
+// A version 1 image loads, with its journal, and is rewritten sectioned
+int test_legacy_upgrade()
+{
+    static char big[PAGE_SIZE + 200];
+    memset(big, 'v', sizeof(big) - 1);
+    const LegacyFileSpec files[] = {
+        {0, "readme.txt", 2000, "HELLO WORLD", 0},
+        {0, "big.txt", 2001, big, 1},
+        {1, "notes.txt", 2002, "version one", 3},
+        {1, "big_link.txt", 2001, big, 1},
+    };
+    int count = sizeof(files) / sizeof(files[0]);
+
+    ASSERT(write_legacy_image(files, count), "Write a version 1 image");
+    unlink(JOURNAL_FILE);
+    restart();
+    ASSERT(legacy_files_intact(files, count), "Every version 1 file loads with its bytes");
+
+    FsFileInfo info;
+    ASSERT(stat_file("big.txt", &info) == FS_OK && info.link_count == 2 && info.page_count == 2,
+           "Copies of a hard link become one inode");
+
+    char magic[8] = {0};
+    FILE *fp = fopen(STORAGE_FILE, "rb");
+    ASSERT(fp && fread(magic, sizeof(magic), 1, fp) == 1, "Read the image back");
+    fclose(fp);
+    ASSERT(memcmp(magic, STORAGE_MAGIC, sizeof(magic)) == 0, "The image is rewritten sectioned");
+
+    // The upgraded image loads on its own, and journals like any other
+    ASSERT(write_file_range("home/notes.txt", "!", 1, 1, NULL) == FS_OK, "Change the upgraded filesystem");
+    restart();
+    int size = 0;
+    char *content = read_all("home/notes.txt", &size);
+    ASSERT(content && size == 12 && memcmp(content, "version one!", 12) == 0,
+           "The upgraded image and its journal load back");
+    free(content);
+    return TEST_PASSED;
+}
+
+// One side of a copy-on-write race: append to the source, or rewrite the clone
+typedef struct
+{
+    const char *path;
+    const char *data;
+    int len;
+    int append;
+    int wait_page; // Written once this page is no longer shared; -1 to start at once
+    FsStatus status;
+} RaceWrite;
+
+static void *race_write(void *arg)
+{
+    RaceWrite *write = arg;
+    while (write->wait_page >= 0 && page_refs(write->wait_page) > 1)
+        sched_yield();
+    write->status = write_file_range(write->path, write->data, write->len, write->append, NULL);
+    return NULL;
+}
+
+// A clone and its source written at once, both into the page they still
+// share. The source's append copies that page and releases it; the clone's
+// write, started right then, finds it private and writes it in place while
+// the append is still copying its own bytes, so the clone's record usually
+// lands first. Replay must still give the source the bytes it copied.
+int test_concurrent_clone_writes()
+{
+    static char other[BIG_SIZE], expected[BIG_SIZE + RACE_APPEND];
+    for (int i = 0; i < BIG_SIZE; i++)
+        other[i] = 'A' + i % 26;
+    memcpy(expected, big_data, BIG_SIZE);
+    memset(expected + BIG_SIZE, '+', RACE_APPEND);
+
+    for (int round = 0; round < RACE_ROUNDS; round++)
+    {
+        ASSERT_MSG(create_file("source.txt", 0644, NULL) == FS_OK, "round %d: create", round);
+        ASSERT_MSG(write_file_range("source.txt", big_data, BIG_SIZE, 0, NULL) == FS_OK,
+                   "round %d: write the source", round);
+        ASSERT_MSG(clone_file("source.txt", "clone.txt", NULL) == FS_OK, "round %d: clone", round);
+        File *clone = find_file_in_dir(fs_state.current_directory, "clone.txt");
+        ASSERT_MSG(clone != NULL, "round %d: find the clone", round);
+
+        RaceWrite writes[2] = {
+            {"source.txt", expected + BIG_SIZE, RACE_APPEND, 1, -1, FS_OK},
+            {"clone.txt", other, BIG_SIZE, 0, file_page(clone, BIG_SIZE / PAGE_SIZE), FS_OK},
+        };
+        pthread_t threads[2];
+        for (int i = 0; i < 2; i++)
+            pthread_create(&threads[i], NULL, race_write, &writes[i]);
+        for (int i = 0; i < 2; i++)
+            pthread_join(threads[i], NULL);
+        ASSERT_MSG(writes[0].status == FS_OK && writes[1].status == FS_OK, "round %d: both writes", round);
+
+        restart();
+        int size;
+        char *source = read_all("source.txt", &size);
+        int source_ok = source && size == BIG_SIZE + RACE_APPEND && memcmp(source, expected, size) == 0;
+        free(source);
+        char *copy = read_all("clone.txt", &size);
+        int clone_ok = copy && size == BIG_SIZE && memcmp(copy, other, size) == 0;
+        free(copy);
+        ASSERT_MSG(source_ok, "round %d: replay restores the source", round);
+        ASSERT_MSG(clone_ok, "round %d: replay restores the clone", round);
+
+        ASSERT_MSG(delete_file("source.txt", NULL) == FS_OK && delete_file("clone.txt", NULL) == FS_OK,
+                   "round %d: delete both", round);
+        checkpoint_filesystem(); // Keeps the journal to one round
+    }
+    return TEST_PASSED;
+}
+
+// Each test starts from a freshly initialized filesystem and empty journal
+#undef TEST
+#define TEST(test_name)                                                \
+    do                                                                 \
+    {                                                                  \
+        printf("\n\033[1;33m=== Running test: %s ===\033[0m\n", #test_name); \
+        initialize_directories();                                      \
+        int result = test_name();                                      \
+        test_stats.total++;                                            \
+        if (result)                                                    \
+            test_stats.passed++;                                       \
+        else                                                           \
+            test_stats.failed++;                                       \
+        printf("%s=== Test %s %s ===\033[0m\n", result ? "\033[1;32m" : "\033[1;31m", \
+               #test_name, result ? "PASSED" : "FAILED");              \
+    } while (0)
+
+TestStats test_stats = {0};
+
+int main()
+{
+    if (!mkdtemp(test_dir) || chdir(test_dir) != 0)
+    {
+        perror("Test directory");
+        return 1;
+    }
+    for (int i = 0; i < BIG_SIZE; i++)
+        big_data[i] = 'a' + i % 26;
+
+    TEST(test_replay_after_restart);
+    TEST(test_truncated_tail);
+    TEST(test_corrupt_record);
+    TEST(test_checkpoint_then_replay);
+    TEST(test_legacy_upgrade);
+    TEST(test_concurrent_clone_writes);
+
+    printf("\n\033[1;34m=== Test Summary ===\033[0m\n");
+    printf("\033[1;32mPassed: %d\033[0m\n", test_stats.passed);
+    printf("\033[1;31mFailed: %d\033[0m\n", test_stats.failed);
+
+    // Remove the image and journal
+    DIR *dir = opendir(".");
+    struct dirent *entry;
+    while (dir && (entry = readdir(dir)) != NULL)
+    {
+        if (strcmp(entry->d_name, ".") != 0 && strcmp(entry->d_name, "..") != 0)
+            unlink(entry->d_name);
+    }
+    if (dir)
+        closedir(dir);
+    if (chdir("/") == 0)
+        rmdir(test_dir);
+    return test_stats.failed > 0 ? 1 : 0;
+}
@@ -0,0 +1,161 @@
+// Scheduler stress test: several threads submit at once, mixing barriers
+// with keyed commands. Each thread's commands must all run, in the order it
+// submitted them (its keyed commands share one path, and a barrier is
+// ordered with everything), and the pool must keep making progress; a stall
+// past STALL_SECONDS counts as a deadlock and fails the run. The same goes
+// for asynchronous rings driven by one thread each, where FS_OP_NOP is a
+// barrier.
+#include "test_utils.h"
+#include "../include/globals.h"
+#include "../include/scheduler.h"
+#include "../include/fsring.h"
+#include <stdlib.h>
+
+#define PRODUCERS 4
+#define CALLS 20000 // Per producer
+#define RING_ENTRIES 64
+#define STALL_SECONDS 5
+
+// Anything the core writes goes here, not into test/
+static char test_dir[] = "/tmp/mini_fs_scheduler.XXXXXX";
+
+static unsigned long completed = 0;
+static int next_call[PRODUCERS]; // Sequence each producer's next command must have
+static int out_of_order = 0;
+
+// Stands in for the shell: every command ends with its producer's call number
+static void execute_command(Job job)
+{
+    long call = atol(strrchr(job.command, ' ') + 1);
+    int producer = call / CALLS, sequence = call % CALLS;
+    if (next_call[producer] != sequence)
+        __atomic_store_n(&out_of_order, 1, __ATOMIC_RELAXED);
+    next_call[producer] = sequence + 1;
+    __atomic_fetch_add(&completed, 1, __ATOMIC_RELEASE);
+}
+
+static void *producer(void *arg)
+{
+    int self = (int)(intptr_t)arg;
+    char command[64];
+
+    for (int i = 0; i < CALLS; i++)
+    {
+        // Every other command a barrier, the rest keyed on this producer's
+        // path; producers share users, so the fair share reorders across them
+        long call = (long)self * CALLS + i;
+        if (i % 2 == 0)
+            snprintf(command, sizeof(command), "sync %ld", call);
+        else
+            snprintf(command, sizeof(command), "stat producer%d/file %ld", self, call);
+        add_job(command, self % MAX_USERS);
+    }
+    return NULL;
+}
+
+// Every command has run, or nothing ran for STALL_SECONDS
+static int wait_for_calls(unsigned long expected)
+{
+    unsigned long seen = 0;
+    int stalled_ms = 0;
+    while (stalled_ms < STALL_SECONDS * 1000)
+    {
+        unsigned long now = __atomic_load_n(&completed, __ATOMIC_ACQUIRE);
+        if (now == expected)
+            return 1;
+        stalled_ms = now == seen ? stalled_ms + 10 : 0;
+        seen = now;
+        usleep(10000);
+    }
+    printf("Stalled after %lu of %lu commands\n", seen, expected);
+    return 0;
+}
+
+static int test_concurrent_barriers()
+{
+    pthread_t threads[PRODUCERS];
+    for (int i = 0; i < PRODUCERS; i++)
+        pthread_create(&threads[i], NULL, producer, (void *)(intptr_t)i);
+
+    int finished = wait_for_calls((unsigned long)PRODUCERS * CALLS);
+    ASSERT(finished, "Barriers submitted from several threads all run");
+    for (int i = 0; i < PRODUCERS; i++)
+        pthread_join(threads[i], NULL);
+
+    ASSERT(!out_of_order, "Each producer's commands run in submission order");
+    return TEST_PASSED;
+}
+
+// Drives its own ring: NOPs and stats of a missing file, half and half
+static void *ring_driver(void *arg)
+{
+    int self = (int)(intptr_t)arg;
+    char path[32];
+    snprintf(path, sizeof(path), "ring%d", self);
+
+    FsRing ring;
+    if (fs_ring_init(&ring, RING_ENTRIES, 0) != 0)
+        return NULL;
+    FsSubmission ops[RING_ENTRIES];
+    for (int i = 0; i < RING_ENTRIES; i++)
+        ops[i] = (FsSubmission){.opcode = i % 2 ? FS_OP_STAT : FS_OP_NOP, .path = path, .user_data = i};
+
+    FsCompletion completions[RING_ENTRIES];
+    for (int done = 0; done < CALLS;)
+    {
+        int submitted = fs_ring_submit(&ring, ops, RING_ENTRIES);
+        for (int reaped = 0; reaped < submitted;)
+        {
+            int got = fs_ring_reap(&ring, completions, RING_ENTRIES, submitted - reaped);
+            for (int i = 0; i < got; i++)
+            {
+                int expected = completions[i].user_data % 2 ? FS_RING_FAILED : FS_RING_OK;
+                if (completions[i].status != expected)
+                    __atomic_store_n(&out_of_order, 1, __ATOMIC_RELAXED);
+            }
+            reaped += got;
+            __atomic_fetch_add(&completed, got, __ATOMIC_RELEASE);
+        }
+        done += submitted;
+    }
+    fs_ring_destroy(&ring);
+    return NULL;
+}
+
+static int test_concurrent_rings()
+{
+    pthread_t threads[PRODUCERS];
+    completed = 0;
+    out_of_order = 0;
+    for (int i = 0; i < PRODUCERS; i++)
+        pthread_create(&threads[i], NULL, ring_driver, (void *)(intptr_t)i);
+
+    // Each driver stops at the first multiple of RING_ENTRIES past CALLS
+    unsigned long per_ring = (CALLS + RING_ENTRIES - 1) / RING_ENTRIES * RING_ENTRIES;
+    int finished = wait_for_calls((unsigned long)PRODUCERS * per_ring);
+    ASSERT(finished, "Rings driven from several threads at once all complete");
+    for (int i = 0; i < PRODUCERS; i++)
+        pthread_join(threads[i], NULL);
+
+    ASSERT(!out_of_order, "Every ring operation completes with its own status");
+    return TEST_PASSED;
+}
+
+int main()
+{
+    if (!mkdtemp(test_dir) || chdir(test_dir) != 0)
+    {
+        perror("Test directory");
+        return 1;
+    }
+    scheduler_start(execute_command);
+    initialize_directories();
+    int result = test_concurrent_barriers();
+    if (result == TEST_PASSED)
+        result = test_concurrent_rings();
+    rmdir(test_dir);
+
+    // A stalled pool never drains, so leave without waiting on it
+    fflush(stdout);
+    _exit(result == TEST_PASSED ? 0 : 1);
+}